@@ -0,0 +1,34 @@
+static uint8_t bits_lut[256] = {
+    0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 
+    0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x03, 0x03, 
+    0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x03, 0x03, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x03, 0x03, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x03, 0x03, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 
+    0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x03, 0x03, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 
+    0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 
+    0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 
+    0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 
+    0x05, 0x05, 0x06, 0x06, 0x06, 0x06, 0x07, 0x07, 
+};
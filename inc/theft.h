@@ -70,6 +70,10 @@ uint64_t theft_random_choice(struct theft *t, uint64_t ceil);
 /* Hash a buffer in one pass. (Wraps the below functions.) */
 theft_hash theft_hash_onepass(const uint8_t *data, size_t bytes);
 
+/* Hash a buffer in one pass, with a 128-bit result. */
+struct theft_hash128
+theft_hash_onepass128(const uint8_t *data, size_t bytes);
+
 /* Initialize/reset a hasher for incremental hashing. */
 void theft_hash_init(struct theft_hasher *h);
 
@@ -81,6 +85,10 @@ void theft_hash_sink(struct theft_hasher *h,
  * (This also resets the internal hasher state.) */
 theft_hash theft_hash_done(struct theft_hasher *h);
 
+/* Finish hashing and get a 128-bit result, whose low half is
+ * the same as theft_hash_done's. (This also resets the hasher.) */
+struct theft_hash128 theft_hash_done128(struct theft_hasher *h);
+
 
 /*********
  * Hooks *
@@ -152,6 +160,48 @@ theft_hook_run_post_print_info(const struct theft_hook_run_post_info *info, void
 void *theft_hook_get_env(struct theft *t);
 
 
+/*************
+ * Deadlines *
+ *************/
+
+/* Has the current call to the property function run past the
+ * configured `.deadline.timeout`? Long-running properties can poll
+ * this and return early. Always false if there is no deadline. */
+bool theft_trial_deadline_exceeded(struct theft *t);
+
+
+/***********
+ * Forking *
+ ***********/
+
+/* In an autoshrinking alloc callback, get how many bits of the
+ * argument's bit pool have been used so far. Saving this where each
+ * step of a generated sequence starts lets the property function
+ * pass it to theft_checkpoint before running that step. */
+size_t theft_checkpoint_position(struct theft *t);
+
+/* In a forked worker, while shrinking, and with `.fork.checkpoints`
+ * set: mark that the property function is about to run the step of
+ * argument ARG_INDEX starting at BIT_POSITION, and everything it has
+ * done so far depends only on the bits before it. A snapshot of the
+ * worker may be kept here, and a later candidate whose bits match up
+ * to this point resumes from it, with the rest of its argument.
+ *
+ * Returns the argument instance to continue with, which is a new
+ * one if this process was resumed for a later candidate, so any
+ * pointers into the old instance must be re-read from it. Otherwise,
+ * it's just returned unchanged. */
+void *theft_checkpoint(struct theft *t, uint8_t arg_index,
+    size_t bit_position);
+
+/* In a forked worker process, save SIZE bytes of DATA for the current
+ * trial, to be passed to the trial_post hook in `info->fork_report`.
+ * This replaces anything saved earlier in the same trial. Returns
+ * false if not running in a worker process, or if SIZE is larger
+ * than THEFT_FORK_REPORT_MAX. */
+bool theft_fork_report(struct theft *t, const void *data, size_t size);
+
+
 /***************************
  * Other utility functions *
  ***************************/
@@ -162,6 +212,37 @@ void theft_set_output_stream(struct theft *t, FILE *out);
 /* Get a seed based on the hash of the current timestamp. */
 theft_seed theft_seed_of_time(void);
 
+/* Get the seed used for trial TRIAL_ID in a run with RUN_SEED, when
+ * using THEFT_SEED_MODE_COUNTER. Trial 0 uses RUN_SEED itself.
+ * (Trial IDs count from after any `always_seeds`.) */
+theft_seed theft_seed_for_trial(theft_seed run_seed, size_t trial_id);
+
+/* Allocate a dedup filter for concurrent runs of the same property
+ * (with different seeds) to share via `.dedup.shared`, so each skips
+ * argument combinations that any of them has already tried. It's a
+ * bloom filter of at most SIZE bytes (0 means
+ * THEFT_DEF_SHARED_DEDUP_BYTES), in shared memory, so it can be used by
+ * runs on other threads, or in processes forked after allocating it.
+ * It can't grow, so size it for the total number of trials. Returns
+ * NULL on error. */
+struct theft_shared_dedup *theft_shared_dedup_new(size_t size);
+
+/* Free a shared dedup filter, once no runs are using it. */
+void theft_shared_dedup_free(struct theft_shared_dedup *shared);
+
+/* Start the fork server for a run of CFG (which must set `.fork.zygote`)
+ * now, rather than after its run_pre hook. Since workers are forked
+ * from the fork server's image, memory the process allocates after
+ * this is never copied into them, or visible to them. To use it, set
+ * `.fork.server` to it in the same config and call `theft_run`, which
+ * stops it once the run is done. Each fork server can only be used for
+ * one run. Returns NULL on error. */
+struct theft_fork_server *
+theft_fork_server_start(const struct theft_run_config *cfg);
+
+/* Free a fork server, after its run (or stopping it, if unused). */
+void theft_fork_server_free(struct theft_fork_server *server);
+
 /* Generic free callback: just call free(instance). */
 void theft_generic_free_cb(void *instance, void *env);
 
@@ -10,6 +10,13 @@ typedef uint64_t theft_seed;
 /* A hash of an instance. */
 typedef uint64_t theft_hash;
 
+/* A 128-bit hash, for when two independent 64-bit halves
+ * are needed. The low half matches the 64-bit hash. */
+struct theft_hash128 {
+    theft_hash lo;
+    theft_hash hi;
+};
+
 /* Configuration for a theft run. (Forward reference, defined below.) */
 struct theft_run_config;
 
@@ -77,7 +84,10 @@ typedef enum theft_trial_res theft_propfun7(struct theft *t,
 
 /* Internal state for incremental hashing. */
 struct theft_hasher {
-    theft_hash accum;
+    uint64_t acc[4];
+    uint64_t total;
+    uint8_t buf[32];
+    uint8_t buf_used;
 };
 
 
@@ -238,6 +248,9 @@ struct theft_hook_run_post_info {
     size_t total_trials;
     theft_seed run_seed;
     struct theft_run_report report;
+    /* The dedup filter's size and accuracy, or NULL if the arguments
+     * couldn't all be hashed. */
+    const struct theft_dedup_stats *dedup;
 };
 typedef enum theft_hook_run_post_res
 theft_hook_run_post_cb(const struct theft_hook_run_post_info *info,
@@ -265,7 +278,10 @@ theft_hook_gen_args_pre_cb(const struct theft_hook_gen_args_pre_info *info,
     void *env);
 
 /* Pre-trial hook: called before running the trial, with the initially
- * generated argument(s). */
+ * generated argument(s). With `.fork.workers` or `.threads`, it's
+ * called in trial order as each trial's result is merged, so the
+ * trial may already be running; halting discards it and any later
+ * trials. */
 enum theft_hook_trial_pre_res {
     THEFT_HOOK_TRIAL_PRE_ERROR,
     THEFT_HOOK_TRIAL_PRE_CONTINUE,
@@ -304,6 +320,39 @@ typedef enum theft_hook_fork_post_res
 theft_hook_fork_post_cb(const struct theft_hook_fork_post_info *info,
     void *env);
 
+/* How far a forked worker process got in running a trial. If the
+ * worker crashed or timed out, this is where. */
+enum theft_fork_stage {
+    THEFT_FORK_STAGE_NONE,      /* hadn't started the trial yet */
+    THEFT_FORK_STAGE_FORK_POST, /* running the fork_post hook */
+    THEFT_FORK_STAGE_PROPERTY,  /* running the property function */
+    THEFT_FORK_STAGE_DONE,      /* the property function returned */
+};
+
+/* Most data a worker can save with theft_fork_report. */
+#define THEFT_FORK_REPORT_MAX 256
+
+/* Written by the forked worker process running a trial, into memory
+ * shared with the parent process. */
+struct theft_fork_report {
+    enum theft_fork_stage stage;
+    uint64_t cpu_usec;          /* user + system CPU time for the trial */
+    uint64_t max_rss_kb;        /* worker's peak resident set size */
+    size_t size;                /* bytes saved with theft_fork_report */
+    uint8_t data[THEFT_FORK_REPORT_MAX];
+};
+
+/* Resource usage for a forked worker process, collected by the parent
+ * process with wait4(2) once the worker has exited. When batching,
+ * this covers every trial the worker ran. */
+struct theft_fork_rusage {
+    uint64_t utime_usec;        /* user CPU time */
+    uint64_t stime_usec;        /* system CPU time */
+    uint64_t max_rss_kb;        /* peak resident set size */
+    uint64_t minflt;            /* page faults without I/O */
+    uint64_t majflt;            /* page faults requiring I/O */
+};
+
 /* Post-trial hook: called after the trial is run, with the arguments
  * and result. */
 enum theft_hook_trial_post_res {
@@ -326,6 +375,14 @@ struct theft_hook_trial_post_info {
     void **args;
     enum theft_trial_res result;
     bool repeat;
+    /* When forking, the report from the worker that ran the trial
+     * (before any shrinking), otherwise NULL. */
+    const struct theft_fork_report *fork_report;
+    /* When forking, the worker's resource usage, otherwise NULL. */
+    const struct theft_fork_rusage *fork_rusage;
+    /* When not forking, whether the trial ran past `.deadline.timeout`
+     * (before any shrinking). */
+    bool deadline_exceeded;
 };
 typedef enum theft_hook_trial_post_res
 theft_hook_trial_post_cb(const struct theft_hook_trial_post_info *info,
@@ -349,6 +406,13 @@ struct theft_hook_counterexample_info {
     uint8_t arity;
     struct theft_type_info **type_info;
     void **args;
+    /* When capturing forked workers' output, what the call that
+     * found this counter-example wrote to stdout and stderr, and
+     * whether it was cut off at `.fork.capture_output.max_bytes`.
+     * Otherwise, NULL. */
+    const char *output;
+    size_t output_size;
+    bool output_truncated;
 };
 typedef enum theft_hook_counterexample_res
 theft_hook_counterexample_cb(const struct theft_hook_counterexample_info *info,
@@ -477,6 +541,87 @@ theft_hook_shrink_trial_post_cb(const struct theft_hook_shrink_trial_post_info *
  * before sending kill(pid, SIGKILL). */
 #define THEFT_DEF_EXIT_TIMEOUT_MSEC 100
 
+/* Defaults for `.fork.auto_timeout`: the timeout is this multiple of
+ * the estimated 99th percentile of passing trials' wall-clock time,
+ * but at least MIN and at most MAX msec. */
+#define THEFT_DEF_AUTO_TIMEOUT_MULTIPLE 10
+#define THEFT_DEF_AUTO_TIMEOUT_MIN_MSEC 10
+#define THEFT_DEF_AUTO_TIMEOUT_MAX_MSEC 10000
+
+/* How many times a supervised run restarts after a crash, by default,
+ * before giving up. */
+#define THEFT_DEF_SUPERVISE_MAX_RESTARTS 100
+
+/* How much of a failing trial's output to keep, when capturing
+ * worker processes' output. */
+#define THEFT_DEF_CAPTURE_MAX_BYTES (64 * 1024)
+
+/* How each trial's seed is derived from the run's seed. */
+enum theft_seed_mode {
+    /* Each trial's seed is drawn from the random number stream
+     * after generating the previous trial's arguments. (Default.) */
+    THEFT_SEED_MODE_CHAINED,
+    /* Trial N's seed only depends on the run seed and N (see
+     * `theft_seed_for_trial`), so any trial can be reproduced
+     * without generating the trials before it. */
+    THEFT_SEED_MODE_COUNTER,
+};
+
+/* Which pseudo-random number generator to use. */
+enum theft_prng {
+    THEFT_PRNG_DEFAULT,         /* currently xoshiro256** */
+    THEFT_PRNG_XOSHIRO256SS,    /* xoshiro256** */
+    /* 64-bit Mersenne Twister, which was used by theft <= 0.4.5.
+     * This can reproduce runs based on seeds from older versions. */
+    THEFT_PRNG_MT19937_64,
+};
+
+/* How to detect argument combinations that have already been tried.
+ * (This is only used when every argument can be hashed.) */
+enum theft_dedup_mode {
+    /* A bloom filter: small, but a false positive can cause an
+     * untried combination to be skipped. (Default.) */
+    THEFT_DEDUP_BLOOM,
+    /* An exact set of 128-bit hashes, which switches to a bloom
+     * filter once it would use more than `.dedup.max_bytes`. */
+    THEFT_DEDUP_EXACT,
+};
+
+/* Default memory budget for THEFT_DEDUP_EXACT. */
+#define THEFT_DEF_DEDUP_MAX_BYTES (64LLU * 1024 * 1024)
+
+/* Default size of a shared dedup filter (see `theft_shared_dedup_new`). */
+#define THEFT_DEF_SHARED_DEDUP_BYTES (16LLU * 1024 * 1024)
+
+/* The dedup filter's size and accuracy at the end of a run, passed to
+ * the run_post hook. `.dedup.max_bytes` only limits the exact set:
+ * once it would use more, it switches to a bloom filter, which keeps
+ * doubling as needed to keep its false positive rate down, so memory
+ * can end up larger than max_bytes. A shared filter keeps the size it
+ * was allocated with, so its false positive rate grows instead. */
+struct theft_dedup_stats {
+    /* The mode in use by the end of the run: THEFT_DEDUP_EXACT may
+     * have switched to THEFT_DEDUP_BLOOM. A shared filter is always
+     * THEFT_DEDUP_BLOOM. */
+    enum theft_dedup_mode mode;
+    size_t memory;              /* bytes allocated */
+    /* Argument combinations marked as tried. For a shared filter,
+     * this includes those marked by other runs using it. */
+    uint64_t marked;
+    double fpr;                 /* estimated false positive rate */
+    /* The bloom filter couldn't grow (because allocation failed), so
+     * its false positive rate kept climbing, and some untried
+     * combinations may have been skipped as duplicates. theft_run
+     * prints a warning when this happens. */
+    bool saturated;
+};
+
+/* Opaque type for a dedup filter shared by concurrent runs. */
+struct theft_shared_dedup;
+
+/* Opaque type for a fork server started ahead of its run. */
+struct theft_fork_server;
+
 /* Configuration struct for a theft run. */
 struct theft_run_config {
     /* Property function under test.
@@ -512,10 +657,95 @@ struct theft_run_config {
     /* Seed for the random number generator. */
     theft_seed seed;
 
+    /* How to derive each trial's seed from the seed above.
+     * Defaults to THEFT_SEED_MODE_CHAINED. */
+    enum theft_seed_mode seed_mode;
+
+    /* Which pseudo-random number generator to use.
+     * Defaults to THEFT_PRNG_DEFAULT. */
+    enum theft_prng prng;
+
+    /* How to skip argument combinations that have already been
+     * tried. Defaults to THEFT_DEDUP_BLOOM; max_bytes defaults to
+     * THEFT_DEF_DEDUP_MAX_BYTES. If shared is set (see
+     * `theft_shared_dedup_new`), it's used instead, and combinations
+     * tried by other runs using it are skipped too. */
+    struct {
+        enum theft_dedup_mode mode;
+        size_t max_bytes;
+        struct theft_shared_dedup *shared;
+    } dedup;
+
     /* Bits to use for the bloom filter -- this field is no
      * longer used, and will be removed in a future release. */
     uint8_t bloom_bits;
 
+    /* A time limit for each call to the property function, without
+     * forking. When it passes, `theft_trial_deadline_exceeded` starts
+     * returning true, so the property can stop early. With unwind,
+     * theft instead jumps out of the property function (via
+     * siglongjmp) and treats the trial as failed -- see
+     * doc/forking.md for the caveats. This uses SIGALRM and an
+     * ITIMER_REAL timer, so it can't be combined with code under
+     * test that uses them. */
+    struct {
+        size_t timeout;         /* in milliseconds (or 0, for none) */
+        bool unwind;
+    } deadline;
+
+    /* Run the trials in a single child process, without forking
+     * for each trial, while this process waits. If it crashes, it's
+     * restarted from the trial it was running, which is re-run (and
+     * shrunk) forked, using the `.fork` settings, and the remaining
+     * trials continue without forking, whether or not `.fork.enable`
+     * is set. The counters and the dedup filter (a shared one, of at
+     * most `.dedup.max_bytes`) carry over to the restarted process.
+     * Hooks other than run_pre and run_post are called in the child
+     * process, so changes they make to the hook environment are lost.
+     * Trials are run one at a time, so `.fork.workers`,
+     * `.fork.trials_per_child`, `.fork.zygote`, and
+     * `.background_shrink` can't be used. max_restarts defaults to
+     * THEFT_DEF_SUPERVISE_MAX_RESTARTS. */
+    struct {
+        bool enable;
+        size_t max_restarts;
+    } supervise;
+
+    /* Run trials on this many threads, in this process, rather than
+     * one at a time. Each thread generates arguments and calls the
+     * property function with its own `struct theft *` handle (and
+     * random number generator), so the property function and the
+     * type info callbacks must be thread-safe. Results are still
+     * merged, reported to hooks, and shrunk in trial order, on the
+     * calling thread. This requires THEFT_SEED_MODE_COUNTER, and
+     * can't be combined with `.fork.enable`, `.supervise`, or
+     * `.deadline`. 0 or 1 runs one trial at a time. */
+    size_t threads;
+
+    /* Shrink failures on a separate thread, with its own `struct
+     * theft *` handle, while this one keeps running trials. Each
+     * failure is counted when it's queued, but only passed to the
+     * counterexample and trial_post hooks once it has been shrunk;
+     * theft_run waits for every failure to be shrunk before
+     * returning. Hooks are never called concurrently, but the
+     * property function can be running on both threads at once, so
+     * it must be thread-safe.
+     * This can't be combined with `.threads`, `.fork.enable`,
+     * `.supervise`, or `.deadline`. */
+    bool background_shrink;
+
+    /* When running trials one at a time, generate up to this many
+     * trials' arguments ahead (and hash them, for dedup), on a
+     * separate thread, while the property function runs. Hooks are
+     * still called, and counters updated, in the same order, and
+     * the trials are the same, but the alloc and hash callbacks can
+     * run at the same time as the property function (and shrinking),
+     * so they must be thread-safe. This has no effect with
+     * `.fork.workers`, `.fork.trials_per_child`, or `.threads`,
+     * which already generate trials ahead. 0 (the default)
+     * generates each trial's arguments just before running it. */
+    size_t prefetch;
+
     /* Fork before running the property test, in case generated
      * arguments can cause the code under test to crash. */
     struct {
@@ -527,6 +757,94 @@ struct theft_run_config {
          * theft wait for them to actually exit (in msec).
          * Defaults to THEFT_DEF_EXIT_TIMEOUT_MSEC. */
         size_t exit_timeout;
+        /* Rather than a fixed timeout, use a multiple of the 99th
+         * percentile of the wall-clock time of trials that have
+         * passed so far (estimated as they pass), clamped between min
+         * and max msec. Until five trials have passed, max is used.
+         * It's frozen while shrinking, so whether a candidate times
+         * out doesn't depend on when it ran. Fields that are 0 use
+         * THEFT_DEF_AUTO_TIMEOUT_*. Overrides `.timeout`. */
+        struct {
+            bool enable;
+            size_t multiple;
+            size_t min;         /* in milliseconds */
+            size_t max;         /* in milliseconds */
+        } auto_timeout;
+        /* How many worker processes to keep running trials at once.
+         * 0 or 1 runs one trial at a time. Results are still merged,
+         * reported to hooks, and shrunk in trial order. */
+        size_t workers;
+        /* Fork a single fork server process after the run_pre hook,
+         * and fork workers from it rather than from the main process.
+         * Only used when every argument uses autoshrinking, since
+         * arguments are sent to it as their autoshrink bit pools. */
+        bool zygote;
+        /* A fork server already started for this config with
+         * `theft_fork_server_start`, to use instead of starting one
+         * after the run_pre hook. */
+        struct theft_fork_server *server;
+        /* Resource limits for each worker process, set (as soft
+         * limits) before the fork_post hook. 0 leaves a limit
+         * unchanged. */
+        struct {
+            size_t address_space; /* RLIMIT_AS, in bytes */
+            size_t cpu;         /* RLIMIT_CPU, in seconds per trial */
+            size_t open_files;  /* RLIMIT_NOFILE */
+            /* By default, RLIMIT_CORE is set to 0, so crashing
+             * workers don't spend time writing core dumps. */
+            bool core_dumps;
+        } rlimits;
+        /* How many trials each worker process runs, one after
+         * another, before exiting. 0 or 1 forks a worker for every
+         * trial. If a worker crashes or times out partway through,
+         * the crash is attributed to the trial it was running, and
+         * its remaining trials are run on a new worker. Calls made
+         * while shrinking are not batched. */
+        size_t trials_per_child;
+        /* CPUs to run workers on, as an array of count CPU numbers
+         * (Linux only, using sched_setaffinity(2); ignored elsewhere).
+         * By default (count 0), workers can run on any CPU the main
+         * process can. */
+        struct {
+            const unsigned *cpus;
+            size_t count;
+        } cpu_set;
+        /* Pin each worker to a single CPU from `.cpu_set`, by worker
+         * slot, rather than letting it use any of them. */
+        bool pin_workers;
+        /* Pin the main process (or the supervised process) to the
+         * first CPU in `.cpu_set`, leaving the rest for workers. The
+         * previous affinity is restored once the run is done. */
+        bool pin_parent;
+        /* Add this to each worker's nice value (see nice(2)).
+         * Negative values usually need privileges. */
+        int nice;
+        /* Send each worker's stdout and stderr to a temporary file
+         * (a memfd, on Linux), rather than letting it through.
+         * Output from passing trials is thrown away; for a failing
+         * trial, the first max_bytes of it (defaulting to
+         * THEFT_DEF_CAPTURE_MAX_BYTES) is kept and printed with the
+         * counter-example. */
+        struct {
+            bool enable;
+            size_t max_bytes;
+        } capture_output;
+        /* While shrinking, keep up to this many snapshot processes,
+         * stopped where a worker called theft_checkpoint, so later
+         * candidates that start with the same bits can resume from
+         * one instead of re-running the steps before it. 0 (the
+         * default) disables this. Only used when every argument uses
+         * autoshrinking. See doc/forking.md. */
+        size_t checkpoints;
+        /* With more than one worker, shrink by generating a candidate
+         * for each worker from the current counter-example, running
+         * them at once, and keeping the first (by tactic order) that
+         * still fails. The rest are killed. With a .shrink callback
+         * this finds the same counter-example as shrinking one
+         * candidate at a time; autoshrinking may take another path,
+         * but the same one every time for a given seed and number of
+         * workers. See doc/forking.md. */
+        bool parallel_shrink;
     } fork;
 
     /* These functions are called in several contexts to report on
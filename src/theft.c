@@ -4,6 +4,7 @@
 #include "theft.h"
 #include "theft_types_internal.h"
 #include "theft_run.h"
+#include "theft_zygote.h"
 
 static enum theft_trial_res should_not_run(struct theft *t, void *arg1);
 
@@ -24,6 +25,20 @@ theft_run(const struct theft_run_config *cfg) {
 
     struct theft *t = NULL;
 
+    if (cfg->fork.server != NULL) {
+        /* Take over the handle the fork server was started with. */
+        struct theft_fork_server *server = cfg->fork.server;
+        t = server->t;
+        if (t == NULL || 0 != memcmp(t->prop.type_info, cfg->type_info,
+                sizeof(t->prop.type_info))) {
+            return THEFT_RUN_ERROR_BAD_ARGS;
+        }
+        server->t = NULL;
+        enum theft_run_res res = theft_run_trials(t);
+        theft_run_free(t);
+        return res;
+    }
+
     enum theft_run_init_res init_res = theft_run_init(cfg, &t);
     switch (init_res) {
     case THEFT_RUN_INIT_ERROR_MEMORY:
@@ -41,6 +56,36 @@ theft_run(const struct theft_run_config *cfg) {
     return res;
 }
 
+struct theft_fork_server *
+theft_fork_server_start(const struct theft_run_config *cfg) {
+    if (cfg == NULL || !cfg->fork.enable || !cfg->fork.zygote
+        || cfg->fork.server != NULL) {
+        return NULL;
+    }
+
+    struct theft_fork_server *res = malloc(sizeof(*res));
+    if (res == NULL) {
+        return NULL;
+    }
+    if (THEFT_RUN_INIT_OK != theft_run_init(cfg, &res->t)) {
+        free(res);
+        return NULL;
+    }
+    if (!theft_zygote_start(res->t)) {
+        theft_run_free(res->t);
+        free(res);
+        return NULL;
+    }
+    return res;
+}
+
+void theft_fork_server_free(struct theft_fork_server *server) {
+    if (server->t != NULL) {
+        theft_run_free(server->t);
+    }
+    free(server);
+}
+
 enum theft_generate_res
 theft_generate(FILE *f, theft_seed seed,
         const struct theft_type_info *info, void *hook_env) {
@@ -1,5 +1,6 @@
 #include "theft_autoshrink_internal.h"
 
+#include "theft_bits.h"
 #include "theft_random.h"
 #include "theft_rng.h"
 
@@ -91,14 +92,15 @@ static void lazily_fill_bit_pool(struct theft *t,
         pool->bits_ceil = nceil;
     }
 
-    while (pool->consumed + bit_count > pool->bits_filled) {
+    if (pool->consumed + bit_count > pool->bits_filled) {
         uint64_t *bits64 = (uint64_t *)pool->bits;
-        size_t offset = pool->bits_filled / 64;
-        assert(offset * 64 < pool->bits_ceil);
-        bits64[offset] = theft_rng_random(t->prng.rng);
-        LOG(3, "filling bit64[%zd]: 0x%016" PRIx64 "\n",
-            offset, bits64[offset]);
-        pool->bits_filled += 64;
+        const size_t offset = pool->bits_filled / 64;
+        const size_t words = (pool->consumed + bit_count
+            - pool->bits_filled + 63) / 64;
+        assert((offset + words) * 64 <= pool->bits_ceil);
+        theft_rng_fill(t->prng.rng, &bits64[offset], words);
+        LOG(3, "filling bit64[%zd..%zd]\n", offset, offset + words);
+        pool->bits_filled += 64 * words;
     }
 }
 
@@ -256,7 +258,27 @@ theft_autoshrink_alloc(struct theft *t, struct autoshrink_env *env,
     return THEFT_ALLOC_OK;
 }
 
-theft_hash
+enum theft_alloc_res
+theft_autoshrink_replay(struct theft *t, struct autoshrink_env *env,
+        const uint8_t *bits, size_t bit_count, void **instance) {
+    assert(env);
+    struct autoshrink_bit_pool *pool =
+      alloc_bit_pool(bit_count == 0 ? 64 : bit_count, bit_count,
+          DEF_REQUESTS_CEIL);
+    if (pool == NULL) {
+        return THEFT_ALLOC_ERROR;
+    }
+    memcpy(pool->bits, bits, (bit_count + 7) / 8);
+    pool->bits_filled = bit_count;
+    env->bit_pool = pool;
+
+    /* Since alloc is deterministic given the same bits, it will make
+     * the same requests, and not read past the bits consumed before.
+     * Replaying as if shrinking prevents filling it with new bits. */
+    return alloc_from_bit_pool(t, env, pool, instance, true);
+}
+
+struct theft_hash128
 theft_autoshrink_hash(struct theft *t, const void *instance,
         struct autoshrink_env *env, void *type_env) {
 
@@ -264,7 +286,8 @@ theft_autoshrink_hash(struct theft *t, const void *instance,
      * the instance, otherwise hash the bit pool. */
     const struct theft_type_info *ti = t->prop.type_info[env->arg_i];
     if (ti->hash != NULL) {
-        return ti->hash(instance, type_env);
+        struct theft_hash128 res = { .lo = ti->hash(instance, type_env) };
+        return res;
     } else {
         struct autoshrink_bit_pool *pool = env->bit_pool;
         assert(pool);
@@ -285,8 +308,9 @@ theft_autoshrink_hash(struct theft *t, const void *instance,
             theft_hash_sink(&h, &rem, 1);
         }
         LOG(5 - LOG_AUTOSHRINK, " ]\n");
-        theft_hash res = theft_hash_done(&h);
-        LOG(2 - LOG_AUTOSHRINK, "%s: 0x%016" PRIx64 "\n", __func__, res);
+        struct theft_hash128 res = theft_hash_done128(&h);
+        LOG(2 - LOG_AUTOSHRINK, "%s: 0x%016" PRIx64 "%016" PRIx64 "\n",
+            __func__, res.hi, res.lo);
         return res;
     }
 }
@@ -369,20 +393,9 @@ theft_autoshrink_shrink(struct theft *t, struct autoshrink_env *env,
 
 static void
 truncate_trailing_zero_bytes(struct autoshrink_bit_pool *pool) {
-    size_t nsize = 0;
     const size_t byte_size = (pool->bits_filled / 8)
       + ((pool->bits_filled % 8) == 0 ? 0 : 1);
-    if (byte_size > 0) {
-        size_t i = byte_size;
-        do {
-            i--;
-            if (pool->bits[i] != 0x00) {
-                nsize = i + 1;
-                break;
-            }
-        } while (i > 0);
-    }
-    nsize *= 8;
+    const size_t nsize = 8 * theft_bits_trim_zero_bytes(pool->bits, byte_size);
     LOG(2, "Truncating to nsize: %zd\n", nsize);
     pool->bits_filled = nsize;
     if (pool->limit > pool->bits_filled) {
@@ -390,16 +403,6 @@ truncate_trailing_zero_bytes(struct autoshrink_bit_pool *pool) {
     }
 }
 
-static uint8_t popcount(uint64_t value) {
-    uint8_t pop = 0;
-    for (uint8_t i = 0; i < 64; i++) {
-        if (value & (1LLU << i)) {
-            pop++;
-        }
-    }
-    return pop;
-}
-
 static uint8_t log2ceil(size_t value) {
     uint8_t res = 0;
     while ((1LLU << res) < value) {
@@ -417,11 +420,6 @@ static void drop_from_bit_pool(struct theft *t,
     size_t src_offset = 0;
     size_t dst_offset = 0;
 
-    size_t src_byte = 0;
-    size_t dst_byte = 0;
-    uint8_t src_bit = 0x01;
-    uint8_t dst_bit = 0x01;
-
     /* If N random bits are <= DROP_THRESHOLD, then drop the
      * current request, otherwise copy it.
      *
@@ -455,58 +453,27 @@ static void drop_from_bit_pool(struct theft *t,
                     drop_offset,
                     drop_size,
                     req_size);
-                for (size_t bi = 0; bi < req_size; bi++) {
-                    if (bi < drop_offset || bi > drop_offset + drop_size) {
-                        if (orig->bits[src_byte] & src_bit) {
-                            copy->bits[dst_byte] |= dst_bit;
-                        }
-
-                        dst_bit <<= 1;
-                        if (dst_bit == 0x00) {
-                            dst_bit = 0x01;
-                            dst_byte++;
-                        }
-                        dst_offset++;
-                    }
 
-                    src_bit <<= 1;
-                    if (src_bit == 0x00) {
-                        src_bit = 0x01;
-                        src_byte++;
-                    }
-                    src_offset++;
-                }
-            } else {                                       /* drop all */
-                for (size_t bi = 0; bi < req_size; bi++) {
-                    src_bit <<= 1;
-                    if (src_bit == 0x00) {
-                        src_bit = 0x01;
-                        src_byte++;
-                    }
-                    src_offset++;
+                /* Keep the bits before and after the dropped range,
+                 * [drop_offset, drop_offset + drop_size]. */
+                theft_bits_copy(copy->bits, dst_offset,
+                    orig->bits, src_offset, drop_offset);
+                dst_offset += drop_offset;
+
+                const size_t tail_start = (size_t)drop_offset + drop_size + 1;
+                if (tail_start < req_size) {
+                    const size_t tail_size = req_size - tail_start;
+                    theft_bits_copy(copy->bits, dst_offset,
+                        orig->bits, src_offset + tail_start, tail_size);
+                    dst_offset += tail_size;
                 }
-            }
+            }                   /* else drop all */
         } else {  // copy
-            for (size_t bi = 0; bi < req_size; bi++) {
-                if (orig->bits[src_byte] & src_bit) {
-                    copy->bits[dst_byte] |= dst_bit;
-                }
-
-                src_bit <<= 1;
-                if (src_bit == 0x00) {
-                    src_bit = 0x01;
-                    src_byte++;
-                }
-                src_offset++;
-
-                dst_bit <<= 1;
-                if (dst_bit == 0x00) {
-                    dst_bit = 0x01;
-                    dst_byte++;
-                }
-                dst_offset++;
-            }
+            theft_bits_copy(copy->bits, dst_offset,
+                orig->bits, src_offset, req_size);
+            dst_offset += req_size;
         }
+        src_offset += req_size;
     }
 
     LOG(2  - LOG_AUTOSHRINK,
@@ -537,7 +504,7 @@ static void mutate_bit_pool(struct theft *t,
 
     /* Get some random bits, and for each 1 bit, we will make one change in
      * the pool copy. */
-    uint8_t change_count = popcount(prng(max_changes, env->udata)) + 1;
+    uint8_t change_count = theft_bits_popcount(prng(max_changes, env->udata)) + 1;
 
     /* If there are only a few requests, and none of them are large,
      * then limit the change count to the request count. This helps
@@ -797,56 +764,16 @@ static size_t offset_of_pos(const struct autoshrink_bit_pool *orig,
     return orig->index[pos];
 }
 
-static void convert_bit_offset(size_t bit_offset,
-                               size_t *byte_offset, uint8_t *bit) {
-    *byte_offset = bit_offset / 8;
-    *bit = bit_offset % 8;
-}
-
 static uint64_t
 read_bits_at_offset(const struct autoshrink_bit_pool *pool,
                     size_t bit_offset, uint8_t size) {
-    size_t byte = 0;
-    uint8_t bit = 0;
-    convert_bit_offset(bit_offset, &byte, &bit);
-    uint64_t acc = 0;
-    uint8_t bit_i = 0x01 << bit;
-
-    for (uint8_t i = 0; i < size; i++) {
-        LOG(5, "byte %zd, size %zd\n", byte, pool->bits_filled);
-        if (pool->bits[byte] & bit_i) {
-            acc |= (1LLU << i);
-        }
-        bit_i <<= 1;
-        if (bit_i == 0) {
-            byte++;
-            bit_i = 0x01;
-        }
-    }
-
-    return acc;
+    return theft_bits_read(pool->bits, bit_offset, size);
 }
 
 static void
 write_bits_at_offset(struct autoshrink_bit_pool *pool,
                      size_t bit_offset, uint8_t size, uint64_t bits) {
-    size_t byte = 0;
-    uint8_t bit = 0;
-    convert_bit_offset(bit_offset, &byte, &bit);
-    uint8_t bit_i = 0x01 << bit;
-
-    for (uint8_t i = 0; i < size; i++) {
-        if (bits & (1LLU << i)) {
-            pool->bits[byte] |= bit_i;
-        } else {
-            pool->bits[byte] &=~ bit_i;
-        }
-        bit_i <<= 1;
-        if (bit_i == 0) {
-            byte++;
-            bit_i = 0x01;
-        }
-    }
+    theft_bits_write(pool->bits, bit_offset, size, bits);
 }
 
 void theft_autoshrink_dump_bit_pool(FILE *f, size_t bit_count,
@@ -936,7 +863,7 @@ void theft_autoshrink_dump_bit_pool(FILE *f, size_t bit_count,
                     }
                 }
                 if (rem > 0) {
-                    uint8_t bits = read_bits_at_offset(pool, offset + byte_count, rem);
+                    uint8_t bits = read_bits_at_offset(pool, offset + 8*byte_count, rem);
                     fprintf(f, "%02x/%u ", bits, rem);
                 }
                 fprintf(f, "]\n");
@@ -164,7 +164,16 @@ enum theft_alloc_res
 theft_autoshrink_alloc(struct theft *t, struct autoshrink_env *env,
     void **instance);
 
-theft_hash
+/* Allocate an instance by replaying the first BIT_COUNT bits of BITS,
+ * i.e., the bits consumed by an earlier call to alloc (possibly in
+ * another process). The bit pool is saved in ENV. */
+enum theft_alloc_res
+theft_autoshrink_replay(struct theft *t, struct autoshrink_env *env,
+    const uint8_t *bits, size_t bit_count, void **instance);
+
+/* Hash callback. If the type has its own hash callback, its hash is
+ * used for the low half, otherwise the consumed bit pool is hashed. */
+struct theft_hash128
 theft_autoshrink_hash(struct theft *t, const void *instance,
     struct autoshrink_env *env, void *type_env);
 
@@ -38,9 +38,6 @@ static bool build_index(struct autoshrink_bit_pool *pool);
 static size_t offset_of_pos(const struct autoshrink_bit_pool *orig,
     size_t pos);
 
-static void convert_bit_offset(size_t bit_offset,
-    size_t *byte_offset, uint8_t *bit);
-
 static uint64_t
 read_bits_at_offset(const struct autoshrink_bit_pool *pool,
     size_t bit_offset, uint8_t size);
@@ -16,6 +16,17 @@ theft_seed theft_seed_of_time(void) {
     return (uint64_t)theft_hash_onepass((const uint8_t *)&tv, sizeof(tv));
 }
 
+/* Derive trial seeds with SplitMix64's increment and output
+ * function, so each is a cheap, independent function of the run
+ * seed and the trial ID. */
+theft_seed theft_seed_for_trial(theft_seed run_seed, size_t trial_id) {
+    if (trial_id == 0) { return run_seed; }
+    uint64_t z = run_seed + (uint64_t)trial_id * 0x9e3779b97f4a7c15LLU;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9LLU;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebLLU;
+    return z ^ (z >> 31);
+}
+
 void theft_generic_free_cb(void *instance, void *env) {
     (void)env;
     free(instance);
@@ -147,6 +158,18 @@ theft_print_counterexample(const struct theft_hook_counterexample_info *info,
             fprintf(t->out, "\n");
         }
     }
+    if (info->output != NULL) {
+        fprintf(t->out, "    Output:\n");
+        fwrite(info->output, 1, info->output_size, t->out);
+        if (info->output_size > 0
+            && info->output[info->output_size - 1] != '\n') {
+            fprintf(t->out, "\n");
+        }
+        if (info->output_truncated) {
+            fprintf(t->out, "    (output truncated to %zd bytes)\n",
+                info->output_size);
+        }
+    }
     return THEFT_HOOK_COUNTEREXAMPLE_CONTINUE;
 }
 
@@ -0,0 +1,167 @@
+#include "theft_bits.h"
+
+#include <assert.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HAVE_BIT_BUILTINS 1
+#else
+#define HAVE_BIT_BUILTINS 0
+#endif
+
+static uint64_t get_mask(uint8_t bits) {
+    return (bits == 64U ? (uint64_t)-1 : ((1LLU << bits) - 1));
+}
+
+/* Load COUNT (<= 8) bytes as a little-endian word. With COUNT == 8,
+ * compilers turn this into a single (possibly byte-swapped) load. */
+static uint64_t load_le(const uint8_t *buf, uint8_t count) {
+    uint64_t acc = 0;
+    if (count == 8) {
+        return ((uint64_t)buf[0] | ((uint64_t)buf[1] << 8)
+            | ((uint64_t)buf[2] << 16) | ((uint64_t)buf[3] << 24)
+            | ((uint64_t)buf[4] << 32) | ((uint64_t)buf[5] << 40)
+            | ((uint64_t)buf[6] << 48) | ((uint64_t)buf[7] << 56));
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        acc |= (uint64_t)buf[i] << (8*i);
+    }
+    return acc;
+}
+
+static void store_le(uint8_t *buf, uint8_t count, uint64_t word) {
+    for (uint8_t i = 0; i < count; i++) {
+        buf[i] = (uint8_t)(word >> (8*i));
+    }
+}
+
+uint64_t
+theft_bits_read(const uint8_t *buf, size_t bit_offset, uint8_t size) {
+    assert(size <= 64);
+    if (size == 0) { return 0; }
+    const uint8_t *p = &buf[bit_offset / 8];
+    const uint8_t shift = bit_offset % 8;
+    const uint8_t bytes = (shift + size + 7) / 8; /* 1 to 9 */
+
+    uint64_t acc;
+    if (bytes <= 8) {
+        acc = load_le(p, bytes) >> shift;
+    } else {
+        acc = (load_le(p, 8) >> shift) | ((uint64_t)p[8] << (64 - shift));
+    }
+    return acc & get_mask(size);
+}
+
+void
+theft_bits_write(uint8_t *buf, size_t bit_offset, uint8_t size,
+        uint64_t bits) {
+    assert(size <= 64);
+    if (size == 0) { return; }
+    uint8_t *p = &buf[bit_offset / 8];
+    const uint8_t shift = bit_offset % 8;
+    const uint8_t bytes = (shift + size + 7) / 8; /* 1 to 9 */
+    const uint64_t mask = get_mask(size);
+    bits &= mask;
+
+    if (bytes <= 8) {
+        uint64_t word = load_le(p, bytes);
+        word = (word & ~(mask << shift)) | (bits << shift);
+        store_le(p, bytes, word);
+    } else {
+        /* shift > 0 here, since at most 64 bits are written. */
+        uint64_t word = load_le(p, 8);
+        word = (word & ~(mask << shift)) | (bits << shift);
+        store_le(p, 8, word);
+        const uint8_t hi_bits = shift + size - 64;
+        const uint8_t hi_mask = (uint8_t)get_mask(hi_bits);
+        p[8] = (uint8_t)((p[8] & ~hi_mask) | ((bits >> (64 - shift)) & hi_mask));
+    }
+}
+
+void
+theft_bits_copy(uint8_t *dst, size_t dst_offset,
+        const uint8_t *src, size_t src_offset, size_t bit_count) {
+    /* When both are byte-aligned, copy whole bytes directly. */
+    if ((dst_offset % 8) == 0 && (src_offset % 8) == 0) {
+        uint8_t *d = &dst[dst_offset / 8];
+        const uint8_t *s = &src[src_offset / 8];
+        const size_t bytes = bit_count / 8;
+        for (size_t i = 0; i < bytes; i++) {
+            d[i] = s[i];
+        }
+        dst_offset += 8*bytes;
+        src_offset += 8*bytes;
+        bit_count -= 8*bytes;
+    }
+
+    while (bit_count > 0) {
+        const uint8_t step = (bit_count < 64 ? bit_count : 64);
+        theft_bits_write(dst, dst_offset, step,
+            theft_bits_read(src, src_offset, step));
+        dst_offset += step;
+        src_offset += step;
+        bit_count -= step;
+    }
+}
+
+size_t
+theft_bits_trim_zero_bytes(const uint8_t *buf, size_t byte_count) {
+    size_t i = byte_count;
+    /* Check a byte at a time until at a word boundary... */
+    while (i > 0 && (i % 8) != 0) {
+        if (buf[i - 1] != 0x00) { return i; }
+        i--;
+    }
+
+    /* ...then a word at a time. */
+    while (i > 0) {
+        const uint64_t word = load_le(&buf[i - 8], 8);
+        if (word != 0) {
+            return i - 8 + (63 - theft_bits_clz(word)) / 8 + 1;
+        }
+        i -= 8;
+    }
+    return 0;
+}
+
+uint8_t
+theft_bits_popcount(uint64_t value) {
+#if HAVE_BIT_BUILTINS
+    return (uint8_t)__builtin_popcountll(value);
+#else
+    value = value - ((value >> 1) & 0x5555555555555555ULL);
+    value = (value & 0x3333333333333333ULL)
+      + ((value >> 2) & 0x3333333333333333ULL);
+    value = (value + (value >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (uint8_t)((value * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+uint8_t
+theft_bits_ctz(uint64_t value) {
+    assert(value != 0);
+#if HAVE_BIT_BUILTINS
+    return (uint8_t)__builtin_ctzll(value);
+#else
+    uint8_t res = 0;
+    while ((value & 0x01) == 0) {
+        value >>= 1;
+        res++;
+    }
+    return res;
+#endif
+}
+
+uint8_t
+theft_bits_clz(uint64_t value) {
+    assert(value != 0);
+#if HAVE_BIT_BUILTINS
+    return (uint8_t)__builtin_clzll(value);
+#else
+    uint8_t res = 0;
+    while ((value & (1ULL << 63)) == 0) {
+        value <<= 1;
+        res++;
+    }
+    return res;
+#endif
+}
@@ -0,0 +1,42 @@
+#ifndef THEFT_BITS_H
+#define THEFT_BITS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Word-at-a-time operations on little-endian bit buffers, where bit N
+ * is (buf[N / 8] >> (N % 8)) & 1. Bits are never read or written past
+ * the last byte covered by the requested range. */
+
+/* Read SIZE (<= 64) bits starting at BIT_OFFSET. */
+uint64_t
+theft_bits_read(const uint8_t *buf, size_t bit_offset, uint8_t size);
+
+/* Overwrite SIZE (<= 64) bits starting at BIT_OFFSET with the low
+ * bits of BITS, leaving neighboring bits unchanged. */
+void
+theft_bits_write(uint8_t *buf, size_t bit_offset, uint8_t size,
+    uint64_t bits);
+
+/* Copy BIT_COUNT bits from SRC (starting at SRC_OFFSET) to DST
+ * (starting at DST_OFFSET). The ranges must not overlap. */
+void
+theft_bits_copy(uint8_t *dst, size_t dst_offset,
+    const uint8_t *src, size_t src_offset, size_t bit_count);
+
+/* Get the number of bytes in BUF, up to and including the last
+ * non-zero byte, i.e., BYTE_COUNT minus any trailing zero bytes. */
+size_t
+theft_bits_trim_zero_bytes(const uint8_t *buf, size_t byte_count);
+
+/* Count the bits set in VALUE. */
+uint8_t
+theft_bits_popcount(uint64_t value);
+
+/* Count trailing / leading zero bits. VALUE must be non-zero. */
+uint8_t
+theft_bits_ctz(uint64_t value);
+uint8_t
+theft_bits_clz(uint64_t value);
+
+#endif
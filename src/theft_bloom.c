@@ -1,238 +1,448 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE     /* for MAP_ANONYMOUS */
+#endif
+
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #include "theft.h"
 #include "theft_bloom.h"
+#include "theft_bits.h"
 #include "theft_types_internal.h"
 
-/* This is a dynamic blocked bloom filter, loosely based on
- * _Cache Efficient Bloom Filters for Shared Memory Machines_
- * by Tim Kaler.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* This is a split block bloom filter, as in _Cache-, Hash- and
+ * Space-Efficient Bloom Filters_ by Putze, Sanders, and Singler,
+ * with flat growth.
  *
- * The top level of the bloom filter uses the first N bits of the hash
- * (top_block2) to choose between (1 << N) distinct bloom filter blocks.
- * These blocks are created as necessary, i.e., a NULL block means no
- * bits in that block would have been set.
+ * Each filter is a flat array of 64-byte (cache line sized) blocks.
+ * A 128-bit key picks one block with its low half, and one bit in
+ * each of the block's 8 64-bit words with 6-bit chunks of its high
+ * half, so marking or checking a key only touches one cache
+ * line, and checking is a single masked compare.
  *
- * When checking for matches, HASH_COUNT different chunks of M bits from
- * the hash are used to check each block's bloom filter. (M is
- * block->size2, and the bloom filter has (1 << M) bits.) If any of
- * the selected bits are false, there was no match. Every bloom filter
- * in the block's linked list is checked, so all must match for
- * `theft_bloom_check` to return true.
+ * When the newest filter has too many bits set, a new one twice its
+ * size is appended, and new keys are only marked there. Checking
+ * tests one block in every filter, so the number of filters (the
+ * depth) only grows with the log of the number of keys marked.
  *
- * When marking, only the front (largest) bloom filter in the
- * appropriate block is updated. If marking did not change any
- * bits (all bits chosen by the hash were already set), then
- * the bloom filter is considered too full, and a new one is
- * inserted before it, as the new head of the block. The new
- * bloom filter's size2 is one larger, so more bits of the hash
- * are used, and the bloom filter doubles in size. */
-
-/* Default number of bits to use for choosing a specific
- * block (linked list of bloom filters) */
-#define DEF_TOP_BLOCK_BITS 9
-
-/* Default number of bits in each first-layer bloom filter */
+ * Since the block index comes from its own 64 bits, filters can keep
+ * doubling until allocation fails. If that happens (or the configured
+ * maximum size is reached), the filter is saturated: keys are still
+ * marked in the newest filter, but its false positive rate will keep
+ * climbing, so new trials may be skipped as duplicates. This is noted
+ * in its stats, so the run can print a warning. */
+
+/* Default log2 of the number of blocks in the first filter.
+ * (2^9 64-byte blocks: 32 KB.) */
 #define DEF_MIN_FILTER_BITS 9
 
-/* How many hashes to check for each block */
-#define HASH_COUNT 4
+#define BLOCK_WORDS 8
+#define BLOCK_SIZE (BLOCK_WORDS * sizeof(uint64_t))
+
+/* Grow when more than MAX_FILL_NUM / MAX_FILL_DEN of the newest filter's
+ * bits are set. At 3/8 full, each filter's false positive
+ * rate is about (3/8)^8, or 0.04%. */
+#define MAX_FILL_NUM 3
+#define MAX_FILL_DEN 8
+
+/* Much larger than could ever be allocated. */
+#define MAX_FILTERS 48
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HAVE_ATOMIC_BUILTINS 1
+#else
+#define HAVE_ATOMIC_BUILTINS 0
+#endif
 
 #define LOG_BLOOM 0
 
+struct bloom_block {
+    uint64_t words[BLOCK_WORDS];
+};
+
 struct bloom_filter {
-    struct bloom_filter *next;
-    uint8_t size2;              /* log2 of bit count */
-    uint8_t bits[];
+    void *alloc;                /* unaligned allocation, for free(3) */
+    struct bloom_block *blocks; /* aligned to BLOCK_SIZE */
+    uint8_t size2;              /* log2 of block count */
+    uint64_t set_bits;
 };
 
 struct theft_bloom {
-    const uint8_t top_block2;
     const uint8_t min_filter2;
-    /* These start as NULL and are lazily allocated.
-     * Each block is a linked list of bloom filters, with successively
-     * larger filters appended at the front as the filters fill up. */
-    struct bloom_filter *blocks[];
+    const uint8_t max_filter2;
+    uint8_t count;              /* filters in use, oldest first */
+    bool saturated;
+    uint64_t marked;
+    struct bloom_filter filters[MAX_FILTERS];
+};
+
+/* A shared filter is a single flat filter, in memory mapped with
+ * MAP_SHARED, so it can't grow. Words are only read and updated
+ * with atomic operations, and bits are never cleared, so checking
+ * needs no lock. Unlike the private filters, all of a key's bits are
+ * in one word of its block, so checking and marking is a single
+ * fetch-or: of any callers marking the same key at the same moment,
+ * only the one whose update sets the missing bits sees it as new.
+ * This costs a somewhat higher false positive rate. */
+struct theft_shared_dedup {
+    struct bloom_block *blocks; /* mapped, so page-aligned */
+    uint8_t size2;              /* log2 of block count */
+    uint64_t *marked;           /* in its own block, after the filter */
 };
 
-static struct theft_bloom_config def_config = { .top_block_bits = 0 };
+static struct theft_bloom_config def_config = { .min_filter_bits = 0 };
+
+static bool alloc_filter(struct bloom_filter *bf, uint8_t size2);
+static size_t shared_map_size(uint8_t size2);
 
-/* Initialize a dynamic blocked bloom filter. */
+/* Initialize a flat, blocked bloom filter. */
 struct theft_bloom *theft_bloom_init(const struct theft_bloom_config *config) {
 #define DEF(X, DEFAULT) (X ? X : DEFAULT)
     config = DEF(config, &def_config);
-    const uint8_t top_block2 = DEF(config->top_block_bits, DEF_TOP_BLOCK_BITS);
     const uint8_t min_filter2 = DEF(config->min_filter_bits, DEF_MIN_FILTER_BITS);
+    const uint8_t max_filter2 = DEF(config->max_filter_bits, UINT8_MAX);
 #undef DEF
 
-    const size_t top_block_count = (1LLU << top_block2);
-    const size_t alloc_size = sizeof(struct theft_bloom) +
-      top_block_count * sizeof(struct bloom_filter *);
-
-    struct theft_bloom *res = malloc(alloc_size);
+    struct theft_bloom *res = malloc(sizeof(*res));
     if (res == NULL) {
         return NULL;
     }
-    memset(&res->blocks, 0x00, top_block_count * sizeof(struct bloom_filter *));
 
     struct theft_bloom b = {
-        .top_block2 = top_block2,
         .min_filter2 = min_filter2,
+        .max_filter2 = max_filter2,
+        .count = 1,
     };
     memcpy(res, &b, sizeof(b));
+
+    if (!alloc_filter(&res->filters[0], min_filter2)) {
+        free(res);
+        return NULL;
+    }
     return res;
 }
 
-static struct bloom_filter *
-alloc_filter(uint8_t bits) {
-    const size_t alloc_size = sizeof(struct bloom_filter)
-      + ((1LLU << bits) / 8);
-    struct bloom_filter *bf = malloc(alloc_size);
-    if (bf != NULL) {
-        memset(bf, 0x00, alloc_size);
-        bf->size2 = bits;
-        LOG(4 - LOG_BLOOM, "%s: %p [size2 %u (%zd bytes)]\n",
-            __func__, (void *)bf, bf->size2, (size_t)((1LLU << bf->size2) / 8));
+static bool
+alloc_filter(struct bloom_filter *bf, uint8_t size2) {
+    const size_t size = (1LLU << size2) * BLOCK_SIZE;
+    /* Over-allocate so the blocks can be aligned to cache lines. */
+    void *alloc = calloc(1, size + BLOCK_SIZE - 1);
+    if (alloc == NULL) {
+        return false;
     }
-    return bf;
+    const uintptr_t aligned = ((uintptr_t)alloc + BLOCK_SIZE - 1)
+        & ~(uintptr_t)(BLOCK_SIZE - 1);
+
+    struct bloom_filter nbf = {
+        .alloc = alloc,
+        .blocks = (struct bloom_block *)aligned,
+        .size2 = size2,
+    };
+    memcpy(bf, &nbf, sizeof(nbf));
+    LOG(4 - LOG_BLOOM, "%s: %p [size2 %u (%zd bytes)]\n",
+        __func__, (void *)bf->blocks, bf->size2, size);
+    return true;
 }
 
-/* Hash data and mark it in the bloom filter. */
-bool theft_bloom_mark(struct theft_bloom *b, uint8_t *data, size_t data_size) {
-    uint64_t hash = theft_hash_onepass(data, data_size);
-    const size_t top_block_count = (1LLU << b->top_block2);
-    LOG(3 - LOG_BLOOM,
-        "%s: overall hash: 0x%016" PRIx64 "\n", __func__, hash);
+/* Set one bit in each word of the block, chosen by the hash. */
+static void
+get_mask(uint64_t hash, struct bloom_block *mask) {
+    for (size_t i = 0; i < BLOCK_WORDS; i++) {
+        mask->words[i] = 1LLU << ((hash >> (6*i)) & 0x3f);
+    }
+}
 
-    const uint64_t top_block_mask = top_block_count - 1;
-    const size_t block_id = hash & top_block_mask;
-    LOG(3 - LOG_BLOOM, "%s: block_id %zd\n", __func__, block_id);
+static struct bloom_block *
+get_block(const struct bloom_filter *bf, uint64_t hash) {
+    const uint64_t block_mask = (1LLU << bf->size2) - 1;
+    return &bf->blocks[hash & block_mask];
+}
 
-    struct bloom_filter *bf = b->blocks[block_id];
-    if (bf == NULL) {           /* lazily allocate */
-        bf = alloc_filter(b->min_filter2);
-        if (bf == NULL) {
-            return false;       /* alloc fail */
-        }
-        b->blocks[block_id] = bf;
+/* Are all the bits in the mask set in the block? */
+static bool
+block_has_all(const struct bloom_block *block,
+        const struct bloom_block *mask) {
+#if defined(__AVX2__)
+    const __m256i *bw = (const __m256i *)block->words;
+    const __m256i *mw = (const __m256i *)mask->words;
+    const __m256i miss = _mm256_or_si256(
+        _mm256_andnot_si256(_mm256_load_si256(&bw[0]),
+            _mm256_loadu_si256(&mw[0])),
+        _mm256_andnot_si256(_mm256_load_si256(&bw[1]),
+            _mm256_loadu_si256(&mw[1])));
+    return _mm256_testz_si256(miss, miss);
+#elif defined(__SSE2__)
+    const __m128i *bw = (const __m128i *)block->words;
+    const __m128i *mw = (const __m128i *)mask->words;
+    __m128i miss = _mm_setzero_si128();
+    for (size_t i = 0; i < BLOCK_WORDS/2; i++) {
+        miss = _mm_or_si128(miss,
+            _mm_andnot_si128(_mm_load_si128(&bw[i]),
+                _mm_loadu_si128(&mw[i])));
+    }
+    return 0xFFFF == _mm_movemask_epi8(
+        _mm_cmpeq_epi32(miss, _mm_setzero_si128()));
+#else
+    uint64_t miss = 0;
+    for (size_t i = 0; i < BLOCK_WORDS; i++) {
+        miss |= mask->words[i] &~ block->words[i];
     }
+    return miss == 0;
+#endif
+}
 
-    /* Must be able to do all checks with one 64 bit hash.
-     * In order to relax this restriction, theft's hashing
-     * code will need to be restructured to give the bloom
-     * filter code two independent hashes. */
-    assert(64 - b->top_block2 - (HASH_COUNT * bf->size2) > 0);
-    hash >>= b->top_block2;
-
-    const uint8_t block_size2 = bf->size2;
-    const uint64_t block_mask = (1LLU << block_size2) - 1;
-    bool any_set = false;
-
-    /* Only mark in the front filter. */
-    for (size_t i = 0; i < HASH_COUNT; i++) {
-        const uint64_t v = (hash >> (i*block_size2)) & block_mask;
-        const uint64_t offset = v / 8;
-        const uint8_t bit = 1 << (v & 0x07);
-        LOG(4 - LOG_BLOOM,
-            "%s: marking %p @ %" PRIu64 " =>  offset %" PRIu64
-            ", bit 0x%02x\n",
-            __func__, (void *)bf, v, offset, bit);
-        if (0 == (bf->bits[offset] & bit)) {
-            any_set = true;
-        }
-        bf->bits[offset] |= bit;
+/* Mark a 128-bit key in the bloom filter. */
+bool theft_bloom_mark(struct theft_bloom *b, struct theft_hash128 key) {
+    LOG(3 - LOG_BLOOM,
+        "%s: key: 0x%016" PRIx64 "%016" PRIx64 "\n",
+        __func__, key.hi, key.lo);
+
+    /* Only mark in the newest filter. */
+    struct bloom_filter *bf = &b->filters[b->count - 1];
+    struct bloom_block *block = get_block(bf, key.lo);
+    struct bloom_block mask;
+    get_mask(key.hi, &mask);
+
+    uint8_t new_bits = 0;
+    for (size_t i = 0; i < BLOCK_WORDS; i++) {
+        new_bits += theft_bits_popcount(mask.words[i] &~ block->words[i]);
+        block->words[i] |= mask.words[i];
     }
+    bf->set_bits += new_bits;
+    b->marked++;
+    LOG(4 - LOG_BLOOM, "%s: marked %p, %u new bits\n",
+        __func__, (void *)block, new_bits);
 
-    /* If all bits were already set, prepend a new, empty filter -- the
-     * previous filter will still match when checking, but there will be
-     * a reduced chance of false positives for new entries. */
-    if (!any_set) {
-        if (b->top_block2 + HASH_COUNT * (bf->size2 + 1) > 64) {
-            /* We can't grow this hash chain any further with the
-             * hash bits available. */
-            LOG(0, "%s: Warning: bloom filter block %zd cannot grow further!\n",
-                __func__, block_id);
+    /* If the newest filter is too full, append a new, empty filter --
+     * the previous filters will still match when checking, but there
+     * will be a reduced chance of false positives for new entries. */
+    const uint64_t bit_count = (1LLU << bf->size2) * BLOCK_SIZE * 8;
+    if (MAX_FILL_DEN * bf->set_bits > MAX_FILL_NUM * bit_count
+        && !b->saturated) {
+        LOG(3 - LOG_BLOOM, "%s: growing bloom filter -- size2 %u\n",
+            __func__, bf->size2 + 1);
+        if (b->count == MAX_FILTERS || bf->size2 >= b->max_filter2
+            || !alloc_filter(&b->filters[b->count], bf->size2 + 1)) {
+            LOG(2 - LOG_BLOOM, "%s: saturated after %" PRIu64 " keys\n",
+                __func__, b->marked);
+            b->saturated = true;
         } else {
-            struct bloom_filter *nbf = alloc_filter(bf->size2 + 1);
-            LOG(3 - LOG_BLOOM, "%s: growing bloom filter -- bits %u, nbf %p\n",
-                __func__, bf->size2 + 1, (void *)nbf);
-            if (nbf == NULL) {
-                return false;       /* alloc fail */
-            }
-            nbf->next = bf;
-            b->blocks[block_id] = nbf; /* append to front */
+            b->count++;
         }
     }
 
-    return true;
+    return !b->saturated;
 }
 
-/* Check whether the data's hash is in the bloom filter. */
-bool theft_bloom_check(struct theft_bloom *b, uint8_t *data, size_t data_size) {
-    uint64_t hash = theft_hash_onepass(data, data_size);
+/* Check whether the key is in the bloom filter. */
+bool theft_bloom_check(struct theft_bloom *b, struct theft_hash128 key) {
     LOG(3 - LOG_BLOOM,
-        "%s: overall hash: 0x%016" PRIx64 "\n", __func__, hash);
-    const size_t top_block_count = (1LLU << b->top_block2);
-    const uint64_t top_block_mask = top_block_count - 1;
-    const size_t block_id = hash & top_block_mask;
-    LOG(3 - LOG_BLOOM, "%s: block_id %zd\n", __func__, block_id);
-
-    struct bloom_filter *bf = b->blocks[block_id];
-    if (bf == NULL) {
-        return false;           /* block not allocated: no bits set */
-    }
+        "%s: key: 0x%016" PRIx64 "%016" PRIx64 "\n",
+        __func__, key.hi, key.lo);
 
-    hash >>= b->top_block2;
-
-    /* Check every block */
-    while (bf != NULL) {
-        const uint8_t block_size2 = bf->size2;
-        const uint64_t block_mask = (1LLU << block_size2) - 1;
-
-        bool hit_all_in_block = true;
-        for (size_t i = 0; i < HASH_COUNT; i++) {
-            const uint64_t v = (hash >> (i * block_size2)) & block_mask;
-            const uint64_t offset = v / 8;
-            const uint8_t bit = 1 << (v & 0x07);
-            LOG(4 - LOG_BLOOM,
-                "%s: checking %p (bits %u) @ %" PRIu64 " => offset %" PRIu64
-                ", bit 0x%02x: 0x%02x\n",
-                __func__, (void *)bf, block_size2, v, offset, bit,
-                (bf->bits[offset] & bit));
-            if (0 == (bf->bits[offset] & bit)) {
-                hit_all_in_block = false;
-                break;
-            }
-        }
-        if (hit_all_in_block) {
+    struct bloom_block mask;
+    get_mask(key.hi, &mask);
+
+    /* Check every filter, newest first. */
+    for (size_t i = b->count; i > 0; i--) {
+        const struct bloom_filter *bf = &b->filters[i - 1];
+        if (block_has_all(get_block(bf, key.lo), &mask)) {
+            LOG(4 - LOG_BLOOM, "%s: hit in filter %zd\n", __func__, i - 1);
             return true;
         }
-        bf = bf->next;
     }
 
-    return false; /* there wasn't any block with all checked bits set */
+    return false; /* there wasn't any filter with all checked bits set */
 }
 
-/* Free the bloom filter. */
-void theft_bloom_free(struct theft_bloom *b) {
-    const size_t top_block_count = (1LLU << b->top_block2);
-    uint8_t max_length = 0;
-    for (size_t i = 0; i < top_block_count; i++) {
-        uint8_t length = 0;
-        struct bloom_filter *bf = b->blocks[i];
-        while (bf != NULL) {
-            struct bloom_filter *next = bf->next;
-            free(bf);
-            bf = next;
-            length++;
+/* Get the bloom filter's current size and estimated accuracy.
+ * The false positive rate assumes bits are set uniformly, so
+ * each filter's rate is (fill)^8. */
+void theft_bloom_stats(const struct theft_bloom *b,
+        struct theft_bloom_stats *stats) {
+    assert(stats);
+    size_t memory = sizeof(*b);
+    double pass_all = 1.0;      /* chance a new key misses every filter */
+    double fill = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        const struct bloom_filter *bf = &b->filters[i];
+        const size_t size = (1LLU << bf->size2) * BLOCK_SIZE;
+        memory += size + BLOCK_SIZE - 1;
+        fill = bf->set_bits / (8.0 * size);
+        double fpr = 1.0;
+        for (size_t w = 0; w < BLOCK_WORDS; w++) { fpr *= fill; }
+        pass_all *= (1.0 - fpr);
+    }
+
+    struct theft_bloom_stats res = {
+        .memory = memory,
+        .marked = b->marked,
+        .depth = b->count,
+        .fill = fill,
+        .fpr = 1.0 - pass_all,
+        .saturated = b->saturated,
+    };
+    memcpy(stats, &res, sizeof(res));
+}
+
+static uint64_t
+atomic_load_word(const uint64_t *word) {
+#if HAVE_ATOMIC_BUILTINS
+    return __atomic_load_n(word, __ATOMIC_RELAXED);
+#else
+    return *(const volatile uint64_t *)word;
+#endif
+}
+
+/* Set BITS in WORD, returning its previous value. Without atomic
+ * builtins, this is only safe in one thread. */
+static uint64_t
+atomic_fetch_or_word(uint64_t *word, uint64_t bits) {
+#if HAVE_ATOMIC_BUILTINS
+    return __atomic_fetch_or(word, bits, __ATOMIC_RELAXED);
+#else
+    const uint64_t prev = *word;
+    *word = prev | bits;
+    return prev;
+#endif
+}
+
+/* Add N to WORD. Without atomic builtins, this is only safe in one
+ * thread. */
+static void
+atomic_add_word(uint64_t *word, uint64_t n) {
+#if HAVE_ATOMIC_BUILTINS
+    (void)__atomic_fetch_add(word, n, __ATOMIC_RELAXED);
+#else
+    *word += n;
+#endif
+}
+
+static size_t
+shared_map_size(uint8_t size2) {
+    return ((1LLU << size2) + 1) * BLOCK_SIZE;
+}
+
+struct theft_shared_dedup *theft_bloom_shared_init(size_t size) {
+    uint8_t size2 = 0;
+    while ((2LLU << size2) * BLOCK_SIZE <= size) { size2++; }
+
+    struct theft_shared_dedup *res = malloc(sizeof(*res));
+    if (res == NULL) {
+        return NULL;
+    }
+    void *blocks = mmap(NULL, shared_map_size(size2),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (blocks == MAP_FAILED) {
+        free(res);
+        return NULL;
+    }
+
+    res->blocks = (struct bloom_block *)blocks;
+    res->size2 = size2;
+    res->marked = &res->blocks[1LLU << size2].words[0];
+    LOG(4 - LOG_BLOOM, "%s: %p [size2 %u]\n",
+        __func__, (void *)res->blocks, res->size2);
+    return res;
+}
+
+/* Get the word in B that holds KEY's bits, and the bits. */
+static uint64_t *
+get_shared_word(const struct theft_shared_dedup *b,
+        struct theft_hash128 key, uint64_t *mask) {
+    struct bloom_block *block =
+        &b->blocks[key.lo & ((1LLU << b->size2) - 1)];
+    uint64_t bits = 0;
+    for (size_t i = 0; i < BLOCK_WORDS; i++) {
+        bits |= 1LLU << ((key.hi >> (6*i)) & 0x3f);
+    }
+    *mask = bits;
+    return &block->words[(key.hi >> (6*BLOCK_WORDS)) % BLOCK_WORDS];
+}
+
+bool theft_bloom_shared_check(const struct theft_shared_dedup *b,
+        struct theft_hash128 key) {
+    uint64_t mask;
+    const uint64_t *word = get_shared_word(b, key, &mask);
+    return (mask &~ atomic_load_word(word)) == 0;
+}
+
+bool theft_bloom_shared_check_and_mark(struct theft_shared_dedup *b,
+        struct theft_hash128 key) {
+    LOG(3 - LOG_BLOOM,
+        "%s: key: 0x%016" PRIx64 "%016" PRIx64 "\n",
+        __func__, key.hi, key.lo);
+
+    uint64_t mask;
+    uint64_t *word = get_shared_word(b, key, &mask);
+
+    /* Only write if a bit is missing, so checking an already-marked
+     * key doesn't make other CPUs' copies of the cache line stale. */
+    if ((mask &~ atomic_load_word(word)) == 0) { return true; }
+    const uint64_t prev = atomic_fetch_or_word(word, mask);
+    if ((mask &~ prev) == 0) { return true; }
+    atomic_add_word(b->marked, 1);
+    return false;
+}
+
+/* Each key's bits are in one word, so the false positive rate is
+ * estimated per word, as (fill)^8, and averaged. */
+void theft_bloom_shared_stats(const struct theft_shared_dedup *b,
+        struct theft_bloom_stats *stats) {
+    assert(stats);
+    const size_t words = (1LLU << b->size2) * BLOCK_WORDS;
+    uint64_t set_bits = 0;
+    double fpr_sum = 0;
+    for (size_t i = 0; i < (1LLU << b->size2); i++) {
+        for (size_t w = 0; w < BLOCK_WORDS; w++) {
+            const uint8_t bits = theft_bits_popcount(
+                atomic_load_word(&b->blocks[i].words[w]));
+            set_bits += bits;
+            const double fill = bits / 64.0;
+            double fpr = 1.0;
+            for (size_t k = 0; k < BLOCK_WORDS; k++) { fpr *= fill; }
+            fpr_sum += fpr;
         }
-        LOG(3 - LOG_BLOOM,
-            "%s: block %zd, length %u\n", __func__, i, length);
-        max_length = (length > max_length ? length : max_length);
     }
+
+    struct theft_bloom_stats res = {
+        .memory = sizeof(*b) + shared_map_size(b->size2),
+        .marked = atomic_load_word(b->marked),
+        .depth = 1,
+        .fill = set_bits / (64.0 * words),
+        .fpr = fpr_sum / words,
+    };
+    memcpy(stats, &res, sizeof(res));
+}
+
+void theft_bloom_shared_free(struct theft_shared_dedup *b) {
+    munmap(b->blocks, shared_map_size(b->size2));
+    free(b);
+}
+
+/* Free the bloom filter. */
+void theft_bloom_free(struct theft_bloom *b) {
+    struct theft_bloom_stats stats;
+    theft_bloom_stats(b, &stats);
     LOG(3 - LOG_BLOOM,
-        "%s: %zd blocks, max length %u\n", __func__, top_block_count, max_length);
+        "%s: %" PRIu64 " marked, %zd bytes, depth %u, fill %g, fpr %g\n",
+        __func__, stats.marked, stats.memory, stats.depth,
+        stats.fill, stats.fpr);
+
+    for (size_t i = 0; i < b->count; i++) {
+        free(b->filters[i].alloc);
+    }
     free(b);
 }
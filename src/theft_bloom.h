@@ -5,24 +5,71 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "theft.h"
+
 /* Opaque type for bloom filter. */
 struct theft_bloom;
 
 struct theft_bloom_config {
-    uint8_t top_block_bits;
+    /* log2 of the number of 64-byte blocks in the first filter. */
     uint8_t min_filter_bits;
+    /* log2 of the number of blocks in the largest filter, after which
+     * the bloom filter is considered saturated. (0: no limit) */
+    uint8_t max_filter_bits;
 };
 
 /* Initialize a bloom filter. */
 struct theft_bloom *theft_bloom_init(const struct theft_bloom_config *config);
 
-/* Hash data and mark it in the bloom filter. */
-bool theft_bloom_mark(struct theft_bloom *b, uint8_t *data, size_t data_size);
+/* Mark a 128-bit key in the bloom filter. Returns false if the
+ * filter is saturated, i.e., could not grow to keep its false
+ * positive rate down. */
+bool theft_bloom_mark(struct theft_bloom *b, struct theft_hash128 key);
+
+/* Check whether the key is in the bloom filter. */
+bool theft_bloom_check(struct theft_bloom *b, struct theft_hash128 key);
 
-/* Check whether the data's hash is in the bloom filter. */
-bool theft_bloom_check(struct theft_bloom *b, uint8_t *data, size_t data_size);
+struct theft_bloom_stats {
+    size_t memory;              /* bytes allocated */
+    uint64_t marked;            /* number of keys marked */
+    uint8_t depth;              /* filters checked for a new key */
+    double fill;                /* fraction of bits set, newest filter */
+    double fpr;                 /* estimated false positive rate */
+    bool saturated;             /* failed to grow */
+};
+
+/* Get the bloom filter's current size and estimated accuracy. */
+void theft_bloom_stats(const struct theft_bloom *b,
+    struct theft_bloom_stats *stats);
 
 /* Free the bloom filter. */
 void theft_bloom_free(struct theft_bloom *b);
 
+/* A fixed-size bloom filter in shared memory, which can be used by
+ * several threads, and by processes forked after it's allocated, at
+ * once. (This is the public `struct theft_shared_dedup`.) */
+struct theft_shared_dedup;
+
+/* Allocate a shared bloom filter of at most SIZE bytes (but at least
+ * one block), plus a block for its count of marked keys, or NULL on
+ * error. */
+struct theft_shared_dedup *theft_bloom_shared_init(size_t size);
+
+/* Check whether the key is in the shared bloom filter. */
+bool theft_bloom_shared_check(const struct theft_shared_dedup *b,
+    struct theft_hash128 key);
+
+/* Mark a 128-bit key in the shared bloom filter, returning whether it
+ * was already there. */
+bool theft_bloom_shared_check_and_mark(struct theft_shared_dedup *b,
+    struct theft_hash128 key);
+
+/* Get the shared bloom filter's size and estimated accuracy. This
+ * reads the whole filter. */
+void theft_bloom_shared_stats(const struct theft_shared_dedup *b,
+    struct theft_bloom_stats *stats);
+
+/* Unmap and free the shared bloom filter. */
+void theft_bloom_shared_free(struct theft_shared_dedup *b);
+
 #endif
@@ -1,13 +1,34 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE     /* for syscall(2), wait4(2), MAP_ANONYMOUS,
+                             * pread(2), ftruncate(2) */
+#endif
+
 #include "theft_call_internal.h"
 #include "theft_autoshrink.h"
+#include "theft_zygote.h"
+#include "theft_deadline.h"
+#include "theft_checkpoint.h"
+#include "theft_sched.h"
+#include "theft_shrink_queue.h"
 
 #include <time.h>
-#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/signalfd.h>
+#endif
 
 #define LOG_CALL 0
 
 #define MAX_FORK_RETRIES 10
 #define DEF_KILL_SIGNAL SIGTERM
+#define KILL_TIME_MSEC 10       /* time to exit after SIGKILL */
 
 /* Actually call the property function. Its number of arguments is not
  * constrained by the typedef, but will be defined at the call site
@@ -16,186 +37,836 @@ enum theft_trial_res
 theft_call(struct theft *t, void **args) {
     enum theft_trial_res res = THEFT_TRIAL_ERROR;
 
-    if (t->fork.enable) {
-        struct timespec tv = { .tv_nsec = 1 };
-        if (-1 == pipe(t->workers[0].fds)) { return THEFT_TRIAL_ERROR; }
-
-        pid_t pid = -1;
-        for (;;) {
-            pid = fork();
-            if (pid == -1) {
-                if (errno == EAGAIN) {
-                    /* If we get EAGAIN, then wait for terminated
-                     * child processes a chance to clean up -- forking
-                     * is probably failing due to RLIMIT_NPROC. */
-                    const int fork_errno = errno;
-                    if (!step_waitpid(t)) { return THEFT_TRIAL_ERROR; }
-                    if (-1 == nanosleep(&tv, NULL)) {
-                        perror("nanosleep");
-                        return THEFT_TRIAL_ERROR;
-                    }
-                    if (tv.tv_nsec >= (1L << MAX_FORK_RETRIES)) {
-                        errno = fork_errno;
-                        perror("fork");
-                        return THEFT_TRIAL_ERROR;
-                    }
-                    errno = 0;
-                    tv.tv_nsec <<= 1;
-                    continue;
-                } else {
-                    perror("fork");
-                    return THEFT_TRIAL_ERROR;
-                }
-            } else {
-                break;
-            }
+    if (theft_call_forking(t)) {
+        struct worker_info *worker = theft_call_idle_worker(t);
+        assert(worker != NULL);
+        if (!theft_call_start(t, worker, args)) {
+            return THEFT_TRIAL_ERROR;
         }
 
-        if (pid == -1) {
-            close(t->workers[0].fds[0]);
-            close(t->workers[0].fds[1]);
-            return THEFT_TRIAL_ERROR;
-        } else if (pid == 0) {  /* child */
-            close(t->workers[0].fds[0]);
-            int out_fd = t->workers[0].fds[1];
-            if (run_fork_post_hook(t, args) == THEFT_HOOK_FORK_POST_ERROR) {
-                uint8_t byte = (uint8_t)THEFT_TRIAL_ERROR;
-                ssize_t wr = write(out_fd, (const void *)&byte, sizeof(byte));
-                (void)wr;
-                exit(EXIT_FAILURE);
-            }
-            res = theft_call_inner(t, args);
-            uint8_t byte = (uint8_t)res;
-            ssize_t wr = write(out_fd, (const void *)&byte, sizeof(byte));
-            exit(wr == 1 && res == THEFT_TRIAL_PASS
-                ? EXIT_SUCCESS
-                : EXIT_FAILURE);
-        } else {                /* parent */
-            close(t->workers[0].fds[1]);
-            t->workers[0].pid = pid;
-
-            t->workers[0].state = WS_ACTIVE;
-            res = parent_handle_child_call(t, pid, &t->workers[0]);
-            close(t->workers[0].fds[0]);
-            t->workers[0].state = WS_INACTIVE;
-
-            if (!step_waitpid(t)) { return THEFT_TRIAL_ERROR; }
-            return res;
+        res = parent_handle_child_call(t, worker);
+        if (!reap_worker(t, worker)) { return THEFT_TRIAL_ERROR; }
+        t->last_report = &worker->reports[0];
+        t->last_rusage = &worker->rusage;
+        if (res == THEFT_TRIAL_FAIL) {
+            theft_call_save_output(t, worker, 0, &t->trial);
         }
+        theft_checkpoint_collect(t);
+        return res;
     } else {                    /* just call */
+        /* A background shrinker can run while this does. */
+        theft_shrink_queue_unlock(t);
         res = theft_call_inner(t, args);
+        theft_shrink_queue_lock(t);
     }
     return res;
 }
 
-static enum theft_trial_res
-parent_handle_child_call(struct theft *t, pid_t pid, struct worker_info *worker) {
-    const int fd = worker->fds[0];
-    struct pollfd pfd[1] = {
-        { .fd = fd, .events = POLLIN },
-    };
-    const int timeout = t->fork.timeout;
-    int res = 0;
-    for (;;) {
-        struct timeval tv_pre = { 0, 0 };
-        gettimeofday(&tv_pre, NULL);
-        res = poll(pfd, 1, (timeout == 0 ? -1 : timeout));
-        struct timeval tv_post = { 0, 0 };
-        gettimeofday(&tv_post, NULL);
-
-        const size_t delta = 1000*tv_post.tv_sec - 1000*tv_pre.tv_sec +
-          ((tv_post.tv_usec / 1000) - (tv_pre.tv_usec / 1000));
-        LOG(3 - LOG_CALL,"%s: POLL res %d, elapsed %zd\n",
-            __func__, res, delta);
-        (void)delta;
+/* Are calls to the property function currently made in a forked
+ * worker process? A supervised run only forks to re-run a trial that
+ * crashed. */
+bool
+theft_call_forking(const struct theft *t) {
+    return t->fork.enable && !t->supervise.unforked;
+}
 
-        if (res == -1) {
+/* Get a worker that isn't currently running a trial, or NULL. */
+struct worker_info *
+theft_call_idle_worker(struct theft *t) {
+    for (size_t i = 0; i < t->worker_count; i++) {
+        if (t->workers[i].state == WS_INACTIVE) {
+            return &t->workers[i];
+        }
+    }
+    return NULL;
+}
+
+/* How many workers are currently running a trial, or have exited
+ * but still have a result waiting to be read? */
+size_t
+theft_call_active_workers(struct theft *t) {
+    size_t count = 0;
+    for (size_t i = 0; i < t->worker_count; i++) {
+        if (t->workers[i].state != WS_INACTIVE) { count++; }
+    }
+    return count;
+}
+
+/* Fork a worker process to call the property function with ARGS,
+ * but don't wait for its result. */
+bool
+theft_call_start(struct theft *t, struct worker_info *worker,
+        void **args) {
+    return theft_call_start_batch(t, worker, 1, single_trial_cb, args);
+}
+
+/* Fork a worker process to run COUNT trials in sequence, writing
+ * a result byte for each, but don't wait for any of them. */
+bool
+theft_call_start_batch(struct theft *t, struct worker_info *worker,
+        size_t count, theft_call_batch_cb *cb, void *udata) {
+    struct timespec tv = { .tv_nsec = 1 };
+    assert(count > 0);
+    assert(count <= t->fork.trials_per_child);
+    if (-1 == pipe(worker->fds)) { return false; }
+    worker->batch_count = count;
+    worker->batch_done = 0;
+    memset(worker->reports, 0x00, count * sizeof(worker->reports[0]));
+    memset(&worker->rusage, 0x00, sizeof(worker->rusage));
+    if (t->outputs != NULL) {
+        memset(worker->outputs, 0x00, count * sizeof(worker->outputs[0]));
+        if (!reset_capture_file(worker->output_fd)) {
+            close(worker->fds[0]);
+            close(worker->fds[1]);
+            return false;
+        }
+        /* Anything still buffered would otherwise be written again
+         * by the worker, into its captured output. */
+        fflush(NULL);
+    }
+
+    /* While shrinking, resume from a matching checkpoint, if any. */
+    if (count == 1 && theft_checkpoint_resume(t, worker)) {
+        close(worker->fds[1]);
+        worker->state = WS_ACTIVE;
+        get_time(&worker->start);
+        return true;
+    }
+
+    /* If there's a fork server, have it start the worker instead. */
+    if (t->zygote.pid != -1) {
+        bool ok = theft_zygote_call_start(t, worker, count, cb, udata);
+        close(worker->fds[1]);
+        if (!ok) {
+            close(worker->fds[0]);
+            return false;
+        }
+        worker->state = WS_ACTIVE;
+        get_time(&worker->start);
+        return true;
+    }
+
+    pid_t pid = -1;
+    for (;;) {
+        pid = fork();
+        if (pid == -1) {
             if (errno == EAGAIN) {
+                /* If we get EAGAIN, then wait for terminated
+                 * child processes a chance to clean up -- forking
+                 * is probably failing due to RLIMIT_NPROC. */
+                const int fork_errno = errno;
+                if (!step_waitpid(t)) { break; }
+                if (-1 == nanosleep(&tv, NULL)) {
+                    perror("nanosleep");
+                    break;
+                }
+                if (tv.tv_nsec >= (1L << MAX_FORK_RETRIES)) {
+                    errno = fork_errno;
+                    perror("fork");
+                    break;
+                }
                 errno = 0;
-                continue;
-            } else if (errno == EINTR) {
-                errno = 0;
+                tv.tv_nsec <<= 1;
                 continue;
             } else {
-                return THEFT_TRIAL_ERROR;
+                perror("fork");
+                break;
             }
         } else {
             break;
         }
     }
 
-    if (res == 0) {     /* timeout */
-        int kill_signal = t->fork.signal;
-        if (kill_signal == 0) {
-            kill_signal = DEF_KILL_SIGNAL;
+    if (pid == -1) {
+        close(worker->fds[0]);
+        close(worker->fds[1]);
+        return false;
+    } else if (pid == 0) {  /* child */
+        close(worker->fds[0]);
+        theft_call_run_batch(t, worker, count, cb, udata, worker->fds[1]);
+        return false;           /* not reached */
+    } else {                /* parent */
+        close(worker->fds[1]);
+        worker->pid = pid;
+        worker->state = WS_ACTIVE;
+        get_time(&worker->start);
+        return true;
+    }
+}
+
+/* In a worker process: for each of the COUNT trials, run the
+ * fork_post hook and the property function, fill in its report, and
+ * write the result to OUT_FD. Then exit, successfully only if every
+ * trial passed. */
+void
+theft_call_run_batch(struct theft *t, struct worker_info *worker,
+        size_t count, theft_call_batch_cb *cb, void *udata, int out_fd) {
+    bool all_passed = true;
+    theft_checkpoint_enter_worker(t, worker - t->workers, out_fd);
+    bool limits_ok = (theft_sched_enter_worker(t, worker - t->workers)
+        && set_rlimits(t));
+    const bool capture = (t->outputs != NULL);
+    if (capture && !redirect_output(worker->output_fd)) {
+        limits_ok = false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        void *args[THEFT_MAX_ARITY];
+        cb(t, i, udata, args);
+
+        struct theft_fork_report *report = &worker->reports[i];
+        t->report = report;
+        struct rusage pre;
+        const bool have_usage = (0 == getrusage(RUSAGE_SELF, &pre));
+
+        /* The CPU limit is per trial, so move it past the CPU time
+         * used by earlier trials in the batch. */
+        if (limits_ok && t->fork.rlimit_cpu > 0) {
+            const uint64_t used_sec = (have_usage
+                ? (rusage_cpu_usec(&pre) + 999999) / 1000000 : 0);
+            limits_ok = set_soft_rlimit(RLIMIT_CPU,
+                (rlim_t)(used_sec + t->fork.rlimit_cpu));
         }
-        LOG(2 - LOG_CALL, "%s: kill(%d, %d)\n",
-            __func__, pid, kill_signal);
-        assert(pid != -1);      /* do not do this. */
-        if (-1 == kill(pid, kill_signal)) {
-            return THEFT_TRIAL_ERROR;
+
+        if (capture) {
+            worker->outputs[i].start = capture_offset(worker->output_fd);
         }
 
-        /* Check if kill's signal made the child process terminate (or
-         * if it exited successfully, and there was just a race on the
-         * timeout). If so, save its exit status.
-         *
-         * If it still hasn't exited after the exit_timeout, then
-         * send it SIGKILL and wait for _that_ to make it exit. */
-        const size_t kill_time = 10; /* time to exit after SIGKILL */
-        const size_t timeout_msec = (t->fork.exit_timeout == 0
-            ? THEFT_DEF_EXIT_TIMEOUT_MSEC
-            : t->fork.exit_timeout);
-
-        /* After sending the signal to the timed out process,
-         * give it timeout_msec to actually exit (in case a custom
-         * signal is triggering some sort of cleanup) before sending
-         * SIGKILL and waiting up to kill_time it to change state. */
-        if (!wait_for_exit(t, worker, timeout_msec, kill_time)) {
-            return THEFT_TRIAL_ERROR;
+        enum theft_trial_res res = THEFT_TRIAL_ERROR;
+        report->stage = THEFT_FORK_STAGE_FORK_POST;
+        if (limits_ok
+            && run_fork_post_hook(t, args) != THEFT_HOOK_FORK_POST_ERROR) {
+            report->stage = THEFT_FORK_STAGE_PROPERTY;
+            res = theft_call_inner(t, args);
+            report->stage = THEFT_FORK_STAGE_DONE;
+        }
+
+        struct rusage post;
+        if (have_usage && 0 == getrusage(RUSAGE_SELF, &post)) {
+            /* A worker resumed from a checkpoint is a new process,
+             * which started counting again from 0. */
+            const uint64_t pre_usec = rusage_cpu_usec(&pre);
+            const uint64_t post_usec = rusage_cpu_usec(&post);
+            report->cpu_usec = (post_usec >= pre_usec
+                ? post_usec - pre_usec : post_usec);
+#if defined(__APPLE__)
+            report->max_rss_kb = post.ru_maxrss / 1024; /* in bytes */
+#else
+            report->max_rss_kb = post.ru_maxrss;
+#endif
         }
+        t->report = NULL;
+        if (capture) {
+            finish_capture(t, worker->output_fd, &worker->outputs[i], res);
+        }
+
+        uint8_t byte = (uint8_t)res;
+        ssize_t wr = write(out_fd, (const void *)&byte, sizeof(byte));
+        if (wr != 1 || res == THEFT_TRIAL_ERROR) { exit(EXIT_FAILURE); }
+        if (res != THEFT_TRIAL_PASS) { all_passed = false; }
+    }
+    exit(all_passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static uint64_t
+rusage_cpu_usec(const struct rusage *ru) {
+    return 1000000LLU * (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec)
+        + ru->ru_utime.tv_usec + ru->ru_stime.tv_usec;
+}
+
+void
+theft_call_save_rusage(const struct rusage *ru,
+        struct theft_fork_rusage *out) {
+    out->utime_usec = 1000000LLU * ru->ru_utime.tv_sec + ru->ru_utime.tv_usec;
+    out->stime_usec = 1000000LLU * ru->ru_stime.tv_sec + ru->ru_stime.tv_usec;
+#if defined(__APPLE__)
+    out->max_rss_kb = ru->ru_maxrss / 1024; /* in bytes */
+#else
+    out->max_rss_kb = ru->ru_maxrss;
+#endif
+    out->minflt = ru->ru_minflt;
+    out->majflt = ru->ru_majflt;
+}
+
+/* In a worker process, apply the configured resource limits.
+ * The CPU limit is set before each trial. */
+static bool
+set_rlimits(struct theft *t) {
+    if (!t->fork.core_dumps && !set_soft_rlimit(RLIMIT_CORE, 0)) {
+        return false;
+    }
+    if (t->fork.rlimit_as > 0
+        && !set_soft_rlimit(RLIMIT_AS, (rlim_t)t->fork.rlimit_as)) {
+        return false;
+    }
+    if (t->fork.rlimit_nofile > 0
+        && !set_soft_rlimit(RLIMIT_NOFILE, (rlim_t)t->fork.rlimit_nofile)) {
+        return false;
+    }
+    return true;
+}
+
+/* Set RESOURCE's soft limit to LIMIT, but no higher than its hard
+ * limit, which can't be raised again without privileges. */
+static bool
+set_soft_rlimit(int resource, rlim_t limit) {
+    struct rlimit rl;
+    if (-1 == getrlimit(resource, &rl)) {
+        perror("getrlimit");
+        return false;
+    }
+    if (rl.rlim_max != RLIM_INFINITY && limit > rl.rlim_max) {
+        limit = rl.rlim_max;
+    }
+    rl.rlim_cur = limit;
+    if (-1 == setrlimit(resource, &rl)) {
+        perror("setrlimit");
+        return false;
+    }
+    return true;
+}
+
+/* Map memory shared with worker processes, for their reports, and
+ * open the files their output is captured in. This happens before
+ * the fork server (if any) is started, so workers it forks share
+ * them too. */
+bool
+theft_call_init_workers(struct theft *t) {
+    if (!t->fork.enable) { return true; }
+    const size_t per_worker = t->fork.trials_per_child;
+    const size_t entries = t->worker_count * per_worker;
+    void *p = mmap(NULL, entries * sizeof(*t->reports),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    t->reports = p;
+    for (size_t i = 0; i < t->worker_count; i++) {
+        t->workers[i].reports = &t->reports[i * per_worker];
+    }
+
+    if (!t->fork.capture_output) { return true; }
+    p = mmap(NULL, entries * sizeof(*t->outputs),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    t->outputs = p;
+    for (size_t i = 0; i < t->worker_count; i++) {
+        t->workers[i].outputs = &t->outputs[i * per_worker];
+        t->workers[i].output_fd = -1;
+    }
+    for (size_t i = 0; i < t->worker_count; i++) {
+        t->workers[i].output_fd = open_capture_file();
+        if (t->workers[i].output_fd == -1) { return false; }
+    }
+    return true;
+}
 
-        /* If the child still exited successfully, then consider it a
-         * PASS, even though it exceeded the timeout. */
-        if (worker->state == WS_STOPPED) {
-            const int st = worker->wstatus;
-            LOG(2 - LOG_CALL, "exited? %d, exit_status %d\n",
-                WIFEXITED(st), WEXITSTATUS(st));
-            if (WIFEXITED(st) && WEXITSTATUS(st) == EXIT_SUCCESS) {
-                return THEFT_TRIAL_PASS;
+void
+theft_call_free_workers(struct theft *t) {
+    const size_t entries = t->worker_count * t->fork.trials_per_child;
+    if (t->outputs != NULL) {
+        for (size_t i = 0; i < t->worker_count; i++) {
+            if (t->workers[i].output_fd != -1) {
+                close(t->workers[i].output_fd);
             }
         }
+        munmap(t->outputs, entries * sizeof(*t->outputs));
+        t->outputs = NULL;
+    }
+    if (t->reports != NULL) {
+        munmap(t->reports, entries * sizeof(*t->reports));
+        t->reports = NULL;
+    }
+}
 
-        return THEFT_TRIAL_FAIL;
-    } else {
-        /* As long as the result isn't a timeout, the worker can
-         * just be cleaned up by the next batch of waitpid()s. */
-        enum theft_trial_res trial_res = THEFT_TRIAL_ERROR;
-        uint8_t res_byte = 0xFF;
-        ssize_t rd = 0;
-        for (;;) {
-            rd = read(fd, &res_byte, sizeof(res_byte));
-            if (rd == -1) {
-                if (errno == EINTR) {
-                    errno = 0;
-                    continue;
+/* Open an anonymous file to capture a worker's output in. */
+static int
+open_capture_file(void) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+    int fd = (int)syscall(SYS_memfd_create, "theft_output", 0);
+    if (fd != -1) { return fd; }
+#endif
+    /* Otherwise, fall back on an unlinked temporary file. */
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        perror("tmpfile");
+        return -1;
+    }
+    int fd2 = dup(fileno(f));
+    if (fd2 == -1) { perror("dup"); }
+    fclose(f);
+    return fd2;
+}
+
+/* Empty a worker's capture file before starting a new batch. The
+ * file offset is shared with the worker, so rewind it too. */
+static bool
+reset_capture_file(int fd) {
+    if (-1 == ftruncate(fd, 0) || -1 == lseek(fd, 0, SEEK_SET)) {
+        perror("ftruncate");
+        return false;
+    }
+    return true;
+}
+
+/* In a worker process: send stdout and stderr to the capture file. */
+static bool
+redirect_output(int fd) {
+    if (-1 == dup2(fd, STDOUT_FILENO) || -1 == dup2(fd, STDERR_FILENO)) {
+        perror("dup2");
+        return false;
+    }
+    return true;
+}
+
+/* In a worker process: where the next output will be written. */
+static size_t
+capture_offset(int fd) {
+    fflush(stdout);
+    fflush(stderr);
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    return (offset == -1 ? 0 : (size_t)offset);
+}
+
+/* In a worker process, after a trial: drop its output if it passed,
+ * otherwise cut it down to the configured size, and note where it
+ * ends. */
+static void
+finish_capture(struct theft *t, int fd, struct worker_output *out,
+        enum theft_trial_res res) {
+    const size_t end = capture_offset(fd);
+    size_t total = (end > out->start ? end - out->start : 0);
+    size_t keep = total;
+    if (res == THEFT_TRIAL_PASS) {
+        keep = 0;
+    } else if (keep > t->fork.capture_max_bytes) {
+        keep = t->fork.capture_max_bytes;
+    }
+    if (keep < total) {
+        const off_t new_end = (off_t)(out->start + keep);
+        if (-1 == ftruncate(fd, new_end)
+            || -1 == lseek(fd, new_end, SEEK_SET)) {
+            keep = total;
+        }
+    }
+    out->end = out->start + keep;
+    out->total = total;
+    out->done = true;
+}
+
+/* Replace TRIAL's captured output with what WORKER's I'th trial
+ * wrote. If the worker didn't finish the trial (because it crashed
+ * or timed out), use everything after the trial's start. */
+void
+theft_call_save_output(struct theft *t, const struct worker_info *worker,
+        size_t i, struct trial_info *trial) {
+    if (t->outputs == NULL) { return; }
+    const struct worker_output *out = &worker->outputs[i];
+    size_t end = out->end;
+    size_t total = out->total;
+    if (!out->done) {
+        struct stat st;
+        if (-1 == fstat(worker->output_fd, &st)) { return; }
+        end = (size_t)st.st_size;
+        total = (end > out->start ? end - out->start : 0);
+    }
+
+    free(trial->output);
+    trial->output = NULL;
+    trial->output_size = 0;
+    trial->output_truncated = false;
+    if (end <= out->start) { return; }
+
+    size_t size = end - out->start;
+    if (size > t->fork.capture_max_bytes) {
+        size = t->fork.capture_max_bytes;
+    }
+    char *buf = malloc(size);
+    if (buf == NULL) { return; }
+    size_t rd_total = 0;
+    while (rd_total < size) {
+        ssize_t rd = pread(worker->output_fd, &buf[rd_total],
+            size - rd_total, (off_t)(out->start + rd_total));
+        if (rd == -1 && errno == EINTR) { continue; }
+        if (rd <= 0) { break; }
+        rd_total += (size_t)rd;
+    }
+    if (rd_total == 0) {
+        free(buf);
+        return;
+    }
+    trial->output = buf;
+    trial->output_size = rd_total;
+    trial->output_truncated = (total > rd_total);
+}
+
+bool
+theft_fork_report(struct theft *t, const void *data, size_t size) {
+    if (t->report == NULL || size > THEFT_FORK_REPORT_MAX) {
+        return false;
+    }
+    memcpy(t->report->data, data, size);
+    t->report->size = size;
+    return true;
+}
+
+static void
+single_trial_cb(struct theft *t, size_t i, void *udata, void **args) {
+    (void)i;
+    memcpy(args, udata, t->prop.arity * sizeof(void *));
+}
+
+/* Wait until any active worker has a result (or has timed out),
+ * and save which worker it was in *WORKER and the result in *RES.
+ * The result is for the worker's (worker->batch_done - 1)'th trial.
+ * Once it has finished its batch, or exited early, the worker is
+ * inactive, and ready to be started again. */
+bool
+theft_call_wait_any(struct theft *t, struct worker_info **worker,
+        enum theft_trial_res *res) {
+    return theft_call_wait_any_of(t, t->workers, t->worker_count,
+        worker, res);
+}
+
+/* Like theft_call_wait_any, but only for the COUNT workers starting
+ * at WORKERS, so that workers running other trials are left alone. */
+bool
+theft_call_wait_any_of(struct theft *t, struct worker_info *workers,
+        size_t worker_count, struct worker_info **worker,
+        enum theft_trial_res *res) {
+    struct pollfd pfds[worker_count];
+    struct worker_info *polled[worker_count];
+
+    const size_t timeout_msec = call_timeout(t);
+    for (;;) {
+        size_t count = 0;
+        int timeout = -1;
+        struct timespec now;
+        get_time(&now);
+
+        for (size_t i = 0; i < worker_count; i++) {
+            struct worker_info *w = &workers[i];
+            if (w->state == WS_INACTIVE) { continue; }
+
+            /* Workers that have already exited will have a
+             * result (or EOF) ready to read, so only check for
+             * timeouts on ones that are still running. The
+             * timeout applies to each trial in a batch. */
+            if (timeout_msec > 0 && w->state == WS_ACTIVE) {
+                const int remaining = remaining_msec(t, w, &now);
+                if (timeout == -1 || remaining < timeout) {
+                    timeout = remaining;
                 }
-                return THEFT_TRIAL_ERROR;
-            } else {
-                break;
             }
+
+            pfds[count] = (struct pollfd){
+                .fd = w->fds[0],
+                .events = POLLIN,
+            };
+            polled[count] = w;
+            count++;
+        }
+        assert(count > 0);
+
+        int pres = poll(pfds, count, timeout);
+        LOG(3 - LOG_CALL, "%s: POLL res %d, timeout %d\n",
+            __func__, pres, timeout);
+        if (pres == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                errno = 0;
+                continue;
+            }
+            perror("poll");
+            return false;
+        } else if (pres > 0) {
+            for (size_t i = 0; i < count; i++) {
+                if (pfds[i].revents == 0) { continue; }
+                struct worker_info *w = polled[i];
+                bool closed = false;
+                *res = read_worker_result(w, &closed);
+                if (*res == THEFT_TRIAL_PASS) { observe_latency(t, w); }
+                w->batch_done++;
+                *worker = w;
+                if (closed || w->batch_done == w->batch_count) {
+                    return reap_worker(t, w);
+                }
+                get_time(&w->start);
+                return step_waitpid(t);
+            }
+        }
+
+        /* Nothing ready to read, so check for timeouts. */
+        get_time(&now);
+        for (size_t i = 0; i < count; i++) {
+            struct worker_info *w = polled[i];
+            if (w->state != WS_ACTIVE || timeout_msec == 0) { continue; }
+            if (remaining_msec(t, w, &now) == 0) {
+                LOG(3 - LOG_CALL, "%s: worker %d timed out\n",
+                    __func__, w->pid);
+                *res = handle_timeout(t, w);
+                w->batch_done++;
+                *worker = w;
+                return reap_worker(t, w);
+            }
+        }
+    }
+}
+
+/* Kill any active workers, and wait for them to exit. This is
+ * used to clean up after an error. */
+void
+theft_call_stop_workers(struct theft *t) {
+    for (size_t i = 0; i < t->worker_count; i++) {
+        theft_call_stop_worker(t, &t->workers[i]);
+    }
+}
+
+/* Kill a worker, if it's active, and wait for it to exit. */
+void
+theft_call_stop_worker(struct theft *t, struct worker_info *w) {
+    if (w->state == WS_INACTIVE) { return; }
+    if (w->state == WS_ACTIVE) {
+        if (-1 == kill(w->pid, SIGKILL) && errno != ESRCH) {
+            perror("kill");
+        }
+        /* The fork server reaps its own children, and a worker
+         * resumed from a checkpoint isn't this process's child. */
+        if (t->zygote.pid == -1 && !w->resumed) {
+            int wstatus = 0;
+            while (-1 == waitpid(w->pid, &wstatus, 0) && errno == EINTR) {}
+        }
+    }
+    close(w->fds[0]);
+    if (w->resumed) {
+        close(w->exit_fd);
+        w->resumed = false;
+    }
+    w->state = WS_INACTIVE;
+}
+
+static void
+get_time(struct timespec *ts) {
+    if (-1 == clock_gettime(CLOCK_MONOTONIC, ts)) {
+        perror("clock_gettime");
+        ts->tv_sec = 0;
+        ts->tv_nsec = 0;
+    }
+}
+
+static size_t
+elapsed_msec(const struct timespec *pre, const struct timespec *post) {
+    return 1000*post->tv_sec - 1000*pre->tv_sec +
+      ((post->tv_nsec / 1000000) - (pre->tv_nsec / 1000000));
+}
+
+/* How long until the worker's current trial times out? */
+static int
+remaining_msec(const struct theft *t, const struct worker_info *worker,
+        const struct timespec *now) {
+    const size_t elapsed = elapsed_msec(&worker->start, now);
+    const size_t timeout = call_timeout(t);
+    return (elapsed >= timeout ? 0 : (int)(timeout - elapsed));
+}
+
+/* The timeout for each trial, in msec, or 0 for none. */
+static size_t
+call_timeout(const struct theft *t) {
+    const struct auto_timeout_info *at = &t->auto_timeout;
+    if (!at->enable) { return t->fork.timeout; }
+    return (at->frozen ? at->frozen_msec : auto_timeout_msec(at));
+}
+
+/* A multiple of the estimated 99th percentile of passing trials' wall
+ * clock time, within the configured bounds. The estimate is no use
+ * until a few trials have passed, so until then, use the maximum. */
+static size_t
+auto_timeout_msec(const struct auto_timeout_info *at) {
+    if (at->latency.count < 5) { return at->max; }
+    const double usec = at->multiple * theft_quantile_get(&at->latency);
+    const size_t msec = (size_t)(usec / 1000) + 1;
+    return (msec < at->min ? at->min : msec > at->max ? at->max : msec);
+}
+
+/* Record how long the worker took to pass its current trial, for the
+ * automatic timeout. */
+static void
+observe_latency(struct theft *t, const struct worker_info *worker) {
+    struct auto_timeout_info *at = &t->auto_timeout;
+    if (!at->enable || at->frozen) { return; }
+    struct timespec now;
+    get_time(&now);
+    const double usec = 1000000.0 * (now.tv_sec - worker->start.tv_sec)
+        + (now.tv_nsec - worker->start.tv_nsec) / 1000.0;
+    theft_quantile_add(&at->latency, usec);
+}
+
+/* Freeze (or thaw) the automatic timeout at its current value. */
+void
+theft_call_freeze_timeout(struct theft *t, bool frozen) {
+    struct auto_timeout_info *at = &t->auto_timeout;
+    if (frozen && !at->frozen) {
+        at->frozen_msec = auto_timeout_msec(at);
+        LOG(2 - LOG_CALL, "%s: froze timeout at %zd msec\n",
+            __func__, at->frozen_msec);
+    }
+    at->frozen = frozen;
+}
+
+static enum theft_trial_res
+parent_handle_child_call(struct theft *t, struct worker_info *worker) {
+    struct pollfd pfd = { .fd = worker->fds[0], .events = POLLIN };
+    for (;;) {
+        /* Restarting after EINTR doesn't restart the timeout. */
+        int timeout = -1;
+        if (call_timeout(t) > 0) {
+            struct timespec now;
+            get_time(&now);
+            timeout = remaining_msec(t, worker, &now);
+        }
+
+        int res = poll(&pfd, 1, timeout);
+        LOG(3 - LOG_CALL,"%s: POLL res %d, timeout %d\n",
+            __func__, res, timeout);
+
+        if (res == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                errno = 0;
+                continue;
+            }
+            return THEFT_TRIAL_ERROR;
+        } else if (res == 0) {
+            return handle_timeout(t, worker);
+        } else {
+            bool closed = false;
+            enum theft_trial_res tres = read_worker_result(worker, &closed);
+            if (tres == THEFT_TRIAL_PASS) { observe_latency(t, worker); }
+            return tres;
+        }
+    }
+}
+
+/* Once a worker has written its last result (or closed its pipe),
+ * wait for it to exit, so its resource usage is available, and
+ * mark it inactive. */
+static bool
+reap_worker(struct theft *t, struct worker_info *worker) {
+    close(worker->fds[0]);
+    bool ok = true;
+    if (worker->state == WS_ACTIVE) {
+        ok = wait_for_exit(t, worker, exit_timeout_msec(t), KILL_TIME_MSEC);
+    }
+    if (worker->resumed) {
+        close(worker->exit_fd);
+        worker->resumed = false;
+    }
+    worker->state = WS_INACTIVE;
+    return ok;
+}
+
+static size_t
+exit_timeout_msec(const struct theft *t) {
+    return (t->fork.exit_timeout == 0
+        ? THEFT_DEF_EXIT_TIMEOUT_MSEC
+        : t->fork.exit_timeout);
+}
+
+/* The worker has exceeded the timeout: signal it, and give it a
+ * chance to exit before killing it. */
+static enum theft_trial_res
+handle_timeout(struct theft *t, struct worker_info *worker) {
+    const pid_t pid = worker->pid;
+    int kill_signal = t->fork.signal;
+    if (kill_signal == 0) {
+        kill_signal = DEF_KILL_SIGNAL;
+    }
+    LOG(2 - LOG_CALL, "%s: kill(%d, %d)\n",
+        __func__, pid, kill_signal);
+    assert(pid != -1);      /* do not do this. */
+    if (-1 == kill(pid, kill_signal)) {
+        return THEFT_TRIAL_ERROR;
+    }
+
+    /* Check if kill's signal made the child process terminate (or
+     * if it exited successfully, and there was just a race on the
+     * timeout). If so, save its exit status.
+     *
+     * If it still hasn't exited after the exit_timeout, then
+     * send it SIGKILL and wait for _that_ to make it exit. */
+    const size_t kill_time = KILL_TIME_MSEC;
+    const size_t timeout_msec = exit_timeout_msec(t);
+
+    /* After sending the signal to the timed out process,
+     * give it timeout_msec to actually exit (in case a custom
+     * signal is triggering some sort of cleanup) before sending
+     * SIGKILL and waiting up to kill_time it to change state. */
+    if (!wait_for_exit(t, worker, timeout_msec, kill_time)) {
+        return THEFT_TRIAL_ERROR;
+    }
+
+    /* A worker running a batch may have finished the trial that
+     * timed out (and moved on to the next) before it got the signal,
+     * so use the trial's result if it was written. */
+    if (worker->batch_count > 1) {
+        struct pollfd pfd = { .fd = worker->fds[0], .events = POLLIN };
+        bool closed = false;
+        if (poll(&pfd, 1, 0) == 1) {
+            enum theft_trial_res res = read_worker_result(worker, &closed);
+            if (!closed) { return res; }
+        }
+        return THEFT_TRIAL_FAIL;
+    }
+
+    /* If the child still exited successfully, then consider it a
+     * PASS, even though it exceeded the timeout. (There's no exit
+     * status for a worker resumed from a checkpoint.) */
+    if (worker->state == WS_STOPPED && !worker->resumed) {
+        const int st = worker->wstatus;
+        LOG(2 - LOG_CALL, "exited? %d, exit_status %d\n",
+            WIFEXITED(st), WEXITSTATUS(st));
+        if (WIFEXITED(st) && WEXITSTATUS(st) == EXIT_SUCCESS) {
+            return THEFT_TRIAL_PASS;
         }
+    }
 
-        if (rd == 0) {
-            /* closed without response -> crashed */
-            trial_res = THEFT_TRIAL_FAIL;
+    return THEFT_TRIAL_FAIL;
+}
+
+/* Read the result byte written by a worker. As long as the result
+ * isn't a timeout, the worker can just be cleaned up by the next
+ * batch of waitpid()s. If there won't be any more results from the
+ * worker (the pipe was closed, or reading failed), set *CLOSED. */
+static enum theft_trial_res
+read_worker_result(struct worker_info *worker, bool *closed) {
+    enum theft_trial_res trial_res = THEFT_TRIAL_ERROR;
+    uint8_t res_byte = 0xFF;
+    ssize_t rd = 0;
+    for (;;) {
+        rd = read(worker->fds[0], &res_byte, sizeof(res_byte));
+        if (rd == -1) {
+            if (errno == EINTR) {
+                errno = 0;
+                continue;
+            }
+            *closed = true;
+            return THEFT_TRIAL_ERROR;
         } else {
-            assert(rd == 1);
-            trial_res = (enum theft_trial_res)res_byte;
+            break;
         }
+    }
 
-        return trial_res;
+    if (rd == 0) {
+        /* closed without response -> crashed */
+        trial_res = THEFT_TRIAL_FAIL;
+        *closed = true;
+    } else {
+        assert(rd == 1);
+        trial_res = (enum theft_trial_res)res_byte;
     }
+
+    return trial_res;
 }
 
 /* Clean up after all child processes that have changed state.
@@ -204,20 +875,33 @@ static bool
 step_waitpid(struct theft *t) {
     int wstatus = 0;
     int old_errno = errno;
+
+    /* Workers started by the fork server are its children, so it
+     * reports their exit statuses instead. */
+    if (t->zygote.pid != -1 && !theft_zygote_step(t)) {
+        return false;
+    }
+
     for (;;) {
         errno = 0;
-        pid_t res = waitpid(-1, &wstatus, WNOHANG);
+        struct rusage ru;
+        pid_t res = wait4(-1, &wstatus, WNOHANG, &ru);
         LOG(2 - LOG_CALL, "%s: waitpid? %d\n", __func__, res);
         if (res == -1) {
             if (errno == ECHILD) { break; } /* No Children */
             perror("waitpid");
-            return THEFT_TRIAL_ERROR;
+            return false;
         } else if (res == 0) {
             break;   /* no children have changed state */
         } else {
-            if (res == t->workers[0].pid) {
-                t->workers[0].state = WS_STOPPED;
-                t->workers[0].wstatus = wstatus;
+            for (size_t i = 0; i < t->worker_count; i++) {
+                struct worker_info *w = &t->workers[i];
+                if (w->state == WS_ACTIVE && res == w->pid) {
+                    w->state = WS_STOPPED;
+                    w->wstatus = wstatus;
+                    theft_call_save_rusage(&ru, &w->rusage);
+                    break;
+                }
             }
         }
     }
@@ -226,42 +910,177 @@ step_waitpid(struct theft *t) {
 }
 
 /* Wait timeout msec. for the worker to exit. If kill_timeout is
- * non-zero, then send SIGKILL and wait that much longer. */
+ * non-zero, then send SIGKILL and wait that much longer.
+ *
+ * Rather than checking periodically, this blocks in poll(2) until
+ * the worker's exit is reported or the time runs out: by the fork
+ * server, if the worker was started by it, by EOF on its exit pipe,
+ * if it was resumed from a checkpoint, and otherwise by a pidfd
+ * for the worker, or a signalfd for SIGCHLD on older Linux kernels.
+ * Elsewhere, it falls back on checking every millisecond. */
 static bool
 wait_for_exit(struct theft *t, struct worker_info *worker,
     size_t timeout, size_t kill_timeout) {
-    for (size_t i = 0; i < timeout + kill_timeout; i++) {
-        if (!step_waitpid(t)) { return false; }
+    struct exit_watch ew;
+    exit_watch_open(t, worker, &ew);
+
+    struct timespec start;
+    get_time(&start);
+    bool killed = false;
+    bool ok = true;
+
+    for (;;) {
+        if (!step_waitpid(t)) {
+            ok = false;
+            break;
+        }
         if (worker->state == WS_STOPPED) { break; }
 
+        /* If the fork server exited, nothing will report it. */
+        if (ew.type == EXIT_WATCH_ZYGOTE && t->zygote.pid == -1) {
+            ew.type = EXIT_WATCH_NONE;
+            ew.fd = -1;
+        }
+
+        struct timespec now;
+        get_time(&now);
+        const size_t elapsed = elapsed_msec(&start, &now);
+
         /* If worker hasn't exited yet and kill_timeout is
          * non-zero, send SIGKILL. */
-        if (i == timeout) {
-            assert(kill_timeout > 0);
+        if (!killed && elapsed >= timeout) {
+            if (kill_timeout == 0) { break; }
             assert(worker->pid != -1);
-            int kill_res = kill(worker->pid, SIGKILL);
-            if (kill_res == -1) {
-                if (kill_res == ESRCH) {
+            if (-1 == kill(worker->pid, SIGKILL)) {
+                if (errno == ESRCH) {
                     /* Process no longer exists (it probably
                      * just exited); let waitpid handle it. */
+                    errno = 0;
                 } else {
                     perror("kill");
-                    return false;
+                    ok = false;
+                    break;
                 }
             }
+            killed = true;
         }
 
-        const struct timespec one_msec = { .tv_nsec = 1000000 };
-        if (-1 == nanosleep(&one_msec, NULL)) {
-            perror("nanosleep");
-            return false;
+        const size_t deadline = (killed ? timeout + kill_timeout : timeout);
+        if (elapsed >= deadline) { break; }
+
+        struct pollfd pfd = { .fd = ew.fd, .events = POLLIN };
+        const int poll_timeout = (ew.fd == -1
+            ? 1 : (int)(deadline - elapsed));
+        const int pres = poll(&pfd, (ew.fd == -1 ? 0 : 1), poll_timeout);
+        if (pres == -1) {
+            if (errno == EINTR) {
+                errno = 0;
+                continue;
+            }
+            perror("poll");
+            ok = false;
+            break;
+        }
+        if (pres > 0 && ew.type == EXIT_WATCH_SIGNALFD) {
+            exit_watch_drain(&ew);
+        } else if (pres > 0 && ew.type == EXIT_WATCH_PIPE) {
+            worker->state = WS_STOPPED;
         }
     }
-    return true;
+
+    exit_watch_close(&ew);
+    return ok;
+}
+
+/* Get a file descriptor that will be readable once the worker has
+ * exited (or, for a signalfd, once any child process has changed
+ * state). If there isn't any way to get one, ew->fd is -1. */
+static void
+exit_watch_open(struct theft *t, const struct worker_info *worker,
+        struct exit_watch *ew) {
+    ew->type = EXIT_WATCH_NONE;
+    ew->fd = -1;
+
+    if (worker->resumed) {
+        ew->type = EXIT_WATCH_PIPE;
+        ew->fd = worker->exit_fd;
+        return;
+    }
+
+    if (t->zygote.pid != -1) {
+        ew->type = EXIT_WATCH_ZYGOTE;
+        ew->fd = t->zygote.fd;
+        return;
+    }
+
+#if defined(__linux__)
+#ifdef SYS_pidfd_open
+    ew->fd = (int)syscall(SYS_pidfd_open, worker->pid, 0);
+    if (ew->fd != -1) {
+        ew->type = EXIT_WATCH_PIDFD;
+        return;
+    }
+    errno = 0;                  /* ENOSYS before Linux 5.3 */
+#endif
+
+    /* SIGCHLD has to be blocked to be read from a signalfd. Any
+     * signal still pending when the previous mask is restored is
+     * delivered as usual. */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (-1 == sigprocmask(SIG_BLOCK, &mask, &ew->old_mask)) {
+        errno = 0;
+        return;
+    }
+    ew->fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (ew->fd == -1) {
+        sigprocmask(SIG_SETMASK, &ew->old_mask, NULL);
+        errno = 0;
+        return;
+    }
+    ew->type = EXIT_WATCH_SIGNALFD;
+#endif
+}
+
+static void
+exit_watch_drain(struct exit_watch *ew) {
+#if defined(__linux__)
+    struct signalfd_siginfo info[8];
+    while (read(ew->fd, info, sizeof(info)) > 0) {}
+    errno = 0;
+#else
+    (void)ew;
+#endif
+}
+
+static void
+exit_watch_close(struct exit_watch *ew) {
+    switch (ew->type) {
+    case EXIT_WATCH_NONE:
+    case EXIT_WATCH_ZYGOTE:
+    case EXIT_WATCH_PIPE:
+        break;                  /* nothing to close */
+    case EXIT_WATCH_PIDFD:
+        close(ew->fd);
+        break;
+    case EXIT_WATCH_SIGNALFD:
+        close(ew->fd);
+        sigprocmask(SIG_SETMASK, &ew->old_mask, NULL);
+        break;
+    }
 }
 
 static enum theft_trial_res
 theft_call_inner(struct theft *t, void **args) {
+    if (t->deadline.timeout > 0) {
+        return theft_deadline_call(t, args, call_property);
+    }
+    return call_property(t, args);
+}
+
+static enum theft_trial_res
+call_property(struct theft *t, void **args) {
     switch (t->prop.arity) {
     case 1:
         return t->prop.u.fun1(t, args[0]);
@@ -292,36 +1111,39 @@ theft_call_inner(struct theft *t, void **args) {
     }
 }
 
-/* Populate a buffer with hashes of all the arguments. */
-static void
-get_arg_hash_buffer(theft_hash *buffer, struct theft *t) {
+/* Get a 128-bit key for the tuple of argument instances, by hashing
+ * together the hashes of all the arguments. */
+struct theft_hash128
+theft_call_arg_hash_key(struct theft *t) {
+    struct theft_hash128 buffer[THEFT_MAX_ARITY];
     for (uint8_t i = 0; i < t->prop.arity; i++) {
         struct theft_type_info *ti = t->prop.type_info[i];
 
-        theft_hash h = (ti->autoshrink_config.enable
-            ? theft_autoshrink_hash(t, t->trial.args[i].instance,
-                t->trial.args[i].u.as.env, ti->env)
-            : ti->hash(t->trial.args[i].instance, ti->env));
+        struct theft_hash128 h = { .lo = 0 };
+        if (ti->autoshrink_config.enable) {
+            h = theft_autoshrink_hash(t, t->trial.args[i].instance,
+                t->trial.args[i].u.as.env, ti->env);
+        } else {
+            h.lo = ti->hash(t->trial.args[i].instance, ti->env);
+        }
 
-        LOG(4, "%s: arg %d hash; 0x%016" PRIx64 "\n", __func__, i, h);
+        LOG(4, "%s: arg %d hash; 0x%016" PRIx64 "%016" PRIx64 "\n",
+            __func__, i, h.hi, h.lo);
         buffer[i] = h;
     }
+    return theft_hash_onepass128((const uint8_t *)buffer,
+        t->prop.arity * sizeof(buffer[0]));
 }
 
 /* Check if this combination of argument instances has been called. */
 bool theft_call_check_called(struct theft *t) {
-    theft_hash buffer[THEFT_MAX_ARITY];
-    get_arg_hash_buffer(buffer, t);
-    return theft_bloom_check(t->bloom, (uint8_t *)buffer,
-        t->prop.arity * sizeof(theft_hash));
-}
-
-/* Mark the tuple of argument instances as called in the bloom filter. */
-void theft_call_mark_called(struct theft *t) {
-    theft_hash buffer[THEFT_MAX_ARITY];
-    get_arg_hash_buffer(buffer, t);
-    theft_bloom_mark(t->bloom, (uint8_t *)buffer,
-        t->prop.arity * sizeof(theft_hash));
+    return theft_dedup_check(t->dedup, theft_call_arg_hash_key(t));
+}
+
+/* Check if this combination of argument instances has been called,
+ * and mark it as called if not. */
+bool theft_call_check_and_mark_called(struct theft *t) {
+    return theft_dedup_check_and_mark(t->dedup, theft_call_arg_hash_key(t));
 }
 
 static enum theft_hook_fork_post_res
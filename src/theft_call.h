@@ -8,11 +8,106 @@
 enum theft_trial_res
 theft_call(struct theft *t, void **args);
 
+/* Are calls to the property function currently made in a forked
+ * worker process? */
+bool
+theft_call_forking(const struct theft *t);
+
+/* With an automatic timeout, keep using its current value until
+ * thawed, rather than adapting it to trials that pass. */
+void
+theft_call_freeze_timeout(struct theft *t, bool frozen);
+
+/* Get a worker that isn't currently running a trial, or NULL. */
+struct worker_info *
+theft_call_idle_worker(struct theft *t);
+
+/* How many workers are currently running a trial? */
+size_t
+theft_call_active_workers(struct theft *t);
+
+/* Fork a worker process to call the property function with ARGS,
+ * but don't wait for its result. */
+bool
+theft_call_start(struct theft *t, struct worker_info *worker,
+    void **args);
+
+/* Make the I'th trial of a batch the current trial (t->trial),
+ * and save its arguments in ARGS. */
+typedef void
+theft_call_batch_cb(struct theft *t, size_t i, void *udata, void **args);
+
+/* Fork a worker process to run COUNT trials in sequence, getting
+ * each from CB, and writing a result byte for each. Don't wait for
+ * any of them. */
+bool
+theft_call_start_batch(struct theft *t, struct worker_info *worker,
+    size_t count, theft_call_batch_cb *cb, void *udata);
+
+/* In a worker process: run the fork_post hook and the property
+ * function for each trial in the batch, fill in its entry in
+ * WORKER's reports (and captured output), write each result to
+ * OUT_FD, and exit. */
+void
+theft_call_run_batch(struct theft *t, struct worker_info *worker,
+    size_t count, theft_call_batch_cb *cb, void *udata, int out_fd);
+
+/* Map the memory shared with worker processes for their reports,
+ * and open the files capturing their output, if forking. Returns
+ * false on error. */
+bool
+theft_call_init_workers(struct theft *t);
+
+/* Unmap the workers' shared memory and close their capture files. */
+void
+theft_call_free_workers(struct theft *t);
+
+/* When capturing output, replace TRIAL's output with what WORKER's
+ * I'th trial wrote (up to the configured size). */
+void
+theft_call_save_output(struct theft *t, const struct worker_info *worker,
+    size_t i, struct trial_info *trial);
+
+/* Save the parts of a worker's resource usage (from wait4) that are
+ * reported to hooks. */
+struct rusage;
+void
+theft_call_save_rusage(const struct rusage *ru,
+    struct theft_fork_rusage *out);
+
+/* Wait until any active worker has a result (or has timed out),
+ * and save which worker it was in *WORKER and the result in *RES.
+ * The result is for the worker's (worker->batch_done - 1)'th trial.
+ * Once it has finished its batch, or exited early, the worker is
+ * inactive, and ready to be started again. */
+bool
+theft_call_wait_any(struct theft *t, struct worker_info **worker,
+    enum theft_trial_res *res);
+
+/* Like theft_call_wait_any, but only for the COUNT workers starting
+ * at WORKERS. */
+bool
+theft_call_wait_any_of(struct theft *t, struct worker_info *workers,
+    size_t count, struct worker_info **worker, enum theft_trial_res *res);
+
+/* Kill any active workers, and wait for them to exit. */
+void
+theft_call_stop_workers(struct theft *t);
+
+/* Kill a worker, if it's active, and wait for it to exit. */
+void
+theft_call_stop_worker(struct theft *t, struct worker_info *worker);
+
+/* Get a 128-bit key for the current trial's arguments, for dedup. */
+struct theft_hash128
+theft_call_arg_hash_key(struct theft *t);
+
 /* Check if this combination of argument instances has been called. */
 bool theft_call_check_called(struct theft *t);
 
-/* Mark the tuple of argument instances as called in the bloom filter. */
-void theft_call_mark_called(struct theft *t);
+/* Check if this combination of argument instances has been called,
+ * and mark it as called if not. */
+bool theft_call_check_and_mark_called(struct theft *t);
 
 
 #endif
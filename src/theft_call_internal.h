@@ -2,21 +2,99 @@
 #define THEFT_CALL_INTERNAL_H
 
 #include "theft_call.h"
-#include "theft_bloom.h"
+#include "theft_dedup.h"
 #include <assert.h>
+#include <string.h>
 
 #include <unistd.h>
 #include <sys/wait.h>
 #include <poll.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+/* How wait_for_exit finds out a worker has exited. */
+struct exit_watch {
+    enum exit_watch_type {
+        EXIT_WATCH_NONE,        /* no fd, check periodically */
+        EXIT_WATCH_ZYGOTE,      /* reported by the fork server */
+        EXIT_WATCH_PIDFD,       /* the worker's pidfd (Linux 5.3+) */
+        EXIT_WATCH_SIGNALFD,    /* SIGCHLD, via signalfd (Linux) */
+        EXIT_WATCH_PIPE,        /* EOF on a resumed worker's exit pipe */
+    } type;
+    int fd;
+    sigset_t old_mask;          /* for EXIT_WATCH_SIGNALFD */
+};
 
 static enum theft_trial_res
 theft_call_inner(struct theft *t, void **args);
 
 static enum theft_trial_res
-parent_handle_child_call(struct theft *t, pid_t pid,
-    struct worker_info *worker);
+call_property(struct theft *t, void **args);
+
+static enum theft_trial_res
+parent_handle_child_call(struct theft *t, struct worker_info *worker);
+
+static enum theft_trial_res
+handle_timeout(struct theft *t, struct worker_info *worker);
+
+static enum theft_trial_res
+read_worker_result(struct worker_info *worker, bool *closed);
+
+static void
+single_trial_cb(struct theft *t, size_t i, void *udata, void **args);
+
+static uint64_t
+rusage_cpu_usec(const struct rusage *ru);
+
+static bool
+set_rlimits(struct theft *t);
+
+static bool
+set_soft_rlimit(int resource, rlim_t limit);
+
+static int
+open_capture_file(void);
+
+static bool
+reset_capture_file(int fd);
+
+static bool
+redirect_output(int fd);
+
+static size_t
+capture_offset(int fd);
+
+static void
+finish_capture(struct theft *t, int fd, struct worker_output *out,
+    enum theft_trial_res res);
+
+static bool
+reap_worker(struct theft *t, struct worker_info *worker);
+
+static size_t
+exit_timeout_msec(const struct theft *t);
+
+static void
+get_time(struct timespec *ts);
+
+static size_t
+elapsed_msec(const struct timespec *pre, const struct timespec *post);
+
+static size_t
+call_timeout(const struct theft *t);
+
+static size_t
+auto_timeout_msec(const struct auto_timeout_info *at);
+
+static void
+observe_latency(struct theft *t, const struct worker_info *worker);
+
+static int
+remaining_msec(const struct theft *t, const struct worker_info *worker,
+    const struct timespec *now);
 
 static enum theft_hook_fork_post_res
 run_fork_post_hook(struct theft *t, void **args);
@@ -28,4 +106,14 @@ static bool
 wait_for_exit(struct theft *t, struct worker_info *worker,
     size_t timeout, size_t kill_timeout);
 
+static void
+exit_watch_open(struct theft *t, const struct worker_info *worker,
+    struct exit_watch *ew);
+
+static void
+exit_watch_drain(struct exit_watch *ew);
+
+static void
+exit_watch_close(struct exit_watch *ew);
+
 #endif
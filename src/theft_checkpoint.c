@@ -0,0 +1,522 @@
+#include "theft_checkpoint_internal.h"
+#include "theft_call.h"
+#include "theft_autoshrink.h"
+
+/* Checkpoints save re-running the common prefix of a sequence of steps
+ * (e.g., commands in a stateful test) for every shrinking candidate.
+ * When a worker calls theft_checkpoint before running a step, it forks
+ * a snapshot process, which stops there, and sends the main process
+ * the snapshot's control socket, keyed by a hash of the bits that the
+ * arguments' alloc callbacks consumed before that step.
+ *
+ * Before starting a worker for a later candidate, the main process
+ * checks if its bits start the same way as any kept snapshot's. If so,
+ * it sends that snapshot the candidate's bits, and the snapshot forks
+ * a new worker, which replays them to build the new argument instance,
+ * and continues the property function from the checkpoint with it.
+ * The new worker is the snapshot's child, not this process's, so it
+ * holds the write end of an exit pipe, and its exit is noticed by EOF
+ * on the read end.
+ *
+ * Snapshots exit once their control socket is closed. */
+
+#define LOG_CHECKPOINT 0
+
+bool
+theft_checkpoint_init(struct theft *t) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    cp->reg_fds[0] = -1;
+    cp->reg_fds[1] = -1;
+    cp->out_fd = -1;
+    cp->exit_fd = -1;
+    if (cp->max == 0 || !t->fork.enable || t->fork.zygote) { return true; }
+    for (uint8_t i = 0; i < t->prop.arity; i++) {
+        if (!t->prop.type_info[i]->autoshrink_config.enable) {
+            LOG(2 - LOG_CHECKPOINT, "%s: arg %u doesn't use autoshrinking,"
+                " not using checkpoints\n", __func__, i);
+            return true;
+        }
+    }
+
+    cp->entries = calloc(cp->max, sizeof(cp->entries[0]));
+    if (cp->entries == NULL) { return false; }
+    if (-1 == socketpair(AF_UNIX, SOCK_DGRAM, 0, cp->reg_fds)) {
+        perror("socketpair");
+        cp->reg_fds[0] = -1;
+        cp->reg_fds[1] = -1;
+        return false;
+    }
+
+    /* Neither the workers sending registrations nor the main process
+     * receiving them should ever block. */
+    for (size_t i = 0; i < 2; i++) {
+        const int flags = fcntl(cp->reg_fds[i], F_GETFL);
+        if (flags == -1
+            || -1 == fcntl(cp->reg_fds[i], F_SETFL, flags | O_NONBLOCK)) {
+            perror("fcntl");
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+theft_checkpoint_free(struct theft *t) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    if (cp->entries == NULL) { return; } /* not in use */
+    theft_checkpoint_disarm(t);
+    for (size_t i = 0; i < 2; i++) {
+        if (cp->reg_fds[i] != -1) {
+            close(cp->reg_fds[i]);
+            cp->reg_fds[i] = -1;
+        }
+    }
+    free(cp->entries);
+    cp->entries = NULL;
+}
+
+void
+theft_checkpoint_arm(struct theft *t) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    cp->armed = (cp->reg_fds[0] != -1 && theft_call_forking(t));
+}
+
+void
+theft_checkpoint_disarm(struct theft *t) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    if (!cp->armed) { return; }
+    theft_checkpoint_collect(t);
+    while (cp->count > 0) { drop_entry(t, cp->count - 1); }
+    cp->armed = false;
+}
+
+void
+theft_checkpoint_enter_worker(struct theft *t, size_t worker_id,
+        int out_fd) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    if (!cp->armed) { return; }
+
+    /* Snapshots should only be kept alive by the main process. The
+     * entries are kept, to avoid taking the same snapshots again. */
+    for (size_t i = 0; i < cp->count; i++) {
+        close(cp->entries[i].fd);
+        cp->entries[i].fd = -1;
+    }
+    cp->in_worker = true;
+    cp->worker_id = worker_id;
+    cp->created = 0;
+    cp->out_fd = out_fd;
+}
+
+size_t
+theft_checkpoint_position(struct theft *t) {
+    return (t->prng.bit_pool == NULL ? 0 : t->prng.bit_pool->consumed);
+}
+
+void *
+theft_checkpoint(struct theft *t, uint8_t arg_index, size_t bit_position) {
+    assert(arg_index < t->prop.arity);
+    struct checkpoint_info *cp = &t->checkpoint;
+    struct arg_info *ai = &t->trial.args[arg_index];
+    if (!cp->in_worker || cp->created == cp->max
+        || ai->type != ARG_AUTOSHRINK
+        || bit_position > ai->u.as.env->bit_pool->consumed) {
+        return ai->instance;
+    }
+
+    const uint64_t key = prefix_key(t, arg_index, bit_position);
+    if (!known_key(t, key)) {
+        take_snapshot(t, arg_index, bit_position, key);
+    }
+
+    /* If this is a worker resumed from the snapshot, the argument
+     * has been replaced. */
+    return ai->instance;
+}
+
+bool
+theft_checkpoint_resume(struct theft *t, struct worker_info *worker) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    if (!cp->armed || cp->count == 0) { return false; }
+    const size_t worker_id = worker - t->workers;
+
+    /* Use the matching snapshot furthest along. It has to have been
+     * taken by a worker in the same slot, since it uses that slot's
+     * shared memory and capture file. */
+    size_t best = cp->count;
+    for (size_t i = 0; i < cp->count; i++) {
+        const struct checkpoint_entry *e = &cp->entries[i];
+        if (e->worker_id != worker_id) { continue; }
+        if (best < cp->count
+            && cp->entries[best].bit_position >= e->bit_position) {
+            continue;
+        }
+        const struct autoshrink_bit_pool *pool =
+            t->trial.args[e->arg_index].u.as.env->bit_pool;
+        if (e->bit_position > pool->consumed) { continue; }
+        if (prefix_key(t, e->arg_index, e->bit_position) == e->key) {
+            best = i;
+        }
+    }
+    if (best == cp->count) { return false; }
+
+    int exit_fds[2];
+    if (-1 == pipe(exit_fds)) {
+        errno = 0;
+        return false;
+    }
+
+    pid_t pid = -1;
+    const bool ok = send_resume(t, &cp->entries[best],
+        worker->fds[1], exit_fds[1], &pid);
+    close(exit_fds[1]);
+    if (!ok) {
+        /* The snapshot has probably exited, so stop using it. */
+        LOG(2 - LOG_CHECKPOINT, "%s: resuming failed, dropping %zd\n",
+            __func__, best);
+        close(exit_fds[0]);
+        drop_entry(t, best);
+        errno = 0;
+        return false;
+    }
+
+    LOG(2 - LOG_CHECKPOINT, "%s: resumed at bit %zd, pid %d\n",
+        __func__, cp->entries[best].bit_position, pid);
+    worker->pid = pid;
+    worker->resumed = true;
+    worker->exit_fd = exit_fds[0];
+    return true;
+}
+
+void
+theft_checkpoint_collect(struct theft *t) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    if (!cp->armed) { return; }
+    for (;;) {
+        struct checkpoint_registration reg;
+        int fd = -1;
+        const ssize_t rd = recv_with_fds(cp->reg_fds[0],
+            &reg, sizeof(reg), &fd, 1, 0);
+        if (rd == -1) {
+            if (errno == EINTR) { continue; }
+            errno = 0;          /* EAGAIN: nothing left */
+            return;
+        } else if (rd != sizeof(reg) || fd == -1) {
+            if (fd != -1) { close(fd); }
+            continue;
+        }
+
+        /* Two workers may have stopped at the same point. */
+        if (known_key(t, reg.key)) {
+            close(fd);
+            continue;
+        }
+        if (cp->count == cp->max) { drop_entry(t, 0); }
+        cp->entries[cp->count] = (struct checkpoint_entry){
+            .key = reg.key,
+            .arg_index = reg.arg_index,
+            .bit_position = reg.bit_position,
+            .worker_id = reg.worker_id,
+            .fd = fd,
+        };
+        cp->count++;
+    }
+}
+
+/* Hash the bits consumed by every argument, but only the first
+ * BIT_POSITION bits for ARG_INDEX. */
+static uint64_t
+prefix_key(struct theft *t, uint8_t arg_index, size_t bit_position) {
+    struct theft_hasher h;
+    theft_hash_init(&h);
+    theft_hash_sink(&h, &arg_index, sizeof(arg_index));
+    for (uint8_t i = 0; i < t->prop.arity; i++) {
+        const struct autoshrink_bit_pool *pool =
+            t->trial.args[i].u.as.env->bit_pool;
+        const size_t bits = (i == arg_index ? bit_position : pool->consumed);
+        theft_hash_sink(&h, (const uint8_t *)&bits, sizeof(bits));
+        theft_hash_sink(&h, pool->bits, bits / 8);
+        const uint8_t rem_bits = bits % 8;
+        if (rem_bits > 0) {
+            const uint8_t mask = ((1U << rem_bits) - 1);
+            uint8_t rem = pool->bits[bits / 8] & mask;
+            theft_hash_sink(&h, &rem, 1);
+        }
+    }
+    return theft_hash_done(&h);
+}
+
+static bool
+known_key(const struct theft *t, uint64_t key) {
+    const struct checkpoint_info *cp = &t->checkpoint;
+    for (size_t i = 0; i < cp->count; i++) {
+        if (cp->entries[i].key == key) { return true; }
+    }
+    return false;
+}
+
+/* Fork a snapshot process, and register it with the main process.
+ * In the snapshot, this only returns once it has forked a worker
+ * resumed from here, with the argument replaced. */
+static void
+take_snapshot(struct theft *t, uint8_t arg_index, size_t bit_position,
+        uint64_t key) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    int fds[2];
+    if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        errno = 0;
+        return;
+    }
+
+    /* Otherwise, every worker resumed from the snapshot would write
+     * another copy of anything still buffered. */
+    fflush(NULL);
+
+    const pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        errno = 0;
+        return;
+    } else if (pid == 0) {
+        close(fds[0]);
+        snapshot_main(t, fds[1], arg_index);
+        return;                 /* resumed */
+    }
+
+    close(fds[1]);
+    cp->created++;
+    struct checkpoint_registration reg = {
+        .key = key,
+        .bit_position = bit_position,
+        .worker_id = cp->worker_id,
+        .arg_index = arg_index,
+    };
+
+    /* If this fails (say, the main process has fallen behind), the
+     * snapshot sees EOF once the socket is closed here, and exits. */
+    if (!send_with_fds(cp->reg_fds[1], &reg, sizeof(reg), &fds[0], 1, 0)) {
+        errno = 0;
+    }
+    close(fds[0]);
+}
+
+/* In a snapshot: wait for requests to resume, and fork a worker for
+ * each. Returns in the new worker; the snapshot itself exits once its
+ * control socket is closed. */
+static void
+snapshot_main(struct theft *t, int fd, uint8_t arg_index) {
+    struct checkpoint_info *cp = &t->checkpoint;
+
+    /* Let go of the worker's result pipe, but keep its descriptor
+     * number, for resumed workers to put theirs in its place. */
+    const int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1 || -1 == dup2(null_fd, cp->out_fd)) {
+        _exit(EXIT_FAILURE);
+    }
+    close(null_fd);
+    if (cp->exit_fd != -1) {
+        close(cp->exit_fd);
+        cp->exit_fd = -1;
+    }
+
+    /* Resumed workers are reaped automatically. */
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        struct resume_request req;
+        int fds[2] = { -1, -1 };
+        const ssize_t rd = recv_with_fds(fd, &req, sizeof(req), fds, 2, 0);
+        if (rd == -1 && errno == EINTR) { continue; }
+        if (rd <= 0 || fds[0] == -1 || fds[1] == -1
+            || !read_all(fd, (uint8_t *)&req + rd, sizeof(req) - rd)) {
+            _exit(EXIT_SUCCESS);
+        }
+
+        uint8_t *bits = malloc((req.bit_count + 7) / 8 + 1);
+        if (bits == NULL || !read_all(fd, bits, (req.bit_count + 7) / 8)) {
+            _exit(EXIT_FAILURE);
+        }
+
+        const pid_t pid = fork();
+        if (pid == 0) {
+            close(fd);
+            resume_worker(t, arg_index, &req, bits, fds);
+            free(bits);
+            return;
+        }
+        close(fds[0]);
+        close(fds[1]);
+        free(bits);
+        if (!write_all(fd, &pid, sizeof(pid))) { _exit(EXIT_SUCCESS); }
+    }
+}
+
+/* In a newly forked worker: replace the result pipe, and the argument
+ * at ARG_INDEX with one replayed from BITS. */
+static void
+resume_worker(struct theft *t, uint8_t arg_index,
+        const struct resume_request *req, const uint8_t *bits, int fds[2]) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    signal(SIGCHLD, SIG_DFL);
+    if (-1 == dup2(fds[0], cp->out_fd)) { _exit(EXIT_FAILURE); }
+    close(fds[0]);
+    cp->exit_fd = fds[1];       /* held open until this process exits */
+    cp->created = 0;
+
+    const struct theft_type_info *ti = t->prop.type_info[arg_index];
+    struct autoshrink_env *env = theft_autoshrink_alloc_env(t, arg_index, ti);
+    void *instance = NULL;
+    if (env == NULL || THEFT_ALLOC_OK != theft_autoshrink_replay(t,
+            env, bits, req->bit_count, &instance)) {
+        const uint8_t byte = (uint8_t)THEFT_TRIAL_ERROR;
+        ssize_t wr = write(cp->out_fd, &byte, sizeof(byte));
+        (void)wr;
+        exit(EXIT_FAILURE);
+    }
+
+    /* The old instance may still be referenced further up the stack,
+     * so it's left alone. */
+    t->trial.args[arg_index].u.as.env = env;
+    t->trial.args[arg_index].instance = instance;
+    if (t->report != NULL) {
+        t->report->stage = THEFT_FORK_STAGE_PROPERTY;
+    }
+}
+
+/* Send the current trial's bits for the entry's argument to its
+ * snapshot, and get the pid of the worker it forks. */
+static bool
+send_resume(struct theft *t, const struct checkpoint_entry *e,
+        int result_fd, int exit_fd, pid_t *pid) {
+    const struct autoshrink_bit_pool *pool =
+        t->trial.args[e->arg_index].u.as.env->bit_pool;
+    const struct resume_request req = { .bit_count = pool->consumed };
+    const int fds[2] = { result_fd, exit_fd };
+    return send_with_fds(e->fd, &req, sizeof(req), fds, 2, 0)
+        && write_all(e->fd, pool->bits, (req.bit_count + 7) / 8)
+        && read_all(e->fd, pid, sizeof(*pid))
+        && *pid != -1;
+}
+
+/* Stop the I'th snapshot, and remove it from the table. */
+static void
+drop_entry(struct theft *t, size_t i) {
+    struct checkpoint_info *cp = &t->checkpoint;
+    assert(i < cp->count);
+    if (cp->entries[i].fd != -1) { close(cp->entries[i].fd); }
+    memmove(&cp->entries[i], &cp->entries[i + 1],
+        (cp->count - i - 1) * sizeof(cp->entries[0]));
+    cp->count--;
+}
+
+static bool
+send_with_fds(int fd, const void *buf, size_t size,
+        const int *fds, size_t fd_count, int flags) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    memset(&control, 0x00, sizeof(control));
+    assert(fd_count <= 2);
+
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = CMSG_SPACE(fd_count * sizeof(int)),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+
+    ssize_t wr = 0;
+    do {
+        wr = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+    } while (wr == -1 && errno == EINTR);
+    if (wr == -1) { return false; }
+
+    /* The fds go with the first byte, send the rest if necessary. */
+    return write_all(fd, (const uint8_t *)buf + wr, size - wr);
+}
+
+/* Receive up to SIZE bytes, and FD_COUNT fds (which are left as
+ * they were if none were sent). */
+static ssize_t
+recv_with_fds(int fd, void *buf, size_t size,
+        int *fds, size_t fd_count, int flags) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    assert(fd_count <= 2);
+
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = size,
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    const ssize_t rd = recvmsg(fd, &msg, flags);
+    if (rd <= 0) { return rd; }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET
+        && cmsg->cmsg_type == SCM_RIGHTS) {
+        int got[2] = { -1, -1 };
+        size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (received > 2) { received = 2; } /* the rest didn't fit */
+        memcpy(got, CMSG_DATA(cmsg), received * sizeof(int));
+        for (size_t i = 0; i < received; i++) {
+            if (i < fd_count) {
+                fds[i] = got[i];
+            } else {
+                close(got[i]);
+            }
+        }
+    }
+    return rd;
+}
+
+static bool
+write_all(int fd, const void *buf, size_t size) {
+    const uint8_t *p = buf;
+    while (size > 0) {
+        ssize_t wr = send(fd, p, size, MSG_NOSIGNAL);
+        if (wr == -1) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        p += wr;
+        size -= wr;
+    }
+    return true;
+}
+
+static bool
+read_all(int fd, void *buf, size_t size) {
+    uint8_t *p = buf;
+    while (size > 0) {
+        ssize_t rd = read(fd, p, size);
+        if (rd == -1) {
+            if (errno == EINTR) { continue; }
+            return false;
+        } else if (rd == 0) {
+            return false;
+        }
+        p += rd;
+        size -= rd;
+    }
+    return true;
+}
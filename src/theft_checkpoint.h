@@ -0,0 +1,44 @@
+#ifndef THEFT_CHECKPOINT_H
+#define THEFT_CHECKPOINT_H
+
+#include "theft_types_internal.h"
+
+struct worker_info;
+
+/* If T is configured to keep checkpoints, and every argument uses
+ * autoshrinking, open the socket workers register snapshots over.
+ * Returns false on error. */
+bool
+theft_checkpoint_init(struct theft *t);
+
+/* Stop any snapshots, and close the socket. */
+void
+theft_checkpoint_free(struct theft *t);
+
+/* Start (or stop) taking snapshots in workers, around shrinking.
+ * Disarming also stops any snapshots that were kept. */
+void
+theft_checkpoint_arm(struct theft *t);
+void
+theft_checkpoint_disarm(struct theft *t);
+
+/* In a worker process, about to run a trial: close the control
+ * sockets for snapshots inherited from the main process, and note
+ * where the worker's results go. */
+void
+theft_checkpoint_enter_worker(struct theft *t, size_t worker_id,
+    int out_fd);
+
+/* If a kept snapshot matches the current trial's arguments, have it
+ * fork a worker that resumes from there, writing its result to
+ * worker->fds[1]. Returns false if there isn't one (or it failed), and
+ * the worker should be forked as usual. */
+bool
+theft_checkpoint_resume(struct theft *t, struct worker_info *worker);
+
+/* Save any snapshots workers have registered since the last call,
+ * stopping the oldest ones once there are too many. */
+void
+theft_checkpoint_collect(struct theft *t);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef THEFT_CHECKPOINT_INTERNAL_H
+#define THEFT_CHECKPOINT_INTERNAL_H
+
+#include "theft_checkpoint.h"
+
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Sent by a worker to the main process when it keeps a snapshot,
+ * along with the snapshot's control socket (via SCM_RIGHTS). */
+struct checkpoint_registration {
+    uint64_t key;
+    size_t bit_position;
+    size_t worker_id;
+    uint8_t arg_index;
+};
+
+/* Sent to a snapshot to resume from it, along with the result pipe
+ * and exit pipe for the new worker. It's followed by the bits the
+ * argument's alloc callback consumed. The snapshot replies with the
+ * new worker's pid, or -1. */
+struct resume_request {
+    size_t bit_count;
+};
+
+static uint64_t
+prefix_key(struct theft *t, uint8_t arg_index, size_t bit_position);
+
+static bool
+known_key(const struct theft *t, uint64_t key);
+
+static void
+take_snapshot(struct theft *t, uint8_t arg_index, size_t bit_position,
+    uint64_t key);
+
+static void
+snapshot_main(struct theft *t, int fd, uint8_t arg_index);
+
+static void
+resume_worker(struct theft *t, uint8_t arg_index,
+    const struct resume_request *req, const uint8_t *bits, int fds[2]);
+
+static bool
+send_resume(struct theft *t, const struct checkpoint_entry *e,
+    int result_fd, int exit_fd, pid_t *pid);
+
+static void
+drop_entry(struct theft *t, size_t i);
+
+static bool
+send_with_fds(int fd, const void *buf, size_t size,
+    const int *fds, size_t fd_count, int flags);
+
+static ssize_t
+recv_with_fds(int fd, void *buf, size_t size,
+    int *fds, size_t fd_count, int flags);
+
+static bool
+write_all(int fd, const void *buf, size_t size);
+
+static bool
+read_all(int fd, void *buf, size_t size);
+
+#endif
@@ -0,0 +1,111 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE     /* for setitimer(2) */
+#endif
+
+#include "theft_deadline.h"
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+/* The deadline is tracked with an ITIMER_REAL timer, which sends
+ * SIGALRM when it expires. The signal handler can only see globals,
+ * so there is only one deadline per process, but only one property
+ * function call is running at a time anyway. (A forked worker gets
+ * its own copy, and sets its own timer.)
+ *
+ * When unwinding, the handler siglongjmps back out of the property
+ * function. This is only as safe as whatever the property was doing
+ * at the time -- if it was in the middle of malloc(3) or holding a
+ * lock, the process will likely be left in a bad state. It's meant
+ * for code that is stuck in a loop of its own. */
+
+static volatile sig_atomic_t exceeded = 0;
+static volatile sig_atomic_t jump_armed = 0;
+static sigjmp_buf jump_buf;
+
+static void
+handle_alarm(int sig);
+
+static bool
+set_timer(size_t msec);
+
+bool
+theft_deadline_init(struct theft *t) {
+    if (t->deadline.timeout == 0) { return true; }
+    struct sigaction sa;
+    memset(&sa, 0x00, sizeof(sa));
+    sa.sa_handler = handle_alarm;
+    sigemptyset(&sa.sa_mask);
+    if (-1 == sigaction(SIGALRM, &sa, &t->deadline.old_action)) {
+        perror("sigaction");
+        return false;
+    }
+    t->deadline.installed = true;
+    return true;
+}
+
+void
+theft_deadline_free(struct theft *t) {
+    if (!t->deadline.installed) { return; }
+    set_timer(0);
+    sigaction(SIGALRM, &t->deadline.old_action, NULL);
+    t->deadline.installed = false;
+}
+
+enum theft_trial_res
+theft_deadline_call(struct theft *t, void **args,
+        theft_deadline_call_cb *cb) {
+    exceeded = 0;
+    jump_armed = 0;
+
+    if (t->deadline.unwind && sigsetjmp(jump_buf, 1) != 0) {
+        /* Unwound from the signal handler: the timer has expired. */
+        t->deadline.last_exceeded = true;
+        return THEFT_TRIAL_FAIL;
+    }
+
+    jump_armed = t->deadline.unwind;
+    if (!set_timer(t->deadline.timeout)) {
+        jump_armed = 0;
+        return THEFT_TRIAL_ERROR;
+    }
+    enum theft_trial_res res = cb(t, args);
+    jump_armed = 0;
+    set_timer(0);
+
+    t->deadline.last_exceeded = (exceeded != 0);
+    return res;
+}
+
+bool
+theft_trial_deadline_exceeded(struct theft *t) {
+    return t->deadline.timeout > 0 && exceeded != 0;
+}
+
+static void
+handle_alarm(int sig) {
+    (void)sig;
+    exceeded = 1;
+    if (jump_armed) {
+        jump_armed = 0;
+        siglongjmp(jump_buf, 1);
+    }
+}
+
+/* Start a one-shot timer for MSEC milliseconds, or stop it if 0. */
+static bool
+set_timer(size_t msec) {
+    struct itimerval it = {
+        .it_value = {
+            .tv_sec = msec / 1000,
+            .tv_usec = 1000 * (msec % 1000),
+        },
+    };
+    if (-1 == setitimer(ITIMER_REAL, &it, NULL)) {
+        perror("setitimer");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef THEFT_DEADLINE_H
+#define THEFT_DEADLINE_H
+
+#include "theft_types_internal.h"
+
+/* Call the property function with ARGS, via CB. */
+typedef enum theft_trial_res
+theft_deadline_call_cb(struct theft *t, void **args);
+
+/* Install the SIGALRM handler used for deadlines, if T has one.
+ * Returns false on error. */
+bool
+theft_deadline_init(struct theft *t);
+
+/* Restore the previous SIGALRM handler. */
+void
+theft_deadline_free(struct theft *t);
+
+/* Call CB with ARGS, with a timer set for T's deadline. If the deadline
+ * passes, theft_trial_deadline_exceeded starts returning true, and
+ * when unwinding, the call is abandoned and treated as a failure. */
+enum theft_trial_res
+theft_deadline_call(struct theft *t, void **args,
+    theft_deadline_call_cb *cb);
+
+#endif
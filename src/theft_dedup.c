@@ -0,0 +1,304 @@
+#include <string.h>
+#include <assert.h>
+
+#include "theft_dedup.h"
+#include "theft_bloom.h"
+#include "theft_types_internal.h"
+
+/* The exact set is an open-addressing hash table of 128-bit keys,
+ * using linear probing, so a lookup usually only touches one or two
+ * cache lines. (The keys are already hashes, so the low bits are
+ * used directly as the index.) An all-zero key marks an empty slot,
+ * so a key that happens to be all zeroes is stored as { 0, 1 }.
+ *
+ * The table doubles in size when it's half full. If that would use
+ * more than max_bytes, then all of its keys are moved into a bloom
+ * filter, and that is used from then on. */
+
+/* log2 of the initial number of slots in the exact set. (16 KB) */
+#define DEF_SET_BITS 10
+
+#define LOG_DEDUP 0
+
+struct theft_dedup {
+    enum theft_dedup_mode mode;
+    size_t max_bytes;
+
+    /* THEFT_DEDUP_EXACT */
+    uint8_t size2;              /* log2 of slot count */
+    size_t count;
+    struct theft_hash128 *keys;
+
+    /* THEFT_DEDUP_BLOOM */
+    struct theft_bloom *bloom;
+
+    /* Shared with other runs, instead of the above. */
+    struct theft_shared_dedup *shared;
+    /* Keys not yet added to shared (an exact set), if pending. */
+    struct theft_dedup *pending;
+};
+
+static bool switch_to_bloom(struct theft_dedup *d);
+static bool grow_set(struct theft_dedup *d);
+static struct theft_hash128 *find_slot(struct theft_hash128 *keys,
+    uint8_t size2, struct theft_hash128 key);
+
+struct theft_dedup *theft_dedup_init(enum theft_dedup_mode mode,
+        size_t max_bytes) {
+    struct theft_dedup *d = calloc(1, sizeof(*d));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->mode = mode;
+    d->max_bytes = (max_bytes ? max_bytes : THEFT_DEF_DEDUP_MAX_BYTES);
+
+    switch (mode) {
+    case THEFT_DEDUP_EXACT:
+        if ((1LLU << DEF_SET_BITS) * sizeof(struct theft_hash128)
+            <= d->max_bytes) {
+            d->size2 = DEF_SET_BITS;
+            d->keys = calloc(1LLU << d->size2, sizeof(d->keys[0]));
+            if (d->keys == NULL) {
+                free(d);
+                return NULL;
+            }
+            break;
+        }
+        /* Not even the initial set fits, use the bloom filter. */
+        d->mode = THEFT_DEDUP_BLOOM;
+        /* fall through */
+    case THEFT_DEDUP_BLOOM:
+        d->bloom = theft_bloom_init(NULL);
+        if (d->bloom == NULL) {
+            free(d);
+            return NULL;
+        }
+        break;
+    default:
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+struct theft_dedup *theft_dedup_init_shared(struct theft_shared_dedup *shared) {
+    struct theft_dedup *d = calloc(1, sizeof(*d));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->mode = THEFT_DEDUP_BLOOM;
+    d->shared = shared;
+    return d;
+}
+
+struct theft_dedup *theft_dedup_init_pending(struct theft_shared_dedup *shared) {
+    struct theft_dedup *d = theft_dedup_init_shared(shared);
+    if (d == NULL) {
+        return NULL;
+    }
+    d->pending = theft_dedup_init(THEFT_DEDUP_EXACT, SIZE_MAX);
+    if (d->pending == NULL) {
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+bool theft_dedup_commit(struct theft_dedup *d) {
+    struct theft_dedup *p = d->pending;
+    if (p == NULL || p->count == 0) {
+        return true;
+    } else if (p->mode != THEFT_DEDUP_EXACT) {
+        return false;           /* couldn't grow, keys are lost */
+    }
+
+    for (size_t i = 0; i < (1LLU << p->size2); i++) {
+        const struct theft_hash128 key = p->keys[i];
+        if (key.lo != 0 || key.hi != 0) {
+            theft_bloom_shared_check_and_mark(d->shared, key);
+        }
+    }
+    memset(p->keys, 0x00, (1LLU << p->size2) * sizeof(p->keys[0]));
+    p->count = 0;
+    return true;
+}
+
+struct theft_shared_dedup *theft_shared_dedup_new(size_t size) {
+    return theft_bloom_shared_init(size ? size : THEFT_DEF_SHARED_DEDUP_BYTES);
+}
+
+void theft_shared_dedup_free(struct theft_shared_dedup *shared) {
+    theft_bloom_shared_free(shared);
+}
+
+static struct theft_hash128 normalize(struct theft_hash128 key) {
+    if (key.lo == 0 && key.hi == 0) { key.hi = 1; }
+    return key;
+}
+
+/* Find the key's slot, or the empty slot where it would go. */
+static struct theft_hash128 *find_slot(struct theft_hash128 *keys,
+        uint8_t size2, struct theft_hash128 key) {
+    const uint64_t mask = (1LLU << size2) - 1;
+    for (uint64_t i = key.lo & mask; ; i = (i + 1) & mask) {
+        struct theft_hash128 *slot = &keys[i];
+        if ((slot->lo == key.lo && slot->hi == key.hi)
+            || (slot->lo == 0 && slot->hi == 0)) {
+            return slot;
+        }
+    }
+}
+
+bool theft_dedup_mark(struct theft_dedup *d, struct theft_hash128 key) {
+    if (d->pending != NULL) {
+        return theft_bloom_shared_check(d->shared, key)
+            || theft_dedup_mark(d->pending, key);
+    } else if (d->shared != NULL) {
+        theft_bloom_shared_check_and_mark(d->shared, key);
+        return true;
+    } else if (d->mode == THEFT_DEDUP_BLOOM) {
+        return theft_bloom_mark(d->bloom, key);
+    }
+
+    key = normalize(key);
+    struct theft_hash128 *slot = find_slot(d->keys, d->size2, key);
+    if (slot->lo != 0 || slot->hi != 0) {
+        return true;            /* already present */
+    }
+
+    /* Keep the load factor at or under 1/2. */
+    if (2 * (d->count + 1) > (1LLU << d->size2)) {
+        if (!grow_set(d)) {
+            return false;
+        }
+        if (d->mode == THEFT_DEDUP_BLOOM) {
+            return theft_bloom_mark(d->bloom, key);
+        }
+        slot = find_slot(d->keys, d->size2, key);
+    }
+
+    *slot = key;
+    d->count++;
+    return true;
+}
+
+bool theft_dedup_check(struct theft_dedup *d, struct theft_hash128 key) {
+    if (d->pending != NULL) {
+        return theft_bloom_shared_check(d->shared, key)
+            || theft_dedup_check(d->pending, key);
+    } else if (d->shared != NULL) {
+        return theft_bloom_shared_check(d->shared, key);
+    } else if (d->mode == THEFT_DEDUP_BLOOM) {
+        return theft_bloom_check(d->bloom, key);
+    }
+
+    key = normalize(key);
+    const struct theft_hash128 *slot = find_slot(d->keys, d->size2, key);
+    return slot->lo != 0 || slot->hi != 0;
+}
+
+bool theft_dedup_check_and_mark(struct theft_dedup *d,
+        struct theft_hash128 key) {
+    if (d->pending != NULL) {
+        return theft_bloom_shared_check(d->shared, key)
+            || theft_dedup_check_and_mark(d->pending, key);
+    } else if (d->shared != NULL) {
+        return theft_bloom_shared_check_and_mark(d->shared, key);
+    }
+    if (theft_dedup_check(d, key)) {
+        return true;
+    }
+    theft_dedup_mark(d, key);
+    return false;
+}
+
+/* Double the set's size, or switch to a bloom filter if
+ * that would exceed the memory budget. */
+static bool grow_set(struct theft_dedup *d) {
+    const uint8_t nsize2 = d->size2 + 1;
+    const size_t nbytes = (1LLU << nsize2) * sizeof(struct theft_hash128);
+    if (nbytes > d->max_bytes) {
+        return switch_to_bloom(d);
+    }
+
+    struct theft_hash128 *nkeys = calloc(1LLU << nsize2, sizeof(nkeys[0]));
+    if (nkeys == NULL) {
+        return switch_to_bloom(d);
+    }
+
+    for (size_t i = 0; i < (1LLU << d->size2); i++) {
+        const struct theft_hash128 key = d->keys[i];
+        if (key.lo != 0 || key.hi != 0) {
+            *find_slot(nkeys, nsize2, key) = key;
+        }
+    }
+    LOG(3 - LOG_DEDUP, "%s: growing to %zd bytes, %zd keys\n",
+        __func__, nbytes, d->count);
+
+    free(d->keys);
+    d->keys = nkeys;
+    d->size2 = nsize2;
+    return true;
+}
+
+static bool switch_to_bloom(struct theft_dedup *d) {
+    LOG(2 - LOG_DEDUP, "%s: exact set over budget (%zd bytes) after"
+        " %zd keys, switching to bloom filter\n",
+        __func__, d->max_bytes, d->count);
+    d->bloom = theft_bloom_init(NULL);
+    if (d->bloom == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < (1LLU << d->size2); i++) {
+        const struct theft_hash128 key = d->keys[i];
+        if (key.lo != 0 || key.hi != 0) {
+            theft_bloom_mark(d->bloom, key);
+        }
+    }
+    free(d->keys);
+    d->keys = NULL;
+    d->count = 0;
+    d->mode = THEFT_DEDUP_BLOOM;
+    return true;
+}
+
+void theft_dedup_stats(const struct theft_dedup *d,
+        struct theft_dedup_stats *stats) {
+    struct theft_dedup_stats res = { .mode = d->mode, };
+    struct theft_bloom_stats bs;
+    if (d->shared != NULL) {
+        theft_bloom_shared_stats(d->shared, &bs);
+        res.memory = bs.memory;
+        res.marked = bs.marked;
+        res.fpr = bs.fpr;
+        if (d->pending != NULL) {
+            /* Keys that haven't been committed yet. */
+            struct theft_dedup_stats ps;
+            theft_dedup_stats(d->pending, &ps);
+            res.memory += ps.memory;
+            res.marked += ps.marked;
+        }
+    } else if (d->mode == THEFT_DEDUP_BLOOM) {
+        theft_bloom_stats(d->bloom, &bs);
+        res.memory = bs.memory;
+        res.marked = bs.marked;
+        res.fpr = bs.fpr;
+        res.saturated = bs.saturated;
+    } else {
+        res.memory = (1LLU << d->size2) * sizeof(d->keys[0]);
+        res.marked = d->count;
+    }
+    memcpy(stats, &res, sizeof(res));
+}
+
+enum theft_dedup_mode theft_dedup_mode(const struct theft_dedup *d) {
+    return d->mode;
+}
+
+void theft_dedup_free(struct theft_dedup *d) {
+    if (d->pending) { theft_dedup_free(d->pending); }
+    if (d->bloom) { theft_bloom_free(d->bloom); }
+    free(d->keys);
+    free(d);
+}
@@ -0,0 +1,61 @@
+#ifndef THEFT_DEDUP_H
+#define THEFT_DEDUP_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "theft.h"
+
+/* Opaque type for the set of argument combinations already tried.
+ * Depending on the mode, this is either a bloom filter, or an exact
+ * set of 128-bit keys that switches to a bloom filter when it would
+ * exceed its memory budget. */
+struct theft_dedup;
+
+/* Initialize a dedup set. max_bytes is only used by
+ * THEFT_DEDUP_EXACT; 0 means THEFT_DEF_DEDUP_MAX_BYTES. */
+struct theft_dedup *theft_dedup_init(enum theft_dedup_mode mode,
+    size_t max_bytes);
+
+/* Initialize a dedup set that uses SHARED (which it doesn't own),
+ * so keys marked by other runs using it are found too. Its mode is
+ * THEFT_DEDUP_BLOOM. */
+struct theft_dedup *theft_dedup_init_shared(struct theft_shared_dedup *shared);
+
+/* Initialize a dedup set that checks SHARED, but keeps keys marked in
+ * it to itself until theft_dedup_commit is called, so other processes
+ * don't see them until then. */
+struct theft_dedup *theft_dedup_init_pending(struct theft_shared_dedup *shared);
+
+/* Add the keys marked since the last commit to the shared set.
+ * Returns false on error. */
+bool theft_dedup_commit(struct theft_dedup *d);
+
+/* Mark a key as tried. Returns false if it could not be
+ * recorded (e.g. if the bloom filter is saturated). */
+bool theft_dedup_mark(struct theft_dedup *d, struct theft_hash128 key);
+
+/* Check whether the key has (probably, if using a bloom
+ * filter) been marked. */
+bool theft_dedup_check(struct theft_dedup *d, struct theft_hash128 key);
+
+/* Check whether the key has been marked, and mark it if not. With a
+ * shared dedup set, this is a single atomic operation, so when
+ * concurrent runs check and mark the same key, it's only missing for
+ * one of them. */
+bool theft_dedup_check_and_mark(struct theft_dedup *d,
+    struct theft_hash128 key);
+
+/* Get the set's current mode, size, and estimated accuracy. */
+void theft_dedup_stats(const struct theft_dedup *d,
+    struct theft_dedup_stats *stats);
+
+/* Get the mode currently in use -- this changes from
+ * THEFT_DEDUP_EXACT to THEFT_DEDUP_BLOOM on falling back. */
+enum theft_dedup_mode theft_dedup_mode(const struct theft_dedup *d);
+
+/* Free the dedup set. */
+void theft_dedup_free(struct theft_dedup *d);
+
+#endif
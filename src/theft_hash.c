@@ -1,17 +1,80 @@
 #include "theft.h"
 
 #include <assert.h>
+#include <string.h>
 
-/* Fowler/Noll/Vo hash, 64-bit FNV-1a.
- * This hashing algorithm is in the public domain.
- * For more details, see: http://www.isthe.com/chongo/tech/comp/fnv/. */
-static const uint64_t fnv64_prime = 1099511628211L;
-static const uint64_t fnv64_offset_basis = 14695981039346656037UL;
+/* A multiply-rotate hash in the style of xxHash64 (by Yann Collet,
+ * BSD licensed; see https://github.com/Cyan4973/xxHash): four
+ * independent 64-bit lanes each absorb 8 bytes per step, so it hashes
+ * 32 bytes per round rather than 1, and the lanes are combined in two
+ * different ways to get a 128-bit result.
+ *
+ * Unlike xxHash64, input that doesn't fill a whole stripe is zero-padded
+ * and run through the lanes (the total length is mixed in at the end),
+ * so short inputs still affect all 256 bits of state. */
+static const uint64_t prime1 = 0x9E3779B185EBCA87LLU;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FLLU;
+static const uint64_t prime3 = 0x165667B19E3779F9LLU;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63LLU;
+static const uint64_t prime5 = 0x27D4EB2F165667C5LLU;
+
+#define STRIPE_SIZE sizeof(((struct theft_hasher *)0)->buf)
+
+static uint64_t rotl(uint64_t x, uint8_t r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const uint8_t *p) {
+    /* Little-endian load; compilers turn this into a single
+     * load on little-endian targets. */
+    return ((uint64_t)p[0] << 0) | ((uint64_t)p[1] << 8)
+        | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+        | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+        | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+static uint64_t merge64(uint64_t h, uint64_t acc) {
+    h ^= round64(0, acc);
+    return h * prime1 + prime4;
+}
+
+static uint64_t avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void
+sink_stripes(uint64_t acc[4], const uint8_t *data, size_t stripes) {
+    uint64_t a0 = acc[0], a1 = acc[1], a2 = acc[2], a3 = acc[3];
+    for (size_t i = 0; i < stripes; i++) {
+        const uint8_t *p = &data[i * STRIPE_SIZE];
+        a0 = round64(a0, read64(&p[0]));
+        a1 = round64(a1, read64(&p[8]));
+        a2 = round64(a2, read64(&p[16]));
+        a3 = round64(a3, read64(&p[24]));
+    }
+    acc[0] = a0; acc[1] = a1; acc[2] = a2; acc[3] = a3;
+}
 
 /* Initialize a hasher for incremental hashing. */
 void theft_hash_init(struct theft_hasher *h) {
     assert(h);
-    h->accum = fnv64_offset_basis;
+    h->acc[0] = prime1 + prime2;
+    h->acc[1] = prime2;
+    h->acc[2] = 0;
+    h->acc[3] = -prime1;
+    h->total = 0;
+    h->buf_used = 0;
 }
 
 /* Sink more data into an incremental hash. */
@@ -20,19 +83,75 @@ void theft_hash_sink(struct theft_hasher *h,
     assert(h);
     assert(data);
     if (h == NULL || data == NULL) { return; }
-    uint64_t a = h->accum;
-    for (size_t i = 0; i < bytes; i++) {
-        a = (a ^ data[i]) * fnv64_prime;
+    h->total += bytes;
+
+    /* Top off a partially filled stripe first. */
+    if (h->buf_used > 0) {
+        size_t space = STRIPE_SIZE - h->buf_used;
+        if (bytes < space) {
+            memcpy(&h->buf[h->buf_used], data, bytes);
+            h->buf_used += bytes;
+            return;
+        }
+        memcpy(&h->buf[h->buf_used], data, space);
+        sink_stripes(h->acc, h->buf, 1);
+        h->buf_used = 0;
+        data += space;
+        bytes -= space;
+    }
+
+    const size_t stripes = bytes / STRIPE_SIZE;
+    sink_stripes(h->acc, data, stripes);
+
+    const size_t rem = bytes % STRIPE_SIZE;
+    memcpy(h->buf, &data[stripes * STRIPE_SIZE], rem);
+    h->buf_used = rem;
+}
+
+/* Absorb any buffered input, then combine the lanes into two
+ * differently mixed 64-bit halves. */
+static struct theft_hash128 finish(struct theft_hasher *h) {
+    uint64_t *acc = h->acc;
+    if (h->buf_used > 0) {
+        memset(&h->buf[h->buf_used], 0x00, STRIPE_SIZE - h->buf_used);
+        sink_stripes(acc, h->buf, 1);
     }
-    h->accum = a;
+
+    uint64_t lo = rotl(acc[0], 1) + rotl(acc[1], 7)
+        + rotl(acc[2], 12) + rotl(acc[3], 18);
+    lo = merge64(lo, acc[0]);
+    lo = merge64(lo, acc[1]);
+    lo = merge64(lo, acc[2]);
+    lo = merge64(lo, acc[3]);
+    lo += h->total;
+
+    uint64_t hi = rotl(acc[0], 41) + rotl(acc[1], 29)
+        + rotl(acc[2], 23) + rotl(acc[3], 11) + prime5;
+    hi = merge64(hi, acc[3]);
+    hi = merge64(hi, acc[2]);
+    hi = merge64(hi, acc[1]);
+    hi = merge64(hi, acc[0]);
+    hi ^= h->total * prime5;
+
+    struct theft_hash128 res = {
+        .lo = avalanche(lo),
+        .hi = avalanche(hi),
+    };
+    theft_hash_init(h);                /* reset */
+    return res;
 }
 
 /* Finish hashing and get the result. */
 theft_hash theft_hash_done(struct theft_hasher *h) {
     assert(h);
-    theft_hash res = h->accum;
-    theft_hash_init(h);                /* reset */
-    return res;
+    return finish(h).lo;
+}
+
+/* Finish hashing and get a 128-bit result. The low half
+ * is the same as theft_hash_done's result. */
+struct theft_hash128 theft_hash_done128(struct theft_hasher *h) {
+    assert(h);
+    return finish(h);
 }
 
 /* Hash a buffer in one pass. (Wraps the above functions.) */
@@ -43,3 +162,13 @@ theft_hash theft_hash_onepass(const uint8_t *data, size_t bytes) {
     theft_hash_sink(&h, data, bytes);
     return theft_hash_done(&h);
 }
+
+/* Hash a buffer in one pass, with a 128-bit result. */
+struct theft_hash128
+theft_hash_onepass128(const uint8_t *data, size_t bytes) {
+    assert(data);
+    struct theft_hasher h;
+    theft_hash_init(&h);
+    theft_hash_sink(&h, data, bytes);
+    return theft_hash_done128(&h);
+}
@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "theft_quantile.h"
+
+/* Each of the three middle markers is adjusted (by one rank at a time)
+ * whenever it's at least one rank off from where the quantile it
+ * tracks should be, and its height is re-estimated with a piecewise
+ * parabolic fit through it and its neighbors, or linearly if that
+ * would put it out of order. */
+
+static void
+sort_heights(double *heights, size_t count);
+
+static double
+parabolic(const struct theft_quantile *q, size_t i, double d);
+
+static double
+linear(const struct theft_quantile *q, size_t i, double d);
+
+void theft_quantile_init(struct theft_quantile *q, double p) {
+    memset(q, 0x00, sizeof(*q));
+    q->p = p;
+}
+
+void theft_quantile_add(struct theft_quantile *q, double x) {
+    const double p = q->p;
+    if (q->count < 5) {
+        q->heights[q->count] = x;
+        q->count++;
+        if (q->count == 5) {
+            sort_heights(q->heights, 5);
+            for (size_t i = 0; i < 5; i++) { q->positions[i] = i + 1; }
+            q->desired[0] = 1;
+            q->desired[1] = 1 + 2*p;
+            q->desired[2] = 1 + 4*p;
+            q->desired[3] = 3 + 2*p;
+            q->desired[4] = 5;
+            q->increments[0] = 0;
+            q->increments[1] = p/2;
+            q->increments[2] = p;
+            q->increments[3] = (1 + p)/2;
+            q->increments[4] = 1;
+        }
+        return;
+    }
+
+    /* Find the cell the sample falls in, extending the minimum or
+     * maximum if necessary, and shift the markers above it. */
+    size_t k = 0;
+    if (x < q->heights[0]) {
+        q->heights[0] = x;
+        k = 0;
+    } else if (x >= q->heights[4]) {
+        q->heights[4] = x;
+        k = 3;
+    } else {
+        while (k < 3 && x >= q->heights[k + 1]) { k++; }
+    }
+    for (size_t i = k + 1; i < 5; i++) { q->positions[i]++; }
+    for (size_t i = 0; i < 5; i++) { q->desired[i] += q->increments[i]; }
+
+    for (size_t i = 1; i < 4; i++) {
+        const double off = q->desired[i] - q->positions[i];
+        if ((off >= 1 && q->positions[i + 1] - q->positions[i] > 1)
+            || (off <= -1 && q->positions[i - 1] - q->positions[i] < -1)) {
+            const double d = (off >= 0 ? 1 : -1);
+            double h = parabolic(q, i, d);
+            if (!(q->heights[i - 1] < h && h < q->heights[i + 1])) {
+                h = linear(q, i, d);
+            }
+            q->heights[i] = h;
+            q->positions[i] += d;
+        }
+    }
+    q->count++;
+}
+
+double theft_quantile_get(const struct theft_quantile *q) {
+    if (q->count >= 5) { return q->heights[2]; }
+    if (q->count == 0) { return 0; }
+
+    double sorted[5];
+    memcpy(sorted, q->heights, q->count * sizeof(sorted[0]));
+    sort_heights(sorted, q->count);
+    /* Nearest rank: ceil(p * count), counting from 1. */
+    const double exact = q->p * q->count;
+    size_t rank = (size_t)exact;
+    if (rank < exact) { rank++; }
+    if (rank > 0) { rank--; }
+    return sorted[rank < q->count ? rank : q->count - 1];
+}
+
+static void
+sort_heights(double *heights, size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        const double h = heights[i];
+        size_t j = i;
+        while (j > 0 && heights[j - 1] > h) {
+            heights[j] = heights[j - 1];
+            j--;
+        }
+        heights[j] = h;
+    }
+}
+
+static double
+parabolic(const struct theft_quantile *q, size_t i, double d) {
+    const double *n = q->positions;
+    const double *h = q->heights;
+    return h[i] + d / (n[i + 1] - n[i - 1])
+        * ((n[i] - n[i - 1] + d) * (h[i + 1] - h[i]) / (n[i + 1] - n[i])
+            + (n[i + 1] - n[i] - d) * (h[i] - h[i - 1]) / (n[i] - n[i - 1]));
+}
+
+static double
+linear(const struct theft_quantile *q, size_t i, double d) {
+    const size_t j = (d > 0 ? i + 1 : i - 1);
+    return q->heights[i]
+        + d * (q->heights[j] - q->heights[i])
+        / (q->positions[j] - q->positions[i]);
+}
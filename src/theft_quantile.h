@@ -0,0 +1,34 @@
+#ifndef THEFT_QUANTILE_H
+#define THEFT_QUANTILE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Streaming estimate of the P'th quantile of a series of samples,
+ * in constant space, using the P-square algorithm (Jain & Chlamtac,
+ * "The P² algorithm for dynamic calculation of quantiles and
+ * histograms without storing observations", 1985). */
+struct theft_quantile {
+    double p;
+    size_t count;
+    /* Five markers: the minimum, the P/2, P, and (1+P)/2 quantiles,
+     * and the maximum. Until there are five samples, heights just
+     * holds them. */
+    double heights[5];
+    double positions[5];        /* 1-based rank of each marker */
+    double desired[5];          /* where each marker should be */
+    double increments[5];       /* how far that moves per sample */
+};
+
+/* Initialize Q to estimate the P'th quantile, 0 < P < 1. */
+void theft_quantile_init(struct theft_quantile *q, double p);
+
+/* Add a sample. */
+void theft_quantile_add(struct theft_quantile *q, double x);
+
+/* Get the current estimate. With fewer than five samples, this is
+ * the nearest-rank quantile of those; with none, it's 0. */
+double theft_quantile_get(const struct theft_quantile *q);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "theft_types_internal.h"
 #include "theft_rng.h"
+#include "theft_bits.h"
 
 #include <inttypes.h>
 #include <assert.h>
@@ -53,6 +54,15 @@ void theft_random_bits_bulk(struct theft *t, uint32_t bit_count, uint64_t *buf)
     uint8_t shift = 0;
     size_t offset = 0;
 
+    /* If no bits are buffered, whole words can be filled directly
+     * from the PRNG, in blocks. */
+    if (t->prng.bits_available == 0 && rem >= 64) {
+        const size_t words = rem / 64;
+        theft_rng_fill(t->prng.rng, buf, words);
+        offset = words;
+        rem -= 64 * words;
+    }
+
     while (rem > 0) {
         if (t->prng.bits_available == 0) {
             t->prng.buf = theft_rng_random(t->prng.rng);
@@ -72,6 +82,7 @@ void theft_random_bits_bulk(struct theft *t, uint32_t bit_count, uint64_t *buf)
             __func__, rem, t->prng.bits_available, t->prng.buf, offset, take);
 
         const uint64_t mask = get_mask(take);
+        if (shift == 0) { buf[offset] = 0; }
         buf[offset] |= (t->prng.buf & mask) << shift;
         LOG(5, "== buf[%zd]: %016" PRIx64 " (%u / %u)\n",
             offset, buf[offset], bit_count - rem, bit_count);
@@ -111,10 +122,7 @@ uint64_t theft_random_choice(struct theft *t, uint64_t ceil) {
 
     /* If ceil is a power of two, just return that many bits. */
     if ((ceil & (ceil - 1)) == 0) {
-        uint8_t log2_ceil = 1;
-        while (ceil > (1LLU << log2_ceil)) {
-            log2_ceil++;
-        }
+        const uint8_t log2_ceil = theft_bits_ctz(ceil);
         assert((1LLU << log2_ceil) == ceil);
         return theft_random_bits(t, log2_ceil);
     }
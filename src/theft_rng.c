@@ -58,42 +58,252 @@
  * multiple instances running in the same address space.
  * 
  * Also, the functions in the module's public interface have
- * been prefixed with "theft_rng_". */
+ * been prefixed with "theft_rng_", and MT19937-64 is now one of
+ * several PRNG backends, selected via a table of function pointers.
+ *
+ * The xoshiro256** backend is based on the public domain reference
+ * implementation by David Blackman and Sebastiano Vigna:
+ *     http://xoshiro.di.unimi.it/xoshiro256starstar.c */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
 #include "theft_rng.h"
 
-#define THEFT_MT_PARAM_N 312
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Operations for a PRNG backend. STATE points to state_size bytes. */
+struct theft_rng_backend {
+    size_t state_size;
+    void (*reset)(void *state, uint64_t seed);
+    uint64_t (*next)(void *state);
+    /* Write COUNT words to BUF, same as COUNT calls to next. */
+    void (*fill)(void *state, uint64_t *buf, size_t count);
+    /* Advance the state as if by a large number of calls to next,
+     * or NULL if not supported. */
+    void (*jump)(void *state);
+};
+
 struct theft_rng {
+    const struct theft_rng_backend *backend;
+    uint64_t state[];
+};
+
+static void mt_reset(void *state, uint64_t seed);
+static uint64_t mt_next(void *state);
+static void mt_fill(void *state, uint64_t *buf, size_t count);
+static void xoshiro_reset(void *state, uint64_t seed);
+static uint64_t xoshiro_next(void *state);
+static void xoshiro_fill(void *state, uint64_t *buf, size_t count);
+static void xoshiro_jump(void *state);
+
+#define THEFT_MT_PARAM_N 312
+struct mt_state {
     uint64_t mt[THEFT_MT_PARAM_N]; /* the array for the state vector  */
     int16_t mti;
 };
 
-#define NN THEFT_MT_PARAM_N
-#define MM 156
-#define MATRIX_A 0xB5026F5AA96619E9ULL
-#define UM 0xFFFFFFFF80000000ULL /* Most significant 33 bits */
-#define LM 0x7FFFFFFFULL /* Least significant 31 bits */
+struct xoshiro_state {
+    uint64_t s[4];
+};
+
+static const struct theft_rng_backend mt19937_64_backend = {
+    .state_size = sizeof(struct mt_state),
+    .reset = mt_reset,
+    .next = mt_next,
+    .fill = mt_fill,
+    .jump = NULL,
+};
 
-static uint64_t genrand64_int64(struct theft_rng *r);
+static const struct theft_rng_backend xoshiro256ss_backend = {
+    .state_size = sizeof(struct xoshiro_state),
+    .reset = xoshiro_reset,
+    .next = xoshiro_next,
+    .fill = xoshiro_fill,
+    .jump = xoshiro_jump,
+};
+
+static const struct theft_rng_backend *
+get_backend(enum theft_prng type) {
+    switch (type) {
+    case THEFT_PRNG_DEFAULT:
+    case THEFT_PRNG_XOSHIRO256SS:
+        return &xoshiro256ss_backend;
+    case THEFT_PRNG_MT19937_64:
+        return &mt19937_64_backend;
+    default:
+        return NULL;
+    }
+}
 
-/* Heap-allocate a mersenne twister struct. */
+/* Heap-allocate a PRNG, using the default backend. */
 struct theft_rng *theft_rng_init(uint64_t seed) {
-    struct theft_rng *mt = malloc(sizeof(struct theft_rng));
-    if (mt == NULL) { return NULL; }
-    theft_rng_reset(mt, seed);
-    return mt;
+    return theft_rng_init_type(THEFT_PRNG_DEFAULT, seed);
+}
+
+/* Heap-allocate a PRNG of a particular type. Returns NULL on
+ * allocation failure or an unknown type. */
+struct theft_rng *theft_rng_init_type(enum theft_prng type, uint64_t seed) {
+    const struct theft_rng_backend *backend = get_backend(type);
+    if (backend == NULL) { return NULL; }
+    struct theft_rng *rng = malloc(offsetof(struct theft_rng, state)
+        + backend->state_size);
+    if (rng == NULL) { return NULL; }
+    rng->backend = backend;
+    theft_rng_reset(rng, seed);
+    return rng;
+}
+
+/* Free a heap-allocated PRNG. */
+void theft_rng_free(struct theft_rng *rng) {
+    free(rng);
+}
+
+/* Copy SRC's state to DST, which must use the same backend. */
+void theft_rng_copy(struct theft_rng *dst, const struct theft_rng *src) {
+    assert(dst->backend == src->backend);
+    memcpy(dst->state, src->state, src->backend->state_size);
 }
 
-/* Free a heap-allocated mersenne twister struct. */
-void theft_rng_free(struct theft_rng *mt) {
-    free(mt);
+/* Reset a PRNG's state, based on a seed. */
+void theft_rng_reset(struct theft_rng *rng, uint64_t seed) {
+    rng->backend->reset(rng->state, seed);
 }
 
+/* Get a 64-bit random number. */
+uint64_t theft_rng_random(struct theft_rng *rng) {
+    return rng->backend->next(rng->state);
+}
+
+/* Fill BUF with COUNT 64-bit random numbers. This produces the same
+ * values as COUNT calls to theft_rng_random, but generates them in
+ * blocks rather than one at a time. */
+void theft_rng_fill(struct theft_rng *rng, uint64_t *buf, size_t count) {
+    rng->backend->fill(rng->state, buf, count);
+}
+
+/* Jump ahead in the random number stream, as if by 2^128 calls to
+ * theft_rng_random. Returns false if not supported by the backend. */
+bool theft_rng_jump(struct theft_rng *rng) {
+    if (rng->backend->jump == NULL) { return false; }
+    rng->backend->jump(rng->state);
+    return true;
+}
+
+/* Generate a random number on [0,1]-real-interval. */
+double theft_rng_uint64_to_double(uint64_t x) {
+    return (x >> 11) * (1.0/9007199254740991.0);
+}
+
+/************
+ * xoshiro256**
+ ************/
+
+static uint64_t rotl(const uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/* SplitMix64, used to expand the seed to the full state, as the
+ * xoshiro authors recommend. */
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void xoshiro_reset(void *state, uint64_t seed) {
+    struct xoshiro_state *xs = (struct xoshiro_state *)state;
+    for (int i = 0; i < 4; i++) {
+        xs->s[i] = splitmix64(&seed);
+    }
+}
+
+static uint64_t xoshiro_next(void *state) {
+    uint64_t *s = ((struct xoshiro_state *)state)->s;
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/* Each output depends on the previous state, so this can't be
+ * vectorized, but keeping the state in locals avoids loading and
+ * storing it for every word. */
+static void xoshiro_fill(void *state, uint64_t *buf, size_t count) {
+    uint64_t *s = ((struct xoshiro_state *)state)->s;
+    uint64_t s0 = s[0], s1 = s[1], s2 = s[2], s3 = s[3];
+
+    for (size_t i = 0; i < count; i++) {
+        buf[i] = rotl(s1 * 5, 7) * 9;
+        const uint64_t t = s1 << 17;
+        s2 ^= s0;
+        s3 ^= s1;
+        s1 ^= s2;
+        s0 ^= s3;
+        s2 ^= t;
+        s3 = rotl(s3, 45);
+    }
+
+    s[0] = s0;
+    s[1] = s1;
+    s[2] = s2;
+    s[3] = s3;
+}
+
+/* Equivalent to 2^128 calls to next; this can be used to generate
+ * 2^128 non-overlapping subsequences. */
+static void xoshiro_jump(void *state) {
+    static const uint64_t JUMP[] = {
+        0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+        0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL,
+    };
+    uint64_t *s = ((struct xoshiro_state *)state)->s;
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (size_t i = 0; i < sizeof(JUMP)/sizeof(JUMP[0]); i++) {
+        for (int b = 0; b < 64; b++) {
+            if (JUMP[i] & ((uint64_t)1 << b)) {
+                s0 ^= s[0];
+                s1 ^= s[1];
+                s2 ^= s[2];
+                s3 ^= s[3];
+            }
+            (void)xoshiro_next(state);
+        }
+    }
+    s[0] = s0;
+    s[1] = s1;
+    s[2] = s2;
+    s[3] = s3;
+}
+
+/*************
+ * MT19937-64
+ *************/
+
+#define NN THEFT_MT_PARAM_N
+#define MM 156
+#define MATRIX_A 0xB5026F5AA96619E9ULL
+#define UM 0xFFFFFFFF80000000ULL /* Most significant 33 bits */
+#define LM 0x7FFFFFFFULL /* Least significant 31 bits */
+
 /* initializes mt[NN] with a seed */
-void theft_rng_reset(struct theft_rng *mt, uint64_t seed)
+static void mt_reset(void *state, uint64_t seed)
 {
+    struct mt_state *mt = (struct mt_state *)state;
     mt->mt[0] = seed;
     uint16_t mti = 0;
     for (mti=1; mti<NN; mti++) {
@@ -103,50 +313,157 @@ void theft_rng_reset(struct theft_rng *mt, uint64_t seed)
     mt->mti = mti;
 }
 
-/* Get a 64-bit random number. */
-uint64_t theft_rng_random(struct theft_rng *mt) {
-    return genrand64_int64(mt);
-}
-
-/* Generate a random number on [0,1]-real-interval. */
-double theft_rng_uint64_to_double(uint64_t x) {
-    return (x >> 11) * (1.0/9007199254740991.0);
-}
-
-/* generates a random number on [0, 2^64-1]-interval */
-static uint64_t genrand64_int64(struct theft_rng *r)
+/* generate NN words at one time */
+static void mt_twist(struct mt_state *r)
 {
     int i;
     uint64_t x;
     static uint64_t mag01[2]={0ULL, MATRIX_A};
 
-    if (r->mti >= NN) { /* generate NN words at one time */
-
-        /* if init has not been called, */
-        /* a default initial seed is used */
-        if (r->mti == NN+1)
-            theft_rng_reset(r, 5489ULL);
+    /* (The reference implementation's check for an uninitialized
+     * state is omitted: theft_rng_init_type always resets it.) */
 
-        for (i=0;i<NN-MM;i++) {
-            x = (r->mt[i]&UM)|(r->mt[i+1]&LM);
-            r->mt[i] = r->mt[i+MM] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
-        }
-        for (;i<NN-1;i++) {
-            x = (r->mt[i]&UM)|(r->mt[i+1]&LM);
-            r->mt[i] = r->mt[i+(MM-NN)] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
-        }
-        x = (r->mt[NN-1]&UM)|(r->mt[0]&LM);
-        r->mt[NN-1] = r->mt[MM-1] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
+    /* Each word only depends on words that are either before it
+     * (already updated) or at least MT_LANES ahead (not updated yet),
+     * so the twist can be done MT_LANES words at a time. mag01's
+     * lookup becomes a mask of the low bit, negated. */
+#if defined(__AVX2__)
+#define MT_LANES 4
+    const __m256i um = _mm256_set1_epi64x((long long)UM);
+    const __m256i lm = _mm256_set1_epi64x((long long)LM);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i ma = _mm256_set1_epi64x((long long)MATRIX_A);
+    const __m256i zero = _mm256_setzero_si256();
+#define MT_TWIST_STEP(I, J)                                             \
+    do {                                                                \
+        __m256i cur = _mm256_loadu_si256((const __m256i *)&r->mt[I]);   \
+        __m256i nxt = _mm256_loadu_si256((const __m256i *)&r->mt[I+1]); \
+        __m256i far = _mm256_loadu_si256((const __m256i *)&r->mt[J]);   \
+        __m256i y = _mm256_or_si256(_mm256_and_si256(cur, um),          \
+            _mm256_and_si256(nxt, lm));                                 \
+        __m256i mag = _mm256_and_si256(ma,                              \
+            _mm256_sub_epi64(zero, _mm256_and_si256(y, one)));          \
+        __m256i res = _mm256_xor_si256(far,                             \
+            _mm256_xor_si256(_mm256_srli_epi64(y, 1), mag));            \
+        _mm256_storeu_si256((__m256i *)&r->mt[I], res);                 \
+    } while (0)
+#elif defined(__SSE2__)
+#define MT_LANES 2
+    const __m128i um = _mm_set1_epi64x((long long)UM);
+    const __m128i lm = _mm_set1_epi64x((long long)LM);
+    const __m128i one = _mm_set1_epi64x(1);
+    const __m128i ma = _mm_set1_epi64x((long long)MATRIX_A);
+    const __m128i zero = _mm_setzero_si128();
+#define MT_TWIST_STEP(I, J)                                             \
+    do {                                                                \
+        __m128i cur = _mm_loadu_si128((const __m128i *)&r->mt[I]);      \
+        __m128i nxt = _mm_loadu_si128((const __m128i *)&r->mt[I+1]);    \
+        __m128i far = _mm_loadu_si128((const __m128i *)&r->mt[J]);      \
+        __m128i y = _mm_or_si128(_mm_and_si128(cur, um),                \
+            _mm_and_si128(nxt, lm));                                    \
+        __m128i mag = _mm_and_si128(ma,                                 \
+            _mm_sub_epi64(zero, _mm_and_si128(y, one)));                \
+        __m128i res = _mm_xor_si128(far,                                \
+            _mm_xor_si128(_mm_srli_epi64(y, 1), mag));                  \
+        _mm_storeu_si128((__m128i *)&r->mt[I], res);                    \
+    } while (0)
+#endif
 
-        r->mti = 0;
+    i = 0;
+#ifdef MT_LANES
+    for (;i + MT_LANES <= NN-MM;i += MT_LANES) {
+        MT_TWIST_STEP(i, i+MM);
+    }
+#endif
+#if !defined(MT_LANES) || ((NN-MM) % MT_LANES) != 0
+    for (;i<NN-MM;i++) {
+        x = (r->mt[i]&UM)|(r->mt[i+1]&LM);
+        r->mt[i] = r->mt[i+MM] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
+    }
+#endif
+#ifdef MT_LANES
+    for (;i + MT_LANES <= NN-1;i += MT_LANES) {
+        MT_TWIST_STEP(i, i+(MM-NN));
     }
-  
-    x = r->mt[r->mti++];
+#undef MT_TWIST_STEP
+#undef MT_LANES
+#endif
+    for (;i<NN-1;i++) {
+        x = (r->mt[i]&UM)|(r->mt[i+1]&LM);
+        r->mt[i] = r->mt[i+(MM-NN)] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
+    }
+    x = (r->mt[NN-1]&UM)|(r->mt[0]&LM);
+    r->mt[NN-1] = r->mt[MM-1] ^ (x>>1) ^ mag01[(int)(x&1ULL)];
+
+    r->mti = 0;
+}
 
+static uint64_t mt_temper(uint64_t x)
+{
     x ^= (x >> 29) & 0x5555555555555555ULL;
     x ^= (x << 17) & 0x71D67FFFEDA60000ULL;
     x ^= (x << 37) & 0xFFF7EEE000000000ULL;
     x ^= (x >> 43);
-
     return x;
 }
+
+/* generates a random number on [0, 2^64-1]-interval */
+static uint64_t mt_next(void *state)
+{
+    struct mt_state *r = (struct mt_state *)state;
+    if (r->mti >= NN) {
+        mt_twist(r);
+    }
+    return mt_temper(r->mt[r->mti++]);
+}
+
+/* Temper COUNT words from SRC into DST. */
+static void mt_temper_block(const uint64_t *src, uint64_t *dst, size_t count)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i c1 = _mm256_set1_epi64x((long long)0x5555555555555555ULL);
+    const __m256i c2 = _mm256_set1_epi64x((long long)0x71D67FFFEDA60000ULL);
+    const __m256i c3 = _mm256_set1_epi64x((long long)0xFFF7EEE000000000ULL);
+    for (; i + 4 <= count; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)&src[i]);
+        x = _mm256_xor_si256(x, _mm256_and_si256(_mm256_srli_epi64(x, 29), c1));
+        x = _mm256_xor_si256(x, _mm256_and_si256(_mm256_slli_epi64(x, 17), c2));
+        x = _mm256_xor_si256(x, _mm256_and_si256(_mm256_slli_epi64(x, 37), c3));
+        x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 43));
+        _mm256_storeu_si256((__m256i *)&dst[i], x);
+    }
+#elif defined(__SSE2__)
+    const __m128i c1 = _mm_set1_epi64x((long long)0x5555555555555555ULL);
+    const __m128i c2 = _mm_set1_epi64x((long long)0x71D67FFFEDA60000ULL);
+    const __m128i c3 = _mm_set1_epi64x((long long)0xFFF7EEE000000000ULL);
+    for (; i + 2 <= count; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *)&src[i]);
+        x = _mm_xor_si128(x, _mm_and_si128(_mm_srli_epi64(x, 29), c1));
+        x = _mm_xor_si128(x, _mm_and_si128(_mm_slli_epi64(x, 17), c2));
+        x = _mm_xor_si128(x, _mm_and_si128(_mm_slli_epi64(x, 37), c3));
+        x = _mm_xor_si128(x, _mm_srli_epi64(x, 43));
+        _mm_storeu_si128((__m128i *)&dst[i], x);
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = mt_temper(src[i]);
+    }
+}
+
+/* Generate COUNT words, a block (up to NN words) at a time. */
+static void mt_fill(void *state, uint64_t *buf, size_t count)
+{
+    struct mt_state *r = (struct mt_state *)state;
+    while (count > 0) {
+        if (r->mti >= NN) {
+            mt_twist(r);
+        }
+        size_t avail = NN - r->mti;
+        size_t n = (count < avail ? count : avail);
+        mt_temper_block(&r->mt[r->mti], buf, n);
+        r->mti += n;
+        buf += n;
+        count -= n;
+    }
+}
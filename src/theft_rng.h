@@ -2,27 +2,53 @@
 #define THEFT_RNG_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-/* Wrapper for Mersenne Twister.
- * See copyright and license in theft_rng.c, more details at:
+#include "theft.h"
+
+/* Pseudo-random number generators, with several backends:
+ *
+ * - xoshiro256** (the default): small state, so cheap to reseed
+ *   for every trial. More details at:
+ *     http://xoshiro.di.unimi.it/
+ *
+ * - MT19937-64: Mersenne Twister, which was used by theft <= 0.4.5.
+ *   See copyright and license in theft_rng.c, more details at:
  *     http://www.math.sci.hiroshima-u.ac.jp/~m-mat/MT/emt.html
  *
- * Local modifications are described in theft_mt.c. */
+ * Local modifications are described in theft_rng.c. */
 
-/* Opaque type for a Mersenne Twister PRNG. */
+/* Opaque type for a PRNG. */
 struct theft_rng;
 
-/* Heap-allocate a mersenne twister struct. */
+/* Heap-allocate a PRNG, using the default backend. */
 struct theft_rng *theft_rng_init(uint64_t seed);
 
-/* Free a heap-allocated mersenne twister struct. */
-void theft_rng_free(struct theft_rng *mt);
+/* Heap-allocate a PRNG of a particular type. Returns NULL on
+ * allocation failure or an unknown type. */
+struct theft_rng *theft_rng_init_type(enum theft_prng type, uint64_t seed);
+
+/* Free a heap-allocated PRNG. */
+void theft_rng_free(struct theft_rng *rng);
 
-/* Reset a mersenne twister struct, possibly stack-allocated. */
-void theft_rng_reset(struct theft_rng *mt, uint64_t seed);
+/* Copy SRC's state to DST, which must use the same backend. */
+void theft_rng_copy(struct theft_rng *dst, const struct theft_rng *src);
+
+/* Reset a PRNG's state, based on a seed. */
+void theft_rng_reset(struct theft_rng *rng, uint64_t seed);
 
 /* Get a 64-bit random number. */
-uint64_t theft_rng_random(struct theft_rng *mt);
+uint64_t theft_rng_random(struct theft_rng *rng);
+
+/* Fill BUF with COUNT 64-bit random numbers. This produces the same
+ * values as COUNT calls to theft_rng_random, but generates them in
+ * blocks rather than one at a time. */
+void theft_rng_fill(struct theft_rng *rng, uint64_t *buf, size_t count);
+
+/* Jump ahead in the random number stream, as if by 2^128 calls to
+ * theft_rng_random. Returns false if not supported by the backend. */
+bool theft_rng_jump(struct theft_rng *rng);
 
 /* Convert a uint64_t to a number on the [0,1]-real-interval. */
 double theft_rng_uint64_to_double(uint64_t x);
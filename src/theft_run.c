@@ -1,14 +1,31 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE     /* for MAP_ANONYMOUS */
+#endif
+
 #include "theft_run_internal.h"
 
-#include "theft_bloom.h"
+#include "theft_dedup.h"
 #include "theft_rng.h"
 #include "theft_call.h"
+#include "theft_zygote.h"
+#include "theft_deadline.h"
+#include "theft_checkpoint.h"
+#include "theft_sched.h"
 #include "theft_trial.h"
 #include "theft_random.h"
 #include "theft_autoshrink.h"
+#include "theft_shrink_queue.h"
 
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
 
 #define LOG_RUN 0
 
@@ -22,7 +39,17 @@ theft_run_init(const struct theft_run_config *cfg, struct theft **output) {
     memset(t, 0, sizeof(*t));
 
     t->out = stdout;
-    t->prng.rng = theft_rng_init(DEFAULT_THEFT_SEED);
+    switch (cfg->prng) {
+    case THEFT_PRNG_DEFAULT:
+    case THEFT_PRNG_XOSHIRO256SS:
+    case THEFT_PRNG_MT19937_64:
+        break;
+    default:
+        free(t);
+        return THEFT_RUN_INIT_ERROR_BAD_ARGS;
+    }
+    t->prng.type = cfg->prng;
+    t->prng.rng = theft_rng_init_type(cfg->prng, DEFAULT_THEFT_SEED);
     if (t->prng.rng == NULL) {
         free(t);
         return THEFT_RUN_INIT_ERROR_MEMORY;
@@ -40,22 +67,157 @@ theft_run_init(const struct theft_run_config *cfg, struct theft **output) {
         goto cleanup;
     }
 
+    if (cfg->seed_mode != THEFT_SEED_MODE_CHAINED
+        && cfg->seed_mode != THEFT_SEED_MODE_COUNTER) {
+        res = THEFT_RUN_INIT_ERROR_BAD_ARGS;
+        goto cleanup;
+    }
+
+    if (cfg->dedup.mode != THEFT_DEDUP_BLOOM
+        && cfg->dedup.mode != THEFT_DEDUP_EXACT) {
+        res = THEFT_RUN_INIT_ERROR_BAD_ARGS;
+        goto cleanup;
+    }
+
     struct seed_info seeds = {
         .run_seed = cfg->seed ? cfg->seed : DEFAULT_THEFT_SEED,
+        .mode = cfg->seed_mode,
         .always_seed_count = (cfg->always_seeds == NULL
             ? 0 : cfg->always_seed_count),
         .always_seeds = cfg->always_seeds,
     };
     memcpy(&t->seeds, &seeds, sizeof(seeds));
 
+    /* A supervised run forks to re-run any trial that crashed. */
+    if (cfg->supervise.enable && (cfg->fork.workers > 1
+            || cfg->fork.trials_per_child > 1 || cfg->fork.zygote)) {
+        res = THEFT_RUN_INIT_ERROR_BAD_ARGS;
+        goto cleanup;
+    }
+
+    /* Each thread generates its trials independently, so their seeds
+     * can't depend on earlier trials, and nothing that's per-process
+     * (forking, or the deadline's signal handler) can be used. */
+    struct thread_info threads = {
+        .count = (cfg->threads == 0 ? 1 : cfg->threads),
+    };
+    if (threads.count > 1 && (cfg->seed_mode != THEFT_SEED_MODE_COUNTER
+            || cfg->fork.enable || cfg->supervise.enable
+            || cfg->deadline.timeout > 0)) {
+        res = THEFT_RUN_INIT_ERROR_BAD_ARGS;
+        goto cleanup;
+    }
+    memcpy(&t->threads, &threads, sizeof(threads));
+
+    /* The shrinker runs on its own thread, so the same goes for it,
+     * and the threads' lock doesn't cover it. */
+    struct shrink_queue_info shrink_queue = {
+        .enable = cfg->background_shrink,
+    };
+    if (shrink_queue.enable && (threads.count > 1
+            || cfg->fork.enable || cfg->supervise.enable
+            || cfg->deadline.timeout > 0)) {
+        res = THEFT_RUN_INIT_ERROR_BAD_ARGS;
+        goto cleanup;
+    }
+    memcpy(&t->shrink_queue, &shrink_queue, sizeof(shrink_queue));
+
+    struct prefetch_info prefetch = {
+        .depth = cfg->prefetch,
+    };
+    memcpy(&t->prefetch, &prefetch, sizeof(prefetch));
+
     struct fork_info fork = {
-        .enable = cfg->fork.enable,
+        .enable = cfg->fork.enable || cfg->supervise.enable,
         .timeout = cfg->fork.timeout,
         .signal = cfg->fork.signal,
         .exit_timeout = cfg->fork.exit_timeout,
+        .workers = (cfg->fork.workers == 0 ? 1 : cfg->fork.workers),
+        .zygote = cfg->fork.zygote,
+        .trials_per_child = (cfg->fork.trials_per_child == 0
+            ? 1 : cfg->fork.trials_per_child),
+        .rlimit_as = cfg->fork.rlimits.address_space,
+        .rlimit_cpu = cfg->fork.rlimits.cpu,
+        .rlimit_nofile = cfg->fork.rlimits.open_files,
+        .core_dumps = cfg->fork.rlimits.core_dumps,
+        .capture_output = cfg->fork.capture_output.enable,
+        .capture_max_bytes = (cfg->fork.capture_output.max_bytes == 0
+            ? THEFT_DEF_CAPTURE_MAX_BYTES
+            : cfg->fork.capture_output.max_bytes),
+        .parallel_shrink = cfg->fork.parallel_shrink,
     };
     memcpy(&t->fork, &fork, sizeof(fork));
 
+    struct sched_info sched = {
+        .cpus = cfg->fork.cpu_set.cpus,
+        .cpu_count = (cfg->fork.cpu_set.cpus == NULL
+            ? 0 : cfg->fork.cpu_set.count),
+        .pin_workers = cfg->fork.pin_workers,
+        .pin_parent = cfg->fork.pin_parent,
+        .nice = cfg->fork.nice,
+    };
+    memcpy(&t->sched, &sched, sizeof(sched));
+    if (!theft_sched_init(t)) {
+        res = THEFT_RUN_INIT_ERROR_BAD_ARGS;
+        goto cleanup;
+    }
+
+    struct auto_timeout_info auto_timeout = {
+        .enable = cfg->fork.auto_timeout.enable,
+        .multiple = (cfg->fork.auto_timeout.multiple == 0
+            ? THEFT_DEF_AUTO_TIMEOUT_MULTIPLE
+            : cfg->fork.auto_timeout.multiple),
+        .min = (cfg->fork.auto_timeout.min == 0
+            ? THEFT_DEF_AUTO_TIMEOUT_MIN_MSEC
+            : cfg->fork.auto_timeout.min),
+        .max = (cfg->fork.auto_timeout.max == 0
+            ? THEFT_DEF_AUTO_TIMEOUT_MAX_MSEC
+            : cfg->fork.auto_timeout.max),
+    };
+    if (auto_timeout.min > auto_timeout.max) {
+        res = THEFT_RUN_INIT_ERROR_BAD_ARGS;
+        goto cleanup;
+    }
+    memcpy(&t->auto_timeout, &auto_timeout, sizeof(auto_timeout));
+    theft_quantile_init(&t->auto_timeout.latency, 0.99);
+
+    struct deadline_info deadline = {
+        .timeout = cfg->deadline.timeout,
+        .unwind = cfg->deadline.unwind,
+    };
+    memcpy(&t->deadline, &deadline, sizeof(deadline));
+    if (!theft_deadline_init(t)) {
+        res = THEFT_RUN_INIT_ERROR_BAD_ARGS;
+        goto cleanup;
+    }
+
+    struct supervise_info supervise = {
+        .enable = cfg->supervise.enable,
+        .max_restarts = (cfg->supervise.max_restarts == 0
+            ? THEFT_DEF_SUPERVISE_MAX_RESTARTS
+            : cfg->supervise.max_restarts),
+        .crashed_trial = SIZE_MAX,
+    };
+    memcpy(&t->supervise, &supervise, sizeof(supervise));
+    t->zygote.pid = -1;
+    t->zygote.fd = -1;
+
+    /* A pool of workers needs one extra for synchronous calls made
+     * while shrinking, since the others may still be busy -- or, when
+     * shrinking in parallel, another full set. */
+    t->worker_count = (!use_pool(t) ? 1
+        : t->fork.parallel_shrink ? 2 * t->fork.workers
+        : t->fork.workers + 1);
+    t->workers = calloc(t->worker_count, sizeof(*t->workers));
+    if (t->workers == NULL) {
+        res = THEFT_RUN_INIT_ERROR_MEMORY;
+        goto cleanup;
+    }
+    if (!theft_call_init_workers(t)) {
+        res = THEFT_RUN_INIT_ERROR_MEMORY;
+        goto cleanup;
+    }
+
     struct prop_info prop = {
         .name = cfg->name,
         .arity = arity,
@@ -69,6 +231,15 @@ theft_run_init(const struct theft_run_config *cfg, struct theft **output) {
     memcpy(&prop.type_info, cfg->type_info, sizeof(prop.type_info));
     memcpy(&t->prop, &prop, sizeof(prop));
 
+    struct checkpoint_info checkpoint = {
+        .max = cfg->fork.checkpoints,
+    };
+    memcpy(&t->checkpoint, &checkpoint, sizeof(checkpoint));
+    if (!theft_checkpoint_init(t)) {
+        res = THEFT_RUN_INIT_ERROR_MEMORY;
+        goto cleanup;
+    }
+
     struct hook_info hooks = {
         .run_pre = (cfg->hooks.run_pre != NULL
             ? cfg->hooks.run_pre
@@ -99,9 +270,22 @@ theft_run_init(const struct theft_run_config *cfg, struct theft **output) {
     theft_random_set_seed(t, t->seeds.run_seed);
 
     /* If all arguments are hashable, then attempt to use
-     * a bloom filter to avoid redundant checking. */
-    if (all_hashable) {
-        t->bloom = theft_bloom_init(NULL);
+     * a bloom filter or set to avoid redundant checking. */
+    if (all_hashable && t->supervise.enable) {
+        /* Supervised processes keep each trial's combinations to
+         * themselves until it's done, then add them to a filter shared
+         * with any process restarted after a crash. */
+        struct theft_shared_dedup *shared = cfg->dedup.shared;
+        if (shared == NULL) {
+            shared = theft_shared_dedup_new(cfg->dedup.max_bytes);
+            t->supervise.shared_dedup = shared;
+        }
+        t->dedup = (shared != NULL
+            ? theft_dedup_init_pending(shared) : NULL);
+    } else if (all_hashable) {
+        t->dedup = (cfg->dedup.shared != NULL
+            ? theft_dedup_init_shared(cfg->dedup.shared)
+            : theft_dedup_init(cfg->dedup.mode, cfg->dedup.max_bytes));
     }
 
     /* If using the default trial_post callback, allocate its
@@ -119,17 +303,31 @@ theft_run_init(const struct theft_run_config *cfg, struct theft **output) {
     return res;
 
 cleanup:
+    theft_checkpoint_free(t);
+    theft_sched_free(t);
+    theft_deadline_free(t);
     theft_rng_free(t->prng.rng);
+    theft_call_free_workers(t);
+    free(t->workers);
     free(t);
     return res;
 }
 
 void theft_run_free(struct theft *t) {
-    if (t->bloom) {
-        theft_bloom_free(t->bloom);
-        t->bloom = NULL;
+    theft_zygote_stop(t);
+    if (t->dedup) {
+        theft_dedup_free(t->dedup);
+        t->dedup = NULL;
+    }
+    if (t->supervise.shared_dedup) {
+        theft_shared_dedup_free(t->supervise.shared_dedup);
     }
     theft_rng_free(t->prng.rng);
+    theft_call_free_workers(t);
+    theft_checkpoint_free(t);
+    theft_sched_free(t);
+    theft_deadline_free(t);
+    free(t->workers);
 
     if (t->print_trial_result_env != NULL) {
         free(t->print_trial_result_env);
@@ -153,27 +351,36 @@ theft_run_trials(struct theft *t) {
         }
     }
 
-    size_t limit = t->prop.trial_count;
-    theft_seed seed = t->seeds.run_seed;
-
-    for (size_t trial = 0; trial < limit; trial++) {
-        enum run_step_res res = run_step(t, trial, &seed);
-        memset(&t->trial, 0x00, sizeof(t->trial));
+    if (!theft_zygote_start(t)) {
+        goto cleanup;
+    }
+    if (!theft_shrink_queue_start(t)) {
+        theft_zygote_stop(t);
+        goto cleanup;
+    }
 
-        LOG(3 - LOG_RUN,
-            "  -- trial %zd/%zd, new seed 0x%016" PRIx64 "\n",
-            trial, limit, seed);
+    enum run_step_res res = (t->supervise.enable ? run_supervised(t)
+        : use_threads(t) ? run_threads(t)
+        : use_pool(t) ? run_pool(t)
+        : run_serial(t, 0, t->seeds.run_seed));
+    /* Wait for any failures still being shrunk in the background. */
+    if (!theft_shrink_queue_drain(t) && res == RUN_STEP_OK) {
+        res = RUN_STEP_TRIAL_ERROR;
+    }
+    theft_zygote_stop(t);
+    if (res != RUN_STEP_OK) {
+        goto cleanup;
+    }
 
-        switch (res) {
-        case RUN_STEP_OK:
-            continue;
-        case RUN_STEP_HALT:
-            limit = trial;
-            break;
-        default:
-        case RUN_STEP_GEN_ERROR:
-        case RUN_STEP_TRIAL_ERROR:
-            goto cleanup;
+    struct theft_dedup_stats dedup_stats;
+    if (t->dedup != NULL) {
+        theft_dedup_stats(t->dedup, &dedup_stats);
+        if (dedup_stats.saturated) {
+            fprintf(t->out, "Warning: dedup bloom filter saturated after "
+                "%" PRIu64 " argument combinations (%zd bytes, estimated "
+                "false positive rate %g); some trials may have been "
+                "incorrectly skipped as duplicates\n",
+                dedup_stats.marked, dedup_stats.memory, dedup_stats.fpr);
         }
     }
 
@@ -189,6 +396,7 @@ theft_run_trials(struct theft *t) {
                 .skip = t->counters.skip,
                 .dup = t->counters.dup,
             },
+            .dedup = (t->dedup != NULL ? &dedup_stats : NULL),
         };
 
         enum theft_hook_run_post_res res = run_post(&hook_info, t->hooks.env);
@@ -212,13 +420,177 @@ cleanup:
     return THEFT_RUN_ERROR;
 }
 
+/* Run each trial, one at a time, starting with trial FIRST, which
+ * uses SEED (when chaining seeds). */
+static enum run_step_res
+run_serial(struct theft *t, size_t first, theft_seed seed) {
+    size_t limit = t->prop.trial_count;
+    struct supervise_state *st = t->supervise.state;
+    if (!prefetch_start(t, first, seed)) { return RUN_STEP_GEN_ERROR; }
+
+    for (size_t trial = first; trial < limit; trial++) {
+        if (st != NULL) {
+            /* Note where to restart from, if this trial crashes. A
+             * trial that already crashed is re-run forked. */
+            st->trial = trial;
+            st->seed = seed;
+            memcpy(&st->counters, &t->counters, sizeof(t->counters));
+            t->supervise.unforked = (trial != t->supervise.crashed_trial);
+        }
+
+        enum run_step_res res = run_step(t, trial, &seed);
+        memset(&t->trial, 0x00, sizeof(t->trial));
+        if (st != NULL && t->dedup && !theft_dedup_commit(t->dedup)) {
+            res = RUN_STEP_TRIAL_ERROR;
+        }
+
+        LOG(3 - LOG_RUN,
+            "  -- trial %zd/%zd, new seed 0x%016" PRIx64 "\n",
+            trial, limit, seed);
+
+        switch (res) {
+        case RUN_STEP_OK:
+            continue;
+        case RUN_STEP_HALT:
+            limit = trial;
+            break;
+        default:
+        case RUN_STEP_GEN_ERROR:
+        case RUN_STEP_TRIAL_ERROR:
+            prefetch_stop(t);
+            return res;
+        }
+    }
+    prefetch_stop(t);
+    return RUN_STEP_OK;
+}
+
+/* Run the trials in a child process, without forking for each trial,
+ * and wait for it. If it crashes, restart it from the trial it was
+ * running, and have it re-run that trial forked, so it can be shrunk
+ * without crashing again. Since a trial's seed only depends on the
+ * previous trial's seed (or its trial ID), the restarted process
+ * generates the same trials that an uninterrupted run would have.
+ * The counters and the dedup filter, as of the start of the crashed
+ * trial, are in shared memory, so they carry over and the counts match
+ * too; anything else the crashed process changed, including the hooks'
+ * environment, is lost. */
+static enum run_step_res
+run_supervised(struct theft *t) {
+    struct supervise_state *st = mmap(NULL, sizeof(*st),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (st == MAP_FAILED) {
+        perror("mmap");
+        return RUN_STEP_TRIAL_ERROR;
+    }
+
+    enum run_step_res res = RUN_STEP_TRIAL_ERROR;
+    size_t first = 0;
+    theft_seed seed = t->seeds.run_seed;
+    size_t restarts = 0;
+    for (;;) {
+        memset(st, 0x00, sizeof(*st));
+        st->trial = first;
+        st->seed = seed;
+        memcpy(&st->counters, &t->counters, sizeof(t->counters));
+
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            break;
+        } else if (pid == 0) {
+            t->supervise.state = st;
+            st->res = run_serial(t, first, seed);
+            memcpy(&st->counters, &t->counters, sizeof(t->counters));
+            st->done = true;
+            exit(EXIT_SUCCESS);
+        }
+
+        int status = 0;
+        while (-1 == waitpid(pid, &status, 0)) {
+            if (errno != EINTR) {
+                perror("waitpid");
+                goto cleanup;
+            }
+        }
+
+        /* Either way, the counters are up to date as of st->trial. */
+        memcpy(&t->counters, &st->counters, sizeof(t->counters));
+        if (st->done) {
+            res = st->res;
+            break;
+        }
+
+        LOG(2 - LOG_RUN, "%s: supervised process exited (status %d) "
+            "during trial %zd\n", __func__, status, st->trial);
+        if (st->trial == t->supervise.crashed_trial
+            || restarts == t->supervise.max_restarts) {
+            fprintf(t->out, "Supervised process crashed during trial %zd, "
+                "giving up\n", st->trial);
+            break;
+        }
+        restarts++;
+        first = st->trial;
+        seed = st->seed;
+        t->supervise.crashed_trial = first;
+    }
+
+cleanup:
+    munmap(st, sizeof(*st));
+    return res;
+}
+
 static enum run_step_res
 run_step(struct theft *t, size_t trial, theft_seed *seed) {
+    enum all_gen_res gres = ALL_GEN_ERROR;
+    enum theft_hook_trial_post_res pres = THEFT_HOOK_TRIAL_POST_CONTINUE;
+    enum run_step_res res = (t->prefetch.queue != NULL
+        ? prefetch_gen_trial(t, trial, seed, &gres)
+        : gen_trial(t, trial, seed, &gres));
+    /* anything after this point needs to free all args */
+    if (res != RUN_STEP_OK) { goto cleanup; }
+
+    if (gres == ALL_GEN_OK) {
+        res = run_trial_pre_hook(t);
+        if (res != RUN_STEP_OK) { goto cleanup; }
+
+        if (!theft_trial_run(t, &pres)) {
+            res = RUN_STEP_TRIAL_ERROR;
+            goto cleanup;
+        }
+    } else {
+        res = report_gen_result(t, gres, &pres);
+        if (res != RUN_STEP_OK) { goto cleanup; }
+    }
+
+    if (pres == THEFT_HOOK_TRIAL_POST_ERROR) {
+        res = RUN_STEP_TRIAL_ERROR;
+    }
+
+cleanup:
+    theft_trial_free_args(t);
+    return res;
+}
+
+/* Set up t->trial for a trial and generate its arguments, saving
+ * whether they were generated in *GRES. Unless this returns
+ * RUN_STEP_OK, the arguments may still need to be freed.
+ *
+ * When chaining seeds, *SEED is updated to the next trial's seed,
+ * which only depends on this trial's seed -- not on whether (or
+ * where) the trial runs. */
+static enum run_step_res
+gen_trial(struct theft *t, size_t trial, theft_seed *seed,
+        enum all_gen_res *gres) {
     /* If any seeds to always run were specified, use those before
      * reverting to the specified starting seed. */
     const size_t always_seeds = t->seeds.always_seed_count;
     if (trial < always_seeds) {
         *seed = t->seeds.always_seeds[trial];
+    } else if (t->seeds.mode == THEFT_SEED_MODE_COUNTER) {
+        *seed = theft_seed_for_trial(t->seeds.run_seed,
+            trial - always_seeds);
     } else if ((always_seeds > 0) && (trial == always_seeds)) {
         *seed = t->seeds.run_seed;
     }
@@ -231,128 +603,827 @@ run_step(struct theft *t, size_t trial, theft_seed *seed) {
 
     memcpy(&t->trial, &trial_info, sizeof(trial_info));
 
-    theft_hook_gen_args_pre_cb *gen_args_pre = t->hooks.gen_args_pre;
-    if (gen_args_pre != NULL) {
-        struct theft_hook_gen_args_pre_info hook_info = {
-            .prop_name = t->prop.name,
-            .total_trials = t->prop.trial_count,
-            .failures = t->counters.fail,
-            .run_seed = t->seeds.run_seed,
-            .trial_id = t->trial.trial,
-            .trial_seed = t->trial.seed,
-            .arity = t->prop.arity
-        };
-        enum theft_hook_gen_args_pre_res res = gen_args_pre(&hook_info,
-            t->hooks.env);
-
-        switch (res) {
-        case THEFT_HOOK_GEN_ARGS_PRE_CONTINUE:
-            break;
-        case THEFT_HOOK_GEN_ARGS_PRE_HALT:
-            return RUN_STEP_HALT;
-        default:
-            assert(false);
-        case THEFT_HOOK_GEN_ARGS_PRE_ERROR:
-            return RUN_STEP_GEN_ERROR;
-        }
-    }
+    enum run_step_res res = run_gen_args_pre_hook(t);
+    if (res != RUN_STEP_OK) { return res; }
 
     /* Set seed for this trial */
     LOG(3 - LOG_RUN,
         "%s: SETTING TRIAL SEED TO 0x%016" PRIx64 "\n", __func__, trial_info.seed);
     theft_random_set_seed(t, trial_info.seed);
 
-    enum run_step_res res = RUN_STEP_OK;
-    enum all_gen_res gres = gen_all_args(t);
-    /* anything after this point needs to free all args */
+    *gres = gen_all_args(t);
+
+    /* Update seed for next trial */
+    if (t->seeds.mode == THEFT_SEED_MODE_CHAINED) {
+        *seed = theft_random(t);
+        LOG(3 - LOG_RUN, "%s: next trial's seed is 0x%016" PRIx64 "\n",
+            __func__, *seed);
+    }
+    return RUN_STEP_OK;
+}
+
+static enum run_step_res
+run_gen_args_pre_hook(struct theft *t) {
+    theft_hook_gen_args_pre_cb *gen_args_pre = t->hooks.gen_args_pre;
+    if (gen_args_pre == NULL) {
+        return RUN_STEP_OK;
+    }
+
+    struct theft_hook_gen_args_pre_info hook_info = {
+        .prop_name = t->prop.name,
+        .total_trials = t->prop.trial_count,
+        .failures = t->counters.fail,
+        .run_seed = t->seeds.run_seed,
+        .trial_id = t->trial.trial,
+        .trial_seed = t->trial.seed,
+        .arity = t->prop.arity
+    };
+    shared_lock(t);
+    enum theft_hook_gen_args_pre_res res = gen_args_pre(&hook_info,
+        t->hooks.env);
+    shared_unlock(t);
 
+    switch (res) {
+    case THEFT_HOOK_GEN_ARGS_PRE_CONTINUE:
+        return RUN_STEP_OK;
+    case THEFT_HOOK_GEN_ARGS_PRE_HALT:
+        return RUN_STEP_HALT;
+    default:
+        assert(false);
+    case THEFT_HOOK_GEN_ARGS_PRE_ERROR:
+        return RUN_STEP_GEN_ERROR;
+    }
+}
+
+static enum run_step_res
+run_trial_pre_hook(struct theft *t) {
+    if (t->hooks.trial_pre == NULL) {
+        return RUN_STEP_OK;
+    }
+
+    struct theft_hook_trial_pre_info info = {
+        .prop_name = t->prop.name,
+        .total_trials = t->prop.trial_count,
+        .failures = t->counters.fail,
+        .run_seed = t->seeds.run_seed,
+        .trial_id = t->trial.trial,
+        .trial_seed = t->trial.seed,
+        .arity = t->prop.arity,
+    };
+
+    enum theft_hook_trial_pre_res tpres;
+    shared_lock(t);
+    tpres = t->hooks.trial_pre(&info, t->hooks.env);
+    shared_unlock(t);
+    if (tpres == THEFT_HOOK_TRIAL_PRE_HALT) {
+        return RUN_STEP_HALT;
+    } else if (tpres == THEFT_HOOK_TRIAL_PRE_ERROR) {
+        return RUN_STEP_TRIAL_ERROR;
+    }
+    return RUN_STEP_OK;
+}
+
+/* Update counters and call the trial_post hook for a trial that
+ * was skipped, a duplicate, or failed to generate arguments. */
+static enum run_step_res
+report_gen_result(struct theft *t, enum all_gen_res gres,
+        enum theft_hook_trial_post_res *pres) {
     theft_hook_trial_post_cb *post_cb = t->hooks.trial_post;
     void *hook_env = (t->hooks.trial_post == theft_hook_trial_post_print_result
         ? t->print_trial_result_env
         : t->hooks.env);
 
     void *args[THEFT_MAX_ARITY];
-    for (size_t i = 0; i < t->prop.arity; i++) {
-        args[i] = t->trial.args[i].instance;
-    }
+    theft_trial_get_args(t, args);
 
     struct theft_hook_trial_post_info hook_info = {
         .t = t,
         .prop_name = t->prop.name,
         .total_trials = t->prop.trial_count,
         .failures = t->counters.fail,
-        .run_seed = *seed,
-        .trial_id = trial,
-        .trial_seed = trial_info.seed,
+        .run_seed = t->seeds.run_seed,
+        .trial_id = t->trial.trial,
+        .trial_seed = t->trial.seed,
         .arity = t->prop.arity,
         .args = args,
     };
 
-    enum theft_hook_trial_post_res pres;
-
     switch (gres) {
     case ALL_GEN_SKIP:          /* skip generating these args */
         LOG(3 - LOG_RUN, "gen -- skip\n");
         t->counters.skip++;
         hook_info.result = THEFT_TRIAL_SKIP;
-        pres = post_cb(&hook_info, hook_env);
-        break;
+        *pres = post_cb(&hook_info, hook_env);
+        return RUN_STEP_OK;
     case ALL_GEN_DUP:           /* skip these args -- probably already tried */
         LOG(3 - LOG_RUN, "gen -- dup\n");
         t->counters.dup++;
         hook_info.result = THEFT_TRIAL_DUP;
-        pres = post_cb(&hook_info, hook_env);
-        break;
+        *pres = post_cb(&hook_info, hook_env);
+        return RUN_STEP_OK;
     default:
+    case ALL_GEN_OK:
+        assert(false);
     case ALL_GEN_ERROR:         /* error while generating args */
         LOG(1 - LOG_RUN, "gen -- error\n");
         hook_info.result = THEFT_TRIAL_ERROR;
-        pres = post_cb(&hook_info, hook_env);
-        res = RUN_STEP_GEN_ERROR;
-        goto cleanup;
-    case ALL_GEN_OK:
-        LOG(4 - LOG_RUN, "gen -- ok\n");
-        if (t->hooks.trial_pre != NULL) {
-            struct theft_hook_trial_pre_info info = {
-                .prop_name = t->prop.name,
-                .total_trials = t->prop.trial_count,
-                .failures = t->counters.fail,
-                .run_seed = t->seeds.run_seed,
-                .trial_id = trial,
-                .trial_seed = trial_info.seed,
-                .arity = t->prop.arity,
-            };
-
-            enum theft_hook_trial_pre_res tpres;
-            tpres = t->hooks.trial_pre(&info, t->hooks.env);
-            if (tpres == THEFT_HOOK_TRIAL_PRE_HALT) {
-                res = RUN_STEP_HALT;
+        *pres = post_cb(&hook_info, hook_env);
+        return RUN_STEP_GEN_ERROR;
+    }
+}
+
+/* Should trials be run on a pool of workers, rather than one at a
+ * time? This is also used to run batches of trials on one worker. */
+static bool
+use_pool(const struct theft *t) {
+    return t->fork.enable
+        && (t->fork.workers > 1 || t->fork.trials_per_child > 1);
+}
+
+/* Run trials on a pool of worker processes.
+ *
+ * Trials are generated and started in order, but since they can
+ * finish in any order, results are held until every earlier trial
+ * has been merged. Counters, the trial_pre and trial_post hooks, and
+ * shrinking all happen in trial order, so the results are the same as
+ * when running one trial at a time; if trial_pre halts, later trials
+ * that already ran are discarded. Each worker runs a batch of up to
+ * trials_per_child trials, and generation stays at most
+ * POOL_WINDOW_FACTOR batches per worker ahead of merging. */
+static enum run_step_res
+run_pool(struct theft *t) {
+    const size_t workers = t->fork.workers;
+    const size_t window = POOL_WINDOW_FACTOR * workers
+        * t->fork.trials_per_child;
+    struct pending_trial *pending = calloc(window, sizeof(*pending));
+    if (pending == NULL) { return RUN_STEP_TRIAL_ERROR; }
+
+    enum run_step_res res = RUN_STEP_OK;
+    size_t limit = t->prop.trial_count;
+    size_t gen_id = 0;          /* next trial to generate */
+    size_t start_id = 0;        /* next trial to start on a worker */
+    size_t merge_id = 0;        /* next trial to merge */
+    size_t pre_id = 0;          /* next trial to call trial_pre for */
+    theft_seed seed = t->seeds.run_seed;
+
+    while (merge_id < gen_id || gen_id < limit) {
+        while (gen_id < limit && gen_id - merge_id < window) {
+            struct pending_trial *p = &pending[gen_id % window];
+            res = pool_gen_trial(t, gen_id, &seed, p);
+            if (res == RUN_STEP_HALT) {
+                limit = gen_id;
+                res = RUN_STEP_OK;
+            } else if (res != RUN_STEP_OK) {
                 goto cleanup;
-            } else if (tpres == THEFT_HOOK_TRIAL_PRE_ERROR) {
-                res = RUN_STEP_TRIAL_ERROR;
+            } else {
+                if (p->gres == ALL_GEN_ERROR) {
+                    limit = gen_id + 1; /* stop after merging this */
+                }
+                gen_id++;
+            }
+        }
+
+        while (start_id < gen_id) {
+            struct pending_trial *p = &pending[start_id % window];
+            if (p->state == PENDING_READY) {
+                if (theft_call_active_workers(t) >= workers) { break; }
+                if (!pool_start_batch(t, pending, window,
+                        start_id, gen_id)) {
+                    res = RUN_STEP_TRIAL_ERROR;
+                    goto cleanup;
+                }
+            }
+            start_id++;
+        }
+
+        if (merge_id == gen_id) { continue; }
+
+        /* If the hook halts, drop this trial and every later one,
+         * whether or not it has already run. */
+        struct pending_trial *head = &pending[merge_id % window];
+        if (pre_id == merge_id) {
+            res = pool_trial_pre_hook(t, head);
+            if (res == RUN_STEP_HALT) {
+                res = RUN_STEP_OK;
+                goto cleanup;
+            } else if (res != RUN_STEP_OK) {
                 goto cleanup;
             }
+            pre_id++;
         }
 
-        if (!theft_trial_run(t, &pres)) {
+        /* A trial is only merged once its worker has exited, so its
+         * resource usage is known. */
+        if (head->state == PENDING_DONE && head->worker == NULL) {
+            res = pool_merge_trial(t, head);
+            if (res != RUN_STEP_OK) { goto cleanup; }
+            merge_id++;
+            continue;
+        }
+
+        struct worker_info *worker = NULL;
+        enum theft_trial_res tres = THEFT_TRIAL_ERROR;
+        if (!theft_call_wait_any(t, &worker, &tres)) {
             res = RUN_STEP_TRIAL_ERROR;
             goto cleanup;
         }
+
+        /* If the worker exited before finishing its batch, the
+         * result is for the trial it was running when it crashed
+         * (or timed out), and the rest of its batch is requeued. */
+        const bool requeue = (worker->state == WS_INACTIVE
+            && worker->batch_done < worker->batch_count);
+        for (size_t i = 0; i < window; i++) {
+            struct pending_trial *p = &pending[i];
+            if (p->state != PENDING_RUNNING || p->worker != worker) {
+                continue;
+            }
+            if (p->batch_index == worker->batch_done - 1) {
+                p->tres = tres;
+                p->state = PENDING_DONE;
+                memcpy(&p->trial.fork_report,
+                    &worker->reports[p->batch_index],
+                    sizeof(p->trial.fork_report));
+                if (tres == THEFT_TRIAL_FAIL) {
+                    theft_call_save_output(t, worker, p->batch_index,
+                        &p->trial);
+                }
+            } else if (requeue && p->batch_index >= worker->batch_done) {
+                p->state = PENDING_READY;
+                p->worker = NULL;
+                if ((size_t)p->trial.trial < start_id) {
+                    start_id = p->trial.trial;
+                }
+            }
+        }
+
+        if (worker->state == WS_INACTIVE) {
+            for (size_t i = 0; i < window; i++) {
+                struct pending_trial *p = &pending[i];
+                if (p->state == PENDING_DONE && p->worker == worker) {
+                    memcpy(&p->trial.fork_rusage, &worker->rusage,
+                        sizeof(p->trial.fork_rusage));
+                    p->worker = NULL;
+                }
+            }
+        }
     }
 
-    if (pres == THEFT_HOOK_TRIAL_POST_ERROR) {
+cleanup:
+    theft_call_stop_workers(t);
+    for (size_t i = 0; i < window; i++) {
+        if (pending[i].state != PENDING_EMPTY) {
+            memcpy(&t->trial, &pending[i].trial, sizeof(t->trial));
+            theft_trial_free_args(t);
+            memset(&t->trial, 0x00, sizeof(t->trial));
+        }
+    }
+    free(pending);
+    return res;
+}
+
+/* Generate a trial's arguments, and hold it in P until it can be
+ * started on a worker (or merged, if it won't run). The arguments
+ * are marked as called as they're generated, so later trials with the
+ * same arguments are detected as duplicates, just as when running
+ * serially. */
+static enum run_step_res
+pool_gen_trial(struct theft *t, size_t trial, theft_seed *seed,
+        struct pending_trial *p) {
+    enum all_gen_res gres = ALL_GEN_ERROR;
+    enum run_step_res res = gen_trial(t, trial, seed, &gres);
+    if (res != RUN_STEP_OK) {
+        theft_trial_free_args(t);
+        memset(&t->trial, 0x00, sizeof(t->trial));
+        return res;
+    }
+
+    p->worker = NULL;
+    if (gres == ALL_GEN_OK) {
+        p->state = PENDING_READY;
+    } else {
+        p->state = PENDING_DONE;
+    }
+    p->gres = gres;
+    memcpy(&p->trial, &t->trial, sizeof(t->trial));
+    memset(&t->trial, 0x00, sizeof(t->trial));
+    return RUN_STEP_OK;
+}
+
+/* Call the trial_pre hook for the next trial to merge, once every
+ * earlier trial has been merged, rather than before it starts, so the
+ * hook sees the same counters (and can halt after the same trial) as
+ * when running one trial at a time. */
+static enum run_step_res
+pool_trial_pre_hook(struct theft *t, const struct pending_trial *p) {
+    if (p->gres != ALL_GEN_OK) { return RUN_STEP_OK; }
+    memcpy(&t->trial, &p->trial, sizeof(t->trial));
+    enum run_step_res res = run_trial_pre_hook(t);
+    memset(&t->trial, 0x00, sizeof(t->trial));
+    return res;
+}
+
+/* Start an idle worker on a batch of up to trials_per_child trials
+ * that are ready to run, beginning with START_ID. */
+static bool
+pool_start_batch(struct theft *t, struct pending_trial *pending,
+        size_t window, size_t start_id, size_t gen_id) {
+    struct worker_info *worker = theft_call_idle_worker(t);
+    assert(worker != NULL);
+
+    struct pending_trial *batch[t->fork.trials_per_child];
+    size_t count = 0;
+    for (size_t id = start_id;
+         id < gen_id && count < t->fork.trials_per_child; id++) {
+        struct pending_trial *p = &pending[id % window];
+        if (p->state == PENDING_READY) { batch[count++] = p; }
+    }
+
+    /* The worker process gets its own copy of each trial. */
+    bool ok = theft_call_start_batch(t, worker, count,
+        pool_batch_cb, batch);
+    memset(&t->trial, 0x00, sizeof(t->trial));
+    if (!ok) { return false; }
+
+    for (size_t i = 0; i < count; i++) {
+        batch[i]->state = PENDING_RUNNING;
+        batch[i]->worker = worker;
+        batch[i]->batch_index = i;
+    }
+    return true;
+}
+
+static void
+pool_batch_cb(struct theft *t, size_t i, void *udata, void **args) {
+    struct pending_trial **batch = (struct pending_trial **)udata;
+    memcpy(&t->trial, &batch[i]->trial, sizeof(t->trial));
+    theft_trial_get_args(t, args);
+}
+
+/* Update counters, call hooks, and shrink (if necessary) for a
+ * trial that has completed, then free it. */
+static enum run_step_res
+pool_merge_trial(struct theft *t, struct pending_trial *p) {
+    enum run_step_res res = RUN_STEP_OK;
+    enum theft_hook_trial_post_res pres = THEFT_HOOK_TRIAL_POST_CONTINUE;
+    memcpy(&t->trial, &p->trial, sizeof(t->trial));
+    p->state = PENDING_EMPTY;
+
+    LOG(3 - LOG_RUN, "%s: merging trial %d\n", __func__, t->trial.trial);
+
+    if (p->gres == ALL_GEN_OK) {
+        if (!theft_trial_handle_result(t, p->tres, &pres)) {
+            res = RUN_STEP_TRIAL_ERROR;
+        }
+    } else {
+        res = report_gen_result(t, p->gres, &pres);
+    }
+
+    if (res == RUN_STEP_OK && pres == THEFT_HOOK_TRIAL_POST_ERROR) {
         res = RUN_STEP_TRIAL_ERROR;
-        goto cleanup;
     }
 
-    /* Update seed for next trial */
-    *seed = theft_random(t);
-    LOG(3 - LOG_RUN, "end of trial, new seed is 0x%016" PRIx64 "\n", *seed);
-cleanup:
     theft_trial_free_args(t);
+    memset(&t->trial, 0x00, sizeof(t->trial));
     return res;
 }
 
+/* Should trials be run on several threads in this process? */
+static bool
+use_threads(const struct theft *t) {
+    return t->threads.count > 1;
+}
+
+/* Run trials on a pool of threads.
+ *
+ * Each thread takes the next trial ID from a shared counter, then
+ * generates its arguments and calls the property function with its
+ * own handle, which has its own random number generator and trial
+ * info, but shares everything else with T. As with a pool of worker
+ * processes, results are held until every earlier trial has been
+ * merged, and are merged on this thread, in trial order. The trial_pre
+ * hook is called as each trial is merged, so it sees the same counters
+ * as without threads; if it halts, threads stop taking trials, and any
+ * results they already have are discarded. Threads stay at most
+ * POOL_WINDOW_FACTOR trials each ahead of merging.
+ *
+ * Hooks and the dedup filter are only used with the lock held, and
+ * this thread holds it except while waiting for a result, so they're
+ * never used concurrently. Threads only check whether arguments are
+ * duplicates; they are marked as called when merged, so which trials
+ * are reported as duplicates doesn't depend on how the threads were
+ * scheduled. */
+static enum run_step_res
+run_threads(struct theft *t) {
+    const size_t count = t->threads.count;
+    struct thread_shared shared = {
+        .t = t,
+        .window = POOL_WINDOW_FACTOR * count,
+        .limit = t->prop.trial_count,
+        .res = RUN_STEP_OK,
+    };
+    if (0 != pthread_mutex_init(&shared.lock, NULL)) {
+        return RUN_STEP_TRIAL_ERROR;
+    }
+    if (0 != pthread_cond_init(&shared.cond, NULL)) {
+        pthread_mutex_destroy(&shared.lock);
+        return RUN_STEP_TRIAL_ERROR;
+    }
+
+    enum run_step_res res = RUN_STEP_TRIAL_ERROR;
+    size_t started = 0;
+    struct thread_env *envs = calloc(count, sizeof(*envs));
+    shared.pending = calloc(shared.window, sizeof(*shared.pending));
+    if (envs == NULL || shared.pending == NULL) { goto cleanup; }
+
+    pthread_mutex_lock(&shared.lock);
+    for (size_t i = 0; i < count; i++) {
+        envs[i].shared = &shared;
+        envs[i].t = thread_alloc_handle(t, &shared);
+        if (envs[i].t == NULL) { break; }
+        if (0 != pthread_create(&envs[i].thread, NULL,
+                thread_main, &envs[i])) {
+            thread_free_handle(envs[i].t);
+            break;
+        }
+        started++;
+    }
+
+    res = (started == count ? RUN_STEP_OK : RUN_STEP_TRIAL_ERROR);
+    while (res == RUN_STEP_OK && shared.merge_id < shared.limit) {
+        if (shared.stop) {
+            res = shared.res;
+            break;
+        }
+
+        struct pending_trial *head =
+            &shared.pending[shared.merge_id % shared.window];
+        if (head->state != PENDING_DONE) {
+            pthread_cond_wait(&shared.cond, &shared.lock);
+            continue;
+        }
+
+        res = thread_merge_trial(t, head);
+        if (res == RUN_STEP_HALT) {
+            /* Don't hand out any more trials, and discard the results
+             * of any that were already started. */
+            shared.limit = shared.merge_id;
+            res = RUN_STEP_OK;
+            break;
+        }
+        shared.merge_id++;
+        pthread_cond_broadcast(&shared.cond);
+    }
+
+    shared.stop = true;
+    pthread_cond_broadcast(&shared.cond);
+    pthread_mutex_unlock(&shared.lock);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(envs[i].thread, NULL);
+        thread_free_handle(envs[i].t);
+    }
+
+    for (size_t i = 0; i < shared.window; i++) {
+        if (shared.pending[i].state != PENDING_EMPTY) {
+            memcpy(&t->trial, &shared.pending[i].trial, sizeof(t->trial));
+            theft_trial_free_args(t);
+            memset(&t->trial, 0x00, sizeof(t->trial));
+        }
+    }
+
+cleanup:
+    free(shared.pending);
+    free(envs);
+    pthread_cond_destroy(&shared.cond);
+    pthread_mutex_destroy(&shared.lock);
+    return res;
+}
+
+static void *
+thread_main(void *udata) {
+    struct thread_env *env = (struct thread_env *)udata;
+    struct thread_shared *shared = env->shared;
+    struct theft *t = env->t;
+
+    pthread_mutex_lock(&shared->lock);
+    for (;;) {
+        while (!shared->stop && shared->next_id < shared->limit
+            && shared->next_id - shared->merge_id >= shared->window) {
+            pthread_cond_wait(&shared->cond, &shared->lock);
+        }
+        if (shared->stop || shared->next_id >= shared->limit) { break; }
+
+        const size_t trial = shared->next_id++;
+        struct pending_trial *p = &shared->pending[trial % shared->window];
+        p->state = PENDING_RUNNING;
+        /* for the gen_args_pre hook */
+        memcpy(&t->counters, &shared->t->counters, sizeof(t->counters));
+        pthread_mutex_unlock(&shared->lock);
+
+        enum run_step_res res = thread_run_trial(t, trial, p);
+
+        pthread_mutex_lock(&shared->lock);
+        if (res == RUN_STEP_OK) {
+            p->state = PENDING_DONE;
+            if (p->gres == ALL_GEN_ERROR && trial + 1 < shared->limit) {
+                shared->limit = trial + 1; /* stop after merging this */
+            }
+        } else if (res == RUN_STEP_HALT) {
+            p->state = PENDING_EMPTY;
+            if (trial < shared->limit) { shared->limit = trial; }
+        } else {
+            p->state = PENDING_EMPTY;
+            if (!shared->stop) {
+                shared->stop = true;
+                shared->res = res;
+            }
+        }
+        pthread_cond_broadcast(&shared->cond);
+    }
+    pthread_mutex_unlock(&shared->lock);
+    return NULL;
+}
+
+/* On a thread's handle: generate a trial's arguments and call the
+ * property function, saving the results in P to be merged. */
+static enum run_step_res
+thread_run_trial(struct theft *t, size_t trial, struct pending_trial *p) {
+    theft_seed seed = t->seeds.run_seed;
+    enum all_gen_res gres = ALL_GEN_ERROR;
+    enum run_step_res res = gen_trial(t, trial, &seed, &gres);
+    if (res != RUN_STEP_OK) {
+        theft_trial_free_args(t);
+        memset(&t->trial, 0x00, sizeof(t->trial));
+        return res;
+    }
+
+    p->gres = gres;
+    if (gres == ALL_GEN_OK) {
+        void *args[THEFT_MAX_ARITY];
+        theft_trial_get_args(t, args);
+        p->tres = theft_call(t, args);
+    }
+    memcpy(&p->trial, &t->trial, sizeof(t->trial));
+    memset(&t->trial, 0x00, sizeof(t->trial));
+    return RUN_STEP_OK;
+}
+
+/* Mark a trial's arguments as called (or report it as a duplicate,
+ * if an earlier trial had the same arguments), call the trial_pre
+ * hook, then merge it. If the hook halts, P is left unmerged. Any
+ * shrinking uses T's random number generator, which theft_shrink
+ * reseeds from the trial's seed, so it doesn't depend on which trials
+ * were generated first. */
+static enum run_step_res
+thread_merge_trial(struct theft *t, struct pending_trial *p) {
+    if (p->gres == ALL_GEN_OK && t->dedup) {
+        memcpy(&t->trial, &p->trial, sizeof(t->trial));
+        if (theft_call_check_and_mark_called(t)) {
+            p->gres = ALL_GEN_DUP;
+        }
+        memset(&t->trial, 0x00, sizeof(t->trial));
+    }
+    enum run_step_res res = pool_trial_pre_hook(t, p);
+    if (res != RUN_STEP_OK) { return res; }
+    return pool_merge_trial(t, p);
+}
+
+/* Make a handle for a thread, sharing everything with T except the
+ * random number generator and the current trial. */
+static struct theft *
+thread_alloc_handle(struct theft *t, struct thread_shared *shared) {
+    struct theft *res = malloc(sizeof(*res));
+    if (res == NULL) { return NULL; }
+    memcpy(res, t, sizeof(*res));
+
+    res->prng.rng = theft_rng_init_type(t->prng.type, t->seeds.run_seed);
+    if (res->prng.rng == NULL) {
+        free(res);
+        return NULL;
+    }
+    res->prng.buf = 0;
+    res->prng.bits_available = 0;
+    res->prng.bit_pool = NULL;
+    memset(&res->trial, 0x00, sizeof(res->trial));
+    res->threads.shared = shared;
+    return res;
+}
+
+static void
+thread_free_handle(struct theft *t) {
+    theft_rng_free(t->prng.rng);
+    free(t);
+}
+
+/* Generate trials' arguments on a separate thread, up to
+ * prefetch.depth trials ahead of the one running, starting with trial
+ * FIRST (and SEED), if configured.
+ *
+ * The producing thread has its own handle, without the gen_args_pre
+ * hook, and doesn't use the dedup filter; it only hashes the
+ * arguments. When each trial is taken to run, the hook is called,
+ * the arguments are checked and marked as called, and the random
+ * number generator is set to the state it had after generating them,
+ * so hooks, counters, dedup, and shrinking all see the same trials,
+ * in the same order, as without generating ahead. Returns false on
+ * error. */
+static bool
+prefetch_start(struct theft *t, size_t first, theft_seed seed) {
+    if (t->prefetch.depth == 0) { return true; }
+
+    struct prefetch_queue *q = calloc(1, sizeof(*q));
+    if (q == NULL) { return false; }
+    q->depth = t->prefetch.depth;
+    q->next_id = first;
+    q->take_id = first;
+    q->limit = t->prop.trial_count;
+    q->seed = seed;
+
+    if (0 != pthread_mutex_init(&q->lock, NULL)) {
+        free(q);
+        return false;
+    }
+    if (0 != pthread_cond_init(&q->cond, NULL)) {
+        pthread_mutex_destroy(&q->lock);
+        free(q);
+        return false;
+    }
+
+    q->entries = calloc(q->depth, sizeof(*q->entries));
+    if (q->entries == NULL) { goto fail; }
+    for (size_t i = 0; i < q->depth; i++) {
+        q->entries[i].rng = theft_rng_init_type(t->prng.type, 0);
+        if (q->entries[i].rng == NULL) { goto fail; }
+    }
+
+    q->producer = thread_alloc_handle(t, NULL);
+    if (q->producer == NULL) { goto fail; }
+    q->producer->hooks.gen_args_pre = NULL;
+    q->producer->prefetch.queue = q;
+
+    /* Block signals on the producing thread, so the ones meant for
+     * this thread (SIGCHLD, the deadline's timer) are delivered here. */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    const int cres = pthread_create(&q->thread, NULL, prefetch_main, q);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (cres != 0) { goto fail; }
+
+    t->prefetch.queue = q;
+    return true;
+
+fail:
+    free_prefetch_queue(t, q);
+    return false;
+}
+
+/* Stop generating trials ahead, and free any that weren't run. */
+static void
+prefetch_stop(struct theft *t) {
+    struct prefetch_queue *q = t->prefetch.queue;
+    if (q == NULL) { return; }
+
+    pthread_mutex_lock(&q->lock);
+    q->stop = true;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+
+    t->prefetch.queue = NULL;
+    free_prefetch_queue(t, q);
+}
+
+static void
+free_prefetch_queue(struct theft *t, struct prefetch_queue *q) {
+    if (q->entries != NULL) {
+        for (size_t i = 0; i < q->depth; i++) {
+            struct prefetch_entry *e = &q->entries[i];
+            if (e->ready) {
+                memcpy(&t->trial, &e->trial, sizeof(t->trial));
+                theft_trial_free_args(t);
+                memset(&t->trial, 0x00, sizeof(t->trial));
+            }
+            if (e->rng != NULL) { theft_rng_free(e->rng); }
+        }
+        free(q->entries);
+    }
+    if (q->producer != NULL) { thread_free_handle(q->producer); }
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+static void *
+prefetch_main(void *udata) {
+    struct prefetch_queue *q = (struct prefetch_queue *)udata;
+    struct theft *p = q->producer;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (!q->stop && q->next_id < q->limit
+            && q->next_id - q->take_id >= q->depth) {
+            pthread_cond_wait(&q->cond, &q->lock);
+        }
+        if (q->stop || q->next_id >= q->limit) { break; }
+
+        const size_t trial = q->next_id;
+        struct prefetch_entry *e = &q->entries[trial % q->depth];
+        theft_seed seed = q->seed;
+        pthread_mutex_unlock(&q->lock);
+
+        e->gres = ALL_GEN_ERROR;
+        e->res = gen_trial(p, trial, &seed, &e->gres);
+        if (e->res == RUN_STEP_OK && e->gres == ALL_GEN_OK && p->dedup) {
+            e->key = theft_call_arg_hash_key(p);
+        }
+        e->next_seed = seed;
+        theft_rng_copy(e->rng, p->prng.rng);
+        e->prng_buf = p->prng.buf;
+        e->prng_bits_available = p->prng.bits_available;
+        memcpy(&e->trial, &p->trial, sizeof(e->trial));
+        memset(&p->trial, 0x00, sizeof(p->trial));
+
+        pthread_mutex_lock(&q->lock);
+        e->ready = true;
+        q->next_id++;
+        q->seed = seed;
+        if (e->res != RUN_STEP_OK || e->gres == ALL_GEN_ERROR) {
+            q->limit = trial + 1; /* the run stops there */
+        }
+        pthread_cond_broadcast(&q->cond);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+/* Take the next trial generated ahead, in place of gen_trial: wait
+ * for it, then call the gen_args_pre hook and check for duplicates,
+ * as gen_trial would have. */
+static enum run_step_res
+prefetch_gen_trial(struct theft *t, size_t trial, theft_seed *seed,
+        enum all_gen_res *gres) {
+    struct prefetch_queue *q = t->prefetch.queue;
+    struct prefetch_entry *e = &q->entries[trial % q->depth];
+
+    pthread_mutex_lock(&q->lock);
+    assert(trial == q->take_id);
+    while (!e->ready) {
+        pthread_cond_wait(&q->cond, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    memcpy(&t->trial, &e->trial, sizeof(t->trial));
+    *seed = e->next_seed;
+    *gres = e->gres;
+    enum run_step_res res = e->res;
+    const struct theft_hash128 key = e->key;
+    theft_rng_copy(t->prng.rng, e->rng);
+    t->prng.buf = e->prng_buf;
+    t->prng.bits_available = e->prng_bits_available;
+    theft_random_stop_using_bit_pool(t);
+
+    pthread_mutex_lock(&q->lock);
+    e->ready = false;
+    q->take_id++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+
+    if (res != RUN_STEP_OK) { return res; }
+    res = run_gen_args_pre_hook(t);
+    if (res != RUN_STEP_OK) { return res; }
+
+    if (*gres == ALL_GEN_OK && t->dedup
+        && theft_dedup_check_and_mark(t->dedup, key)) {
+        *gres = ALL_GEN_DUP;
+    }
+    return RUN_STEP_OK;
+}
+
+/* Is T the handle generating trials ahead? */
+static bool
+is_prefetcher(const struct theft *t) {
+    return t->prefetch.queue != NULL && t->prefetch.queue->producer == t;
+}
+
+/* On a thread's handle, take the lock shared with the other threads
+ * (and the main thread) before calling hooks or using the dedup
+ * filter. Otherwise, these do nothing. */
+static void
+shared_lock(struct theft *t) {
+    if (t->threads.shared != NULL) {
+        pthread_mutex_lock(&t->threads.shared->lock);
+    }
+}
+
+static void
+shared_unlock(struct theft *t) {
+    if (t->threads.shared != NULL) {
+        pthread_mutex_unlock(&t->threads.shared->lock);
+    }
+}
+
 static uint8_t
 infer_arity(const struct theft_run_config *cfg) {
     for (uint8_t i = 0; i < THEFT_MAX_ARITY; i++) {
@@ -446,9 +1517,16 @@ gen_all_args(struct theft *t) {
         }
     }
 
-    /* check bloom filter */
-    if (t->bloom && theft_call_check_called(t)) {
-        return ALL_GEN_DUP;
+    /* Check whether these arguments were already tried, and if not,
+     * mark them as tried. (On a thread, they're only marked once the
+     * trial is merged, and when generating ahead, once it's run.) */
+    if (t->dedup && !is_prefetcher(t)) {
+        shared_lock(t);
+        const bool dup = (t->threads.shared != NULL
+            ? theft_call_check_called(t)
+            : theft_call_check_and_mark_called(t));
+        shared_unlock(t);
+        if (dup) { return ALL_GEN_DUP; }
     }
 
     return ALL_GEN_OK;
@@ -4,6 +4,9 @@
 #include "theft_types_internal.h"
 #include "theft_run.h"
 
+#include <pthread.h>
+#include <signal.h>
+
 static uint8_t
 infer_arity(const struct theft_run_config *cfg);
 
@@ -13,6 +16,22 @@ enum run_step_res {
     RUN_STEP_GEN_ERROR,
     RUN_STEP_TRIAL_ERROR,
 };
+static enum run_step_res
+run_serial(struct theft *t, size_t first, theft_seed seed);
+
+/* Progress of a supervised run, in memory shared between the
+ * supervisor and the process running the trials. */
+struct supervise_state {
+    size_t trial;               /* the trial currently running */
+    theft_seed seed;            /* its seed, when chaining seeds */
+    struct counter_info counters; /* as of before that trial */
+    bool done;
+    enum run_step_res res;      /* once done */
+};
+
+static enum run_step_res
+run_supervised(struct theft *t);
+
 static enum run_step_res
 run_step(struct theft *t, size_t trial, theft_seed *seed);
 
@@ -30,6 +49,164 @@ enum all_gen_res {
     ALL_GEN_ERROR,              /* memory error or other failure */
 };
 
+static enum run_step_res
+gen_trial(struct theft *t, size_t trial, theft_seed *seed,
+    enum all_gen_res *gres);
+
+static enum run_step_res
+run_gen_args_pre_hook(struct theft *t);
+
+static enum run_step_res
+run_trial_pre_hook(struct theft *t);
+
+static enum run_step_res
+report_gen_result(struct theft *t, enum all_gen_res gres,
+    enum theft_hook_trial_post_res *pres);
+
+/* How far ahead of merging results trials can be generated, as a
+ * multiple of the worker count times the batch size. */
+#define POOL_WINDOW_FACTOR 2
+
+/* A trial that has been generated while running a pool of workers,
+ * but not merged yet. */
+struct pending_trial {
+    enum pending_state {
+        PENDING_EMPTY,
+        PENDING_READY,          /* generated, waiting for a worker */
+        PENDING_RUNNING,        /* running on a worker */
+        PENDING_DONE,           /* has a result, waiting to be merged */
+    } state;
+    enum all_gen_res gres;
+    enum theft_trial_res tres;
+    struct worker_info *worker; /* until its worker has exited */
+    size_t batch_index;         /* position in the worker's batch */
+    struct trial_info trial;
+};
+
+static bool
+use_pool(const struct theft *t);
+
+static enum run_step_res
+run_pool(struct theft *t);
+
+static enum run_step_res
+pool_gen_trial(struct theft *t, size_t trial, theft_seed *seed,
+    struct pending_trial *p);
+
+static enum run_step_res
+pool_trial_pre_hook(struct theft *t, const struct pending_trial *p);
+
+static bool
+pool_start_batch(struct theft *t, struct pending_trial *pending,
+    size_t window, size_t start_id, size_t gen_id);
+
+static void
+pool_batch_cb(struct theft *t, size_t i, void *udata, void **args);
+
+static enum run_step_res
+pool_merge_trial(struct theft *t, struct pending_trial *p);
+
+/* State shared by the threads running trials and the main thread,
+ * which merges their results. It's all protected by lock, except for
+ * each pending trial's contents, which belong to the thread running
+ * it until it's PENDING_DONE, and then to the main thread. */
+struct thread_shared {
+    struct theft *t;            /* the main thread's handle */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* broadcast whenever anything changes */
+    size_t window;
+    struct pending_trial *pending;
+    size_t next_id;             /* next trial to hand out */
+    size_t merge_id;            /* next trial to merge */
+    size_t limit;               /* lowered when a hook halts */
+    bool stop;
+    enum run_step_res res;      /* why a thread stopped the run */
+};
+
+struct thread_env {
+    struct thread_shared *shared;
+    struct theft *t;            /* this thread's handle */
+    pthread_t thread;
+};
+
+static bool
+use_threads(const struct theft *t);
+
+static enum run_step_res
+run_threads(struct theft *t);
+
+static void *
+thread_main(void *udata);
+
+static enum run_step_res
+thread_run_trial(struct theft *t, size_t trial, struct pending_trial *p);
+
+static enum run_step_res
+thread_merge_trial(struct theft *t, struct pending_trial *p);
+
+static struct theft *
+thread_alloc_handle(struct theft *t, struct thread_shared *shared);
+
+static void
+thread_free_handle(struct theft *t);
+
+/* A trial generated ahead of time, waiting to be run. */
+struct prefetch_entry {
+    bool ready;
+    enum run_step_res res;      /* from gen_trial */
+    enum all_gen_res gres;
+    theft_seed next_seed;       /* the seed after generating it */
+    struct theft_hash128 key;   /* for dedup */
+    /* The random number generator's state after generating it. */
+    struct theft_rng *rng;
+    uint64_t prng_buf;
+    uint8_t prng_bits_available;
+    struct trial_info trial;
+};
+
+/* Trials being generated on a separate thread, while the main thread
+ * runs earlier ones. It's all protected by lock, except for each
+ * entry's contents, which belong to the producing thread until it's
+ * ready, and then to the main thread. */
+struct prefetch_queue {
+    struct theft *producer;     /* the producing thread's handle */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* broadcast whenever anything changes */
+    size_t depth;
+    struct prefetch_entry *entries;
+    size_t next_id;             /* next trial to generate */
+    size_t take_id;             /* next trial to run */
+    size_t limit;               /* lowered after a generation error */
+    theft_seed seed;            /* for trial next_id */
+    bool stop;
+};
+
+static bool
+prefetch_start(struct theft *t, size_t first, theft_seed seed);
+
+static void
+prefetch_stop(struct theft *t);
+
+static void
+free_prefetch_queue(struct theft *t, struct prefetch_queue *q);
+
+static void *
+prefetch_main(void *udata);
+
+static enum run_step_res
+prefetch_gen_trial(struct theft *t, size_t trial, theft_seed *seed,
+    enum all_gen_res *gres);
+
+static bool
+is_prefetcher(const struct theft *t);
+
+static void
+shared_lock(struct theft *t);
+
+static void
+shared_unlock(struct theft *t);
+
 static bool init_arg_info(struct theft *t, struct trial_info *trial_info);
 
 static enum all_gen_res
@@ -0,0 +1,107 @@
+#if defined(__linux__)
+#define _GNU_SOURCE         /* for sched_setaffinity(2), CPU_SET */
+#include <sched.h>
+#endif
+
+#include "theft_sched.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+/* CPU affinity uses sched_setaffinity(2), so it's only available on
+ * Linux; elsewhere, the CPU set is ignored (but nice still applies).
+ *
+ * With `.fork.pin_parent`, the main process gets the first CPU in the
+ * set to itself, and workers use the rest (unless there's only one).
+ * With `.fork.pin_workers`, each worker slot gets a single CPU from
+ * the workers' share, in order, wrapping around if there are more
+ * slots than CPUs; otherwise, workers can run on any of them. */
+
+#if defined(__linux__)
+static bool
+set_affinity(const unsigned *cpus, size_t count);
+#endif
+
+bool
+theft_sched_init(struct theft *t) {
+    struct sched_info *s = &t->sched;
+    if (s->cpu_count == 0 || !t->fork.enable) { return true; }
+#if defined(__linux__)
+    for (size_t i = 0; i < s->cpu_count; i++) {
+        if (s->cpus[i] >= CPU_SETSIZE) { return false; }
+    }
+    if (!s->pin_parent) { return true; }
+
+    cpu_set_t *old = malloc(sizeof(*old));
+    if (old == NULL) { return false; }
+    if (-1 == sched_getaffinity(0, sizeof(*old), old)) {
+        perror("sched_getaffinity");
+        free(old);
+        return false;
+    }
+    s->old_affinity = old;
+    return set_affinity(s->cpus, 1);
+#else
+    return true;
+#endif
+}
+
+void
+theft_sched_free(struct theft *t) {
+#if defined(__linux__)
+    struct sched_info *s = &t->sched;
+    if (s->old_affinity == NULL) { return; }
+    if (-1 == sched_setaffinity(0, sizeof(cpu_set_t), s->old_affinity)) {
+        perror("sched_setaffinity");
+    }
+    free(s->old_affinity);
+    s->old_affinity = NULL;
+#else
+    (void)t;
+#endif
+}
+
+bool
+theft_sched_enter_worker(struct theft *t, size_t worker_id) {
+    const struct sched_info *s = &t->sched;
+    if (s->nice != 0) {
+        errno = 0;
+        if (-1 == nice(s->nice) && errno != 0) {
+            perror("nice");
+            return false;
+        }
+    }
+
+#if defined(__linux__)
+    if (s->cpu_count == 0) { return true; }
+    const unsigned *cpus = s->cpus;
+    size_t count = s->cpu_count;
+    if (s->pin_parent && count > 1) {
+        cpus++;
+        count--;
+    }
+    if (s->pin_workers) {
+        return set_affinity(&cpus[worker_id % count], 1);
+    }
+    return set_affinity(cpus, count);
+#else
+    (void)worker_id;
+    return true;
+#endif
+}
+
+#if defined(__linux__)
+static bool
+set_affinity(const unsigned *cpus, size_t count) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < count; i++) {
+        CPU_SET(cpus[i], &set);
+    }
+    if (-1 == sched_setaffinity(0, sizeof(set), &set)) {
+        perror("sched_setaffinity");
+        return false;
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,20 @@
+#ifndef THEFT_SCHED_H
+#define THEFT_SCHED_H
+
+#include "theft_types_internal.h"
+
+/* If configured, pin the main process to its CPU, saving its previous
+ * affinity. Returns false if the CPU set is invalid, or pinning fails. */
+bool
+theft_sched_init(struct theft *t);
+
+/* Restore the main process's previous affinity. */
+void
+theft_sched_free(struct theft *t);
+
+/* In the worker process for slot WORKER_ID: set its CPU affinity and
+ * nice value, if configured. Returns false on error. */
+bool
+theft_sched_enter_worker(struct theft *t, size_t worker_id);
+
+#endif
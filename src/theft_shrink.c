@@ -3,7 +3,9 @@
 
 #include "theft_call.h"
 #include "theft_trial.h"
+#include "theft_random.h"
 #include "theft_autoshrink.h"
+#include "theft_checkpoint.h"
 #include <assert.h>
 
 #define LOG_SHRINK 0
@@ -15,6 +17,13 @@ theft_shrink(struct theft *t) {
     bool progress = false;
     assert(t->prop.arity > 0);
 
+    /* Reseed the PRNG from the failing trial's seed, so shrinking
+     * doesn't depend on what was generated since the trial started
+     * (e.g., arguments for later trials, when running workers). */
+    const theft_seed seed = t->trial.seed;
+    theft_random_set_seed(t, theft_hash_onepass((const uint8_t *)&seed,
+            sizeof(seed)));
+
     do {
         progress = false;
         /* Greedily attempt to simplify each argument as much as
@@ -24,7 +33,9 @@ theft_shrink(struct theft *t) {
         greedy_continue:
             if (ti->shrink || ti->autoshrink_config.enable) {
                 /* attempt to simplify this argument by one step */
-                enum shrink_res rres = attempt_to_shrink_arg(t, arg_i);
+                enum shrink_res rres = (shrink_in_parallel(t)
+                    ? attempt_to_shrink_arg_parallel(t, arg_i)
+                    : attempt_to_shrink_arg(t, arg_i));
 
                 switch (rres) {
                 case SHRINK_OK:
@@ -52,9 +63,9 @@ theft_shrink(struct theft *t) {
  * order, and checking whether the property still fails. If it passes,
  * then revert the simplification and try another tactic.
  *
- * If the bloom filter is being used (i.e., if all arguments have hash
- * callbacks defined), then use it to skip over areas of the state
- * space that have probably already been tried. */
+ * If the bloom filter or dedup set is being used (i.e., if all arguments
+ * have hash callbacks defined), then use it to skip over areas of the
+ * state space that have (probably) already been tried. */
 static enum shrink_res
 attempt_to_shrink_arg(struct theft *t, uint8_t arg_i) {
     struct theft_type_info *ti = t->prop.type_info[arg_i];
@@ -118,8 +129,8 @@ attempt_to_shrink_arg(struct theft *t, uint8_t arg_i) {
         t->trial.args[arg_i].instance = candidate;
         if (use_autoshrink) { as_env->bit_pool = candidate_bit_pool; }
 
-        if (t->bloom) {
-            if (theft_call_check_called(t)) {
+        if (t->dedup) {
+            if (theft_call_check_and_mark_called(t)) {
                 LOG(3 - LOG_SHRINK,
                     "%s: already called, skipping\n", __func__);
                 if (ti->free) { ti->free(candidate, ti->env); }
@@ -129,8 +140,6 @@ attempt_to_shrink_arg(struct theft *t, uint8_t arg_i) {
                 }
                 t->trial.args[arg_i].instance = current;
                 continue;
-            } else {
-                theft_call_mark_called(t);
             }
         }
 
@@ -210,6 +219,295 @@ attempt_to_shrink_arg(struct theft *t, uint8_t arg_i) {
     return SHRINK_DEAD_END;
 }
 
+/* Should candidates be run on several workers at once? */
+static bool
+shrink_in_parallel(const struct theft *t) {
+    return t->fork.parallel_shrink && t->fork.workers > 1
+        && theft_call_forking(t);
+}
+
+/* Simplify an argument like attempt_to_shrink_arg, but generate a
+ * candidate for each worker (from successive tactics), run them all at
+ * once on the last fork.workers worker slots (which are kept free for
+ * this), and keep the first one, in tactic order, that still fails.
+ *
+ * Candidates are generated, and their results looked at, in the same
+ * order every time, so this is reproducible. The shrink_pre and
+ * shrink_post hooks are called for each candidate as it's generated,
+ * before any of them are run, and shrink_trial_post is called for
+ * each result (in order) up to the one that's kept; candidates after
+ * that are killed, and not reported. */
+static enum shrink_res
+attempt_to_shrink_arg_parallel(struct theft *t, uint8_t arg_i) {
+    const size_t max = t->fork.workers;
+    assert(t->worker_count >= max);
+    struct worker_info *workers = &t->workers[t->worker_count - max];
+    struct shrink_candidate cands[max];
+
+    uint32_t tactic = 0;
+    bool no_more = false;
+    while (!no_more && tactic < THEFT_MAX_TACTICS) {
+        size_t count = 0;
+        enum shrink_res res = gen_candidates(t, arg_i, &tactic,
+            cands, max, &count, &no_more);
+        if (res != SHRINK_OK) { return res; }
+        if (count == 0) { break; }
+
+        res = run_candidates(t, arg_i, cands, count, workers);
+        if (res != SHRINK_DEAD_END) { return res; }
+    }
+    return SHRINK_DEAD_END;
+}
+
+/* Generate up to MAX candidates from the current instance, starting
+ * with *TACTIC, and save how many in *COUNT. Tactics that are dead
+ * ends, or whose candidates were already tried, are skipped. */
+static enum shrink_res
+gen_candidates(struct theft *t, uint8_t arg_i, uint32_t *tactic,
+        struct shrink_candidate *cands, size_t max, size_t *count,
+        bool *no_more) {
+    struct theft_type_info *ti = t->prop.type_info[arg_i];
+    const bool use_autoshrink = ti->autoshrink_config.enable;
+    void *current = t->trial.args[arg_i].instance;
+    struct autoshrink_env *as_env = (use_autoshrink
+        ? t->trial.args[arg_i].u.as.env : NULL);
+    struct autoshrink_bit_pool *current_bit_pool = (use_autoshrink
+        ? as_env->bit_pool : NULL);
+
+    enum shrink_res res = SHRINK_OK;
+    size_t n = 0;
+    for (; n < max && *tactic < THEFT_MAX_TACTICS; (*tactic)++) {
+        LOG(2 - LOG_SHRINK, "SHRINKING arg %u, tactic %u (parallel)\n",
+            arg_i, *tactic);
+        enum theft_hook_shrink_pre_res shrink_pre_res;
+        shrink_pre_res = shrink_pre_hook(t, arg_i, current, *tactic);
+        if (shrink_pre_res == THEFT_HOOK_SHRINK_PRE_HALT) {
+            res = SHRINK_HALT;
+            goto fail;
+        } else if (shrink_pre_res != THEFT_HOOK_SHRINK_PRE_CONTINUE) {
+            res = SHRINK_ERROR;
+            goto fail;
+        }
+
+        struct shrink_candidate *c = &cands[n];
+        memset(c, 0x00, sizeof(*c));
+        c->tactic = *tactic;
+        enum theft_shrink_res sres = (use_autoshrink
+            ? theft_autoshrink_shrink(t, as_env, *tactic, &c->instance,
+                &c->bit_pool)
+            : ti->shrink(t, current, *tactic, ti->env, &c->instance));
+
+        t->trial.shrink_count++;
+
+        enum theft_hook_shrink_post_res shrink_post_res;
+        shrink_post_res = shrink_post_hook(t, arg_i,
+            sres == THEFT_SHRINK_OK ? c->instance : current,
+            *tactic, sres);
+        if (shrink_post_res != THEFT_HOOK_SHRINK_POST_CONTINUE) {
+            if (sres == THEFT_SHRINK_OK) { free_candidate(t, arg_i, c); }
+            res = SHRINK_ERROR;
+            goto fail;
+        }
+
+        switch (sres) {
+        case THEFT_SHRINK_OK:
+            break;
+        case THEFT_SHRINK_DEAD_END:
+            continue;           /* try next tactic */
+        case THEFT_SHRINK_NO_MORE_TACTICS:
+            *no_more = true;
+            *count = n;
+            return SHRINK_OK;
+        case THEFT_SHRINK_ERROR:
+        default:
+            res = SHRINK_ERROR;
+            goto fail;
+        }
+
+        if (t->dedup) {
+            set_arg(t, arg_i, c->instance, c->bit_pool);
+            const bool dup = theft_call_check_called(t);
+            set_arg(t, arg_i, current, current_bit_pool);
+            if (dup) {
+                LOG(3 - LOG_SHRINK,
+                    "%s: already called, skipping\n", __func__);
+                free_candidate(t, arg_i, c);
+                continue;
+            }
+        }
+        n++;
+    }
+    *count = n;
+    return SHRINK_OK;
+
+fail:
+    for (size_t i = 0; i < n; i++) { free_candidate(t, arg_i, &cands[i]); }
+    return res;
+}
+
+/* Run COUNT candidates at once, one per worker, and look at their
+ * results in order, until one fails. Returns SHRINK_OK if one was
+ * kept, or SHRINK_DEAD_END if they all passed (or were skipped). */
+static enum shrink_res
+run_candidates(struct theft *t, uint8_t arg_i,
+        struct shrink_candidate *cands, size_t count,
+        struct worker_info *workers) {
+    const bool use_autoshrink =
+        t->prop.type_info[arg_i]->autoshrink_config.enable;
+    void *current = t->trial.args[arg_i].instance;
+    struct autoshrink_bit_pool *current_bit_pool = (use_autoshrink
+        ? t->trial.args[arg_i].u.as.env->bit_pool : NULL);
+
+    /* Workers get the arguments (and bit pools) from the current
+     * trial, so swap each candidate in while starting it. */
+    size_t started = 0;
+    for (; started < count; started++) {
+        struct shrink_candidate *c = &cands[started];
+        void *args[THEFT_MAX_ARITY];
+        set_arg(t, arg_i, c->instance, c->bit_pool);
+        theft_trial_get_args(t, args);
+        c->worker = &workers[started];
+        if (!theft_call_start(t, c->worker, args)) { break; }
+    }
+    set_arg(t, arg_i, current, current_bit_pool);
+
+    enum shrink_res res = SHRINK_ERROR;
+    size_t next = 0;            /* next candidate to look at */
+    if (started < count) { goto cleanup; }
+
+    res = SHRINK_DEAD_END;
+    while (next < count) {
+        struct shrink_candidate *c = &cands[next];
+        if (c->done) {
+            next++;
+            res = examine_candidate(t, arg_i, c, current, current_bit_pool);
+            if (res != SHRINK_DEAD_END) { break; }
+            continue;
+        }
+
+        struct worker_info *worker = NULL;
+        enum theft_trial_res tres = THEFT_TRIAL_ERROR;
+        if (!theft_call_wait_any_of(t, workers, count, &worker, &tres)) {
+            res = SHRINK_ERROR;
+            break;
+        }
+        for (size_t i = next; i < count; i++) {
+            if (cands[i].worker == worker) {
+                cands[i].done = true;
+                cands[i].res = tres;
+            }
+        }
+    }
+
+cleanup:
+    /* Kill the candidates after the one that was kept. */
+    for (size_t i = next; i < count; i++) {
+        if (cands[i].worker != NULL) {
+            theft_call_stop_worker(t, cands[i].worker);
+        }
+        free_candidate(t, arg_i, &cands[i]);
+    }
+    theft_checkpoint_collect(t);
+    return res;
+}
+
+/* Handle a candidate's result, as attempt_to_shrink_arg does: report
+ * it to the shrink_trial_post hook (which can have it run again), and
+ * keep it if it still fails, or free it otherwise. */
+static enum shrink_res
+examine_candidate(struct theft *t, uint8_t arg_i,
+        struct shrink_candidate *c, void *current,
+        struct autoshrink_bit_pool *current_bit_pool) {
+    struct theft_type_info *ti = t->prop.type_info[arg_i];
+    set_arg(t, arg_i, c->instance, c->bit_pool);
+
+    /* An earlier candidate may have been the same. */
+    if (t->dedup && theft_call_check_and_mark_called(t)) {
+        set_arg(t, arg_i, current, current_bit_pool);
+        free_candidate(t, arg_i, c);
+        return SHRINK_DEAD_END;
+    }
+
+    enum theft_trial_res res = c->res;
+    bool repeated = false;
+    for (;;) {
+        void *args[THEFT_MAX_ARITY];
+        theft_trial_get_args(t, args);
+
+        if (!repeated) {
+            if (res == THEFT_TRIAL_FAIL) {
+                t->trial.successful_shrinks++;
+                theft_autoshrink_update_model(t, arg_i, res, 3);
+            } else {
+                t->trial.failed_shrinks++;
+            }
+        }
+
+        enum theft_hook_shrink_trial_post_res stpres;
+        stpres = shrink_trial_post_hook(t, arg_i, args, c->tactic, res);
+        if (stpres == THEFT_HOOK_SHRINK_TRIAL_POST_REPEAT
+            || (stpres == THEFT_HOOK_SHRINK_TRIAL_POST_REPEAT_ONCE && !repeated)) {
+            repeated = true;
+            res = theft_call(t, args);
+            continue;
+        } else if (stpres == THEFT_HOOK_SHRINK_TRIAL_POST_REPEAT_ONCE && repeated) {
+            break;
+        } else if (stpres == THEFT_HOOK_SHRINK_TRIAL_POST_CONTINUE) {
+            break;
+        } else {
+            res = THEFT_TRIAL_ERROR;
+            break;
+        }
+    }
+
+    theft_autoshrink_update_model(t, arg_i, res, 8);
+
+    switch (res) {
+    case THEFT_TRIAL_PASS:
+    case THEFT_TRIAL_SKIP:
+        set_arg(t, arg_i, current, current_bit_pool);
+        free_candidate(t, arg_i, c);
+        return SHRINK_DEAD_END;
+    case THEFT_TRIAL_FAIL:
+        LOG(2 - LOG_SHRINK, "FAIL: COMMITTING %u: tactic %u (parallel)\n",
+            arg_i, c->tactic);
+        /* A repeated call already saved its own output. */
+        if (!repeated) {
+            theft_call_save_output(t, c->worker, 0, &t->trial);
+        }
+        break;
+    default:
+    case THEFT_TRIAL_ERROR:
+        break;
+    }
+
+    /* Either way, the candidate is now the current instance. */
+    if (ti->free) { ti->free(current, ti->env); }
+    if (current_bit_pool) {
+        theft_autoshrink_free_bit_pool(t, current_bit_pool);
+    }
+    return (res == THEFT_TRIAL_FAIL ? SHRINK_OK : SHRINK_ERROR);
+}
+
+/* Make INSTANCE (and its BIT_POOL, when autoshrinking) the current
+ * trial's argument ARG_I. */
+static void
+set_arg(struct theft *t, uint8_t arg_i, void *instance,
+        struct autoshrink_bit_pool *bit_pool) {
+    t->trial.args[arg_i].instance = instance;
+    if (t->prop.type_info[arg_i]->autoshrink_config.enable) {
+        t->trial.args[arg_i].u.as.env->bit_pool = bit_pool;
+    }
+}
+
+static void
+free_candidate(struct theft *t, uint8_t arg_i,
+        struct shrink_candidate *c) {
+    struct theft_type_info *ti = t->prop.type_info[arg_i];
+    if (ti->free) { ti->free(c->instance, ti->env); }
+    if (c->bit_pool) { theft_autoshrink_free_bit_pool(t, c->bit_pool); }
+}
+
 static enum theft_hook_shrink_pre_res
 shrink_pre_hook(struct theft *t,
         uint8_t arg_index, void *arg, uint32_t tactic) {
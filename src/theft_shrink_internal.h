@@ -13,6 +13,45 @@ enum shrink_res {
 static enum shrink_res
 attempt_to_shrink_arg(struct theft *t, uint8_t arg_i);
 
+/* A candidate generated while shrinking in parallel. */
+struct shrink_candidate {
+    uint32_t tactic;
+    void *instance;
+    struct autoshrink_bit_pool *bit_pool; /* when autoshrinking */
+    struct worker_info *worker; /* once started */
+    bool done;                  /* has a result */
+    enum theft_trial_res res;
+};
+
+static bool
+shrink_in_parallel(const struct theft *t);
+
+static enum shrink_res
+attempt_to_shrink_arg_parallel(struct theft *t, uint8_t arg_i);
+
+static enum shrink_res
+gen_candidates(struct theft *t, uint8_t arg_i, uint32_t *tactic,
+    struct shrink_candidate *cands, size_t max, size_t *count,
+    bool *no_more);
+
+static enum shrink_res
+run_candidates(struct theft *t, uint8_t arg_i,
+    struct shrink_candidate *cands, size_t count,
+    struct worker_info *workers);
+
+static enum shrink_res
+examine_candidate(struct theft *t, uint8_t arg_i,
+    struct shrink_candidate *c, void *current,
+    struct autoshrink_bit_pool *current_bit_pool);
+
+static void
+set_arg(struct theft *t, uint8_t arg_i, void *instance,
+    struct autoshrink_bit_pool *bit_pool);
+
+static void
+free_candidate(struct theft *t, uint8_t arg_i,
+    struct shrink_candidate *c);
+
 static enum theft_hook_shrink_pre_res
 shrink_pre_hook(struct theft *t,
     uint8_t arg_index, void *arg, uint32_t tactic);
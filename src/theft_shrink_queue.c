@@ -0,0 +1,204 @@
+#include "theft_shrink_queue_internal.h"
+
+#include "theft_rng.h"
+#include "theft_trial.h"
+
+#define LOG_SHRINK_QUEUE 0
+
+/* Failing trials are moved to a queue rather than shrunk right away,
+ * and a separate thread, with its own handle, shrinks them in the
+ * order they failed. Hooks, the dedup filter, and counters are only
+ * used with the lock held, and each thread only releases it around
+ * calls to the property function, so the main thread can run the
+ * next trial while the shrinker runs a candidate, but hooks are never
+ * called concurrently. */
+
+bool
+theft_shrink_queue_start(struct theft *t) {
+    if (!t->shrink_queue.enable) { return true; }
+
+    struct shrink_queue *q = calloc(1, sizeof(*q));
+    if (q == NULL) { return false; }
+    q->t = t;
+
+    if (0 != pthread_mutex_init(&q->lock, NULL)) {
+        free(q);
+        return false;
+    }
+    if (0 != pthread_cond_init(&q->cond, NULL)) {
+        pthread_mutex_destroy(&q->lock);
+        free(q);
+        return false;
+    }
+
+    q->shrinker = alloc_shrinker_handle(t, q);
+    if (q->shrinker == NULL) { goto fail; }
+
+    pthread_mutex_lock(&q->lock);
+    if (0 != pthread_create(&q->thread, NULL, shrinker_main, q)) {
+        pthread_mutex_unlock(&q->lock);
+        goto fail;
+    }
+    t->shrink_queue.queue = q;
+    return true;
+
+fail:
+    free_queue(t, q);
+    return false;
+}
+
+bool
+theft_shrink_queue_active(const struct theft *t) {
+    const struct shrink_queue *q = t->shrink_queue.queue;
+    return q != NULL && q->shrinker != t;
+}
+
+bool
+theft_shrink_queue_push(struct theft *t) {
+    struct shrink_queue *q = t->shrink_queue.queue;
+    assert(q != NULL);
+    if (q->error) { return false; }
+
+    struct queued_trial *qt = calloc(1, sizeof(*qt));
+    if (qt == NULL) { return false; }
+    memcpy(&qt->trial, &t->trial, sizeof(qt->trial));
+    memset(&t->trial, 0x00, sizeof(t->trial));
+
+    LOG(3 - LOG_SHRINK_QUEUE, "%s: queueing trial %d\n",
+        __func__, qt->trial.trial);
+
+    if (q->tail == NULL) {
+        q->head = qt;
+    } else {
+        q->tail->next = qt;
+    }
+    q->tail = qt;
+    pthread_cond_broadcast(&q->cond);
+    return true;
+}
+
+bool
+theft_shrink_queue_drain(struct theft *t) {
+    struct shrink_queue *q = t->shrink_queue.queue;
+    if (q == NULL) { return true; }
+
+    q->stop = true;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+
+    const bool ok = !q->error;
+    t->shrink_queue.queue = NULL;
+    free_queue(t, q);
+    return ok;
+}
+
+void
+theft_shrink_queue_unlock(struct theft *t) {
+    if (t->shrink_queue.queue != NULL) {
+        pthread_mutex_unlock(&t->shrink_queue.queue->lock);
+    }
+}
+
+void
+theft_shrink_queue_lock(struct theft *t) {
+    if (t->shrink_queue.queue != NULL) {
+        pthread_mutex_lock(&t->shrink_queue.queue->lock);
+    }
+}
+
+/* Shrink queued trials until the queue has been drained, or one
+ * fails with an error. */
+static void *
+shrinker_main(void *udata) {
+    struct shrink_queue *q = (struct shrink_queue *)udata;
+
+    pthread_mutex_lock(&q->lock);
+    while (!q->error) {
+        struct queued_trial *qt = q->head;
+        if (qt == NULL) {
+            if (q->stop) { break; }
+            pthread_cond_wait(&q->cond, &q->lock);
+            continue;
+        }
+
+        q->head = qt->next;
+        if (q->head == NULL) { q->tail = NULL; }
+
+        if (!shrink_trial(q, qt)) { q->error = true; }
+        free(qt);
+        pthread_cond_broadcast(&q->cond);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+/* On the shrinker's handle, shrink and report a queued trial, as if
+ * it had just failed. It was already added to the main handle's
+ * counters when it was queued. Hooks see the main handle's counters
+ * as of now, since the lock is held, except that only failures that
+ * have already been reported are counted, as when shrinking right
+ * away. */
+static bool
+shrink_trial(struct shrink_queue *q, struct queued_trial *qt) {
+    struct theft *s = q->shrinker;
+    LOG(3 - LOG_SHRINK_QUEUE, "%s: shrinking trial %d\n",
+        __func__, qt->trial.trial);
+
+    memcpy(&s->trial, &qt->trial, sizeof(s->trial));
+    memcpy(&s->counters, &q->t->counters, sizeof(s->counters));
+    s->counters.fail = q->reported;
+
+    enum theft_hook_trial_post_res pres = THEFT_HOOK_TRIAL_POST_CONTINUE;
+    const bool ok = theft_trial_handle_result(s, THEFT_TRIAL_FAIL, &pres);
+    q->reported = s->counters.fail;
+
+    theft_trial_free_args(s);
+    memset(&s->trial, 0x00, sizeof(s->trial));
+    return ok && pres != THEFT_HOOK_TRIAL_POST_ERROR;
+}
+
+/* Make a handle for the shrinker, sharing everything with T except
+ * the random number generator and the current trial. */
+static struct theft *
+alloc_shrinker_handle(struct theft *t, struct shrink_queue *q) {
+    struct theft *res = malloc(sizeof(*res));
+    if (res == NULL) { return NULL; }
+    memcpy(res, t, sizeof(*res));
+
+    res->prng.rng = theft_rng_init_type(t->prng.type, t->seeds.run_seed);
+    if (res->prng.rng == NULL) {
+        free(res);
+        return NULL;
+    }
+    res->prng.buf = 0;
+    res->prng.bits_available = 0;
+    res->prng.bit_pool = NULL;
+    memset(&res->trial, 0x00, sizeof(res->trial));
+    res->shrink_queue.queue = q;
+    return res;
+}
+
+/* Free the queue, the shrinker's handle, and any trials that were
+ * never shrunk (after an error). The shrinker's thread must have
+ * exited. */
+static void
+free_queue(struct theft *t, struct shrink_queue *q) {
+    struct queued_trial *qt = q->head;
+    while (qt != NULL) {
+        struct queued_trial *next = qt->next;
+        memcpy(&t->trial, &qt->trial, sizeof(t->trial));
+        theft_trial_free_args(t);
+        memset(&t->trial, 0x00, sizeof(t->trial));
+        free(qt);
+        qt = next;
+    }
+
+    if (q->shrinker != NULL) {
+        theft_rng_free(q->shrinker->prng.rng);
+        free(q->shrinker);
+    }
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
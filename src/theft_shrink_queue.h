@@ -0,0 +1,39 @@
+#ifndef THEFT_SHRINK_QUEUE_H
+#define THEFT_SHRINK_QUEUE_H
+
+#include "theft_types_internal.h"
+
+/* If T is configured to shrink in the background, start the
+ * shrinker's thread. Until theft_shrink_queue_drain, the calling
+ * thread holds a lock that it only releases while calling the
+ * property function, and the shrinker does the same, so only property
+ * calls run concurrently. Returns false on error. */
+bool
+theft_shrink_queue_start(struct theft *t);
+
+/* Should failures be queued, rather than shrunk right away? Only on
+ * the main handle, while the shrinker is running. */
+bool
+theft_shrink_queue_active(const struct theft *t);
+
+/* Move the current trial, which failed, to the queue. The shrinker
+ * will shrink it, then count it and call the counterexample and
+ * trial_post hooks. T's current trial no longer has any arguments
+ * afterward. Returns false if the shrinker stopped due to an error. */
+bool
+theft_shrink_queue_push(struct theft *t);
+
+/* Wait for every queued trial to be shrunk, then stop the shrinker.
+ * Returns false if shrinking any of them failed. */
+bool
+theft_shrink_queue_drain(struct theft *t);
+
+/* Release the lock before calling the property function, and take
+ * it again afterward. These do nothing unless the shrinker is
+ * running. */
+void
+theft_shrink_queue_unlock(struct theft *t);
+void
+theft_shrink_queue_lock(struct theft *t);
+
+#endif
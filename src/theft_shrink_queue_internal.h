@@ -0,0 +1,44 @@
+#ifndef THEFT_SHRINK_QUEUE_INTERNAL_H
+#define THEFT_SHRINK_QUEUE_INTERNAL_H
+
+#include "theft_shrink_queue.h"
+
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+/* A failing trial waiting to be shrunk. */
+struct queued_trial {
+    struct queued_trial *next;
+    struct trial_info trial;
+};
+
+/* The queue and its shrinker. Everything here is protected by lock,
+ * which one of the threads holds whenever it isn't calling the
+ * property function. */
+struct shrink_queue {
+    struct theft *t;            /* the main thread's handle */
+    struct theft *shrinker;     /* the shrinker thread's handle */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* broadcast whenever anything changes */
+    struct queued_trial *head;
+    struct queued_trial *tail;
+    size_t reported;            /* failures shrunk and reported so far */
+    bool stop;                  /* no more trials will be queued */
+    bool error;                 /* the shrinker stopped due to an error */
+};
+
+static void *
+shrinker_main(void *udata);
+
+static bool
+shrink_trial(struct shrink_queue *q, struct queued_trial *qt);
+
+static struct theft *
+alloc_shrinker_handle(struct theft *t, struct shrink_queue *q);
+
+static void
+free_queue(struct theft *t, struct shrink_queue *q);
+
+#endif
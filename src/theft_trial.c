@@ -6,6 +6,8 @@
 #include "theft_call.h"
 #include "theft_shrink.h"
 #include "theft_autoshrink.h"
+#include "theft_checkpoint.h"
+#include "theft_shrink_queue.h"
 
 /* Now that arguments have been generated, run the trial and update
  * counters, call cb with results, etc. */
@@ -14,13 +16,30 @@ theft_trial_run(struct theft *t,
         enum theft_hook_trial_post_res *tpres) {
     assert(t->prop.arity > 0);
 
-    if (t->bloom) { theft_call_mark_called(t); }
+    void *args[THEFT_MAX_ARITY];
+    theft_trial_get_args(t, args);
+
+    enum theft_trial_res tres = theft_call(t, args);
+    t->trial.deadline_exceeded = t->deadline.last_exceeded;
+    if (theft_call_forking(t)) {
+        memcpy(&t->trial.fork_report, t->last_report,
+            sizeof(t->trial.fork_report));
+        memcpy(&t->trial.fork_rusage, t->last_rusage,
+            sizeof(t->trial.fork_rusage));
+    }
+    return theft_trial_handle_result(t, tres, tpres);
+}
 
+/* Update counters, call cb with results, and shrink on failure,
+ * once the current trial's property function has returned TRES. */
+bool
+theft_trial_handle_result(struct theft *t, enum theft_trial_res tres,
+        enum theft_hook_trial_post_res *tpres) {
     void *args[THEFT_MAX_ARITY];
     theft_trial_get_args(t, args);
 
     bool repeated = false;
-    enum theft_trial_res tres = theft_call(t, args);
+    const bool forked = theft_call_forking(t);
     theft_hook_trial_post_cb *trial_post = t->hooks.trial_post;
     void *trial_post_env = (trial_post == theft_hook_trial_post_print_result
         ? t->print_trial_result_env
@@ -36,6 +55,9 @@ theft_trial_run(struct theft *t,
         .arity = t->prop.arity,
         .args = args,
         .result = tres,
+        .fork_report = (forked ? &t->trial.fork_report : NULL),
+        .fork_rusage = (forked ? &t->trial.fork_rusage : NULL),
+        .deadline_exceeded = t->trial.deadline_exceeded,
     };
 
     switch (tres) {
@@ -46,7 +68,23 @@ theft_trial_run(struct theft *t,
         *tpres = trial_post(&hook_info, trial_post_env);
         break;
     case THEFT_TRIAL_FAIL:
+        if (theft_shrink_queue_active(t)) {
+            /* It's counted now, so the trial_pre hook can halt after
+             * it, but only reported once it has been shrunk. */
+            if (!theft_shrink_queue_push(t)) { return false; }
+            t->counters.fail++;
+            *tpres = THEFT_HOOK_TRIAL_POST_CONTINUE;
+            return true;
+        }
+
+        /* Workers only stop at checkpoints while shrinking (and
+         * re-running the counter-example), and an automatic timeout
+         * stays the same throughout. */
+        theft_checkpoint_arm(t);
+        theft_call_freeze_timeout(t, true);
         if (!theft_shrink(t)) {
+            theft_checkpoint_disarm(t);
+            theft_call_freeze_timeout(t, false);
             hook_info.result = THEFT_TRIAL_ERROR;
             /* We may not have a valid reference to the arguments
              * anymore, so remove the stale pointers. */
@@ -63,6 +101,8 @@ theft_trial_run(struct theft *t,
 
         theft_trial_get_args(t, hook_info.args);
         *tpres = report_on_failure(t, &hook_info, trial_post, trial_post_env);
+        theft_checkpoint_disarm(t);
+        theft_call_freeze_timeout(t, false);
         break;
     case THEFT_TRIAL_SKIP:
         if (!repeated) {
@@ -96,6 +136,8 @@ void theft_trial_free_args(struct theft *t) {
             ti->free(t->trial.args[i].instance, ti->env);
         }
     }
+    free(t->trial.output);
+    t->trial.output = NULL;
 }
 
 void
@@ -122,6 +164,9 @@ report_on_failure(struct theft *t,
             .arity = t->prop.arity,
             .type_info = t->prop.type_info,
             .args = hook_info->args,
+            .output = t->trial.output,
+            .output_size = t->trial.output_size,
+            .output_truncated = t->trial.output_truncated,
         };
 
         if (counterexample(&counterexample_hook_info, t->hooks.env)
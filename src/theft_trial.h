@@ -5,6 +5,10 @@ bool
 theft_trial_run(struct theft *t,
     enum theft_hook_trial_post_res *tpres);
 
+bool
+theft_trial_handle_result(struct theft *t, enum theft_trial_res tres,
+    enum theft_hook_trial_post_res *tpres);
+
 void
 theft_trial_get_args(struct theft *t,
     void **args);
@@ -5,6 +5,11 @@
 #include <inttypes.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <time.h>
+#include <signal.h>
+
+#include "theft_quantile.h"
 
 #define THEFT_MAX_TACTICS ((uint32_t)-1)
 #define DEFAULT_THEFT_SEED 0xa600d64b175eedLLU
@@ -17,11 +22,12 @@
         }                                                             \
     } while(0)
 
-struct theft_bloom;             /* bloom filter */
+struct theft_dedup;             /* already tried argument combinations */
 struct theft_rng;               /* pseudorandom number generator */
 
 struct seed_info {
     const theft_seed run_seed;
+    const enum theft_seed_mode mode;
 
     /* Optional array of seeds to always run.
      * Can be used for regression tests. */
@@ -34,6 +40,116 @@ struct fork_info {
     const size_t timeout;
     const int signal;
     const size_t exit_timeout;
+    const size_t workers;
+    const bool zygote;
+    const size_t trials_per_child;
+    const size_t rlimit_as;
+    const size_t rlimit_cpu;
+    const size_t rlimit_nofile;
+    const bool core_dumps;
+    const bool capture_output;
+    const size_t capture_max_bytes;
+    const bool parallel_shrink;
+};
+
+struct sched_info {
+    const unsigned *cpus;       /* CPU numbers, or NULL */
+    const size_t cpu_count;
+    const bool pin_workers;
+    const bool pin_parent;
+    const int nice;
+    /* The main process's affinity before pinning (a cpu_set_t). */
+    void *old_affinity;
+};
+
+struct auto_timeout_info {
+    const bool enable;
+    const size_t multiple;
+    const size_t min;           /* in msec */
+    const size_t max;
+    /* Wall-clock time of passing trials, in usec. */
+    struct theft_quantile latency;
+    /* While shrinking, the timeout in use when it started. */
+    bool frozen;
+    size_t frozen_msec;
+};
+
+struct deadline_info {
+    const size_t timeout;       /* in msec, or 0 for none */
+    const bool unwind;
+    bool installed;             /* SIGALRM handler is installed */
+    struct sigaction old_action;
+    /* Whether the most recent call ran past the deadline. */
+    bool last_exceeded;
+};
+
+/* A snapshot process, stopped at a checkpoint in a worker. */
+struct checkpoint_entry {
+    uint64_t key;               /* hash of the bits before it */
+    uint8_t arg_index;
+    size_t bit_position;
+    size_t worker_id;           /* whose shared memory it uses */
+    int fd;                     /* control socket; closing it stops it */
+};
+
+struct checkpoint_info {
+    const size_t max;           /* snapshots kept, or 0 for none */
+    /* Datagram sockets workers register snapshots over, or -1. */
+    int reg_fds[2];
+    /* Only take snapshots while shrinking. */
+    bool armed;
+    size_t count;
+    struct checkpoint_entry *entries;
+
+    /* In a worker process: */
+    bool in_worker;
+    size_t worker_id;
+    size_t created;             /* snapshots taken by this process */
+    int out_fd;                 /* the worker's result pipe */
+    int exit_fd;                /* held open until a resumed worker exits */
+};
+
+struct supervise_state;         /* shared with the supervisor */
+
+struct supervise_info {
+    const bool enable;
+    const size_t max_restarts;
+    /* In the supervised process: the trial that crashed the previous
+     * one (which is re-run forked), or SIZE_MAX, and whether calls
+     * are currently being made without forking. */
+    size_t crashed_trial;
+    bool unforked;
+    struct supervise_state *state;
+    /* The dedup filter shared by the supervised processes, if the
+     * run made its own. */
+    struct theft_shared_dedup *shared_dedup;
+};
+
+struct thread_shared;           /* shared by threads running trials */
+
+struct thread_info {
+    const size_t count;         /* threads running trials */
+    /* In a thread's handle: state shared with the main thread and
+     * the other threads, or NULL. */
+    struct thread_shared *shared;
+};
+
+struct shrink_queue;            /* failures waiting to be shrunk */
+
+struct shrink_queue_info {
+    const bool enable;
+    /* While running trials: the queue (also in the shrinker's
+     * handle), or NULL. */
+    struct shrink_queue *queue;
+};
+
+struct prefetch_queue;          /* trials generated ahead */
+
+struct prefetch_info {
+    const size_t depth;         /* how many trials ahead, or 0 */
+    /* While running trials one at a time: the queue (also in the
+     * producing thread's handle), or NULL. */
+    struct prefetch_queue *queue;
 };
 
 struct prop_info {
@@ -77,6 +193,7 @@ struct counter_info {
 };
 
 struct prng_info {
+    enum theft_prng type;
     struct theft_rng *rng;      /* random number generator */
     uint64_t buf;               /* buffer for PRNG bits */
     uint8_t bits_available;
@@ -108,6 +225,22 @@ struct trial_info {
     size_t successful_shrinks;
     size_t failed_shrinks;
     struct arg_info args[THEFT_MAX_ARITY];
+    struct theft_fork_report fork_report;
+    struct theft_fork_rusage fork_rusage;
+    bool deadline_exceeded;
+    /* Output captured from the most recent failing call, or NULL. */
+    char *output;
+    size_t output_size;
+    bool output_truncated;
+};
+
+/* Where a trial's output is in its worker's capture file. Shared with
+ * the worker process, which fills it in once the trial is done. */
+struct worker_output {
+    size_t start;
+    size_t end;
+    size_t total;               /* bytes written, before truncation */
+    bool done;
 };
 
 enum worker_state {
@@ -121,22 +254,77 @@ struct worker_info {
     int fds[2];
     pid_t pid;
     int wstatus;
+    struct theft_fork_rusage rusage; /* once it has exited */
+    size_t batch_count;         /* trials the worker will run */
+    size_t batch_done;          /* trials with results read so far */
+    /* Shared with the worker process, one per trial in a batch. */
+    struct theft_fork_report *reports;
+    /* When capturing output: where each trial's output is (also
+     * shared), and the file its stdout and stderr are sent to. */
+    struct worker_output *outputs;
+    int output_fd;
+    struct timespec start;      /* when the current trial started,
+                                 * from the monotonic clock */
+    uint64_t call_id;           /* zygote's ID for the call */
+    /* Resumed from a checkpoint's snapshot, so it isn't a child
+     * process: EOF on exit_fd means it has exited. */
+    bool resumed;
+    int exit_fd;
+};
+
+/* Fork server process, which forks workers from its own image. */
+struct zygote_info {
+    pid_t pid;                  /* -1 if not running */
+    int fd;                     /* socket for requests and replies */
+    uint64_t next_call_id;
+};
+
+/* A fork server started before its run, with the handle for the run
+ * (NULL once it's been used). */
+struct theft_fork_server {
+    struct theft *t;
 };
 
 /* Handle to state for the entire run. */
 struct theft {
     FILE *out;
-    struct theft_bloom *bloom;  /* bloom filter */
+    struct theft_dedup *dedup;  /* tried argument combinations */
     struct theft_print_trial_result_env *print_trial_result_env;
 
     struct prng_info prng;
     struct prop_info prop;
     struct seed_info seeds;
     struct fork_info fork;
+    struct auto_timeout_info auto_timeout;
+    struct sched_info sched;
+    struct deadline_info deadline;
+    struct supervise_info supervise;
+    struct thread_info threads;
+    struct shrink_queue_info shrink_queue;
+    struct prefetch_info prefetch;
+    struct checkpoint_info checkpoint;
     struct hook_info hooks;
     struct counter_info counters;
     struct trial_info trial;
-    struct worker_info workers[1];
+
+    /* Worker processes, when forking. When running a pool of
+     * workers, there is one extra for calls made while shrinking
+     * (or fork.workers extra, when shrinking in parallel). */
+    size_t worker_count;
+    struct worker_info *workers;
+
+    /* Shared memory for the workers' reports, and (in a worker
+     * process) the current trial's report. */
+    struct theft_fork_report *reports;
+    struct theft_fork_report *report;
+    /* Shared memory for where the workers' captured output is. */
+    struct worker_output *outputs;
+    /* The report and resource usage from the most recent call to
+     * theft_call. */
+    const struct theft_fork_report *last_report;
+    const struct theft_fork_rusage *last_rusage;
+
+    struct zygote_info zygote;
 };
 
 #endif
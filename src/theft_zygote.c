@@ -0,0 +1,526 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE         /* for wait4(2) */
+#endif
+
+#include "theft_zygote_internal.h"
+#include "theft_call.h"
+#include "theft_trial.h"
+#include "theft_autoshrink.h"
+
+/* The fork server (or zygote) is forked once, after the run_pre hook
+ * (or earlier, by theft_fork_server_start), and then forks the workers
+ * from its own image, rather than having the main process fork one for
+ * every trial and shrinking step. The main process keeps allocating
+ * memory during the run (argument instances, the dedup set, shrinking
+ * state), none of which the fork server's image needs. Starting it
+ * early also keeps anything the caller allocates before the run out
+ * of it, so forking workers doesn't copy page tables for it.
+ *
+ * For each call, the main process sends the fork server a request over
+ * a socket, along with the write end of the worker's result pipe and
+ * the bits that each argument's alloc callback consumed. The fork server
+ * forks a worker, which replays the bits to build its own copies of
+ * the arguments, and then runs the property just like a directly
+ * forked worker would, writing its result to the pipe. The fork server
+ * replies with the worker's pid (so it can still be signalled on
+ * timeout), and reports each worker's exit status once it's reaped. */
+
+#define LOG_ZYGOTE 0
+
+#define MAX_FORK_RETRIES 10
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Self-pipe, written to by the fork server's SIGCHLD handler. */
+static int sigchld_fds[2] = { -1, -1 };
+
+bool
+theft_zygote_start(struct theft *t) {
+    if (!t->fork.enable || !t->fork.zygote) { return true; }
+    if (t->zygote.pid != -1) { return true; }  /* started early */
+    for (uint8_t i = 0; i < t->prop.arity; i++) {
+        if (!t->prop.type_info[i]->autoshrink_config.enable) {
+            LOG(2 - LOG_ZYGOTE, "%s: arg %u doesn't use autoshrinking,"
+                " forking directly\n", __func__, i);
+            return true;
+        }
+    }
+
+    int fds[2];
+    if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        perror("socketpair");
+        return false;
+    }
+
+    /* Flush any buffered output first, so workers (which exit via
+     * exit(3)) don't each print another copy of it. */
+    fflush(NULL);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    } else if (pid == 0) {
+        close(fds[0]);
+        zygote_main(t, fds[1]);
+        _exit(EXIT_SUCCESS);    /* not reached */
+    }
+
+    close(fds[1]);
+    t->zygote.pid = pid;
+    t->zygote.fd = fds[0];
+    LOG(2 - LOG_ZYGOTE, "%s: started fork server %d\n", __func__, pid);
+    return true;
+}
+
+bool
+theft_zygote_call_start(struct theft *t, struct worker_info *worker,
+        size_t count, theft_call_batch_cb *cb, void *udata) {
+    struct zygote_request req = {
+        .call_id = t->zygote.next_call_id++,
+        .failures = t->counters.fail,
+        .arity = t->prop.arity,
+        .trial_count = count,
+        .worker_id = worker - t->workers,
+    };
+    if (!send_request(t->zygote.fd, &req, worker->fds[1])) {
+        return false;
+    }
+
+    for (size_t trial_i = 0; trial_i < count; trial_i++) {
+        void *args[THEFT_MAX_ARITY];
+        cb(t, trial_i, udata, args);
+
+        size_t bit_counts[THEFT_MAX_ARITY];
+        for (uint8_t i = 0; i < req.arity; i++) {
+            bit_counts[i] = t->trial.args[i].u.as.env->bit_pool->consumed;
+        }
+        if (!write_all(t->zygote.fd, bit_counts,
+                req.arity * sizeof(bit_counts[0]))) {
+            return false;
+        }
+        for (uint8_t i = 0; i < req.arity; i++) {
+            const struct autoshrink_bit_pool *pool =
+                t->trial.args[i].u.as.env->bit_pool;
+            if (!write_all(t->zygote.fd, pool->bits,
+                    (bit_counts[i] + 7) / 8)) {
+                return false;
+            }
+        }
+    }
+
+    /* Exit statuses for other workers may arrive before
+     * the reply for this one. */
+    for (;;) {
+        struct zygote_reply reply;
+        if (!read_reply(t, &reply)) { return false; }
+        if (reply.type == ZYGOTE_REPLY_EXITED) {
+            save_exit_status(t, &reply);
+            continue;
+        }
+
+        assert(reply.call_id == req.call_id);
+        if (reply.pid == -1) { return false; }
+        worker->pid = reply.pid;
+        worker->call_id = req.call_id;
+        return true;
+    }
+}
+
+bool
+theft_zygote_step(struct theft *t) {
+    while (t->zygote.pid != -1) {
+        struct pollfd pfd = { .fd = t->zygote.fd, .events = POLLIN };
+        int pres = poll(&pfd, 1, 0);
+        if (pres == -1) {
+            if (errno == EINTR) { continue; }
+            perror("poll");
+            return false;
+        } else if (pres == 0) {
+            break;
+        }
+
+        struct zygote_reply reply;
+        if (!read_reply(t, &reply)) {
+            /* If the fork server exited, fall back on forking
+             * directly, rather than failing. */
+            return t->zygote.pid == -1;
+        }
+        if (reply.type == ZYGOTE_REPLY_EXITED) {
+            save_exit_status(t, &reply);
+        }
+    }
+    return true;
+}
+
+void
+theft_zygote_stop(struct theft *t) {
+    if (t->zygote.pid == -1) { return; }
+    const pid_t pid = t->zygote.pid;
+
+    /* Closing the socket tells the fork server to exit. */
+    forget_zygote(t);
+    int wstatus = 0;
+    while (-1 == waitpid(pid, &wstatus, 0) && errno == EINTR) {}
+    LOG(2 - LOG_ZYGOTE, "%s: fork server %d exited\n", __func__, pid);
+}
+
+static void
+forget_zygote(struct theft *t) {
+    close(t->zygote.fd);
+    t->zygote.fd = -1;
+    t->zygote.pid = -1;
+}
+
+/* Save the exit status for a worker, if it's still waiting on it. */
+static void
+save_exit_status(struct theft *t, const struct zygote_reply *reply) {
+    for (size_t i = 0; i < t->worker_count; i++) {
+        struct worker_info *w = &t->workers[i];
+        if (w->state == WS_ACTIVE && w->call_id == reply->call_id
+            && w->pid == reply->pid) {
+            w->state = WS_STOPPED;
+            w->wstatus = reply->wstatus;
+            theft_call_save_rusage(&reply->rusage, &w->rusage);
+            break;
+        }
+    }
+}
+
+static bool
+read_reply(struct theft *t, struct zygote_reply *reply) {
+    if (!read_all(t->zygote.fd, reply, sizeof(*reply))) {
+        fprintf(stderr, "theft: fork server exited unexpectedly\n");
+        forget_zygote(t);
+        return false;
+    }
+    return true;
+}
+
+/* The main loop for the fork server process. */
+static void
+zygote_main(struct theft *t, int fd) {
+    if (-1 == pipe(sigchld_fds)) { _exit(EXIT_FAILURE); }
+    for (size_t i = 0; i < 2; i++) {
+        const int flags = fcntl(sigchld_fds[i], F_GETFL);
+        if (flags == -1
+            || -1 == fcntl(sigchld_fds[i], F_SETFL, flags | O_NONBLOCK)) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+    struct sigaction action = { .sa_handler = sigchld_handler };
+    if (-1 == sigaction(SIGCHLD, &action, NULL)) { _exit(EXIT_FAILURE); }
+
+    size_t call_count = 0;
+    struct zygote_call *calls = NULL;
+
+    for (;;) {
+        struct pollfd pfds[2] = {
+            { .fd = fd, .events = POLLIN },
+            { .fd = sigchld_fds[0], .events = POLLIN },
+        };
+        int pres = poll(pfds, 2, -1);
+        if (pres == -1) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+
+        if (pfds[1].revents != 0) {
+            uint8_t buf[64];
+            while (read(sigchld_fds[0], buf, sizeof(buf)) > 0) {}
+            if (!reap_workers(fd, calls, call_count)) { break; }
+        }
+
+        /* EOF here means the main process is done. */
+        if (pfds[0].revents != 0
+            && !handle_request(t, fd, &calls, &call_count)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < call_count; i++) {
+        if (calls[i].pid == 0) { continue; }
+        kill(calls[i].pid, SIGKILL);
+        int wstatus = 0;
+        while (-1 == waitpid(calls[i].pid, &wstatus, 0) && errno == EINTR) {}
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static void
+sigchld_handler(int sig) {
+    (void)sig;
+    const int old_errno = errno;
+    const uint8_t byte = 0;
+    ssize_t wr = write(sigchld_fds[1], &byte, sizeof(byte));
+    (void)wr;
+    errno = old_errno;
+}
+
+/* Receive a request, fork a worker for it, and reply with its pid. */
+static bool
+handle_request(struct theft *t, int fd,
+        struct zygote_call **calls, size_t *call_count) {
+    struct zygote_request req;
+    int out_fd = -1;
+    if (!recv_request(fd, &req, &out_fd)) { return false; }
+
+    bool ok = true;
+    struct zygote_trial *trials = calloc(req.trial_count, sizeof(*trials));
+    if (trials == NULL) { ok = false; }
+    for (size_t trial_i = 0; ok && trial_i < req.trial_count; trial_i++) {
+        struct zygote_trial *zt = &trials[trial_i];
+        if (!read_all(fd, zt->bit_counts,
+                req.arity * sizeof(zt->bit_counts[0]))) {
+            ok = false;
+            break;
+        }
+        for (uint8_t i = 0; i < req.arity; i++) {
+            const size_t size = (zt->bit_counts[i] + 7) / 8;
+            zt->bits[i] = malloc(size == 0 ? 1 : size);
+            if (zt->bits[i] == NULL || !read_all(fd, zt->bits[i], size)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    pid_t pid = -1;
+    struct timespec tv = { .tv_nsec = 1 };
+    while (ok) {
+        pid = fork();
+        if (pid == -1 && errno == EAGAIN
+            && tv.tv_nsec < (1L << MAX_FORK_RETRIES)) {
+            /* Probably RLIMIT_NPROC, so back off and give
+             * exited workers a chance to be reaped. */
+            if (!reap_workers(fd, *calls, *call_count)) { break; }
+            nanosleep(&tv, NULL);
+            tv.tv_nsec <<= 1;
+            continue;
+        }
+        break;
+    }
+
+    if (pid == 0) {
+        close(fd);
+        close(sigchld_fds[0]);
+        close(sigchld_fds[1]);
+        struct sigaction action = { .sa_handler = SIG_DFL };
+        sigaction(SIGCHLD, &action, NULL);
+        run_call(t, &req, trials, out_fd);
+    }
+
+    close(out_fd);
+    for (size_t trial_i = 0; trials != NULL
+             && trial_i < req.trial_count; trial_i++) {
+        for (uint8_t i = 0; i < req.arity; i++) {
+            free(trials[trial_i].bits[i]);
+        }
+    }
+    free(trials);
+    if (!ok) { return false; }
+    if (pid == -1) { perror("fork"); }
+
+    /* Track the worker, reusing a free slot if possible. */
+    if (pid != -1) {
+        struct zygote_call *slot = NULL;
+        for (size_t i = 0; i < *call_count; i++) {
+            if ((*calls)[i].pid == 0) {
+                slot = &(*calls)[i];
+                break;
+            }
+        }
+        if (slot == NULL) {
+            const size_t ncount = (*call_count == 0 ? 8 : 2 * *call_count);
+            struct zygote_call *ncalls = realloc(*calls,
+                ncount * sizeof(*ncalls));
+            if (ncalls == NULL) { return false; }
+            memset(&ncalls[*call_count], 0x00,
+                (ncount - *call_count) * sizeof(*ncalls));
+            slot = &ncalls[*call_count];
+            *calls = ncalls;
+            *call_count = ncount;
+        }
+        slot->pid = pid;
+        slot->call_id = req.call_id;
+    }
+
+    struct zygote_reply reply = {
+        .type = ZYGOTE_REPLY_STARTED,
+        .call_id = req.call_id,
+        .pid = pid,
+    };
+    return write_all(fd, &reply, sizeof(reply));
+}
+
+/* In the worker: run each trial in the request as usual, once its
+ * arguments have been rebuilt from their bits. */
+static void
+run_call(struct theft *t, const struct zygote_request *req,
+        struct zygote_trial *trials, int out_fd) {
+    t->counters.fail = req->failures;
+    struct zygote_batch batch = { .trials = trials, .out_fd = out_fd };
+    theft_call_run_batch(t, &t->workers[req->worker_id],
+        req->trial_count, replay_trial_cb, &batch, out_fd);
+}
+
+static void
+replay_trial_cb(struct theft *t, size_t trial_i, void *udata, void **args) {
+    struct zygote_batch *batch = (struct zygote_batch *)udata;
+    struct zygote_trial *zt = &batch->trials[trial_i];
+    if (trial_i > 0) {
+        theft_trial_free_args(t);
+        memset(&t->trial.args, 0x00, sizeof(t->trial.args));
+    }
+
+    for (uint8_t i = 0; i < t->prop.arity; i++) {
+        const struct theft_type_info *ti = t->prop.type_info[i];
+        struct autoshrink_env *env = theft_autoshrink_alloc_env(t, i, ti);
+        void *instance = NULL;
+        if (env == NULL || THEFT_ALLOC_OK != theft_autoshrink_replay(t,
+                env, zt->bits[i], zt->bit_counts[i], &instance)) {
+            const uint8_t byte = (uint8_t)THEFT_TRIAL_ERROR;
+            ssize_t wr = write(batch->out_fd, &byte, sizeof(byte));
+            (void)wr;
+            exit(EXIT_FAILURE);
+        }
+        t->trial.args[i].type = ARG_AUTOSHRINK;
+        t->trial.args[i].u.as.env = env;
+        t->trial.args[i].instance = instance;
+    }
+    theft_trial_get_args(t, args);
+}
+
+/* Reap any workers that have exited, and report their exit statuses. */
+static bool
+reap_workers(int fd, struct zygote_call *calls, size_t call_count) {
+    for (;;) {
+        int wstatus = 0;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &wstatus, WNOHANG, &ru);
+        if (pid == -1) {
+            if (errno == EINTR) { continue; }
+            return errno == ECHILD;
+        } else if (pid == 0) {
+            return true;
+        }
+
+        for (size_t i = 0; i < call_count; i++) {
+            if (calls[i].pid != pid) { continue; }
+            struct zygote_reply reply = {
+                .type = ZYGOTE_REPLY_EXITED,
+                .call_id = calls[i].call_id,
+                .pid = pid,
+                .wstatus = wstatus,
+                .rusage = ru,
+            };
+            calls[i].pid = 0;
+            if (!write_all(fd, &reply, sizeof(reply))) { return false; }
+            break;
+        }
+    }
+}
+
+static bool
+send_request(int fd, const struct zygote_request *req, int out_fd) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0x00, sizeof(control));
+
+    struct iovec iov = {
+        .iov_base = (void *)req,
+        .iov_len = sizeof(*req),
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &out_fd, sizeof(int));
+
+    ssize_t wr = 0;
+    do {
+        wr = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (wr == -1 && errno == EINTR);
+    if (wr == -1) { return false; }
+
+    /* The fd goes with the first byte, send the rest if necessary. */
+    return write_all(fd, (const uint8_t *)req + wr, sizeof(*req) - wr);
+}
+
+static bool
+recv_request(int fd, struct zygote_request *req, int *out_fd) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct iovec iov = {
+        .iov_base = (void *)req,
+        .iov_len = sizeof(*req),
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t rd = 0;
+    do {
+        rd = recvmsg(fd, &msg, 0);
+    } while (rd == -1 && errno == EINTR);
+    if (rd <= 0) { return false; }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS) {
+        return false;
+    }
+    memcpy(out_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    return read_all(fd, (uint8_t *)req + rd, sizeof(*req) - rd);
+}
+
+static bool
+write_all(int fd, const void *buf, size_t size) {
+    const uint8_t *p = buf;
+    while (size > 0) {
+        ssize_t wr = send(fd, p, size, MSG_NOSIGNAL);
+        if (wr == -1) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        p += wr;
+        size -= wr;
+    }
+    return true;
+}
+
+static bool
+read_all(int fd, void *buf, size_t size) {
+    uint8_t *p = buf;
+    while (size > 0) {
+        ssize_t rd = read(fd, p, size);
+        if (rd == -1) {
+            if (errno == EINTR) { continue; }
+            return false;
+        } else if (rd == 0) {
+            return false;       /* EOF */
+        }
+        p += rd;
+        size -= rd;
+    }
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef THEFT_ZYGOTE_H
+#define THEFT_ZYGOTE_H
+
+#include "theft_types_internal.h"
+#include "theft_call.h"
+
+/* If configured, and every argument uses autoshrinking, fork the fork
+ * server (zygote) process, unless it's already running. Otherwise, do
+ * nothing, and workers will be forked directly. Returns false on
+ * error. */
+bool
+theft_zygote_start(struct theft *t);
+
+/* Have the fork server start a worker process to run a batch of COUNT
+ * trials, which will write their results to worker->fds[1]. CB makes
+ * each trial current in turn, so its arguments can be sent. */
+bool
+theft_zygote_call_start(struct theft *t, struct worker_info *worker,
+    size_t count, theft_call_batch_cb *cb, void *udata);
+
+/* Save any exit statuses the fork server has reported for workers,
+ * without blocking. */
+bool
+theft_zygote_step(struct theft *t);
+
+/* Stop the fork server, if running, and wait for it to exit. */
+void
+theft_zygote_stop(struct theft *t);
+
+#endif
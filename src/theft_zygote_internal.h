@@ -0,0 +1,102 @@
+#ifndef THEFT_ZYGOTE_INTERNAL_H
+#define THEFT_ZYGOTE_INTERNAL_H
+
+#include "theft_zygote.h"
+
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* Sent to the fork server to start a worker. The worker's result pipe
+ * is passed along with it (via SCM_RIGHTS). It's followed by, for each
+ * trial the worker will run, the bit count for each argument, then
+ * the bits each argument's alloc callback consumed. */
+struct zygote_request {
+    uint64_t call_id;
+    size_t failures;            /* for the fork_post hook */
+    uint8_t arity;
+    size_t trial_count;
+    size_t worker_id;           /* for the worker's shared reports */
+};
+
+/* One trial's arguments, as received by the fork server. */
+struct zygote_trial {
+    size_t bit_counts[THEFT_MAX_ARITY];
+    uint8_t *bits[THEFT_MAX_ARITY];
+};
+
+/* The trials a worker started by the fork server will run. */
+struct zygote_batch {
+    struct zygote_trial *trials;
+    int out_fd;
+};
+
+enum zygote_reply_type {
+    ZYGOTE_REPLY_STARTED,       /* forked the worker (or failed) */
+    ZYGOTE_REPLY_EXITED,        /* the worker exited */
+};
+
+struct zygote_reply {
+    enum zygote_reply_type type;
+    uint64_t call_id;
+    pid_t pid;                  /* -1 if fork failed */
+    int wstatus;
+    struct rusage rusage;       /* from wait4(2) */
+};
+
+/* A worker the fork server is waiting on. */
+struct zygote_call {
+    pid_t pid;
+    uint64_t call_id;
+};
+
+static void
+zygote_main(struct theft *t, int fd);
+
+static bool
+handle_request(struct theft *t, int fd,
+    struct zygote_call **calls, size_t *call_count);
+
+static void
+run_call(struct theft *t, const struct zygote_request *req,
+    struct zygote_trial *trials, int out_fd);
+
+static void
+replay_trial_cb(struct theft *t, size_t trial_i, void *udata, void **args);
+
+static bool
+reap_workers(int fd, struct zygote_call *calls, size_t call_count);
+
+static void
+sigchld_handler(int sig);
+
+static bool
+send_request(int fd, const struct zygote_request *req, int out_fd);
+
+static bool
+recv_request(int fd, struct zygote_request *req, int *out_fd);
+
+static bool
+read_reply(struct theft *t, struct zygote_reply *reply);
+
+static void
+save_exit_status(struct theft *t, const struct zygote_reply *reply);
+
+static void
+forget_zygote(struct theft *t);
+
+static bool
+write_all(int fd, const void *buf, size_t size);
+
+static bool
+read_all(int fd, void *buf, size_t size);
+
+#endif
@@ -8,7 +8,11 @@ int main(int argc, char **argv) {
     RUN_SUITE(prng);
     RUN_SUITE(autoshrink);
     RUN_SUITE(aux);
+    RUN_SUITE(bits);
+    RUN_SUITE(hash);
     RUN_SUITE(bloom);
+    RUN_SUITE(dedup);
+    RUN_SUITE(quantile);
     RUN_SUITE(error);
     RUN_SUITE(integration);
     RUN_SUITE(char_array);
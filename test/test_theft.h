@@ -10,7 +10,11 @@
 SUITE_EXTERN(prng);
 SUITE_EXTERN(autoshrink);
 SUITE_EXTERN(aux);
+SUITE_EXTERN(bits);
+SUITE_EXTERN(hash);
 SUITE_EXTERN(bloom);
+SUITE_EXTERN(dedup);
+SUITE_EXTERN(quantile);
 SUITE_EXTERN(error);
 SUITE_EXTERN(integration);
 SUITE_EXTERN(char_array);
@@ -0,0 +1,183 @@
+#include "test_theft.h"
+#include "theft_bits.h"
+#include "theft_rng.h"
+
+#include <string.h>
+
+/* Bit-at-a-time reference implementations, which the word-at-a-time
+ * versions should always match. */
+static uint64_t
+ref_read(const uint8_t *buf, size_t bit_offset, uint8_t size) {
+    uint64_t acc = 0;
+    for (uint8_t i = 0; i < size; i++) {
+        const size_t bit = bit_offset + i;
+        if (buf[bit / 8] & (1U << (bit % 8))) {
+            acc |= (1LLU << i);
+        }
+    }
+    return acc;
+}
+
+static void
+ref_write(uint8_t *buf, size_t bit_offset, uint8_t size, uint64_t bits) {
+    for (uint8_t i = 0; i < size; i++) {
+        const size_t bit = bit_offset + i;
+        if (bits & (1LLU << i)) {
+            buf[bit / 8] |= (1U << (bit % 8));
+        } else {
+            buf[bit / 8] &=~ (1U << (bit % 8));
+        }
+    }
+}
+
+static void
+ref_copy(uint8_t *dst, size_t dst_offset,
+        const uint8_t *src, size_t src_offset, size_t bit_count) {
+    for (size_t i = 0; i < bit_count; i++) {
+        ref_write(dst, dst_offset + i, 1, ref_read(src, src_offset + i, 1));
+    }
+}
+
+static uint8_t ref_popcount(uint64_t value) {
+    uint8_t pop = 0;
+    for (uint8_t i = 0; i < 64; i++) {
+        if (value & (1LLU << i)) { pop++; }
+    }
+    return pop;
+}
+
+#define BUF_SIZE 64
+
+static void fill_random(struct theft_rng *rng, uint8_t *buf, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = (uint8_t)theft_rng_random(rng);
+    }
+}
+
+TEST read_should_match_bit_serial_read(void) {
+    struct theft_rng *rng = theft_rng_init(1);
+    uint8_t buf[BUF_SIZE];
+
+    for (size_t trial = 0; trial < 1000; trial++) {
+        fill_random(rng, buf, sizeof(buf));
+        for (uint8_t size = 0; size <= 64; size++) {
+            const size_t max_offset = 8*sizeof(buf) - size;
+            const size_t offset = theft_rng_random(rng) % (max_offset + 1);
+            ASSERT_EQ_FMT(ref_read(buf, offset, size),
+                theft_bits_read(buf, offset, size), "0x%016" PRIx64);
+        }
+    }
+
+    theft_rng_free(rng);
+    PASS();
+}
+
+TEST write_should_match_bit_serial_write(void) {
+    struct theft_rng *rng = theft_rng_init(2);
+    uint8_t a[BUF_SIZE], b[BUF_SIZE];
+
+    for (size_t trial = 0; trial < 1000; trial++) {
+        fill_random(rng, a, sizeof(a));
+        memcpy(b, a, sizeof(a));
+        for (uint8_t size = 0; size <= 64; size++) {
+            const size_t max_offset = 8*sizeof(a) - size;
+            const size_t offset = theft_rng_random(rng) % (max_offset + 1);
+            const uint64_t bits = theft_rng_random(rng);
+            ref_write(a, offset, size, bits);
+            theft_bits_write(b, offset, size, bits);
+            ASSERT_MEM_EQ(a, b, sizeof(a));
+        }
+    }
+
+    theft_rng_free(rng);
+    PASS();
+}
+
+TEST write_should_not_touch_bytes_outside_range(void) {
+    /* Only the bytes covering the written range should be accessed;
+     * under valgrind/ASan, this would also catch over-reads. */
+    uint8_t buf[9] = { 0 };
+    theft_bits_write(buf, 7, 64, (uint64_t)-1);
+    ASSERT_EQ_FMT(0x80, buf[0], "0x%02x");
+    for (size_t i = 1; i < 8; i++) {
+        ASSERT_EQ_FMT(0xff, buf[i], "0x%02x");
+    }
+    ASSERT_EQ_FMT(0x7f, buf[8], "0x%02x");
+    ASSERT_EQ_FMT((uint64_t)-1, theft_bits_read(buf, 7, 64), "0x%016" PRIx64);
+    PASS();
+}
+
+TEST copy_should_match_bit_serial_copy(void) {
+    struct theft_rng *rng = theft_rng_init(3);
+    uint8_t src[BUF_SIZE], a[BUF_SIZE], b[BUF_SIZE];
+
+    for (size_t trial = 0; trial < 10000; trial++) {
+        fill_random(rng, src, sizeof(src));
+        fill_random(rng, a, sizeof(a));
+        memcpy(b, a, sizeof(a));
+
+        const size_t count = theft_rng_random(rng) % (8*sizeof(src) + 1);
+        const size_t max_offset = 8*sizeof(src) - count;
+        size_t src_offset = theft_rng_random(rng) % (max_offset + 1);
+        size_t dst_offset = theft_rng_random(rng) % (max_offset + 1);
+        if (trial & 0x01) {     /* exercise the byte-aligned path */
+            src_offset &=~ 0x07;
+            dst_offset &=~ 0x07;
+        }
+
+        ref_copy(a, dst_offset, src, src_offset, count);
+        theft_bits_copy(b, dst_offset, src, src_offset, count);
+        ASSERT_MEM_EQ(a, b, sizeof(a));
+    }
+
+    theft_rng_free(rng);
+    PASS();
+}
+
+TEST trim_zero_bytes_should_find_last_nonzero_byte(void) {
+    uint8_t buf[BUF_SIZE];
+
+    for (size_t len = 0; len <= sizeof(buf); len++) {
+        for (size_t last = 0; last <= len; last++) {
+            /* bytes [0, last) are nonzero, the rest are zero */
+            memset(buf, 0x00, sizeof(buf));
+            memset(buf, 0x01, last);
+            if (last > 0) { buf[last - 1] = 0x80; }
+            ASSERT_EQ_FMT(last, theft_bits_trim_zero_bytes(buf, len), "%zu");
+        }
+    }
+    PASS();
+}
+
+TEST popcount_ctz_clz_should_match_bit_serial(void) {
+    struct theft_rng *rng = theft_rng_init(4);
+
+    for (size_t trial = 0; trial < 100000; trial++) {
+        /* Mask off a random number of high and low bits, so the
+         * zero counts vary. */
+        uint64_t v = theft_rng_random(rng);
+        v >>= trial % 64;
+        v <<= (trial / 64) % 64;
+        ASSERT_EQ_FMT(ref_popcount(v), theft_bits_popcount(v), "%u");
+        if (v == 0) { continue; }
+
+        uint8_t ctz = 0;
+        while ((v & (1LLU << ctz)) == 0) { ctz++; }
+        uint8_t clz = 0;
+        while ((v & (1LLU << (63 - clz))) == 0) { clz++; }
+        ASSERT_EQ_FMT(ctz, theft_bits_ctz(v), "%u");
+        ASSERT_EQ_FMT(clz, theft_bits_clz(v), "%u");
+    }
+
+    theft_rng_free(rng);
+    PASS();
+}
+
+SUITE(bits) {
+    RUN_TEST(read_should_match_bit_serial_read);
+    RUN_TEST(write_should_match_bit_serial_write);
+    RUN_TEST(write_should_not_touch_bytes_outside_range);
+    RUN_TEST(copy_should_match_bit_serial_copy);
+    RUN_TEST(trim_zero_bytes_should_find_last_nonzero_byte);
+    RUN_TEST(popcount_ctz_clz_should_match_bit_serial);
+}
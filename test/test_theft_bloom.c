@@ -1,6 +1,10 @@
 #include "test_theft.h"
 #include "theft_bloom.h"
 
+static struct theft_hash128 key_of(const char *buf, size_t size) {
+    return theft_hash_onepass128((const uint8_t *)buf, size);
+}
+
 TEST all_marked_should_remain_marked(size_t limit) {
     struct theft_bloom *b = theft_bloom_init(NULL);
 
@@ -9,14 +13,83 @@ TEST all_marked_should_remain_marked(size_t limit) {
         size_t used = snprintf(buf, sizeof(buf), "key%zd\n", i);
         assert(used < sizeof(buf));
         ASSERTm("marking should not fail",
-            theft_bloom_mark(b, (uint8_t *)buf, used));
+            theft_bloom_mark(b, key_of(buf, used)));
     }
 
     for (size_t i = 0; i < limit; i++) {
         size_t used = snprintf(buf, sizeof(buf), "key%zd\n", i);
         assert(used < sizeof(buf));
         ASSERTm("marked became unmarked",
-            theft_bloom_check(b, (uint8_t *)buf, used));
+            theft_bloom_check(b, key_of(buf, used)));
+    }
+
+    theft_bloom_free(b);
+    PASS();
+}
+
+TEST false_positive_rate_should_stay_low_while_growing(void) {
+    struct theft_bloom *b = theft_bloom_init(NULL);
+    const size_t limit = 200000;
+
+    char buf[32];
+    for (size_t i = 0; i < limit; i++) {
+        size_t used = snprintf(buf, sizeof(buf), "key%zd\n", i);
+        ASSERT(theft_bloom_mark(b, key_of(buf, used)));
+    }
+
+    struct theft_bloom_stats stats;
+    theft_bloom_stats(b, &stats);
+    ASSERT_EQ_FMT((uint64_t)limit, stats.marked, "%" PRIu64);
+    ASSERTm("should have grown", stats.depth > 1);
+    ASSERT(stats.memory > 0);
+    ASSERT(stats.fill > 0 && stats.fill < 0.5);
+    ASSERT(stats.fpr > 0 && stats.fpr < 0.01);
+    ASSERT_FALSE(stats.saturated);
+
+    /* Check keys that were never marked. */
+    size_t false_positives = 0;
+    for (size_t i = 0; i < limit; i++) {
+        size_t used = snprintf(buf, sizeof(buf), "other%zd\n", i);
+        if (theft_bloom_check(b, key_of(buf, used))) {
+            false_positives++;
+        }
+    }
+    const double fpr = false_positives / (double)limit;
+    if (GREATEST_IS_VERBOSE()) {
+        printf("depth %u, %zd bytes, est. fpr %g, measured %g\n",
+            stats.depth, stats.memory, stats.fpr, fpr);
+    }
+    ASSERT(fpr < 2 * stats.fpr + 0.001);
+
+    theft_bloom_free(b);
+    PASS();
+}
+
+TEST saturation_should_be_reported(void) {
+    struct theft_bloom_config cfg = {
+        .min_filter_bits = 1,
+        .max_filter_bits = 3,
+    };
+    struct theft_bloom *b = theft_bloom_init(&cfg);
+    ASSERT(b);
+
+    char buf[32];
+    size_t i = 0;
+    for (i = 0; i < 10000; i++) {
+        size_t used = snprintf(buf, sizeof(buf), "key%zd\n", i);
+        if (!theft_bloom_mark(b, key_of(buf, used))) { break; }
+    }
+    ASSERTm("should saturate", i < 10000);
+
+    struct theft_bloom_stats stats;
+    theft_bloom_stats(b, &stats);
+    ASSERT(stats.saturated);
+    ASSERT_EQ_FMT(3, stats.depth, "%u");
+
+    /* Everything marked should still be found. */
+    for (size_t j = 0; j <= i; j++) {
+        size_t used = snprintf(buf, sizeof(buf), "key%zd\n", j);
+        ASSERT(theft_bloom_check(b, key_of(buf, used)));
     }
 
     theft_bloom_free(b);
@@ -27,4 +100,6 @@ SUITE(bloom) {
     RUN_TESTp(all_marked_should_remain_marked, 10);
     RUN_TESTp(all_marked_should_remain_marked, 1000);
     RUN_TESTp(all_marked_should_remain_marked, 100000);
+    RUN_TEST(false_positive_rate_should_stay_low_while_growing);
+    RUN_TEST(saturation_should_be_reported);
 }
@@ -0,0 +1,312 @@
+#include "test_theft.h"
+#include "theft_dedup.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static struct theft_hash128 key_of(const char *prefix, size_t i) {
+    char buf[32];
+    size_t used = snprintf(buf, sizeof(buf), "%s%zd", prefix, i);
+    assert(used < sizeof(buf));
+    return theft_hash_onepass128((const uint8_t *)buf, used);
+}
+
+TEST exact_set_should_not_have_false_positives(void) {
+    struct theft_dedup *d = theft_dedup_init(THEFT_DEDUP_EXACT, 0);
+    ASSERT(d);
+    const size_t limit = 200000;
+
+    for (size_t i = 0; i < limit; i++) {
+        ASSERT(theft_dedup_mark(d, key_of("key", i)));
+    }
+    ASSERT_EQ_FMT(THEFT_DEDUP_EXACT, theft_dedup_mode(d), "%d");
+
+    for (size_t i = 0; i < limit; i++) {
+        ASSERTm("marked became unmarked", theft_dedup_check(d, key_of("key", i)));
+        ASSERTm("false positive", !theft_dedup_check(d, key_of("other", i)));
+    }
+
+    theft_dedup_free(d);
+    PASS();
+}
+
+TEST all_zero_key_should_be_stored(void) {
+    struct theft_dedup *d = theft_dedup_init(THEFT_DEDUP_EXACT, 0);
+    ASSERT(d);
+    const struct theft_hash128 zero = { .lo = 0, .hi = 0 };
+    ASSERT_FALSE(theft_dedup_check(d, zero));
+    ASSERT(theft_dedup_mark(d, zero));
+    ASSERT(theft_dedup_check(d, zero));
+    theft_dedup_free(d);
+    PASS();
+}
+
+TEST exact_set_should_fall_back_to_bloom_over_budget(void) {
+    /* Only enough for the initial 1024-slot table. */
+    const size_t max_bytes = 1024 * sizeof(struct theft_hash128);
+    struct theft_dedup *d = theft_dedup_init(THEFT_DEDUP_EXACT, max_bytes);
+    ASSERT(d);
+    const size_t limit = 10000;
+
+    for (size_t i = 0; i < limit; i++) {
+        ASSERT(theft_dedup_mark(d, key_of("key", i)));
+        if (i < 512) {
+            ASSERT_EQ_FMT(THEFT_DEDUP_EXACT, theft_dedup_mode(d), "%d");
+        }
+    }
+    ASSERT_EQ_FMT(THEFT_DEDUP_BLOOM, theft_dedup_mode(d), "%d");
+
+    /* Keys from before and after the switch should still be found. */
+    for (size_t i = 0; i < limit; i++) {
+        ASSERTm("marked became unmarked", theft_dedup_check(d, key_of("key", i)));
+    }
+
+    theft_dedup_free(d);
+    PASS();
+}
+
+TEST dedup_stats_should_report_mode_memory_and_marked_keys(void) {
+    const size_t max_bytes = 1024 * sizeof(struct theft_hash128);
+    struct theft_dedup *d = theft_dedup_init(THEFT_DEDUP_EXACT, max_bytes);
+    ASSERT(d);
+    struct theft_dedup_stats stats;
+
+    for (size_t i = 0; i < 500; i++) {
+        ASSERT(theft_dedup_mark(d, key_of("key", i)));
+    }
+    theft_dedup_stats(d, &stats);
+    ASSERT_EQ_FMT(THEFT_DEDUP_EXACT, stats.mode, "%d");
+    ASSERT_EQ_FMT((uint64_t)500, stats.marked, "%" PRIu64);
+    ASSERT(stats.memory <= max_bytes);
+    ASSERT(stats.fpr == 0);
+
+    /* The bloom filter it switches to isn't limited by max_bytes. */
+    for (size_t i = 500; i < 100000; i++) {
+        ASSERT(theft_dedup_mark(d, key_of("key", i)));
+    }
+    theft_dedup_stats(d, &stats);
+    ASSERT_EQ_FMT(THEFT_DEDUP_BLOOM, stats.mode, "%d");
+    ASSERT_EQ_FMT((uint64_t)100000, stats.marked, "%" PRIu64);
+    ASSERT(stats.memory > max_bytes);
+    ASSERT(stats.fpr > 0 && stats.fpr < 0.01);
+    theft_dedup_free(d);
+
+    /* A shared filter counts keys marked through any dedup set. */
+    struct theft_shared_dedup *shared = theft_shared_dedup_new(0);
+    ASSERT(shared);
+    struct theft_dedup *a = theft_dedup_init_shared(shared);
+    struct theft_dedup *b = theft_dedup_init_shared(shared);
+    ASSERT(a && b);
+    for (size_t i = 0; i < 1000; i++) {
+        ASSERT_FALSE(theft_dedup_check_and_mark(a, key_of("key", i)));
+        ASSERT(theft_dedup_check_and_mark(b, key_of("key", i)));
+        ASSERT(theft_dedup_mark(b, key_of("other", i)));
+    }
+    theft_dedup_stats(a, &stats);
+    ASSERT_EQ_FMT(THEFT_DEDUP_BLOOM, stats.mode, "%d");
+    ASSERT_EQ_FMT((uint64_t)2000, stats.marked, "%" PRIu64);
+    ASSERT(stats.memory >= THEFT_DEF_SHARED_DEDUP_BYTES);
+    ASSERT(stats.fpr > 0 && stats.fpr < 0.01);
+
+    theft_dedup_free(a);
+    theft_dedup_free(b);
+    theft_shared_dedup_free(shared);
+    PASS();
+}
+
+TEST shared_dedup_should_check_and_mark_once(void) {
+    struct theft_shared_dedup *shared = theft_shared_dedup_new(0);
+    ASSERT(shared);
+    struct theft_dedup *d = theft_dedup_init_shared(shared);
+    ASSERT(d);
+    const size_t limit = 10000;
+
+    for (size_t i = 0; i < limit; i++) {
+        ASSERT_FALSE(theft_dedup_check(d, key_of("key", i)));
+        ASSERT_FALSE(theft_dedup_check_and_mark(d, key_of("key", i)));
+        ASSERT(theft_dedup_check_and_mark(d, key_of("key", i)));
+        ASSERT(theft_dedup_check(d, key_of("key", i)));
+    }
+
+    theft_dedup_free(d);
+    theft_shared_dedup_free(shared);
+    PASS();
+}
+
+TEST pending_dedup_should_only_share_committed_keys(void) {
+    struct theft_shared_dedup *shared = theft_shared_dedup_new(0);
+    ASSERT(shared);
+    struct theft_dedup *d = theft_dedup_init_pending(shared);
+    ASSERT(d);
+    struct theft_dedup *other = theft_dedup_init_shared(shared);
+    ASSERT(other);
+    const size_t limit = 1000;
+
+    for (size_t i = 0; i < limit; i++) {
+        ASSERT_FALSE(theft_dedup_check_and_mark(d, key_of("key", i)));
+        ASSERT(theft_dedup_check(d, key_of("key", i)));
+        ASSERTm("seen before commit",
+            !theft_dedup_check(other, key_of("key", i)));
+    }
+    ASSERT(theft_dedup_commit(d));
+    for (size_t i = 0; i < limit; i++) {
+        ASSERTm("not seen after commit",
+            theft_dedup_check(other, key_of("key", i)));
+        ASSERT(theft_dedup_check_and_mark(d, key_of("key", i)));
+    }
+
+    theft_dedup_free(other);
+    theft_dedup_free(d);
+    theft_shared_dedup_free(shared);
+    PASS();
+}
+
+#define SHARED_THREADS 4
+
+struct mark_env {
+    struct theft_dedup *d;
+    size_t id;
+    size_t limit;
+};
+
+static void *
+mark_every_nth_key(void *udata) {
+    struct mark_env *env = (struct mark_env *)udata;
+    for (size_t i = env->id; i < env->limit; i += SHARED_THREADS) {
+        theft_dedup_check_and_mark(env->d, key_of("key", i));
+    }
+    return NULL;
+}
+
+/* Keys marked on several threads at once (and so, often in the same
+ * words) should all be found afterward. */
+TEST shared_dedup_should_not_lose_concurrent_marks(void) {
+    const size_t limit = 20000;
+    struct theft_shared_dedup *shared = theft_shared_dedup_new(64 * 1024);
+    ASSERT(shared);
+
+    pthread_t threads[SHARED_THREADS];
+    struct mark_env envs[SHARED_THREADS];
+    for (size_t i = 0; i < SHARED_THREADS; i++) {
+        envs[i].d = theft_dedup_init_shared(shared);
+        ASSERT(envs[i].d);
+        envs[i].id = i;
+        envs[i].limit = limit;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                mark_every_nth_key, &envs[i]));
+    }
+    for (size_t i = 0; i < SHARED_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < limit; i++) {
+        ASSERTm("marked became unmarked",
+            theft_dedup_check(envs[0].d, key_of("key", i)));
+    }
+
+    for (size_t i = 0; i < SHARED_THREADS; i++) {
+        theft_dedup_free(envs[i].d);
+    }
+    theft_shared_dedup_free(shared);
+    PASS();
+}
+
+struct claim_env {
+    struct theft_dedup *d;
+    size_t limit;
+    uint8_t *claimed;
+};
+
+static void *
+claim_every_key(void *udata) {
+    struct claim_env *env = (struct claim_env *)udata;
+    for (size_t i = 0; i < env->limit; i++) {
+        if (!theft_dedup_check_and_mark(env->d, key_of("key", i))) {
+            env->claimed[i] = 1;
+        }
+    }
+    return NULL;
+}
+
+/* When several threads check and mark the same keys at once, each key
+ * should be new to exactly one of them. */
+TEST shared_dedup_should_claim_each_key_once(void) {
+    const size_t limit = 20000;
+    struct theft_shared_dedup *shared = theft_shared_dedup_new(1024 * 1024);
+    ASSERT(shared);
+
+    pthread_t threads[SHARED_THREADS];
+    struct claim_env envs[SHARED_THREADS];
+    for (size_t i = 0; i < SHARED_THREADS; i++) {
+        envs[i].d = theft_dedup_init_shared(shared);
+        ASSERT(envs[i].d);
+        envs[i].limit = limit;
+        envs[i].claimed = calloc(limit, sizeof(uint8_t));
+        ASSERT(envs[i].claimed);
+    }
+    for (size_t i = 0; i < SHARED_THREADS; i++) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                claim_every_key, &envs[i]));
+    }
+    for (size_t i = 0; i < SHARED_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t k = 0; k < limit; k++) {
+        size_t claims = 0;
+        for (size_t i = 0; i < SHARED_THREADS; i++) {
+            claims += envs[i].claimed[k];
+        }
+        ASSERT_EQ_FMT((size_t)1, claims, "%zd");
+    }
+
+    for (size_t i = 0; i < SHARED_THREADS; i++) {
+        free(envs[i].claimed);
+        theft_dedup_free(envs[i].d);
+    }
+    theft_shared_dedup_free(shared);
+    PASS();
+}
+
+TEST shared_dedup_should_be_shared_with_forked_process(void) {
+    const size_t limit = 1000;
+    struct theft_shared_dedup *shared = theft_shared_dedup_new(0);
+    ASSERT(shared);
+
+    fflush(NULL);
+    pid_t pid = fork();
+    ASSERT(pid != -1);
+    if (pid == 0) {
+        struct theft_dedup *d = theft_dedup_init_shared(shared);
+        for (size_t i = 0; d != NULL && i < limit; i++) {
+            theft_dedup_check_and_mark(d, key_of("key", i));
+        }
+        _exit(d == NULL ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    int status = 0;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+    struct theft_dedup *d = theft_dedup_init_shared(shared);
+    ASSERT(d);
+    for (size_t i = 0; i < limit; i++) {
+        ASSERTm("not marked in parent",
+            theft_dedup_check_and_mark(d, key_of("key", i)));
+    }
+    theft_dedup_free(d);
+    theft_shared_dedup_free(shared);
+    PASS();
+}
+
+SUITE(dedup) {
+    RUN_TEST(exact_set_should_not_have_false_positives);
+    RUN_TEST(all_zero_key_should_be_stored);
+    RUN_TEST(exact_set_should_fall_back_to_bloom_over_budget);
+    RUN_TEST(dedup_stats_should_report_mode_memory_and_marked_keys);
+    RUN_TEST(shared_dedup_should_check_and_mark_once);
+    RUN_TEST(shared_dedup_should_not_lose_concurrent_marks);
+    RUN_TEST(shared_dedup_should_claim_each_key_once);
+    RUN_TEST(shared_dedup_should_be_shared_with_forked_process);
+    RUN_TEST(pending_dedup_should_only_share_committed_keys);
+}
@@ -0,0 +1,88 @@
+#include "test_theft.h"
+#include "theft_rng.h"
+
+#include <string.h>
+
+#define BUF_SIZE 256
+
+TEST incremental_hashing_should_match_onepass(void) {
+    struct theft_rng *rng = theft_rng_init(1);
+    uint8_t buf[BUF_SIZE];
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (uint8_t)theft_rng_random(rng);
+    }
+
+    for (size_t len = 0; len <= sizeof(buf); len++) {
+        const struct theft_hash128 exp = theft_hash_onepass128(buf, len);
+        ASSERT_EQ_FMT(exp.lo, theft_hash_onepass(buf, len), "0x%016" PRIx64);
+
+        /* Sink in randomly sized chunks, crossing stripe boundaries. */
+        for (size_t trial = 0; trial < 10; trial++) {
+            struct theft_hasher h;
+            theft_hash_init(&h);
+            size_t offset = 0;
+            while (offset < len) {
+                size_t chunk = theft_rng_random(rng) % 40;
+                if (chunk > len - offset) { chunk = len - offset; }
+                theft_hash_sink(&h, &buf[offset], chunk);
+                offset += chunk;
+            }
+            const struct theft_hash128 got = theft_hash_done128(&h);
+            ASSERT_EQ_FMT(exp.lo, got.lo, "0x%016" PRIx64);
+            ASSERT_EQ_FMT(exp.hi, got.hi, "0x%016" PRIx64);
+        }
+    }
+
+    theft_rng_free(rng);
+    PASS();
+}
+
+TEST done_should_reset_hasher(void) {
+    const uint8_t data[] = "some data";
+    struct theft_hasher h;
+    theft_hash_init(&h);
+    theft_hash_sink(&h, data, sizeof(data));
+    theft_hash first = theft_hash_done(&h);
+    theft_hash_sink(&h, data, sizeof(data));
+    ASSERT_EQ_FMT(first, theft_hash_done(&h), "0x%016" PRIx64);
+    PASS();
+}
+
+TEST zero_padding_should_not_collide(void) {
+    /* Partial stripes are zero-padded, so trailing zero bytes
+     * must only be distinguished by the length. */
+    const uint8_t zeroes[64] = { 0 };
+    theft_hash hashes[sizeof(zeroes) + 1];
+    for (size_t len = 0; len <= sizeof(zeroes); len++) {
+        hashes[len] = theft_hash_onepass(zeroes, len);
+        for (size_t i = 0; i < len; i++) {
+            ASSERT(hashes[i] != hashes[len]);
+        }
+    }
+    PASS();
+}
+
+TEST flipping_any_bit_should_change_both_halves(void) {
+    uint8_t buf[72];
+    for (size_t i = 0; i < sizeof(buf); i++) { buf[i] = (uint8_t)i; }
+
+    for (size_t len = 1; len <= sizeof(buf); len++) {
+        const struct theft_hash128 base = theft_hash_onepass128(buf, len);
+        ASSERT(base.lo != base.hi);
+        for (size_t bit = 0; bit < 8*len; bit++) {
+            buf[bit / 8] ^= (1U << (bit % 8));
+            const struct theft_hash128 h = theft_hash_onepass128(buf, len);
+            buf[bit / 8] ^= (1U << (bit % 8));
+            ASSERT(h.lo != base.lo);
+            ASSERT(h.hi != base.hi);
+        }
+    }
+    PASS();
+}
+
+SUITE(hash) {
+    RUN_TEST(incremental_hashing_should_match_onepass);
+    RUN_TEST(done_should_reset_hasher);
+    RUN_TEST(zero_padding_should_not_collide);
+    RUN_TEST(flipping_any_bit_should_change_both_halves);
+}
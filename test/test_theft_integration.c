@@ -1,3 +1,8 @@
+#if defined(__linux__)
+#define _GNU_SOURCE             /* for sched_getaffinity(2) */
+#include <sched.h>
+#endif
+
 #include "test_theft.h"
 
 #include "theft_rng.h"
@@ -6,8 +11,10 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include <sys/resource.h>
+#include <sys/stat.h>
 
 #define COUNT(X) (sizeof(X)/sizeof(X[0]))
 
@@ -503,6 +510,59 @@ TEST always_seeds_must_be_run(void) {
     PASS();
 }
 
+struct trial_seed_env {
+    size_t count;
+    theft_seed seeds[100];
+};
+
+static enum theft_hook_trial_post_res
+record_trial_seed(const struct theft_hook_trial_post_info *info,
+        void *venv) {
+    struct trial_seed_env *env = (struct trial_seed_env *)venv;
+    if (info->trial_id < sizeof(env->seeds)/sizeof(env->seeds[0])) {
+        env->seeds[info->trial_id] = info->trial_seed;
+        env->count++;
+    }
+    return THEFT_HOOK_TRIAL_POST_CONTINUE;
+}
+
+static enum theft_trial_res
+prop_always_pass(struct theft *t, void *arg1) {
+    (void)t;
+    (void)arg1;
+    return THEFT_TRIAL_PASS;
+}
+
+TEST counter_seeds_should_only_depend_on_trial_id(void) {
+    static theft_seed always_seeds[] = { 0xabad5eed };
+    const theft_seed run_seed = 0x600dd06;
+    struct trial_seed_env env = { .count = 0 };
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_always_pass,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint64_t) },
+        .trials = 100,
+        .seed = run_seed,
+        .seed_mode = THEFT_SEED_MODE_COUNTER,
+        ALWAYS_SEEDS(always_seeds),
+        .hooks = {
+            .trial_post = record_trial_seed,
+            .env = &env,
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    ASSERT_EQ_FMT((size_t)100, env.count, "%zu");
+    ASSERT_EQ_FMT(always_seeds[0], env.seeds[0], "%" PRIx64);
+    ASSERT_EQ_FMT(run_seed, env.seeds[1], "%" PRIx64);
+    for (size_t i = 1; i < env.count; i++) {
+        ASSERT_EQ_FMT(theft_seed_for_trial(run_seed, i - 1),
+            env.seeds[i], "%" PRIx64);
+    }
+    PASS();
+}
+
 #define EXPECTED_SEED 0x15a600d64b175eedLL
 
 static enum theft_alloc_res
@@ -605,7 +665,7 @@ save_report_run_post(const struct theft_hook_run_post_info *info, void *env) {
     return THEFT_HOOK_RUN_POST_CONTINUE;
 }
 
-TEST overconstrained_state_spaces_should_be_detected(void) {
+TEST overconstrained_state_spaces_should_be_detected(enum theft_dedup_mode mode) {
     struct theft_run_report report = {
         .pass = 0,
     };
@@ -614,6 +674,7 @@ TEST overconstrained_state_spaces_should_be_detected(void) {
         .prop1 = prop_bool_tautology,
         .type_info = { &bool_info },
         .trials = 100,
+        .dedup.mode = mode,
         .hooks = {
             .run_post = save_report_run_post,
             .env = (void *)&report,
@@ -627,6 +688,71 @@ TEST overconstrained_state_spaces_should_be_detected(void) {
     PASS();
 }
 
+/* A second run with the same seed, sharing the first run's dedup
+ * filter, should skip every trial as a duplicate. */
+TEST shared_dedup_should_skip_trials_from_other_runs(void) {
+    struct theft_shared_dedup *shared = theft_shared_dedup_new(0);
+    ASSERT(shared);
+    struct theft_run_report report = {
+        .pass = 0,
+    };
+
+    struct theft_run_config cfg = {
+        .prop1 = is_pos,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint32_t) },
+        .trials = 100,
+        .seed = 0x5eed,
+        .dedup.shared = shared,
+        .hooks = {
+            .run_post = save_report_run_post,
+            .env = (void *)&report,
+        },
+    };
+
+    ASSERT_EQ(THEFT_RUN_PASS, theft_run(&cfg));
+    ASSERT_EQ(100, report.pass);
+    ASSERT_EQ(THEFT_RUN_SKIP, theft_run(&cfg));
+    ASSERT_EQ(0, report.pass);
+    ASSERT_EQ(100, report.dup);
+
+    theft_shared_dedup_free(shared);
+    PASS();
+}
+
+static enum theft_hook_run_post_res
+save_dedup_stats_run_post(const struct theft_hook_run_post_info *info,
+        void *env) {
+    struct theft_dedup_stats *stats = (struct theft_dedup_stats *)env;
+    if (info->dedup == NULL) { return THEFT_HOOK_RUN_POST_ERROR; }
+    memcpy(stats, info->dedup, sizeof(*stats));
+    return THEFT_HOOK_RUN_POST_CONTINUE;
+}
+
+/* The run_post hook should get the dedup filter's stats, which count
+ * each distinct combination tried. */
+TEST run_post_should_get_dedup_stats(enum theft_dedup_mode mode) {
+    struct theft_dedup_stats stats;
+    memset(&stats, 0x00, sizeof(stats));
+
+    struct theft_run_config cfg = {
+        .prop1 = prop_bool_tautology,
+        .type_info = { &bool_info },
+        .trials = 100,
+        .dedup.mode = mode,
+        .hooks = {
+            .run_post = save_dedup_stats_run_post,
+            .env = (void *)&stats,
+        },
+    };
+
+    ASSERT_EQ(THEFT_RUN_FAIL, theft_run(&cfg));
+    ASSERT_EQ_FMT(mode, stats.mode, "%d");
+    ASSERT_EQ_FMT((uint64_t)2, stats.marked, "%" PRIu64);
+    ASSERT(stats.memory > 0);
+    ASSERT(stats.fpr < 0.01);
+    PASS();
+}
+
 static enum theft_alloc_res
 never_run_alloc(struct theft *t, void *env, void **output) {
     (void)t;
@@ -1198,170 +1324,805 @@ TEST shrink_infinite_loop(void) {
     PASS();
 }
 
-static volatile bool sigusr1_handled_flag = false;
+struct deadline_env {
+    struct crash_env crash;     /* first, for halt_if_found_10 */
+    size_t errors;
+};
 
-static void sigusr1_handler(int sig) {
-    if (sig == SIGUSR1) {
-        sigusr1_handled_flag = true;
+static enum theft_hook_trial_post_res
+found_10_with_deadline(const struct theft_hook_trial_post_info *info,
+        void *venv) {
+    struct deadline_env *env = (struct deadline_env *)venv;
+    if (info->result == THEFT_TRIAL_FAIL && !info->deadline_exceeded) {
+        env->errors++;
+    } else if (info->result == THEFT_TRIAL_PASS && info->deadline_exceeded) {
+        env->errors++;
     }
+    return found_10(info, &env->crash);
 }
 
 static enum theft_trial_res
-prop_wait_for_SIGUSR1(struct theft *t, void *arg1) {
-    bool *v = (bool *)arg1;
-    (void)t;
-    (void)v;
-    struct sigaction action = {
-        .sa_handler = sigusr1_handler,
-    };
-    struct sigaction old_action;
-    if (-1 == sigaction(SIGUSR1, &action, &old_action)) {
-        return THEFT_TRIAL_ERROR;
+prop_poll_deadline_with_int_gte_10(struct theft *t, void *arg1) {
+    uint16_t *v = (uint16_t *)arg1;
+    if (*v >= 10) {
+        while (!theft_trial_deadline_exceeded(t)) {}
+        return THEFT_TRIAL_FAIL;
     }
+    return THEFT_TRIAL_PASS;
+}
 
-    sigusr1_handled_flag = false;
+TEST shrink_with_deadline_polled_by_property(void) {
+    struct deadline_env env = { .errors = 0 };
 
-    for (;;) {
-        poll(NULL, 0, 10);
-        if (sigusr1_handled_flag) {
-            return THEFT_TRIAL_PASS;
-        }
-    }
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_poll_deadline_with_int_gte_10,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 1000,
+        .deadline = { .timeout = 5, },
+        .hooks = {
+            .trial_pre = halt_if_found_10,
+            .trial_post = found_10_with_deadline,
+            .env = &env,
+        },
+    };
 
-    return THEFT_TRIAL_FAIL;
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    ASSERT(env.crash.minimum);
+    ASSERT_EQ_FMT((size_t)0, env.errors, "%zu");
+    PASS();
 }
 
-TEST shrink_and_SIGUSR1_on_timeout(void) {
-    enum theft_run_res res;
+/* Like shrink_infinite_loop, but without forking. */
+TEST shrink_infinite_loop_with_deadline_unwind(void) {
+    struct deadline_env env = { .errors = 0 };
 
     struct theft_run_config cfg = {
         .name = __func__,
-        .prop1 = prop_wait_for_SIGUSR1,
-        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_bool) },
-        .trials = 1,
-        .fork = {
-            .enable = true,
-            .timeout = 10,
-            .signal = SIGUSR1,
+        .prop1 = prop_infinite_loop_with_int_gte_10,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 1000,
+        .deadline = { .timeout = 5, .unwind = true, },
+        .hooks = {
+            .trial_pre = halt_if_found_10,
+            .trial_post = found_10_with_deadline,
+            .env = &env,
         },
     };
 
-    res = theft_run(&cfg);
-    ASSERT_EQm("should pass due to exit(EXIT_SUCCESS)", THEFT_RUN_PASS, res);
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    ASSERT(env.crash.minimum);
+    ASSERT_EQ_FMT((size_t)0, env.errors, "%zu");
     PASS();
 }
 
 static enum theft_trial_res
-prop_infinite_loop(struct theft *t, void *arg1) {
-    bool *v = (bool *)arg1;
-    (void)t;
-    (void)v;
+prop_deadline_never_exceeded(struct theft *t, void *arg1) {
+    (void)arg1;
+    return theft_trial_deadline_exceeded(t)
+        ? THEFT_TRIAL_FAIL : THEFT_TRIAL_PASS;
+}
 
-    struct sigaction action = {
-        .sa_handler = sigusr1_handler,
+TEST deadline_should_not_be_exceeded_without_timeout(void) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_deadline_never_exceeded,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 10,
     };
-    struct sigaction old_action;
-    if (-1 == sigaction(SIGUSR1, &action, &old_action)) {
-        return THEFT_TRIAL_ERROR;
-    }
 
-    for (;;) {
-        (void)poll(NULL, 0, 1);
-    }
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    PASS();
+}
 
-    return THEFT_TRIAL_ERROR;
+static bool set_after_fork_server;
+
+static enum theft_trial_res
+prop_not_set_after_fork_server(struct theft *t, void *arg1) {
+    (void)t;
+    (void)arg1;
+    return set_after_fork_server ? THEFT_TRIAL_FAIL : THEFT_TRIAL_PASS;
 }
 
-/* Send the worker process a SIGUSR1 after a 10 msec timeout.
- * Since it ignores the SIGUSR1, then make sure we send it
- * a SIGKILL instead, so the test still terminates. */
-TEST shrink_and_SIGUSR1_on_timeout_then_SIGKILL(void) {
+/* Workers forked by a fork server started ahead of the run shouldn't
+ * see anything the caller did after starting it. */
+TEST fork_server_started_early_should_not_see_later_state(void) {
+    set_after_fork_server = false;
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_not_set_after_fork_server,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 20,
+        .fork = {
+            .enable = true,
+            .workers = 2,
+            .zygote = true,
+        },
+    };
+
+    struct theft_fork_server *server = theft_fork_server_start(&cfg);
+    ASSERT(server);
+    set_after_fork_server = true;
+    cfg.fork.server = server;
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    ASSERT_EQ_FMTm("should only be used once",
+        THEFT_RUN_ERROR_BAD_ARGS, theft_run(&cfg), "%d");
+    theft_fork_server_free(server);
+
+    /* Started after run_pre, as usual, its workers do see it. */
+    cfg.fork.server = NULL;
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    set_after_fork_server = false;
+    PASS();
+}
+
+TEST shrink_crash_with_workers(size_t workers, size_t trials_per_child,
+        bool zygote) {
     enum theft_run_res res;
 
+    struct crash_env env = { .minimum = false };
+
     struct theft_run_config cfg = {
         .name = __func__,
-        .prop1 = prop_infinite_loop,
-        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_bool) },
-        .trials = 1,
+        .prop1 = prop_crash_with_int_gte_10,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 1000,
         .fork = {
             .enable = true,
-            .timeout = 10,
-            .signal = SIGUSR1,
+            .timeout = 10000,
+            .workers = workers,
+            .zygote = zygote,
+            .trials_per_child = trials_per_child,
+        },
+        .hooks = {
+            .trial_pre = halt_if_found_10,
+            .trial_post = found_10,
+            .env = &env,
         },
     };
 
     res = theft_run(&cfg);
-    ASSERT_EQm("should fail: worker didn't exit after timeout signal",
-        THEFT_RUN_FAIL, res);
+    ASSERT_EQm("should find counter-examples", THEFT_RUN_FAIL, res);
+    ASSERT(env.minimum);
     PASS();
 }
 
-static bool printed_verbose_msg = false;
+#define MAX_RECORDED_TRIALS 200
 
-static enum theft_trial_res
-prop_even_and_not_between_100_and_5000(struct theft *t, void *arg1) {
-    uint64_t *pv = (uint64_t *)arg1;
-    bool *verbose = theft_hook_get_env(t);
-    if (verbose == NULL) { return THEFT_TRIAL_ERROR; }
+struct trial_record_env {
+    size_t count;
+    size_t shrink_failures;     /* as of the last shrink_pre hook */
+    struct trial_record {
+        size_t trial_id;
+        enum theft_trial_res result;
+        uint16_t value;
+        size_t shrink_failures;
+    } records[MAX_RECORDED_TRIALS];
+};
 
-    uint64_t v = *pv;
-    if (v & 0x01) {
-        if (*verbose) {
-            fprintf(stdout, "Failing: %" PRIu64 " is odd\n", v);
-            printed_verbose_msg = true;
-        }
-        return THEFT_TRIAL_FAIL;
+static enum theft_hook_trial_post_res
+record_trial(const struct theft_hook_trial_post_info *info,
+        void *venv) {
+    struct trial_record_env *env = (struct trial_record_env *)venv;
+    if (env->count < MAX_RECORDED_TRIALS) {
+        struct trial_record *r = &env->records[env->count];
+        r->trial_id = info->trial_id;
+        r->result = info->result;
+        r->value = (info->args[0] == NULL
+            ? 0 : *(const uint16_t *)info->args[0]);
+        r->shrink_failures = env->shrink_failures;
+        env->count++;
     }
+    return THEFT_HOOK_TRIAL_POST_CONTINUE;
+}
 
-    if (v >= 100 && v <= 5000) {
-        if (*verbose) {
-            fprintf(stdout, "Failing: %" PRIu64 " is between 100 and 5000\n", v);
-            printed_verbose_msg = true;
-        }
-        return THEFT_TRIAL_FAIL;
+static enum theft_trial_res
+prop_crash_with_int_divisible_by_5(struct theft *t, void *arg1) {
+    uint16_t *v = (uint16_t *)arg1;
+    (void)t;
+    if ((*v % 5) == 0) {
+        abort();
     }
-
     return THEFT_TRIAL_PASS;
 }
 
-struct verbose_test_env {
-    char tag;
-    bool verbose;
-    struct theft_print_trial_result_env print_env;
-};
-
-/* Re-run each failure once, with the verbose flag set. */
-enum theft_hook_trial_post_res
-trial_post_repeat_with_verbose_set(const struct theft_hook_trial_post_info *info,
-    void *env) {
-    struct verbose_test_env *test_env = (struct verbose_test_env *)env;
-    assert(test_env->tag == 'V');
-    test_env->verbose = false;
-
-    if (info->result == THEFT_TRIAL_FAIL) {
-        test_env->verbose = !info->repeat; /* verbose next time */
-        return THEFT_HOOK_TRIAL_POST_REPEAT_ONCE;
+static enum theft_run_res
+run_and_record(size_t workers, size_t trials_per_child, bool zygote,
+        struct trial_record_env *env) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_crash_with_int_divisible_by_5,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .seed = 0x600dd06,
+        .fork = {
+            .enable = true,
+            .workers = workers,
+            .zygote = zygote,
+            .trials_per_child = trials_per_child,
+        },
+        .hooks = {
+            .trial_post = record_trial,
+            .env = env,
+        },
+    };
+    return theft_run(&cfg);
+}
+
+/* Run once with one trial per worker, then again with
+ * trials_per_child set to BATCH, and compare the results. */
+TEST workers_should_report_same_results_in_order(size_t workers,
+        size_t batch, bool first_zygote, bool second_zygote) {
+    static struct trial_record_env first;
+    static struct trial_record_env second;
+    memset(&first, 0x00, sizeof(first));
+    memset(&second, 0x00, sizeof(second));
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record(workers, 1, first_zygote, &first), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record(workers, batch, second_zygote, &second), "%d");
+
+    ASSERT(first.count > 0);
+    ASSERT_EQ_FMT(first.count, second.count, "%zu");
+    for (size_t i = 0; i < first.count; i++) {
+        ASSERT_EQ_FMT(i, first.records[i].trial_id, "%zu");
+        ASSERT_EQ_FMT(first.records[i].trial_id,
+            second.records[i].trial_id, "%zu");
+        ASSERT_EQ_FMT(first.records[i].result,
+            second.records[i].result, "%d");
+        ASSERT_EQ_FMT(first.records[i].value,
+            second.records[i].value, "%u");
     }
-
-    return theft_hook_trial_post_print_result(info, &test_env->print_env);
+    PASS();
 }
 
-TEST repeat_with_verbose_set_after_shrinking(void) {
-    enum theft_run_res res;
-
-    struct verbose_test_env env = {
-        .tag = 'V',
-    };
+static enum theft_trial_res
+prop_int_not_divisible_by_5(struct theft *t, void *arg1) {
+    uint16_t *v = (uint16_t *)arg1;
+    (void)t;
+    return ((*v % 5) == 0 ? THEFT_TRIAL_FAIL : THEFT_TRIAL_PASS);
+}
 
+static enum theft_run_res
+run_and_record_first_fail(size_t workers, size_t trials_per_child,
+        struct trial_record_env *env) {
     struct theft_run_config cfg = {
         .name = __func__,
-        .prop1 = prop_even_and_not_between_100_and_5000,
-        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint64_t) },
+        .prop1 = prop_int_not_divisible_by_5,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
         .trials = 100,
+        .seed = 0x600dd06,
+        .fork = {
+            .enable = true,
+            .workers = workers,
+            .trials_per_child = trials_per_child,
+        },
         .hooks = {
             .trial_pre = theft_hook_first_fail_halt,
-            .trial_post = trial_post_repeat_with_verbose_set,
-            .env = &env,
+            .trial_post = record_trial,
+            .env = env,
+        },
+    };
+    return theft_run(&cfg);
+}
+
+/* Halting from the trial_pre hook on a pool of workers should stop
+ * after the same trial as running one trial at a time, even though
+ * later trials have already started. */
+TEST first_fail_halt_should_stop_workers_after_same_trial(size_t workers,
+        size_t trials_per_child) {
+    static struct trial_record_env first;
+    static struct trial_record_env second;
+    memset(&first, 0x00, sizeof(first));
+    memset(&second, 0x00, sizeof(second));
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_first_fail(1, 1, &first), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_first_fail(workers, trials_per_child, &second),
+        "%d");
+
+    ASSERT(first.count > 0);
+    ASSERT_EQ_FMT(THEFT_TRIAL_FAIL,
+        first.records[first.count - 1].result, "%d");
+    ASSERT_EQ_FMT(first.count, second.count, "%zu");
+    for (size_t i = 0; i < first.count; i++) {
+        ASSERT_EQ_FMT(i, second.records[i].trial_id, "%zu");
+        ASSERT_EQ_FMT(first.records[i].result,
+            second.records[i].result, "%d");
+        ASSERT_EQ_FMT(first.records[i].value,
+            second.records[i].value, "%u");
+    }
+    PASS();
+}
+
+static enum theft_run_res
+run_and_record_threads(size_t threads, enum theft_seed_mode seed_mode,
+        struct trial_record_env *env) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_int_not_divisible_by_5,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .seed = 0x600dd06,
+        .seed_mode = seed_mode,
+        .threads = threads,
+        .hooks = {
+            .trial_post = record_trial,
+            .env = env,
+        },
+    };
+    return theft_run(&cfg);
+}
+
+/* Running on threads should report the same results, in order, as
+ * running one trial at a time. */
+TEST threads_should_report_same_results_in_order(size_t threads) {
+    static struct trial_record_env first;
+    static struct trial_record_env second;
+    memset(&first, 0x00, sizeof(first));
+    memset(&second, 0x00, sizeof(second));
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_threads(1, THEFT_SEED_MODE_COUNTER, &first), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_threads(threads, THEFT_SEED_MODE_COUNTER, &second),
+        "%d");
+
+    ASSERT_EQ_FMT((size_t)100, first.count, "%zu");
+    ASSERT_EQ_FMT(first.count, second.count, "%zu");
+    for (size_t i = 0; i < first.count; i++) {
+        ASSERT_EQ_FMT(i, second.records[i].trial_id, "%zu");
+        ASSERT_EQ_FMT(first.records[i].result,
+            second.records[i].result, "%d");
+        if (first.records[i].result == THEFT_TRIAL_PASS) {
+            ASSERT_EQ_FMT(first.records[i].value,
+                second.records[i].value, "%u");
+        }
+    }
+
+    /* Trials' seeds can't be chained when running on threads. */
+    ASSERT_EQ_FMT(THEFT_RUN_ERROR_BAD_ARGS,
+        run_and_record_threads(threads, THEFT_SEED_MODE_CHAINED, &second),
+        "%d");
+    PASS();
+}
+
+static enum theft_run_res
+run_and_record_threads_first_fail(size_t threads,
+        struct trial_record_env *env) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_int_not_divisible_by_5,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .seed = 0x600dd06,
+        .seed_mode = THEFT_SEED_MODE_COUNTER,
+        .threads = threads,
+        .hooks = {
+            .trial_pre = theft_hook_first_fail_halt,
+            .trial_post = record_trial,
+            .env = env,
+        },
+    };
+    return theft_run(&cfg);
+}
+
+/* Halting from the trial_pre hook should stop after the same trial
+ * with threads as without, even if later trials have already run. */
+TEST first_fail_halt_should_stop_threads_after_same_trial(size_t threads) {
+    static struct trial_record_env first;
+    static struct trial_record_env second;
+    memset(&first, 0x00, sizeof(first));
+    memset(&second, 0x00, sizeof(second));
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_threads_first_fail(1, &first), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_threads_first_fail(threads, &second), "%d");
+
+    ASSERT(first.count > 0);
+    ASSERT_EQ_FMT(THEFT_TRIAL_FAIL,
+        first.records[first.count - 1].result, "%d");
+    ASSERT_EQ_FMT(first.count, second.count, "%zu");
+    for (size_t i = 0; i < first.count; i++) {
+        ASSERT_EQ_FMT(i, second.records[i].trial_id, "%zu");
+        ASSERT_EQ_FMT(first.records[i].result,
+            second.records[i].result, "%d");
+    }
+    PASS();
+}
+
+static enum theft_hook_shrink_pre_res
+record_shrink_failures(const struct theft_hook_shrink_pre_info *info,
+        void *venv) {
+    struct trial_record_env *env = (struct trial_record_env *)venv;
+    env->shrink_failures = info->failures;
+    return THEFT_HOOK_SHRINK_PRE_CONTINUE;
+}
+
+static enum theft_run_res
+run_and_record_background_shrink(bool background, bool fork,
+        struct trial_record_env *env) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_int_not_divisible_by_5,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .seed = 0x600dd06,
+        .background_shrink = background,
+        .fork = { .enable = fork, },
+        .hooks = {
+            .trial_post = record_trial,
+            .shrink_pre = record_shrink_failures,
+            .env = env,
+        },
+    };
+    return theft_run(&cfg);
+}
+
+/* Shrinking in the background should report the same trials as
+ * shrinking right away, except that failures are reported once
+ * they've been shrunk, so they can come after later trials. */
+TEST background_shrink_should_report_every_failure(void) {
+    static struct trial_record_env first;
+    static struct trial_record_env second;
+    memset(&first, 0x00, sizeof(first));
+    memset(&second, 0x00, sizeof(second));
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_background_shrink(false, false, &first), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_background_shrink(true, false, &second), "%d");
+
+    ASSERT_EQ_FMT((size_t)100, first.count, "%zu");
+    ASSERT_EQ_FMT(first.count, second.count, "%zu");
+    size_t failures = 0;
+    for (size_t i = 0; i < second.count; i++) {
+        const struct trial_record *r = &second.records[i];
+        ASSERT(r->trial_id < first.count);
+        const struct trial_record *expected = &first.records[r->trial_id];
+        ASSERT_EQ_FMT(expected->result, r->result, "%d");
+        if (r->result == THEFT_TRIAL_FAIL) {
+            /* It may have shrunk another way, but still fails. */
+            ASSERT_EQ_FMT(0, r->value % 5, "%u");
+            /* Hooks should see the failures reported before it. */
+            ASSERT_EQ_FMT(failures, r->shrink_failures, "%zu");
+            failures++;
+        } else {
+            ASSERT_EQ_FMT(expected->value, r->value, "%u");
+        }
+    }
+    ASSERT(failures > 0);
+
+    /* The shrinker is a thread, so this can't fork. */
+    ASSERT_EQ_FMT(THEFT_RUN_ERROR_BAD_ARGS,
+        run_and_record_background_shrink(true, true, &second), "%d");
+    PASS();
+}
+
+static enum theft_run_res
+run_and_record_background_first_fail(bool background,
+        struct trial_record_env *env) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_int_not_divisible_by_5,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .seed = 0x600dd06,
+        .background_shrink = background,
+        .hooks = {
+            .trial_pre = theft_hook_first_fail_halt,
+            .trial_post = record_trial,
+            .env = env,
+        },
+    };
+    return theft_run(&cfg);
+}
+
+/* A failure waiting to be shrunk in the background should already be
+ * counted, so halting from the trial_pre hook stops after the same
+ * trial as shrinking right away. */
+TEST first_fail_halt_should_count_queued_failures(void) {
+    static struct trial_record_env first;
+    static struct trial_record_env second;
+    memset(&first, 0x00, sizeof(first));
+    memset(&second, 0x00, sizeof(second));
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_background_first_fail(false, &first), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_background_first_fail(true, &second), "%d");
+
+    ASSERT(first.count > 0);
+    ASSERT_EQ_FMT(THEFT_TRIAL_FAIL,
+        first.records[first.count - 1].result, "%d");
+    ASSERT_EQ_FMT(first.count, second.count, "%zu");
+    for (size_t i = 0; i < first.count; i++) {
+        ASSERT_EQ_FMT(first.records[i].trial_id,
+            second.records[i].trial_id, "%zu");
+        ASSERT_EQ_FMT(first.records[i].result,
+            second.records[i].result, "%d");
+    }
+    PASS();
+}
+
+/* The gen_args_pre hook should still be called for each trial after
+ * the trial_post hook for the one before it. */
+static enum theft_hook_gen_args_pre_res
+check_gen_args_pre_order(const struct theft_hook_gen_args_pre_info *info,
+        void *venv) {
+    struct trial_record_env *env = (struct trial_record_env *)venv;
+    return (info->trial_id == env->count
+        ? THEFT_HOOK_GEN_ARGS_PRE_CONTINUE
+        : THEFT_HOOK_GEN_ARGS_PRE_ERROR);
+}
+
+static enum theft_run_res
+run_and_record_prefetch(size_t prefetch, bool fork,
+        struct trial_record_env *env) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_int_not_divisible_by_5,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .seed = 0x600dd06,
+        .prefetch = prefetch,
+        .fork = { .enable = fork, },
+        .hooks = {
+            .gen_args_pre = check_gen_args_pre_order,
+            .trial_post = record_trial,
+            .env = env,
+        },
+    };
+    return theft_run(&cfg);
+}
+
+/* Generating arguments ahead should run the same trials, shrink them
+ * the same way, and call hooks in the same order. */
+TEST prefetch_should_report_same_results_in_order(size_t prefetch,
+        bool fork) {
+    static struct trial_record_env first;
+    static struct trial_record_env second;
+    memset(&first, 0x00, sizeof(first));
+    memset(&second, 0x00, sizeof(second));
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_prefetch(0, fork, &first), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_record_prefetch(prefetch, fork, &second), "%d");
+
+    ASSERT_EQ_FMT((size_t)100, first.count, "%zu");
+    ASSERT_EQ_FMT(first.count, second.count, "%zu");
+    for (size_t i = 0; i < first.count; i++) {
+        ASSERT_EQ_FMT(i, second.records[i].trial_id, "%zu");
+        ASSERT_EQ_FMT(first.records[i].result,
+            second.records[i].result, "%d");
+        ASSERT_EQ_FMT(first.records[i].value,
+            second.records[i].value, "%u");
+    }
+    PASS();
+}
+
+static enum theft_trial_res
+prop_hang_with_int_divisible_by_50(struct theft *t, void *arg1) {
+    uint16_t *v = (uint16_t *)arg1;
+    (void)t;
+    if ((*v % 50) == 0) {
+        for (;;) {
+            (void)poll(NULL, 0, 1);
+        }
+    }
+    return THEFT_TRIAL_PASS;
+}
+
+/* A worker that times out partway through a batch should only fail
+ * the trial it was running; the rest of its batch should be rerun. */
+TEST batched_worker_timeout_should_only_fail_current_trial(size_t workers,
+        bool zygote) {
+    static struct trial_record_env env;
+    memset(&env, 0x00, sizeof(env));
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_hang_with_int_divisible_by_50,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = MAX_RECORDED_TRIALS,
+        .seed = 0x600dd06,
+        .fork = {
+            .enable = true,
+            .timeout = 10,
+            .workers = workers,
+            .zygote = zygote,
+            .trials_per_child = 8,
+        },
+        .hooks = {
+            .trial_post = record_trial,
+            .env = &env,
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    ASSERT_EQ_FMT((size_t)MAX_RECORDED_TRIALS, env.count, "%zu");
+    for (size_t i = 0; i < env.count; i++) {
+        const struct trial_record *r = &env.records[i];
+        ASSERT_EQ_FMT(i, r->trial_id, "%zu");
+        if (r->result == THEFT_TRIAL_PASS) {
+            ASSERT(r->value % 50 != 0);
+        } else if (r->result == THEFT_TRIAL_FAIL) {
+            ASSERT_EQ_FMT(0, r->value % 50, "%d");
+        }
+    }
+    PASS();
+}
+
+static volatile bool sigusr1_handled_flag = false;
+
+static void sigusr1_handler(int sig) {
+    if (sig == SIGUSR1) {
+        sigusr1_handled_flag = true;
+    }
+}
+
+static enum theft_trial_res
+prop_wait_for_SIGUSR1(struct theft *t, void *arg1) {
+    bool *v = (bool *)arg1;
+    (void)t;
+    (void)v;
+    struct sigaction action = {
+        .sa_handler = sigusr1_handler,
+    };
+    struct sigaction old_action;
+    if (-1 == sigaction(SIGUSR1, &action, &old_action)) {
+        return THEFT_TRIAL_ERROR;
+    }
+
+    sigusr1_handled_flag = false;
+
+    for (;;) {
+        poll(NULL, 0, 10);
+        if (sigusr1_handled_flag) {
+            return THEFT_TRIAL_PASS;
+        }
+    }
+
+    return THEFT_TRIAL_FAIL;
+}
+
+TEST shrink_and_SIGUSR1_on_timeout(bool zygote) {
+    enum theft_run_res res;
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_wait_for_SIGUSR1,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_bool) },
+        .trials = 1,
+        .fork = {
+            .enable = true,
+            .timeout = 10,
+            .signal = SIGUSR1,
+            .zygote = zygote,
+        },
+    };
+
+    res = theft_run(&cfg);
+    ASSERT_EQm("should pass due to exit(EXIT_SUCCESS)", THEFT_RUN_PASS, res);
+    PASS();
+}
+
+static enum theft_trial_res
+prop_infinite_loop(struct theft *t, void *arg1) {
+    bool *v = (bool *)arg1;
+    (void)t;
+    (void)v;
+
+    struct sigaction action = {
+        .sa_handler = sigusr1_handler,
+    };
+    struct sigaction old_action;
+    if (-1 == sigaction(SIGUSR1, &action, &old_action)) {
+        return THEFT_TRIAL_ERROR;
+    }
+
+    for (;;) {
+        (void)poll(NULL, 0, 1);
+    }
+
+    return THEFT_TRIAL_ERROR;
+}
+
+/* Send the worker process a SIGUSR1 after a 10 msec timeout.
+ * Since it ignores the SIGUSR1, then make sure we send it
+ * a SIGKILL instead, so the test still terminates. */
+TEST shrink_and_SIGUSR1_on_timeout_then_SIGKILL(bool zygote) {
+    enum theft_run_res res;
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_infinite_loop,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_bool) },
+        .trials = 1,
+        .fork = {
+            .enable = true,
+            .timeout = 10,
+            .signal = SIGUSR1,
+            .zygote = zygote,
+        },
+    };
+
+    res = theft_run(&cfg);
+    ASSERT_EQm("should fail: worker didn't exit after timeout signal",
+        THEFT_RUN_FAIL, res);
+    PASS();
+}
+
+static bool printed_verbose_msg = false;
+
+static enum theft_trial_res
+prop_even_and_not_between_100_and_5000(struct theft *t, void *arg1) {
+    uint64_t *pv = (uint64_t *)arg1;
+    bool *verbose = theft_hook_get_env(t);
+    if (verbose == NULL) { return THEFT_TRIAL_ERROR; }
+
+    uint64_t v = *pv;
+    if (v & 0x01) {
+        if (*verbose) {
+            fprintf(stdout, "Failing: %" PRIu64 " is odd\n", v);
+            printed_verbose_msg = true;
+        }
+        return THEFT_TRIAL_FAIL;
+    }
+
+    if (v >= 100 && v <= 5000) {
+        if (*verbose) {
+            fprintf(stdout, "Failing: %" PRIu64 " is between 100 and 5000\n", v);
+            printed_verbose_msg = true;
+        }
+        return THEFT_TRIAL_FAIL;
+    }
+
+    return THEFT_TRIAL_PASS;
+}
+
+struct verbose_test_env {
+    char tag;
+    bool verbose;
+    struct theft_print_trial_result_env print_env;
+};
+
+/* Re-run each failure once, with the verbose flag set. */
+enum theft_hook_trial_post_res
+trial_post_repeat_with_verbose_set(const struct theft_hook_trial_post_info *info,
+    void *env) {
+    struct verbose_test_env *test_env = (struct verbose_test_env *)env;
+    assert(test_env->tag == 'V');
+    test_env->verbose = false;
+
+    if (info->result == THEFT_TRIAL_FAIL) {
+        test_env->verbose = !info->repeat; /* verbose next time */
+        return THEFT_HOOK_TRIAL_POST_REPEAT_ONCE;
+    }
+
+    return theft_hook_trial_post_print_result(info, &test_env->print_env);
+}
+
+TEST repeat_with_verbose_set_after_shrinking(void) {
+    enum theft_run_res res;
+
+    struct verbose_test_env env = {
+        .tag = 'V',
+    };
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_even_and_not_between_100_and_5000,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint64_t) },
+        .trials = 100,
+        .hooks = {
+            .trial_pre = theft_hook_first_fail_halt,
+            .trial_post = trial_post_repeat_with_verbose_set,
+            .env = &env,
         },
     };
 
@@ -1373,63 +2134,963 @@ TEST repeat_with_verbose_set_after_shrinking(void) {
     PASS();
 }
 
-struct fork_post_env {
-    bool hook_flag;
+struct fork_post_env {
+    bool hook_flag;
+    uint16_t value;
+};
+
+static enum theft_hook_fork_post_res
+fork_post_set_flag(const struct theft_hook_fork_post_info *info, void *env) {
+    (void)info;
+    struct fork_post_env *hook_env = (struct fork_post_env *)env;
+    hook_env->value = *(uint16_t *)info->args[0];
+    return THEFT_HOOK_FORK_POST_CONTINUE;
+}
+
+static enum theft_trial_res
+prop_ignore_input_return_fork_hook(struct theft *t, void *arg1) {
+    uint16_t value = *(uint16_t *)arg1;
+
+    struct fork_post_env *hook_env = theft_hook_get_env(t);
+    if (hook_env == NULL) { return THEFT_TRIAL_ERROR; }
+
+    /* Check that the value is the same in the fork_post hook
+     * and when the property runs -- this is mainly a guard
+     * against incorrect autoshrinker boxing/unboxing. */
+    if (hook_env->value == value) {
+        hook_env->hook_flag = true;
+    }
+
+    return hook_env->hook_flag
+      ? THEFT_TRIAL_PASS
+      : THEFT_TRIAL_FAIL;
+}
+
+TEST forking_hook(void) {
+    enum theft_run_res res;
+
+    struct fork_post_env env = {
+        .value = 0,
+    };
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_ignore_input_return_fork_hook,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 1,
+        .hooks = {
+            .fork_post = fork_post_set_flag,
+            .env = &env,
+        },
+        .fork = {
+            .enable = true,
+        },
+    };
+
+    res = theft_run(&cfg);
+    ASSERT_EQ_FMTm("hook_flag is set on child process, unmodified due to COW",
+        false, env.hook_flag, "%d");
+    ASSERT_ENUM_EQ(THEFT_RUN_PASS, res, theft_run_res_str);
+    PASS();
+}
+
+struct fork_report_env {
+    size_t checked;
+    size_t errors;
+};
+
+static enum theft_trial_res
+prop_report_value_and_crash_if_divisible_by_5(struct theft *t, void *arg1) {
+    uint16_t v = *(uint16_t *)arg1;
+    if (!theft_fork_report(t, &v, sizeof(v))) {
+        return THEFT_TRIAL_ERROR;
+    }
+    if ((v % 5) == 0) { abort(); }
+    return THEFT_TRIAL_PASS;
+}
+
+static enum theft_hook_trial_post_res
+check_fork_report(const struct theft_hook_trial_post_info *info,
+        void *venv) {
+    struct fork_report_env *env = (struct fork_report_env *)venv;
+    const struct theft_fork_report *report = info->fork_report;
+    if (info->result == THEFT_TRIAL_DUP) {
+        return THEFT_HOOK_TRIAL_POST_CONTINUE; /* not run */
+    }
+    if (report == NULL || report->size != sizeof(uint16_t)) {
+        env->errors++;
+        return THEFT_HOOK_TRIAL_POST_CONTINUE;
+    }
+    uint16_t reported = 0;
+    memcpy(&reported, report->data, sizeof(reported));
+
+    if (info->result == THEFT_TRIAL_PASS) {
+        if (report->stage != THEFT_FORK_STAGE_DONE
+            || reported != *(uint16_t *)info->args[0]) {
+            env->errors++;
+        }
+    } else if (info->result == THEFT_TRIAL_FAIL) {
+        /* The report is from before shrinking, and the worker
+         * crashed in the property function. */
+        if (report->stage != THEFT_FORK_STAGE_PROPERTY
+            || (reported % 5) != 0) {
+            env->errors++;
+        }
+    }
+    env->checked++;
+    return THEFT_HOOK_TRIAL_POST_CONTINUE;
+}
+
+TEST fork_report_should_be_passed_to_trial_post(size_t workers,
+        size_t trials_per_child, bool zygote) {
+    struct fork_report_env env = { .checked = 0 };
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_report_value_and_crash_if_divisible_by_5,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .fork = {
+            .enable = true,
+            .workers = workers,
+            .trials_per_child = trials_per_child,
+            .zygote = zygote,
+        },
+        .hooks = {
+            .trial_post = check_fork_report,
+            .env = &env,
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    ASSERT(env.checked > 0);
+    ASSERT_EQ_FMT((size_t)0, env.errors, "%zu");
+    PASS();
+}
+
+static enum theft_trial_res
+prop_fork_report_should_fail_without_forking(struct theft *t, void *arg1) {
+    (void)arg1;
+    const uint8_t byte = 0;
+    return theft_fork_report(t, &byte, sizeof(byte))
+        ? THEFT_TRIAL_FAIL : THEFT_TRIAL_PASS;
+}
+
+static enum theft_hook_trial_post_res
+check_no_fork_report(const struct theft_hook_trial_post_info *info,
+        void *venv) {
+    struct fork_report_env *env = (struct fork_report_env *)venv;
+    if (info->fork_report != NULL) { env->errors++; }
+    env->checked++;
+    return THEFT_HOOK_TRIAL_POST_CONTINUE;
+}
+
+TEST fork_report_should_be_unavailable_without_forking(void) {
+    struct fork_report_env env = { .checked = 0 };
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_fork_report_should_fail_without_forking,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 10,
+        .hooks = {
+            .trial_post = check_no_fork_report,
+            .env = &env,
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    ASSERT(env.checked > 0);
+    ASSERT_EQ_FMT((size_t)0, env.errors, "%zu");
+    PASS();
+}
+
+#define RLIMIT_TEST_AS (2LLU * 1024 * 1024 * 1024)
+#define RLIMIT_TEST_NOFILE 64
+
+static rlim_t parent_core_limit = 0;
+
+static bool
+soft_limit_is(int resource, rlim_t expected) {
+    struct rlimit rl;
+    return getrlimit(resource, &rl) == 0 && rl.rlim_cur == expected;
+}
+
+static enum theft_trial_res
+prop_rlimits_should_be_set(struct theft *t, void *arg1) {
+    (void)t;
+    (void)arg1;
+    if (!soft_limit_is(RLIMIT_AS, RLIMIT_TEST_AS)) { return THEFT_TRIAL_FAIL; }
+    if (!soft_limit_is(RLIMIT_NOFILE, RLIMIT_TEST_NOFILE)) {
+        return THEFT_TRIAL_FAIL;
+    }
+    if (!soft_limit_is(RLIMIT_CORE, 0)) { return THEFT_TRIAL_FAIL; }
+
+    /* More than the address space limit allows. */
+    void *p = malloc(RLIMIT_TEST_AS + 1);
+    if (p != NULL) {
+        free(p);
+        return THEFT_TRIAL_FAIL;
+    }
+    return THEFT_TRIAL_PASS;
+}
+
+TEST fork_rlimits_should_be_set_in_workers(size_t workers,
+        size_t trials_per_child, bool zygote) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_rlimits_should_be_set,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 20,
+        .fork = {
+            .enable = true,
+            .workers = workers,
+            .trials_per_child = trials_per_child,
+            .zygote = zygote,
+            .rlimits = {
+                .address_space = RLIMIT_TEST_AS,
+                .open_files = RLIMIT_TEST_NOFILE,
+            },
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    PASS();
+}
+
+static enum theft_trial_res
+prop_core_limit_should_be_unchanged(struct theft *t, void *arg1) {
+    (void)t;
+    (void)arg1;
+    return soft_limit_is(RLIMIT_CORE, parent_core_limit)
+        ? THEFT_TRIAL_PASS : THEFT_TRIAL_FAIL;
+}
+
+TEST fork_core_dumps_should_keep_core_limit(void) {
+    struct rlimit rl;
+    ASSERT_EQ(0, getrlimit(RLIMIT_CORE, &rl));
+    parent_core_limit = rl.rlim_cur;
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_core_limit_should_be_unchanged,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 10,
+        .fork = {
+            .enable = true,
+            .rlimits = { .core_dumps = true, },
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    PASS();
+}
+
+#define RUSAGE_TEST_BYTES (16 * 1024 * 1024)
+
+static enum theft_trial_res
+prop_touch_memory(struct theft *t, void *arg1) {
+    (void)t;
+    (void)arg1;
+    volatile uint8_t *p = malloc(RUSAGE_TEST_BYTES);
+    if (p == NULL) { return THEFT_TRIAL_ERROR; }
+    for (size_t i = 0; i < RUSAGE_TEST_BYTES; i += 512) { p[i] = 1; }
+    free((void *)p);
+    return THEFT_TRIAL_PASS;
+}
+
+static enum theft_hook_trial_post_res
+check_fork_rusage(const struct theft_hook_trial_post_info *info,
+        void *venv) {
+    struct fork_report_env *env = (struct fork_report_env *)venv;
+    if (info->result != THEFT_TRIAL_PASS) {
+        return THEFT_HOOK_TRIAL_POST_CONTINUE;
+    }
+    const struct theft_fork_rusage *ru = info->fork_rusage;
+    if (ru == NULL || ru->max_rss_kb < RUSAGE_TEST_BYTES / 1024
+        || ru->minflt == 0) {
+        env->errors++;
+    }
+    env->checked++;
+    return THEFT_HOOK_TRIAL_POST_CONTINUE;
+}
+
+TEST fork_rusage_should_be_passed_to_trial_post(size_t workers,
+        size_t trials_per_child, bool zygote) {
+    struct fork_report_env env = { .checked = 0 };
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_touch_memory,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 20,
+        .fork = {
+            .enable = true,
+            .workers = workers,
+            .trials_per_child = trials_per_child,
+            .zygote = zygote,
+        },
+        .hooks = {
+            .trial_post = check_fork_rusage,
+            .env = &env,
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    ASSERT(env.checked > 0);
+    ASSERT_EQ_FMT((size_t)0, env.errors, "%zu");
+    PASS();
+}
+
+static double
+cpu_sec(void) {
+    struct rusage ru;
+    if (0 != getrusage(RUSAGE_SELF, &ru)) { return -1; }
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+        + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static enum theft_trial_res
+prop_use_600_msec_of_cpu(struct theft *t, void *arg1) {
+    (void)t;
+    (void)arg1;
+    const double start = cpu_sec();
+    if (start < 0) { return THEFT_TRIAL_ERROR; }
+    while (cpu_sec() - start < 0.6) {}
+    return THEFT_TRIAL_PASS;
+}
+
+/* The CPU limit is per trial, so a worker running a batch of trials
+ * that each use less than the limit shouldn't be killed. */
+TEST fork_rlimit_cpu_should_be_per_trial__slow(void) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_use_600_msec_of_cpu,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 4,
+        .fork = {
+            .enable = true,
+            .trials_per_child = 4,
+            .rlimits = { .cpu = 1, },
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    PASS();
+}
+
+struct capture_output_env {
+    size_t counterexamples;
     uint16_t value;
+    char output[128];
+    size_t output_size;
+    bool output_truncated;
 };
 
-static enum theft_hook_fork_post_res
-fork_post_set_flag(const struct theft_hook_fork_post_info *info, void *env) {
-    (void)info;
-    struct fork_post_env *hook_env = (struct fork_post_env *)env;
-    hook_env->value = *(uint16_t *)info->args[0];
-    return THEFT_HOOK_FORK_POST_CONTINUE;
+static enum theft_trial_res
+prop_print_and_fail_if_at_least_1000(struct theft *t, void *arg1) {
+    (void)t;
+    uint16_t v = *(uint16_t *)arg1;
+    printf("out %u\n", v);
+    fprintf(stderr, "err %u\n", v);
+    return (v >= 1000 ? THEFT_TRIAL_FAIL : THEFT_TRIAL_PASS);
+}
+
+static enum theft_hook_counterexample_res
+save_counterexample_output(const struct theft_hook_counterexample_info *info,
+        void *venv) {
+    struct capture_output_env *env = (struct capture_output_env *)venv;
+    env->counterexamples++;
+    env->value = *(uint16_t *)info->args[0];
+    env->output_size = 0;
+    if (info->output != NULL && info->output_size < sizeof(env->output)) {
+        memcpy(env->output, info->output, info->output_size);
+        env->output[info->output_size] = '\0';
+        env->output_size = info->output_size;
+    }
+    env->output_truncated = info->output_truncated;
+    return THEFT_HOOK_COUNTEREXAMPLE_CONTINUE;
+}
+
+/* Only the output from the minimal counter-example should be kept,
+ * since everything from passing trials is discarded. */
+TEST capture_output_should_be_attached_to_counterexample(size_t workers,
+        size_t trials_per_child, bool zygote) {
+    struct capture_output_env env = { .counterexamples = 0 };
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_print_and_fail_if_at_least_1000,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .fork = {
+            .enable = true,
+            .workers = workers,
+            .trials_per_child = trials_per_child,
+            .zygote = zygote,
+            .capture_output = { .enable = true, },
+        },
+        .hooks = {
+            .counterexample = save_counterexample_output,
+            .trial_post = theft_hook_trial_post_print_result,
+            .env = &env,
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    ASSERT(env.counterexamples > 0);
+    /* stdout and stderr are buffered differently, so they can
+     * appear in either order. */
+    char out_line[16], err_line[16];
+    snprintf(out_line, sizeof(out_line), "out %u\n", env.value);
+    snprintf(err_line, sizeof(err_line), "err %u\n", env.value);
+    ASSERT_EQ_FMT(strlen(out_line) + strlen(err_line),
+        env.output_size, "%zu");
+    ASSERT(strstr(env.output, out_line) != NULL);
+    ASSERT(strstr(env.output, err_line) != NULL);
+    ASSERT_FALSE(env.output_truncated);
+    PASS();
 }
 
 static enum theft_trial_res
-prop_ignore_input_return_fork_hook(struct theft *t, void *arg1) {
-    uint16_t value = *(uint16_t *)arg1;
+prop_print_100_bytes_and_fail(struct theft *t, void *arg1) {
+    (void)t;
+    (void)arg1;
+    for (size_t i = 0; i < 10; i++) {
+        fprintf(stderr, "%s", "abcdefghi\n");
+    }
+    return THEFT_TRIAL_FAIL;
+}
 
-    struct fork_post_env *hook_env = theft_hook_get_env(t);
-    if (hook_env == NULL) { return THEFT_TRIAL_ERROR; }
+TEST capture_output_should_be_truncated(void) {
+    struct capture_output_env env = { .counterexamples = 0 };
 
-    /* Check that the value is the same in the fork_post hook
-     * and when the property runs -- this is mainly a guard
-     * against incorrect autoshrinker boxing/unboxing. */
-    if (hook_env->value == value) {
-        hook_env->hook_flag = true;
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_print_100_bytes_and_fail,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 1,
+        .fork = {
+            .enable = true,
+            .capture_output = { .enable = true, .max_bytes = 25, },
+        },
+        .hooks = {
+            .counterexample = save_counterexample_output,
+            .trial_post = theft_hook_trial_post_print_result,
+            .env = &env,
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    ASSERT_EQ_FMT((size_t)1, env.counterexamples, "%zu");
+    ASSERT_EQ_FMT((size_t)25, env.output_size, "%zu");
+    ASSERT_STR_EQ("abcdefghi\nabcdefghi\nabcde", env.output);
+    ASSERT(env.output_truncated);
+    PASS();
+}
+
+static enum theft_trial_res
+prop_print_and_crash_if_at_least_1000(struct theft *t, void *arg1) {
+    (void)t;
+    uint16_t v = *(uint16_t *)arg1;
+    fprintf(stderr, "err %u\n", v);
+    if (v >= 1000) { abort(); }
+    return THEFT_TRIAL_PASS;
+}
+
+/* A worker that crashes doesn't get to note where its output ends,
+ * but what it wrote before crashing should still be kept. */
+TEST capture_output_should_be_kept_when_worker_crashes(size_t workers,
+        size_t trials_per_child) {
+    struct capture_output_env env = { .counterexamples = 0 };
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_print_and_crash_if_at_least_1000,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .fork = {
+            .enable = true,
+            .workers = workers,
+            .trials_per_child = trials_per_child,
+            .capture_output = { .enable = true, },
+        },
+        .hooks = {
+            .counterexample = save_counterexample_output,
+            .trial_post = theft_hook_trial_post_print_result,
+            .env = &env,
+        },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    ASSERT(env.counterexamples > 0);
+    char err_line[16];
+    snprintf(err_line, sizeof(err_line), "err %u\n", env.value);
+    ASSERT_STR_EQ(err_line, env.output);
+    PASS();
+}
+
+/* Trial results, sent through a pipe, since hooks in a supervised
+ * run are called in a child process. */
+struct supervise_record {
+    size_t trial_id;
+    theft_seed seed;
+    enum theft_trial_res result;
+    uint16_t value;
+};
+
+struct supervise_env {
+    int fds[2];
+    struct theft_run_report report;
+};
+
+static enum theft_trial_res
+prop_crash_if_divisible_by_16(struct theft *t, void *arg1) {
+    (void)t;
+    uint16_t v = *(uint16_t *)arg1;
+    if ((v % 16) == 0) { abort(); }
+    return THEFT_TRIAL_PASS;
+}
+
+static enum theft_hook_trial_post_res
+send_supervise_record(const struct theft_hook_trial_post_info *info,
+        void *venv) {
+    struct supervise_env *env = (struct supervise_env *)venv;
+    struct supervise_record r = {
+        .trial_id = info->trial_id,
+        .seed = info->trial_seed,
+        .result = info->result,
+        .value = *(uint16_t *)info->args[0],
+    };
+    if (sizeof(r) != write(env->fds[1], &r, sizeof(r))) {
+        return THEFT_HOOK_TRIAL_POST_ERROR;
     }
+    return THEFT_HOOK_TRIAL_POST_CONTINUE;
+}
 
-    return hook_env->hook_flag
-      ? THEFT_TRIAL_PASS
-      : THEFT_TRIAL_FAIL;
+static enum theft_hook_run_post_res
+save_run_report(const struct theft_hook_run_post_info *info, void *venv) {
+    struct supervise_env *env = (struct supervise_env *)venv;
+    env->report = info->report;
+    return THEFT_HOOK_RUN_POST_CONTINUE;
 }
 
-TEST forking_hook(void) {
-    enum theft_run_res res;
+static enum theft_run_res
+run_and_read_records(bool supervise, struct supervise_env *env,
+        struct supervise_record *records, size_t *count) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_crash_if_divisible_by_16,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
+        .trials = 100,
+        .fork = { .enable = !supervise, },
+        .supervise = { .enable = supervise, },
+        .hooks = {
+            .trial_post = send_supervise_record,
+            .run_post = save_run_report,
+            .env = env,
+        },
+    };
 
-    struct fork_post_env env = {
-        .value = 0,
+    if (-1 == pipe(env->fds)) { return THEFT_RUN_ERROR; }
+    enum theft_run_res res = theft_run(&cfg);
+    close(env->fds[1]);
+    *count = 0;
+    while (*count < 100 && sizeof(records[0]) == read(env->fds[0],
+            &records[*count], sizeof(records[0]))) {
+        (*count)++;
+    }
+    close(env->fds[0]);
+    return res;
+}
+
+static enum theft_trial_res
+prop_crash_if_u8_divisible_by_16(struct theft *t, void *arg1) {
+    (void)t;
+    uint8_t v = *(uint8_t *)arg1;
+    if ((v % 16) == 0) { abort(); }
+    return THEFT_TRIAL_PASS;
+}
+
+static enum theft_run_res
+run_and_report_u8(bool supervise, struct supervise_env *env) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_crash_if_u8_divisible_by_16,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint8_t) },
+        .trials = 200,
+        .seed = 0x5eed,
+        .fork = { .enable = !supervise, },
+        .supervise = { .enable = supervise, },
+        .hooks = {
+            .run_post = save_run_report,
+            .env = env,
+        },
     };
+    return theft_run(&cfg);
+}
+
+/* With few possible arguments, many trials are duplicates. A restarted
+ * process should still skip the ones tried before the crash (and the
+ * crashing trial's shrinking candidates), so the counts match. */
+TEST supervised_run_should_keep_dedup_across_restarts(void) {
+    struct supervise_env forked, supervised;
+    memset(&forked, 0x00, sizeof(forked));
+    memset(&supervised, 0x00, sizeof(supervised));
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, run_and_report_u8(false, &forked), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_report_u8(true, &supervised), "%d");
+    ASSERT(forked.report.dup > 0);
+    ASSERT_EQ_FMT(forked.report.pass, supervised.report.pass, "%zu");
+    ASSERT_EQ_FMT(forked.report.fail, supervised.report.fail, "%zu");
+    ASSERT_EQ_FMT(forked.report.skip, supervised.report.skip, "%zu");
+    ASSERT_EQ_FMT(forked.report.dup, supervised.report.dup, "%zu");
+    PASS();
+}
+
+/* A supervised run should restart after each crash, shrink the
+ * crashing trial, and end up running the same trials as a forked run. */
+TEST supervised_run_should_restart_after_crash(void) {
+    static struct supervise_record forked[100], supervised[100];
+    struct supervise_env env;
+    size_t forked_count = 0, supervised_count = 0;
+
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_read_records(false, &env, forked, &forked_count), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL,
+        run_and_read_records(true, &env, supervised, &supervised_count),
+        "%d");
+    ASSERT_EQ_FMT((size_t)100, forked_count, "%zu");
+    ASSERT_EQ_FMT((size_t)100, supervised_count, "%zu");
+    ASSERT_EQ_FMT((size_t)100, env.report.pass + env.report.fail
+        + env.report.skip + env.report.dup, "%zu");
+    ASSERT(env.report.fail > 0);
+
+    size_t failures = 0;
+    for (size_t i = 0; i < supervised_count; i++) {
+        const struct supervise_record *r = &supervised[i];
+        ASSERT_EQ_FMT(i, r->trial_id, "%zu");
+        ASSERT_EQ_FMT(forked[i].seed, r->seed, "%" PRIx64);
+        ASSERT_EQ_FMT(forked[i].result, r->result, "%d");
+        if (r->result == THEFT_TRIAL_FAIL) {
+            /* Shrunk as far as it would be in a forked run. (Not
+             * always to 0, since that may already have been tried.) */
+            ASSERT_EQ_FMT(forked[i].value, r->value, "%u");
+            failures++;
+        }
+    }
+    ASSERT_EQ_FMT(env.report.fail, failures, "%zu");
+    PASS();
+}
+
+static enum theft_trial_res
+prop_always_crash(struct theft *t, void *arg1) {
+    (void)t;
+    (void)arg1;
+    abort();
+}
 
+TEST supervised_run_should_give_up_after_max_restarts(void) {
     struct theft_run_config cfg = {
         .name = __func__,
-        .prop1 = prop_ignore_input_return_fork_hook,
+        .prop1 = prop_always_crash,
         .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint16_t) },
-        .trials = 1,
+        .trials = 100,
+        .supervise = { .enable = true, .max_restarts = 2, },
+    };
+
+    ASSERT_EQ_FMT(THEFT_RUN_ERROR, theft_run(&cfg), "%d");
+    PASS();
+}
+
+#if defined(__linux__)
+struct sched_env {
+    unsigned cpus[2];
+    size_t cpu_count;
+    int worker_prio;
+    bool parent_pinned;
+};
+
+static bool
+pinned_to(unsigned cpu) {
+    cpu_set_t set;
+    if (-1 == sched_getaffinity(0, sizeof(set), &set)) { return false; }
+    return CPU_COUNT(&set) == 1 && CPU_ISSET(cpu, &set);
+}
+
+static enum theft_hook_trial_pre_res
+check_parent_pinned(const struct theft_hook_trial_pre_info *info,
+        void *env) {
+    (void)info;
+    struct sched_env *senv = (struct sched_env *)env;
+    if (!pinned_to(senv->cpus[0])) { senv->parent_pinned = false; }
+    return THEFT_HOOK_TRIAL_PRE_CONTINUE;
+}
+
+static enum theft_trial_res
+prop_worker_is_pinned_and_niced(struct theft *t, void *arg1) {
+    (void)arg1;
+    const struct sched_env *env = theft_hook_get_env(t);
+    const unsigned cpu = env->cpus[env->cpu_count - 1];
+    const int prio = getpriority(PRIO_PROCESS, 0);
+    return (pinned_to(cpu) && prio == env->worker_prio
+        ? THEFT_TRIAL_PASS : THEFT_TRIAL_FAIL);
+}
+
+TEST fork_should_pin_parent_and_workers_to_cpu_set(void) {
+    cpu_set_t before;
+    ASSERT_EQ_FMT(0, sched_getaffinity(0, sizeof(before), &before), "%d");
+
+    /* Use the first (up to) two CPUs this process can run on: the
+     * parent gets the first, and the worker the other. */
+    struct sched_env env = { .parent_pinned = true, };
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE && env.cpu_count < 2; cpu++) {
+        if (CPU_ISSET(cpu, &before)) { env.cpus[env.cpu_count++] = cpu; }
+    }
+    ASSERT(env.cpu_count > 0);
+    const int prio = getpriority(PRIO_PROCESS, 0);
+    env.worker_prio = (prio + 3 > 19 ? 19 : prio + 3);
+
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_worker_is_pinned_and_niced,
+        .type_info = { theft_get_builtin_type_info(THEFT_BUILTIN_uint8_t) },
+        .trials = 20,
         .hooks = {
-            .fork_post = fork_post_set_flag,
+            .trial_pre = check_parent_pinned,
             .env = &env,
         },
         .fork = {
             .enable = true,
+            .cpu_set = { .cpus = env.cpus, .count = env.cpu_count, },
+            .pin_workers = true,
+            .pin_parent = true,
+            .nice = 3,
         },
     };
 
-    res = theft_run(&cfg);
-    ASSERT_EQ_FMTm("hook_flag is set on child process, unmodified due to COW",
-        false, env.hook_flag, "%d");
-    ASSERT_ENUM_EQ(THEFT_RUN_PASS, res, theft_run_res_str);
+    ASSERT_EQ_FMT(THEFT_RUN_PASS, theft_run(&cfg), "%d");
+    ASSERT(env.parent_pinned);
+
+    cpu_set_t after;
+    ASSERT_EQ_FMT(0, sched_getaffinity(0, sizeof(after), &after), "%d");
+    ASSERTm("parent affinity not restored", CPU_EQUAL(&before, &after));
+    PASS();
+}
+#endif
+
+static enum theft_trial_res
+prop_infinite_loop_with_int_gte_6300(struct theft *t, void *arg1) {
+    uint16_t *v = (uint16_t *)arg1;
+    (void)t;
+    if (*v >= 6300) {
+        for (;;) {}
+    }
+    return THEFT_TRIAL_PASS;
+}
+
+static enum theft_hook_counterexample_res
+save_uint16_counterexample(const struct theft_hook_counterexample_info *info,
+        void *env) {
+    uint16_t *min = (uint16_t *)env;
+    *min = *(const uint16_t *)info->args[0];
+    return THEFT_HOOK_COUNTEREXAMPLE_CONTINUE;
+}
+
+TEST auto_timeout_should_adapt_to_passing_trials(void) {
+    uint16_t limit = 6400;
+    struct theft_type_info info;
+    theft_copy_builtin_type_info(THEFT_BUILTIN_uint16_t, &info);
+    info.env = &limit;
+
+    uint16_t min = 0;
+    const size_t max_msec = 3000;
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_infinite_loop_with_int_gte_6300,
+        .type_info = { &info },
+        .trials = 1000,
+        .hooks = {
+            .trial_pre = theft_hook_first_fail_halt,
+            .counterexample = save_uint16_counterexample,
+            .env = &min,
+        },
+        .fork = {
+            .enable = true,
+            .auto_timeout = { .enable = true, .max = max_msec, },
+        },
+    };
+
+    struct timeval pre, post;
+    ASSERT_EQ_FMT(0, gettimeofday(&pre, NULL), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+    ASSERT_EQ_FMT(0, gettimeofday(&post, NULL), "%d");
+    ASSERT(min >= 6300);
+
+    /* Once calibrated, every hang while shrinking should have timed
+     * out well before the maximum, let alone all of them together. */
+    const size_t elapsed_msec = 1000 * (post.tv_sec - pre.tv_sec)
+        + (post.tv_usec - pre.tv_usec) / 1000;
+    ASSERT(elapsed_msec < max_msec);
+    PASS();
+}
+
+static enum theft_hook_counterexample_res
+save_uint32_counterexample(const struct theft_hook_counterexample_info *info,
+        void *env) {
+    uint32_t *min = (uint32_t *)env;
+    *min = *(const uint32_t *)info->args[0];
+    return THEFT_HOOK_COUNTEREXAMPLE_CONTINUE;
+}
+
+static enum theft_run_res
+run_and_shrink_uint(const struct theft_type_info *info, bool parallel,
+        uint32_t *min) {
+    struct theft_run_config cfg = {
+        .name = __func__,
+        .prop1 = prop_uint_is_lte_12345,
+        .type_info = { info },
+        .trials = 1000,
+        .seed = 0x5eed,
+        .hooks = {
+            .trial_pre = theft_hook_first_fail_halt,
+            .counterexample = save_uint32_counterexample,
+            .env = min,
+        },
+        .fork = {
+            .enable = true,
+            .workers = 4,
+            .parallel_shrink = parallel,
+        },
+    };
+    return theft_run(&cfg);
+}
+
+/* Shrinking on several workers at once should keep the first
+ * candidate that fails, in tactic order, so it ends up with the same
+ * counter-example every time -- and, with a shrinker that always
+ * gets there, the same one as shrinking one candidate at a time. */
+TEST parallel_shrink_should_find_same_counterexample(void) {
+    uint32_t serial = 0, parallel = 0, again = 0;
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, run_and_shrink_uint(
+            &shrink_test_uint_type_info, false, &serial), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, run_and_shrink_uint(
+            &shrink_test_uint_type_info, true, &parallel), "%d");
+    ASSERT_EQ_FMT((uint32_t)12346, serial, "%u");
+    ASSERT_EQ_FMT(serial, parallel, "%u");
+
+    const struct theft_type_info *autoshrink =
+        theft_get_builtin_type_info(THEFT_BUILTIN_uint32_t);
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, run_and_shrink_uint(
+            autoshrink, true, &parallel), "%d");
+    ASSERT_EQ_FMT(THEFT_RUN_FAIL, run_and_shrink_uint(
+            autoshrink, true, &again), "%d");
+    ASSERT(parallel > 12345);
+    ASSERT_EQ_FMT(parallel, again, "%u");
+    PASS();
+}
+
+#define CHECKPOINT_MAX_STEPS 16
+
+/* A sequence of steps, and the position in the bit pool where each
+ * starts (plus where the one after the last would have). */
+struct step_list {
+    size_t count;
+    uint8_t steps[CHECKPOINT_MAX_STEPS];
+    size_t positions[CHECKPOINT_MAX_STEPS + 1];
+};
+
+static enum theft_alloc_res
+step_list_alloc(struct theft *t, void *env, void **instance) {
+    (void)env;
+    struct step_list *l = calloc(1, sizeof(*l));
+    if (l == NULL) { return THEFT_ALLOC_ERROR; }
+    for (;;) {
+        l->positions[l->count] = theft_checkpoint_position(t);
+        if (l->count == CHECKPOINT_MAX_STEPS
+            || theft_random_bits(t, 2) == 0) {
+            break;
+        }
+        l->steps[l->count] = theft_random_bits(t, 4);
+        l->count++;
+    }
+    *instance = l;
+    return THEFT_ALLOC_OK;
+}
+
+static struct theft_type_info step_list_info = {
+    .alloc = step_list_alloc,
+    .free = theft_generic_free_cb,
+    .autoshrink_config = { .enable = true, },
+};
+
+struct checkpoint_env {
+    int steps_fd;               /* gets a byte for each step run */
+    bool found;
+    struct step_list min;
+};
+
+static enum theft_trial_res
+prop_step_sum_is_small(struct theft *t, void *arg) {
+    struct checkpoint_env *env = theft_hook_get_env(t);
+    struct step_list *l = (struct step_list *)arg;
+    size_t sum = 0;
+    for (size_t i = 0; ; i++) {
+        l = theft_checkpoint(t, 0, l->positions[i]);
+        if (i == l->count) { break; }
+        if (1 != write(env->steps_fd, "s", 1)) { return THEFT_TRIAL_ERROR; }
+        sum += l->steps[i];
+    }
+    return (sum > 40 ? THEFT_TRIAL_FAIL : THEFT_TRIAL_PASS);
+}
+
+static enum theft_hook_counterexample_res
+save_min_step_list(const struct theft_hook_counterexample_info *info,
+        void *env) {
+    struct checkpoint_env *cenv = (struct checkpoint_env *)env;
+    cenv->found = true;
+    memcpy(&cenv->min, info->args[0], sizeof(cenv->min));
+    return THEFT_HOOK_COUNTEREXAMPLE_CONTINUE;
+}
+
+TEST checkpoints_should_skip_steps_shared_with_earlier_candidates(void) {
+    size_t steps_run[2];
+    struct step_list min[2];
+    for (size_t run = 0; run < 2; run++) {
+        FILE *f = tmpfile();
+        ASSERT(f != NULL);
+        struct checkpoint_env env = { .steps_fd = fileno(f), };
+        struct theft_run_config cfg = {
+            .name = __func__,
+            .prop1 = prop_step_sum_is_small,
+            .type_info = { &step_list_info },
+            .trials = 100,
+            .hooks = {
+                .trial_pre = theft_hook_first_fail_halt,
+                .counterexample = save_min_step_list,
+                .env = &env,
+            },
+            .fork = {
+                .enable = true,
+                .checkpoints = (run == 0 ? 0 : 16),
+            },
+        };
+
+        ASSERT_EQ_FMT(THEFT_RUN_FAIL, theft_run(&cfg), "%d");
+        struct stat st;
+        ASSERT_EQ_FMT(0, fstat(fileno(f), &st), "%d");
+        fclose(f);
+        ASSERT(env.found);
+        steps_run[run] = (size_t)st.st_size;
+        min[run] = env.min;
+    }
+
+    /* Resuming from checkpoints shouldn't change how it shrinks,
+     * just run fewer steps to get there. */
+    ASSERT_EQ_FMT(min[0].count, min[1].count, "%zd");
+    ASSERT_MEM_EQ(min[0].steps, min[1].steps, min[0].count);
+    ASSERT(steps_run[1] < steps_run[0]);
     PASS();
 }
 
@@ -1599,7 +3260,10 @@ SUITE(integration) {
     RUN_TEST(generated_int_list_does_not_repeat_values);
     RUN_TEST(two_generated_lists_do_not_match);
     RUN_TEST(always_seeds_must_be_run);
-    RUN_TEST(overconstrained_state_spaces_should_be_detected);
+    RUN_TESTp(overconstrained_state_spaces_should_be_detected, THEFT_DEDUP_BLOOM);
+    RUN_TESTp(overconstrained_state_spaces_should_be_detected, THEFT_DEDUP_EXACT);
+    RUN_TESTp(run_post_should_get_dedup_stats, THEFT_DEDUP_BLOOM);
+    RUN_TESTp(run_post_should_get_dedup_stats, THEFT_DEDUP_EXACT);
 
     /* Tests for hook_cb functionality */
     RUN_TEST(save_seed_and_error_before_generating_args);
@@ -1611,17 +3275,77 @@ SUITE(integration) {
 
     /* Tests for forking/timeouts */
     RUN_TEST(shrink_crash);
+    RUN_TESTp(shrink_crash_with_workers, 4, 1, false);
+    RUN_TESTp(shrink_crash_with_workers, 1, 1, true);
+    RUN_TESTp(shrink_crash_with_workers, 4, 1, true);
+    RUN_TESTp(shrink_crash_with_workers, 1, 8, false);
+    RUN_TESTp(shrink_crash_with_workers, 4, 8, true);
+    RUN_TEST(fork_server_started_early_should_not_see_later_state);
+    RUN_TESTp(workers_should_report_same_results_in_order, 8, 1, false, false);
+    RUN_TESTp(workers_should_report_same_results_in_order, 1, 1, false, true);
+    RUN_TESTp(workers_should_report_same_results_in_order, 8, 1, false, true);
+    RUN_TESTp(workers_should_report_same_results_in_order, 1, 8, false, false);
+    RUN_TESTp(workers_should_report_same_results_in_order, 4, 16, false, true);
+    RUN_TESTp(first_fail_halt_should_stop_workers_after_same_trial, 4, 1);
+    RUN_TESTp(first_fail_halt_should_stop_workers_after_same_trial, 1, 8);
+    RUN_TESTp(first_fail_halt_should_stop_workers_after_same_trial, 4, 4);
+    RUN_TESTp(batched_worker_timeout_should_only_fail_current_trial, 1, false);
+    RUN_TESTp(batched_worker_timeout_should_only_fail_current_trial, 4, true);
     RUN_TEST(shrink_infinite_loop);
+    RUN_TEST(shrink_with_deadline_polled_by_property);
+    RUN_TEST(shrink_infinite_loop_with_deadline_unwind);
+    RUN_TEST(deadline_should_not_be_exceeded_without_timeout);
     RUN_TEST(shrink_abort_immediately_to_stress_forking__slow);
-    RUN_TEST(shrink_and_SIGUSR1_on_timeout);
-    RUN_TEST(shrink_and_SIGUSR1_on_timeout_then_SIGKILL);
+    RUN_TESTp(shrink_and_SIGUSR1_on_timeout, false);
+    RUN_TESTp(shrink_and_SIGUSR1_on_timeout, true);
+    RUN_TESTp(shrink_and_SIGUSR1_on_timeout_then_SIGKILL, false);
+    RUN_TESTp(shrink_and_SIGUSR1_on_timeout_then_SIGKILL, true);
     RUN_TEST(forking_hook);
+    RUN_TESTp(fork_report_should_be_passed_to_trial_post, 1, 1, false);
+    RUN_TESTp(fork_report_should_be_passed_to_trial_post, 4, 8, false);
+    RUN_TESTp(fork_report_should_be_passed_to_trial_post, 4, 8, true);
+    RUN_TEST(fork_report_should_be_unavailable_without_forking);
+    RUN_TESTp(fork_rlimits_should_be_set_in_workers, 1, 1, false);
+    RUN_TESTp(fork_rlimits_should_be_set_in_workers, 4, 8, true);
+    RUN_TEST(fork_core_dumps_should_keep_core_limit);
+    RUN_TESTp(fork_rusage_should_be_passed_to_trial_post, 1, 1, false);
+    RUN_TESTp(fork_rusage_should_be_passed_to_trial_post, 4, 8, false);
+    RUN_TESTp(fork_rusage_should_be_passed_to_trial_post, 4, 8, true);
+    RUN_TEST(fork_rlimit_cpu_should_be_per_trial__slow);
+    RUN_TESTp(capture_output_should_be_attached_to_counterexample,
+        1, 1, false);
+    RUN_TESTp(capture_output_should_be_attached_to_counterexample,
+        4, 8, false);
+    RUN_TESTp(capture_output_should_be_attached_to_counterexample,
+        4, 8, true);
+    RUN_TEST(capture_output_should_be_truncated);
+    RUN_TESTp(capture_output_should_be_kept_when_worker_crashes, 1, 1);
+    RUN_TESTp(capture_output_should_be_kept_when_worker_crashes, 4, 8);
     RUN_TEST(forking_privilege_drop_cpu_limit__slow);
+    RUN_TESTp(threads_should_report_same_results_in_order, 2);
+    RUN_TESTp(threads_should_report_same_results_in_order, 8);
+    RUN_TESTp(first_fail_halt_should_stop_threads_after_same_trial, 4);
+    RUN_TEST(background_shrink_should_report_every_failure);
+    RUN_TEST(first_fail_halt_should_count_queued_failures);
+    RUN_TESTp(prefetch_should_report_same_results_in_order, 1, false);
+    RUN_TESTp(prefetch_should_report_same_results_in_order, 8, false);
+    RUN_TESTp(prefetch_should_report_same_results_in_order, 8, true);
+    RUN_TEST(shared_dedup_should_skip_trials_from_other_runs);
+    RUN_TEST(supervised_run_should_restart_after_crash);
+    RUN_TEST(supervised_run_should_keep_dedup_across_restarts);
+    RUN_TEST(supervised_run_should_give_up_after_max_restarts);
+    RUN_TEST(checkpoints_should_skip_steps_shared_with_earlier_candidates);
+#if defined(__linux__)
+    RUN_TEST(fork_should_pin_parent_and_workers_to_cpu_set);
+#endif
+    RUN_TEST(auto_timeout_should_adapt_to_passing_trials);
+    RUN_TEST(parallel_shrink_should_find_same_counterexample);
 
     RUN_TEST(repeat_with_verbose_set_after_shrinking);
 
     // Regressions
     RUN_TEST(expected_seed_should_be_used_first);
+    RUN_TEST(counter_seeds_should_only_depend_on_trial_id);
     RUN_TEST(trial_post_hook_gets_correct_args);
     RUN_TEST(free_callback_should_be_optional);
 }
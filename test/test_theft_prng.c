@@ -1,5 +1,6 @@
 #include "test_theft.h"
 #include "theft_random.h"
+#include "theft_rng.h"
 
 /* These are included to allocate a valid theft handle, but
  * this file is only testing its random number generation
@@ -196,6 +197,96 @@ TEST seed_with_upper_32_bits_masked_should_produce_different_value(void) {
     PASS();
 }
 
+TEST mt19937_64_should_match_reference_output(void) {
+    struct theft_rng *rng = theft_rng_init_type(THEFT_PRNG_MT19937_64, 5489);
+    ASSERT(rng);
+
+    /* The C++11 standard specifies that the 10000th value from a
+     * default-constructed std::mt19937_64 (seed 5489) is this. */
+    uint64_t v = 0;
+    for (size_t i = 0; i < 10000; i++) {
+        v = theft_rng_random(rng);
+    }
+    ASSERT_EQ_FMT((uint64_t)9981545732273789042ULL, v, "%" PRIu64);
+
+    ASSERTm("MT19937-64 does not support jumping", !theft_rng_jump(rng));
+    theft_rng_free(rng);
+    PASS();
+}
+
+TEST prng_jump_should_start_a_different_series(void) {
+    struct theft_rng *a = theft_rng_init_type(THEFT_PRNG_XOSHIRO256SS, 12345);
+    struct theft_rng *b = theft_rng_init_type(THEFT_PRNG_XOSHIRO256SS, 12345);
+    ASSERT(a);
+    ASSERT(b);
+
+    ASSERT(theft_rng_jump(a));
+    ASSERT(theft_rng_jump(b));
+    for (size_t i = 0; i < 8; i++) {
+        ASSERT_EQ_FMT(theft_rng_random(a), theft_rng_random(b), "%" PRIx64);
+    }
+
+    theft_rng_reset(b, 12345);
+    bool differs = false;
+    for (size_t i = 0; i < 8; i++) {
+        if (theft_rng_random(a) != theft_rng_random(b)) { differs = true; }
+    }
+    ASSERTm("jumping should skip ahead in the series", differs);
+
+    theft_rng_free(a);
+    theft_rng_free(b);
+    PASS();
+}
+
+TEST prng_fill_should_match_individual_calls(enum theft_prng type) {
+    struct theft_rng *a = theft_rng_init_type(type, 0x5eed);
+    struct theft_rng *b = theft_rng_init_type(type, 0x5eed);
+    ASSERT(a);
+    ASSERT(b);
+
+    /* Start partway into a block, and fill across several. */
+    uint64_t buf[1000];
+    for (size_t i = 0; i < 7; i++) {
+        ASSERT_EQ_FMT(theft_rng_random(a), theft_rng_random(b), "%" PRIx64);
+    }
+    theft_rng_fill(a, buf, 1000);
+    for (size_t i = 0; i < 1000; i++) {
+        ASSERT_EQ_FMT(theft_rng_random(b), buf[i], "%" PRIx64);
+    }
+    ASSERT_EQ_FMT(theft_rng_random(a), theft_rng_random(b), "%" PRIx64);
+
+    theft_rng_free(a);
+    theft_rng_free(b);
+    PASS();
+}
+
+TEST bulk_sampling_should_match_individual_words(uint32_t bit_count) {
+    struct theft *t = init(); ASSERT(t);
+    uint64_t buf[64];
+    memset(buf, 0xFF, sizeof(buf));
+
+    theft_random_set_seed(t, 0xabad5eed);
+    theft_random_bits_bulk(t, bit_count, buf);
+
+    theft_random_set_seed(t, 0xabad5eed);
+    for (size_t i = 0; i < bit_count / 64; i++) {
+        ASSERT_EQ_FMT(theft_random(t), buf[i], "%" PRIx64);
+    }
+    if (bit_count % 64) {
+        const uint8_t rem = bit_count % 64;
+        ASSERT_EQ_FMT(theft_random_bits(t, rem), buf[bit_count / 64],
+            "%" PRIx64);
+    }
+
+    theft_run_free(t);
+    PASS();
+}
+
+TEST unknown_prng_type_should_be_rejected(void) {
+    ASSERT_EQ(NULL, theft_rng_init_type((enum theft_prng)-1, 0));
+    PASS();
+}
+
 #if THEFT_USE_FLOATING_POINT
 TEST check_random_choice_0(void) {
     struct theft *t = init(); ASSERT(t);
@@ -249,6 +340,13 @@ SUITE(prng) {
     }
 
     RUN_TEST(seed_with_upper_32_bits_masked_should_produce_different_value);
+    RUN_TEST(mt19937_64_should_match_reference_output);
+    RUN_TEST(prng_jump_should_start_a_different_series);
+    RUN_TEST(unknown_prng_type_should_be_rejected);
+    RUN_TESTp(prng_fill_should_match_individual_calls, THEFT_PRNG_XOSHIRO256SS);
+    RUN_TESTp(prng_fill_should_match_individual_calls, THEFT_PRNG_MT19937_64);
+    RUN_TESTp(bulk_sampling_should_match_individual_words, 64 * 64);
+    RUN_TESTp(bulk_sampling_should_match_individual_words, 64 * 10 + 13);
 
 #if THEFT_USE_FLOATING_POINT
     RUN_TEST(check_random_choice_0);
@@ -0,0 +1,56 @@
+#include "test_theft.h"
+#include "theft_quantile.h"
+
+/* Visit 0 <= i < 10000 in a scrambled order, since the estimate
+ * shouldn't depend on the samples arriving sorted. */
+static size_t scrambled(size_t i) {
+    return (i * 7919) % 10000;
+}
+
+TEST quantile_should_use_nearest_rank_before_five_samples(void) {
+    struct theft_quantile q;
+    theft_quantile_init(&q, 0.5);
+    ASSERT_EQ_FMT(0.0, theft_quantile_get(&q), "%g");
+    theft_quantile_add(&q, 3);
+    theft_quantile_add(&q, 1);
+    theft_quantile_add(&q, 2);
+    ASSERT_EQ_FMT(2.0, theft_quantile_get(&q), "%g");
+
+    theft_quantile_init(&q, 0.99);
+    theft_quantile_add(&q, 3);
+    theft_quantile_add(&q, 1);
+    theft_quantile_add(&q, 2);
+    ASSERT_EQ_FMT(3.0, theft_quantile_get(&q), "%g");
+    PASS();
+}
+
+TEST quantile_should_estimate_p99_of_uniform_samples(void) {
+    struct theft_quantile q;
+    theft_quantile_init(&q, 0.99);
+    for (size_t i = 0; i < 10000; i++) {
+        theft_quantile_add(&q, scrambled(i));
+    }
+    const double est = theft_quantile_get(&q);
+    ASSERTm("p99 estimate too far off", est > 9800 && est < 10000);
+    PASS();
+}
+
+TEST quantile_should_estimate_median_of_skewed_samples(void) {
+    struct theft_quantile q;
+    theft_quantile_init(&q, 0.5);
+    for (size_t i = 0; i < 10000; i++) {
+        const double x = scrambled(i);
+        theft_quantile_add(&q, x * x);
+    }
+    /* The median is 5000^2. */
+    const double est = theft_quantile_get(&q);
+    ASSERTm("median estimate too far off",
+        est > 0.95 * 25000000.0 && est < 1.05 * 25000000.0);
+    PASS();
+}
+
+SUITE(quantile) {
+    RUN_TEST(quantile_should_use_nearest_rank_before_five_samples);
+    RUN_TEST(quantile_should_estimate_p99_of_uniform_samples);
+    RUN_TEST(quantile_should_estimate_median_of_skewed_samples);
+}